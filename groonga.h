@@ -135,7 +135,8 @@ typedef enum {
 
 typedef enum {
   GRN_CONTENT_TSV,
-  GRN_CONTENT_JSON
+  GRN_CONTENT_JSON,
+  GRN_CONTENT_MSGPACK
 } grn_content_type;
 
 typedef struct _grn_obj grn_obj;
@@ -227,6 +228,26 @@ GRN_API grn_encoding grn_get_default_encoding(void);
  **/
 GRN_API grn_rc grn_set_default_encoding(grn_encoding encoding);
 
+/**
+ * grn_get_scan_threads:
+ *
+ * indexを使えない条件をgrn_table_selectが評価する際に、
+ * レコードを走査するスレッドの数を返します。
+ **/
+GRN_API int grn_get_scan_threads(void);
+
+/**
+ * grn_set_scan_threads:
+ * @n_threads: 走査に用いるスレッドの数を指定します。1の場合は並列化しません。
+ *
+ * indexを使えない条件を評価する際の走査スレッド数を変更します。
+ * 永続化されたテーブルに対する、副作用を持たない条件式のみが並列に評価されます。
+ * 並列に走査した結果にはID順にレコードが追加されるため、
+ * GRN_TABLE_PAT_KEYのテーブルではキー順に走査した場合と結果の順序が異なります。
+ * grn_table_sortが大量のレコードを並べ替える際にも同じスレッド数を用います。
+ **/
+GRN_API grn_rc grn_set_scan_threads(int n_threads);
+
 #define GRN_CTX_GET_ENCODING(ctx) ((ctx)->encoding)
 #define GRN_CTX_SET_ENCODING(ctx,enc) \
   ((ctx)->encoding = (enc == GRN_ENC_DEFAULT) ? grn_get_default_encoding() : enc)
@@ -248,6 +269,7 @@ typedef unsigned short int grn_obj_flags;
 
 #define GRN_OBJ_KEY_WITH_SIS           (0x01<<6)
 #define GRN_OBJ_KEY_NORMALIZE          (0x01<<7)
+#define GRN_OBJ_KEY_INLINE             (0x01<<11)
 
 #define GRN_OBJ_COLUMN_TYPE_MASK       (0x07)
 #define GRN_OBJ_COLUMN_SCALAR          (0x00)
@@ -816,6 +838,7 @@ GRN_API int grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
  * @n_results:group化の結果を格納する構造体の配列のサイズ
  *
  * tableのレコードを特定の条件でグループ化する
+ * 数値カラムの値をグループ毎に集計するにはgrn_table_group_with_calc_target()を用いる。
  **/
 
 typedef struct _grn_table_group_result grn_table_group_result;
@@ -827,6 +850,21 @@ typedef unsigned int grn_table_group_flags;
 #define GRN_TABLE_GROUP_CALC_SUM       (0x01<<6)
 #define GRN_TABLE_GROUP_CALC_AVG       (0x01<<7)
 
+/**
+ * grn_table_create_with_calc_values:
+ * @name: 作成するtableの名前。
+ * @path: 作成するtableのファイルパス。
+ * @flags: grn_table_create()と同じ。GRN_OBJ_WITH_SUBRECが付与される。
+ * @key_type: keyの型。
+ * @value_type: grn_table_create()と同じ。
+ *
+ * grn_table_group()の集計結果(_max, _min, _sum, _avg)を格納できるtableを作成する。
+ **/
+GRN_API grn_obj *grn_table_create_with_calc_values(grn_ctx *ctx,
+                                                   const char *name, unsigned name_size,
+                                                   const char *path, grn_obj_flags flags,
+                                                   grn_obj *key_type, grn_obj *value_type);
+
 typedef enum {
   GRN_OP_PUSH = 0,
   GRN_OP_POP,
@@ -919,6 +957,19 @@ GRN_API grn_rc grn_table_group(grn_ctx *ctx, grn_obj *table,
                                grn_table_sort_key *keys, int n_keys,
                                grn_table_group_result *results, int n_results);
 
+/**
+ * grn_table_group_with_calc_target:
+ * @calc_target: 集計の対象とする数値カラム。
+ *
+ * grn_table_group()に加えて、resultsのflagsにGRN_TABLE_GROUP_CALC_MAX/MIN/SUM/AVGが
+ * 指定された結果について、calc_targetの値をグループ毎に集計する。
+ * その他の引数はgrn_table_group()と同じ。
+ **/
+GRN_API grn_rc grn_table_group_with_calc_target(grn_ctx *ctx, grn_obj *table,
+                                                grn_table_sort_key *keys, int n_keys,
+                                                grn_table_group_result *results,
+                                                int n_results, grn_obj *calc_target);
+
 /**
  * grn_table_setoperation:
  * @table1: 対象table1
@@ -1088,7 +1139,8 @@ typedef enum {
   GRN_INFO_VERSION,
   GRN_INFO_CONFIGURE_OPTIONS,
   GRN_INFO_CONFIG_PATH,
-  GRN_INFO_PARTIAL_MATCH_THRESHOLD
+  GRN_INFO_PARTIAL_MATCH_THRESHOLD,
+  GRN_INFO_CONCURRENT_INSERT
 } grn_info_type;
 
 /**
@@ -1683,6 +1735,8 @@ struct _grn_obj_format {
 
 GRN_API grn_rc grn_text_otoj(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj,
                              grn_obj_format *format);
+GRN_API grn_rc grn_text_otomsgpack(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj,
+                                   grn_obj_format *format);
 
 /* various values exchanged via grn_obj */
 
@@ -1938,6 +1992,36 @@ GRN_API grn_rc grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output
                           unsigned drilldown_output_columns_len,
                           int drilldown_offset, int drilldown_hits);
 
+/**
+ * grn_select:
+ * @drilldown_calc_types: drilldownの各グループで集計する値(MAX, MIN, SUM, AVG)。
+ * @drilldown_calc_target: 集計の対象とする数値カラム。
+ * @top_k: 0より大きい場合、queryのスコアが上位top_k件に入らないレコードの
+ *         評価を打ち切る。
+ *
+ * grn_search()に集計と上位k件の絞り込みを加えたもの。
+ * その他の引数はgrn_search()と同じ。
+ **/
+GRN_API grn_rc grn_select(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
+                          const char *table, unsigned table_len,
+                          const char *match_column, unsigned match_column_len,
+                          const char *query, unsigned query_len,
+                          const char *filter, unsigned filter_len,
+                          const char *foreach, unsigned foreach_len,
+                          const char *sortby, unsigned sortby_len,
+                          const char *output_columns, unsigned output_columns_len,
+                          int offset, int hits,
+                          const char *drilldown, unsigned drilldown_len,
+                          const char *drilldown_sortby, unsigned drilldown_sortby_len,
+                          const char *drilldown_output_columns,
+                          unsigned drilldown_output_columns_len,
+                          int drilldown_offset, int drilldown_hits,
+                          const char *drilldown_calc_types,
+                          unsigned drilldown_calc_types_len,
+                          const char *drilldown_calc_target,
+                          unsigned drilldown_calc_target_len,
+                          int top_k);
+
 GRN_API grn_rc grn_load(grn_ctx *ctx, grn_content_type input_type,
                         const char *table, unsigned table_len,
                         const char *columns, unsigned columns_len,
@@ -42,6 +42,10 @@
 #ifndef USE_MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif /* USE_MSG_NOSIGNAL */
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif /* MSG_DONTWAIT */
 /******* grn_com_queue ********/
 
 grn_rc
@@ -155,36 +159,116 @@ grn_msg_set_property(grn_ctx *ctx, grn_obj *obj,
   return GRN_SUCCESS;
 }
 
-/******* sender
+/* starts or stops waiting for com to get writable. kqueue has a filter
+   for each direction, so EVFILT_WRITE is added and deleted by itself. */
+static grn_rc
+grn_com_event_set_pollout(grn_ctx *ctx, grn_com *com, int pollout)
+{
+  if (com->pollout != pollout) {
+#ifdef USE_KQUEUE
+    struct kevent e;
+    EV_SET(&e, com->fd, GRN_COM_POLLOUT, pollout ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    if (kevent(com->ev->kqfd, &e, 1, NULL, 0, NULL) == -1) {
+      SERR("kevent");
+      return ctx->rc;
+    }
+#else /* USE_KQUEUE */
+    int events = pollout ? (GRN_COM_POLLIN|GRN_COM_POLLOUT) : GRN_COM_POLLIN;
+#ifdef USE_EPOLL
+    struct epoll_event e;
+    memset(&e, 0, sizeof(struct epoll_event));
+    e.data.fd = com->fd;
+    e.events = (__uint32_t) events;
+    if (epoll_ctl(com->ev->epfd, EPOLL_CTL_MOD, com->fd, &e) == -1) {
+      SERR("epoll_ctl");
+      return ctx->rc;
+    }
+#endif /* USE_EPOLL*/
+    com->events = events;
+#endif /* USE_KQUEUE */
+    com->pollout = pollout;
+  }
+  return GRN_SUCCESS;
+}
 
-static void * CALLBACK
-sender(void *arg)
+/* writes msg from the offset peer->sent without blocking */
+static grn_rc
+grn_msg_write(grn_ctx *ctx, grn_msg *m, int flags)
 {
-  grn_com_event *ev = (grn_com_event *)arg;
-  MUTEX_LOCK(ev->mutex);
-  while (ev->ctx->stat != GRN_CTX_QUIT) {
-    while (!(peers_with_msg = get_out_msgs(peers))) {
-      COND_WAIT(ev->cond, ev->mutex);
-      if (ev->ctx->stat == GRN_CTX_QUIT) { goto exit; }
+  grn_com *peer = m->peer;
+  char *body = GRN_BULK_HEAD((grn_obj *)m);
+  size_t size = GRN_BULK_VSIZE((grn_obj *)m);
+  size_t header_size = m->header.proto == GRN_COM_PROTO_HTTP ? 0 : sizeof(grn_com_header);
+  while (peer->sent < header_size + size) {
+    ssize_t ret;
+#ifdef WIN32
+    if (peer->sent < header_size) {
+      ret = send(peer->fd, (char *)&m->header + peer->sent, header_size - peer->sent, 0);
+    } else {
+      ret = send(peer->fd, body + peer->sent - header_size,
+                 header_size + size - peer->sent, 0);
     }
+    if (ret == SOCKET_ERROR) {
+      SERR("send");
+      return ctx->rc;
+    }
+#else /* WIN32 */
+    struct iovec msg_iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = msg_iov;
+    if (peer->sent < header_size) {
+      msg_iov[0].iov_base = (char *)&m->header + peer->sent;
+      msg_iov[0].iov_len = header_size - peer->sent;
+      msg_iov[1].iov_base = body;
+      msg_iov[1].iov_len = size;
+      msg.msg_iovlen = 2;
+    } else {
+      msg_iov[0].iov_base = body + peer->sent - header_size;
+      msg_iov[0].iov_len = header_size + size - peer->sent;
+      msg.msg_iovlen = 1;
+    }
+    if ((ret = sendmsg(peer->fd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT|flags)) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) { return GRN_OPERATION_WOULD_BLOCK; }
+      if (errno == EINTR) { continue; }
+      SERR("sendmsg");
+      return ctx->rc;
+    }
+#endif /* WIN32 */
+    peer->sent += ret;
+  }
+  return GRN_SUCCESS;
+}
+
+/* called from grn_com_event_poll when peer gets writable */
+static void
+grn_com_sender(grn_ctx *ctx, grn_com *com)
+{
+  grn_msg *msg;
+  grn_com_event *ev = com->ev;
+  MUTEX_LOCK(ev->mutex);
+  while ((msg = (grn_msg *)com->new.next)) {
+    grn_rc rc;
     MUTEX_UNLOCK(ev->mutex);
-    peers_writable = poll(peers_with_msg, POLLOUT);
-    for (peer in peers_writable) {
-      msgs = queue_peek_all(peer->send_new);
-      if (!send(msgs)) {
-        queue_deque(peer->send_new, msgs);
-        for (msg in msgs) { enque(msg->edge->send_old, msg); }
+    if ((rc = grn_msg_write(ctx, msg, 0)) == GRN_OPERATION_WOULD_BLOCK) { return; }
+    MUTEX_LOCK(ev->mutex);
+    com->sent = 0;
+    grn_com_queue_deque(ctx, &com->new);
+    grn_com_queue_enque(ctx, msg->old, (grn_com_queue_entry *)msg);
+    if (rc) {
+      /* the peer is gone. pending messages are discarded. */
+      while ((msg = (grn_msg *)grn_com_queue_deque(ctx, &com->new))) {
+        grn_com_queue_enque(ctx, msg->old, (grn_com_queue_entry *)msg);
       }
+      ERRCLR(ctx);
     }
-    MUTEX_LOCK(ev->mutex);
   }
-exit :
+  grn_com_event_set_pollout(ctx, com, 0);
+  /* wakes up the threads waiting for the queue to drain */
+  COND_BROADCAST(ev->cond);
   MUTEX_UNLOCK(ev->mutex);
-  return NULL;
 }
 
-********/
-
 grn_rc
 grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
 {
@@ -192,57 +276,41 @@ grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
   grn_msg *m = (grn_msg *)msg;
   grn_com *peer = m->peer;
   grn_com_header *header = &m->header;
+  switch (header->proto) {
+  case GRN_COM_PROTO_HTTP :
+    break;
+  case GRN_COM_PROTO_GQTP :
+    if ((flags & GRN_CTX_MORE)) { flags |= GRN_CTX_QUIET; }
+    if (ctx->stat == GRN_CTX_QUIT) { flags |= GRN_CTX_QUIT; }
+    header->qtype = 0;
+    header->keylen = 0;
+    header->level = 0;
+    header->flags = flags;
+    header->status = 0;
+    header->opaque = 0;
+    header->cas = 0;
+    header->size = htonl(GRN_BULK_VSIZE(msg));
+    break;
+  case GRN_COM_PROTO_MBREQ :
+    return GRN_FUNCTION_NOT_IMPLEMENTED;
+  case GRN_COM_PROTO_MBRES :
+    header->size = htonl(GRN_BULK_VSIZE(msg));
+    break;
+  default :
+    return GRN_INVALID_ARGUMENT;
+  }
   if (GRN_COM_QUEUE_EMPTYP(&peer->new)) {
-    switch (header->proto) {
-    case GRN_COM_PROTO_HTTP :
-      {
-        ssize_t ret;
-        ret = send(peer->fd, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), MSG_NOSIGNAL);
-        if (ret == -1) { SERR("send"); }
-        if (ctx->rc != GRN_OPERATION_WOULD_BLOCK) {
-          grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
-          return ctx->rc;
-        }
-      }
-      break;
-    case GRN_COM_PROTO_GQTP :
-      {
-        if ((flags & GRN_CTX_MORE)) { flags |= GRN_CTX_QUIET; }
-        if (ctx->stat == GRN_CTX_QUIT) { flags |= GRN_CTX_QUIT; }
-        header->qtype = 0;
-        header->keylen = 0;
-        header->level = 0;
-        header->flags = flags;
-        header->status = 0;
-        header->opaque = 0;
-        header->cas = 0;
-        //todo : MSG_DONTWAIT
-        rc = grn_com_send(ctx, peer, header,
-                          GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), 0);
-        if (rc != GRN_OPERATION_WOULD_BLOCK) {
-          grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
-          return rc;
-        }
-      }
-      break;
-    case GRN_COM_PROTO_MBREQ :
-      return GRN_FUNCTION_NOT_IMPLEMENTED;
-    case GRN_COM_PROTO_MBRES :
-      rc = grn_com_send(ctx, peer, header,
-                        GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg),
-                        (flags & GRN_CTX_MORE) ? MSG_MORE :0);
-      if (rc != GRN_OPERATION_WOULD_BLOCK) {
-        grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
-        return rc;
-      }
-      break;
-    default :
-      return GRN_INVALID_ARGUMENT;
+    peer->sent = 0;
+    rc = grn_msg_write(ctx, m, (flags & GRN_CTX_MORE) ? MSG_MORE : 0);
+    if (rc != GRN_OPERATION_WOULD_BLOCK) {
+      grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
+      return rc;
     }
   }
+  /* the rest is written by grn_com_sender when peer gets writable */
   MUTEX_LOCK(peer->ev->mutex);
   rc = grn_com_queue_enque(ctx, &peer->new, (grn_com_queue_entry *)msg);
-  COND_SIGNAL(peer->ev->cond);
+  grn_com_event_set_pollout(ctx, peer, 1);
   MUTEX_UNLOCK(peer->ev->mutex);
   return rc;
 }
@@ -281,6 +349,7 @@ grn_rc
 grn_com_event_init(grn_ctx *ctx, grn_com_event *ev, int max_nevents, int data_size)
 {
   ev->max_nevents = max_nevents;
+  ev->reuse_port = 0;
   if ((ev->hash = grn_hash_create(ctx, NULL, sizeof(grn_sock), data_size, 0))) {
     MUTEX_INIT(ev->mutex);
     COND_INIT(ev->cond);
@@ -382,6 +451,9 @@ grn_com_event_add(grn_ctx *ctx, grn_com_event *ev, grn_sock fd, int events, grn_
       c->ev = ev;
       c->fd = fd;
       c->events = events;
+      c->pollout = 0;
+      c->sent = 0;
+      GRN_TEXT_INIT(&c->rest, 0);
       if (com) { *com = c; }
     }
   }
@@ -448,9 +520,10 @@ grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd)
       }
 #endif /* USE_EPOLL*/
 #ifdef USE_KQUEUE
-      struct kevent e;
-      EV_SET(&e, (fd), c->events, EV_DELETE, 0, 0, NULL);
-      if (kevent(ev->kqfd, &e, 1, NULL, 0, NULL) == -1) {
+      struct kevent e[2];
+      EV_SET(&e[0], (fd), c->events, EV_DELETE, 0, 0, NULL);
+      EV_SET(&e[1], (fd), GRN_COM_POLLOUT, EV_DELETE, 0, 0, NULL);
+      if (kevent(ev->kqfd, e, c->pollout ? 2 : 1, NULL, 0, NULL) == -1) {
         SERR("kevent");
         return ctx->rc;
       }
@@ -463,6 +536,21 @@ grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd)
   }
 }
 
+static const char *
+scan_delimiter(const char *p, const char *e)
+{
+  while (p + 4 <= e) {
+    if (p[3] == '\n') {
+      if (p[2] == '\r') {
+        if (p[1] == '\n') {
+          if (p[0] == '\r') { return p + 4; } else { p += 2; }
+        } else { p += 2; }
+      } else { p += 4; }
+    } else { p += p[3] == '\r' ? 1 : 4; }
+  }
+  return NULL;
+}
+
 static void
 grn_com_receiver(grn_ctx *ctx, grn_com *com)
 {
@@ -486,17 +574,21 @@ grn_com_receiver(grn_ctx *ctx, grn_com *com)
     // GRN_LOG(ctx, GRN_LOG_NOTICE, "accepted (%d)", fd);
     return;
   } else {
-    grn_msg *msg = (grn_msg *)grn_msg_open(ctx, com, &ev->recv_old);
-    grn_com_recv(ctx, msg->peer, &msg->header, (grn_obj *)msg);
-    if (msg->peer /* is_edge_request(msg)*/) {
-      memcpy(&msg->edge_id, &ev->curr_edge_id, sizeof(grn_com_addr));
-      if (!com->has_sid) {
-        com->has_sid = 1;
-        com->sid = ev->curr_edge_id.sid++;
+    /* pipelined requests already received are dispatched in order */
+    do {
+      grn_msg *msg = (grn_msg *)grn_msg_open(ctx, com, &ev->recv_old);
+      grn_com_recv(ctx, msg->peer, &msg->header, (grn_obj *)msg);
+      if (msg->peer /* is_edge_request(msg)*/) {
+        memcpy(&msg->edge_id, &ev->curr_edge_id, sizeof(grn_com_addr));
+        if (!com->has_sid) {
+          com->has_sid = 1;
+          com->sid = ev->curr_edge_id.sid++;
+        }
+        msg->edge_id.sid = com->sid;
       }
-      msg->edge_id.sid = com->sid;
-    }
-    ev->msg_handler(ctx, (grn_obj *)msg);
+      ev->msg_handler(ctx, (grn_obj *)msg);
+    } while (!ctx->rc && !com->closed &&
+             scan_delimiter(GRN_BULK_HEAD(&com->rest), GRN_BULK_CURR(&com->rest)));
   }
 }
 
@@ -533,6 +625,7 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
   }
   if (timeout < 0 && !nevents) { GRN_LOG(ctx, GRN_LOG_NOTICE, "select returns 0 events"); }
   GRN_HASH_EACH(ctx, ev->hash, eh, &pfd, &dummy, &com, {
+    if (FD_ISSET(*pfd, &wfds)) { grn_com_sender(ctx, com); }
     if (FD_ISSET(*pfd, &rfds)) { grn_com_receiver(ctx, com); }
   });
 #else /* USE_SELECT */
@@ -558,8 +651,7 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
   ctx->rc = GRN_SUCCESS;
   GRN_HASH_EACH(ctx, ev->hash, eh, &pfd, &dummy, &com, {
     ep->fd = *pfd;
-    //    ep->events =(short) com->events;
-    ep->events = POLLIN;
+    ep->events = (short) com->events;
     ep->revents = 0;
     ep++;
     nfd++;
@@ -589,6 +681,7 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
       if (grn_sock_close(efd) == -1) { SERR("close"); }
       continue;
     }
+    if ((ep->events & GRN_COM_POLLOUT)) { grn_com_sender(ctx, com); }
     if ((ep->events & GRN_COM_POLLIN)) { grn_com_receiver(ctx, com); }
 #else /* USE_EPOLL */
 #ifdef USE_KQUEUE
@@ -603,6 +696,7 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
       if (grn_sock_close(efd) == -1) { SERR("close"); }
       continue;
     }
+    if ((ep->filter == GRN_COM_POLLOUT)) { grn_com_sender(ctx, com); }
     if ((ep->filter == GRN_COM_POLLIN)) { grn_com_receiver(ctx, com); }
 #else
     efd = ep->fd;
@@ -613,6 +707,7 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
       if (grn_sock_close(efd) == -1) { SERR("close"); }
       continue;
     }
+    if ((ep->revents & GRN_COM_POLLOUT)) { grn_com_sender(ctx, com); }
     if ((ep->revents & GRN_COM_POLLIN)) { grn_com_receiver(ctx, com); }
 #endif /* USE_KQUEUE */
 #endif /* USE_EPOLL */
@@ -695,21 +790,6 @@ grn_com_send(grn_ctx *ctx, grn_com *cs,
 
 #define RETRY_MAX 10
 
-static const char *
-scan_delimiter(const char *p, const char *e)
-{
-  while (p + 4 <= e) {
-    if (p[3] == '\n') {
-      if (p[2] == '\r') {
-        if (p[1] == '\n') {
-          if (p[0] == '\r') { return p + 4; } else { p += 2; }
-        } else { p += 2; }
-      } else { p += 4; }
-    } else { p += p[3] == '\r' ? 1 : 4; }
-  }
-  return NULL;
-}
-
 #define BUFSIZE 4096
 
 static grn_rc
@@ -718,9 +798,13 @@ grn_com_recv_text(grn_ctx *ctx, grn_com *com,
 {
   const char *p;
   int retry = 0;
+  if (GRN_BULK_VSIZE(&com->rest)) {
+    grn_bulk_write(ctx, buf, GRN_BULK_HEAD(&com->rest), GRN_BULK_VSIZE(&com->rest));
+    GRN_BULK_REWIND(&com->rest);
+  }
   grn_bulk_write(ctx, buf, (char *)header, ret);
   if ((p = scan_delimiter(GRN_BULK_HEAD(buf), GRN_BULK_CURR(buf)))) {
-    // todo : keep rest of message
+    grn_bulk_write(ctx, &com->rest, p, GRN_BULK_CURR(buf) - p);
     GRN_BULK_SET_CURR(buf, p);
     header->qtype = *GRN_BULK_HEAD(buf);
     header->proto = GRN_COM_PROTO_HTTP;
@@ -742,8 +826,8 @@ grn_com_recv_text(grn_ctx *ctx, grn_com *com,
       off_t o = GRN_BULK_VSIZE(buf);
       p = GRN_BULK_CURR(buf);
       if ((p = scan_delimiter(p - (o > 3 ? 3 : o), p + ret))) {
+        grn_bulk_write(ctx, &com->rest, p, GRN_BULK_CURR(buf) + ret - p);
         GRN_BULK_SET_CURR(buf, p);
-        // todo : keep rest of message
         break;
       } else {
         GRN_BULK_INCR_LEN(buf, ret);
@@ -781,6 +865,9 @@ grn_com_recv(grn_ctx *ctx, grn_com *com, grn_com_header *header, grn_obj *buf)
   int retry = 0;
   byte *p = (byte *)header;
   size_t rest = sizeof(grn_com_header);
+  if (GRN_BULK_VSIZE(&com->rest)) {
+    return grn_com_recv_text(ctx, com, header, buf, 0);
+  }
   do {
     if ((ret = recv(com->fd, p, rest, 0)) < 0) {
       SERR("recv size");
@@ -882,6 +969,7 @@ grn_com_copen(grn_ctx *ctx, grn_com_event *ev, const char *dest, int port)
   } else {
     if (!(cs = GRN_CALLOC(sizeof(grn_com)))) { goto exit; }
     cs->fd = fd;
+    GRN_TEXT_INIT(&cs->rest, 0);
   }
 exit :
   if (!cs) { grn_sock_close(fd); }
@@ -905,6 +993,7 @@ grn_com_close(grn_ctx *ctx, grn_com *com)
 {
   grn_sock fd = com->fd;
   grn_com_event *ev = com->ev;
+  GRN_OBJ_FIN(ctx, &com->rest);
   if (ev) { grn_com_event_del(ctx, ev, fd); }
   if (!com->closed) { grn_com_close_(ctx, com); }
   if (!ev) { GRN_FREE(com); }
@@ -941,6 +1030,13 @@ grn_com_sopen(grn_ctx *ctx, grn_com_event *ev, int port,
       SERR("setsockopt");
       goto exit;
     }
+#ifdef SO_REUSEPORT
+    if (ev && ev->reuse_port &&
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, (void *) &v, sizeof(int)) == -1) {
+      SERR("setsockopt");
+      goto exit;
+    }
+#endif /* SO_REUSEPORT */
   }
   if (bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0) {
     SERR("bind");
@@ -961,6 +1057,7 @@ grn_com_sopen(grn_ctx *ctx, grn_com_event *ev, int port,
   } else {
     if (!(cs = GRN_MALLOC(sizeof(grn_com)))) { goto exit; }
     cs->fd = lfd;
+    GRN_TEXT_INIT(&cs->rest, 0);
   }
 exit :
   if (!cs) {
@@ -124,9 +124,12 @@ struct _grn_com {
   uint16_t sid;
   uint8_t has_sid;
   uint8_t closed;
+  uint8_t pollout; /* waits for getting writable to flush new */
   grn_com_queue new;
   grn_com_event *ev;
   void *opaque;
+  grn_obj rest;
+  size_t sent;
 };
 
 struct _grn_com_event {
@@ -140,6 +143,7 @@ struct _grn_com_event {
   grn_com_addr curr_edge_id;
   grn_com *acceptor;
   void *opaque;
+  int reuse_port;
 #ifndef USE_SELECT
 #ifdef USE_EPOLL
   int epfd;
@@ -20,6 +20,7 @@
 #include "token.h"
 #include "ql.h"
 #include "pat.h"
+#include "ii.h"
 #include "snip.h"
 #include <stdarg.h>
 #include <stdio.h>
@@ -192,12 +193,16 @@ grn_loader_init(grn_loader *loader)
   GRN_TEXT_INIT(&loader->values, 0);
   GRN_UINT32_INIT(&loader->level, GRN_OBJ_VECTOR);
   GRN_PTR_INIT(&loader->columns, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  GRN_UINT32_INIT(&loader->counts, GRN_OBJ_VECTOR);
+  GRN_TEXT_INIT(&loader->rest, 0);
+  GRN_PTR_INIT(&loader->indexes, GRN_OBJ_VECTOR, GRN_ID_NIL);
   loader->table = NULL;
   loader->last = NULL;
   loader->ifexists = NULL;
   loader->values_size = 0;
   loader->nrecords = 0;
   loader->stat = GRN_LOADER_BEGIN;
+  loader->input_type = GRN_CONTENT_JSON;
 }
 
 void
@@ -209,11 +214,17 @@ grn_ctx_loader_clear(grn_ctx *ctx)
   grn_obj **p = (grn_obj **)GRN_BULK_HEAD(&loader->columns);
   uint32_t i = GRN_BULK_VSIZE(&loader->columns) / sizeof(grn_obj *);
   if (ctx->impl->db) { while (i--) { grn_obj_unlink(ctx, *p++); } }
+  p = (grn_obj **)GRN_BULK_HEAD(&loader->indexes);
+  i = GRN_BULK_VSIZE(&loader->indexes) / sizeof(grn_obj *);
+  if (ctx->impl->db) { while (i--) { grn_ii_bulk_end(ctx, (grn_ii *)*p++); } }
   if (loader->ifexists) { grn_obj_unlink(ctx, loader->ifexists); }
   while (v < ve) { GRN_OBJ_FIN(ctx, v++); }
   GRN_OBJ_FIN(ctx, &loader->values);
   GRN_OBJ_FIN(ctx, &loader->level);
   GRN_OBJ_FIN(ctx, &loader->columns);
+  GRN_OBJ_FIN(ctx, &loader->counts);
+  GRN_OBJ_FIN(ctx, &loader->rest);
+  GRN_OBJ_FIN(ctx, &loader->indexes);
   grn_loader_init(loader);
 }
 
@@ -271,6 +282,10 @@ grn_ctx_impl_init(grn_ctx *ctx)
   ctx->impl->objects = NULL;
   ctx->impl->symbols = NULL;
   ctx->impl->com = NULL;
+  ctx->impl->output = NULL;
+  ctx->impl->data.ptr = NULL;
+  ctx->impl->n_output_flushes = 0;
+  ctx->impl->n_volatile_procs = 0;
   ctx->impl->outbuf = grn_obj_open(ctx, GRN_BULK, 0, 0);
   GRN_TEXT_INIT(&ctx->impl->subbuf, 0);
   grn_loader_init(&ctx->impl->loader);
@@ -577,6 +592,7 @@ grn_init(void)
     return rc;
   }
   */
+  grn_cache_init();
   GRN_LOG(ctx, GRN_LOG_NOTICE, "grn_init");
   return rc;
 }
@@ -623,6 +639,7 @@ grn_fin(void)
       GRN_GFREE(ctx);
     }
   }
+  grn_cache_fin();
   grn_io_fin();
   grn_ctx_fin(ctx);
   grn_token_fin();
@@ -919,6 +936,20 @@ grn_ctx_stream_out_func(grn_ctx *ctx, int flags, void *stream)
   }
 }
 
+void
+grn_ctx_output_flush(grn_ctx *ctx, grn_obj *bulk)
+{
+  /* grn_ctx_concat_func keeps everything in outbuf, so that flushing is
+     meaningless for it. */
+  if (ctx->impl && ctx->impl->output &&
+      ctx->impl->output != grn_ctx_concat_func &&
+      bulk == ctx->impl->outbuf &&
+      GRN_BULK_VSIZE(bulk) >= GRN_CTX_OUTPUT_FLUSH_SIZE) {
+    ctx->impl->output(ctx, GRN_CTX_MORE, ctx->impl->data.ptr);
+    ctx->impl->n_output_flushes++;
+  }
+}
+
 void
 grn_ctx_recv_handler_set(grn_ctx *ctx, void (*func)(grn_ctx *, int, void *), void *func_arg)
 {
@@ -986,6 +1017,188 @@ grn_del(const char *key)
   return grn_hash_delete(&grn_gctx, grn_gctx.impl->symbols, key, strlen(key), NULL);
 }
 
+/**** grn_cache ****/
+
+typedef struct _grn_cache_entry grn_cache_entry;
+
+struct _grn_cache_entry {
+  grn_cache_entry *next;
+  grn_cache_entry *prev;
+  grn_id id;
+  grn_obj *db;
+  uint32_t modified;
+  uint32_t size;
+  char *value;
+};
+
+/* entries are kept in LRU order; next is the most recently used one. */
+static struct {
+  grn_cache_entry *next;
+  grn_cache_entry *prev;
+  grn_hash *hash;
+  grn_mutex mutex;
+  grn_cache_statistics stat;
+} grn_gcache;
+
+#define GRN_CACHE_HEAD ((grn_cache_entry *)&grn_gcache)
+
+void
+grn_cache_init(void)
+{
+  grn_gcache.next = GRN_CACHE_HEAD;
+  grn_gcache.prev = GRN_CACHE_HEAD;
+  grn_gcache.hash = grn_hash_create(&grn_gctx, NULL, GRN_TABLE_MAX_KEY_SIZE,
+                                    sizeof(grn_cache_entry), GRN_OBJ_KEY_VAR_SIZE);
+  MUTEX_INIT(grn_gcache.mutex);
+  memset(&grn_gcache.stat, 0, sizeof(grn_cache_statistics));
+  grn_gcache.stat.max_nentries = GRN_CACHE_DEFAULT_MAX_NENTRIES;
+  grn_gcache.stat.max_size = GRN_CACHE_DEFAULT_MAX_SIZE;
+  if (getenv("GRN_CACHE_MAX_NENTRIES")) {
+    grn_gcache.stat.max_nentries = atoi(getenv("GRN_CACHE_MAX_NENTRIES"));
+  }
+  if (getenv("GRN_CACHE_MAX_SIZE")) {
+    grn_gcache.stat.max_size = strtoull(getenv("GRN_CACHE_MAX_SIZE"), NULL, 10);
+  }
+}
+
+inline static void
+grn_cache_unlink(grn_cache_entry *ce)
+{
+  ce->prev->next = ce->next;
+  ce->next->prev = ce->prev;
+}
+
+inline static void
+grn_cache_link(grn_cache_entry *ce)
+{
+  ce->next = grn_gcache.next;
+  ce->prev = GRN_CACHE_HEAD;
+  grn_gcache.next->prev = ce;
+  grn_gcache.next = ce;
+}
+
+/* grn_gcache.mutex must be locked by the caller. */
+static void
+grn_cache_expire_entry(grn_cache_entry *ce)
+{
+  grn_cache_unlink(ce);
+  grn_gcache.stat.nentries--;
+  grn_gcache.stat.size -= ce->size;
+  GRN_GFREE(ce->value);
+  grn_hash_delete_by_id(&grn_gctx, grn_gcache.hash, ce->id, NULL);
+}
+
+void
+grn_cache_fin(void)
+{
+  grn_cache_entry *ce;
+  if (!grn_gcache.hash) { return; }
+  for (ce = grn_gcache.next; ce != GRN_CACHE_HEAD; ce = ce->next) {
+    GRN_GFREE(ce->value);
+  }
+  grn_hash_close(&grn_gctx, grn_gcache.hash);
+  grn_gcache.hash = NULL;
+  MUTEX_DESTROY(grn_gcache.mutex);
+}
+
+int
+grn_cache_fetch(grn_ctx *ctx, grn_obj *db,
+                const char *key, uint32_t key_size, grn_obj *output)
+{
+  int hit = 0;
+  grn_cache_entry *ce;
+  if (!grn_gcache.hash || !grn_gcache.stat.max_nentries ||
+      key_size > GRN_TABLE_MAX_KEY_SIZE) {
+    return 0;
+  }
+  MUTEX_LOCK(grn_gcache.mutex);
+  grn_gcache.stat.nfetches++;
+  if (grn_hash_get(&grn_gctx, grn_gcache.hash, key, key_size, (void **)&ce)) {
+    if (ce->db == db && ce->modified == grn_db_modified(db)) {
+      grn_bulk_write(ctx, output, ce->value, ce->size);
+      grn_cache_unlink(ce);
+      grn_cache_link(ce);
+      grn_gcache.stat.nhits++;
+      hit = 1;
+    } else {
+      grn_cache_expire_entry(ce);
+    }
+  }
+  MUTEX_UNLOCK(grn_gcache.mutex);
+  return hit;
+}
+
+/* modified must be taken by grn_db_modified() before the value is
+   computed, so that the entry is stale if db is modified meanwhile. */
+void
+grn_cache_update(grn_ctx *ctx, grn_obj *db, uint32_t modified,
+                 const char *key, uint32_t key_size,
+                 const char *value, uint32_t value_size)
+{
+  int added;
+  char *v;
+  grn_id id;
+  grn_cache_entry *ce;
+  if (!grn_gcache.hash || !grn_gcache.stat.max_nentries ||
+      key_size > GRN_TABLE_MAX_KEY_SIZE || !value_size ||
+      value_size > grn_gcache.stat.max_size ||
+      modified != grn_db_modified(db)) {
+    return;
+  }
+  if (!(v = GRN_GMALLOC(value_size))) { return; }
+  memcpy(v, value, value_size);
+  MUTEX_LOCK(grn_gcache.mutex);
+  if ((id = grn_hash_add(&grn_gctx, grn_gcache.hash, key, key_size,
+                         (void **)&ce, &added))) {
+    if (added) {
+      ce->id = id;
+      grn_gcache.stat.nentries++;
+    } else {
+      grn_cache_unlink(ce);
+      grn_gcache.stat.size -= ce->size;
+      GRN_GFREE(ce->value);
+    }
+    ce->db = db;
+    ce->modified = modified;
+    ce->size = value_size;
+    ce->value = v;
+    grn_cache_link(ce);
+    grn_gcache.stat.size += value_size;
+    while (grn_gcache.stat.nentries > grn_gcache.stat.max_nentries ||
+           grn_gcache.stat.size > grn_gcache.stat.max_size) {
+      grn_cache_expire_entry(grn_gcache.prev);
+    }
+  } else {
+    GRN_GFREE(v);
+  }
+  MUTEX_UNLOCK(grn_gcache.mutex);
+}
+
+void
+grn_cache_expire_db(grn_obj *db)
+{
+  grn_cache_entry *ce, *ce_;
+  if (!grn_gcache.hash) { return; }
+  MUTEX_LOCK(grn_gcache.mutex);
+  for (ce = grn_gcache.next; ce != GRN_CACHE_HEAD; ce = ce_) {
+    ce_ = ce->next;
+    if (ce->db == db) { grn_cache_expire_entry(ce); }
+  }
+  MUTEX_UNLOCK(grn_gcache.mutex);
+}
+
+void
+grn_cache_get_statistics(grn_cache_statistics *statistics)
+{
+  if (!grn_gcache.hash) {
+    memset(statistics, 0, sizeof(grn_cache_statistics));
+    return;
+  }
+  MUTEX_LOCK(grn_gcache.mutex);
+  memcpy(statistics, &grn_gcache.stat, sizeof(grn_cache_statistics));
+  MUTEX_UNLOCK(grn_gcache.mutex);
+}
+
 /**** memory allocation ****/
 
 #define ALIGN_SIZE (1<<3)
@@ -399,6 +399,30 @@ void grn_ctx_loader_clear(grn_ctx *ctx);
 grn_rc grn_ctx_sendv(grn_ctx *ctx, int argc, char **argv, int flags);
 void grn_ctx_set_next_expr(grn_ctx *ctx, grn_obj *expr);
 
+/**** grn_cache ****/
+
+#define GRN_CACHE_DEFAULT_MAX_NENTRIES 100
+#define GRN_CACHE_DEFAULT_MAX_SIZE     (16 * 1024 * 1024)
+
+typedef struct {
+  uint32_t nentries;
+  uint32_t max_nentries;
+  uint64_t size;
+  uint64_t max_size;
+  uint64_t nfetches;
+  uint64_t nhits;
+} grn_cache_statistics;
+
+void grn_cache_init(void);
+void grn_cache_fin(void);
+int grn_cache_fetch(grn_ctx *ctx, grn_obj *db,
+                    const char *key, uint32_t key_size, grn_obj *output);
+void grn_cache_update(grn_ctx *ctx, grn_obj *db, uint32_t modified,
+                      const char *key, uint32_t key_size,
+                      const char *value, uint32_t value_size);
+void grn_cache_expire_db(grn_obj *db);
+void grn_cache_get_statistics(grn_cache_statistics *statistics);
+
 /**** receive handler ****/
 
 void grn_ctx_recv_handler_set(grn_ctx *c, void (*func)(grn_ctx *, int, void *),
@@ -407,6 +431,12 @@ void grn_ctx_recv_handler_set(grn_ctx *c, void (*func)(grn_ctx *, int, void *),
 void grn_ctx_concat_func(grn_ctx *ctx, int flags, void *dummy);
 void grn_ctx_stream_out_func(grn_ctx *c, int flags, void *stream);
 
+/* pending output larger than this is passed to the receive handler
+   with GRN_CTX_MORE while a large result is being formatted. */
+#define GRN_CTX_OUTPUT_FLUSH_SIZE (64 * 1024)
+
+void grn_ctx_output_flush(grn_ctx *ctx, grn_obj *bulk);
+
 grn_rc grn_db_init_builtin_procs(grn_ctx *ctx);
 
 #ifdef __cplusplus
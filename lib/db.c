@@ -48,9 +48,12 @@ struct _grn_db {
   grn_ja *specs;
   grn_tiny_array values;
   grn_mutex lock;
+  uint32_t *modified;
 };
 
 static grn_rc grn_db_obj_init(grn_ctx *ctx, grn_obj *db, grn_id id, grn_db_obj *obj);
+static void grn_obj_touch(grn_obj *obj);
+static grn_obj *grn_obj_last_column(grn_obj *obj);
 
 inline static void
 gen_pathname(const char *path, char *buffer, int fno)
@@ -82,6 +85,7 @@ grn_db_create(grn_ctx *ctx, const char *path, grn_db_create_optarg *optarg)
       if ((s->keys = grn_pat_create(ctx, path, GRN_PAT_MAX_KEY_SIZE, 0,
                                     GRN_OBJ_KEY_VAR_SIZE))) {
         MUTEX_INIT(s->lock);
+        s->modified = &s->keys->header->modified;
         GRN_DB_OBJ_SET_TYPE(s, GRN_DB);
         s->obj.db = (grn_obj *)s;
         s->obj.header.domain = GRN_ID_NIL;
@@ -135,6 +139,7 @@ grn_db_open(grn_ctx *ctx, const char *path)
         gen_pathname(path, buffer, 0);
         if ((s->specs = grn_ja_open(ctx, buffer))) {
           MUTEX_INIT(s->lock);
+          s->modified = &s->keys->header->modified;
           GRN_DB_OBJ_SET_TYPE(s, GRN_DB);
           s->obj.db = (grn_obj *)s;
           s->obj.header.domain = GRN_ID_NIL;
@@ -170,6 +175,7 @@ grn_db_close(grn_ctx *ctx, grn_obj *db)
   grn_db *s = (grn_db *)db;
   if (!s) { return GRN_INVALID_ARGUMENT; }
   GRN_API_ENTER;
+  grn_cache_expire_db(db);
   GRN_TINY_ARRAY_EACH(&s->values, 1, grn_pat_curr_id(ctx, s->keys), id, vp, {
     if (*vp) { grn_obj_close(ctx, *vp); }
   });
@@ -189,6 +195,12 @@ grn_db_close(grn_ctx *ctx, grn_obj *db)
   GRN_API_RETURN(GRN_SUCCESS);
 }
 
+uint32_t
+grn_db_modified(grn_obj *db)
+{
+  return db ? *((grn_db *)db)->modified : 0;
+}
+
 static grn_rc grn_obj_delete_by_id(grn_ctx *ctx, grn_obj *db, grn_id id, int removep);
 
 grn_obj *
@@ -539,7 +551,7 @@ grn_proc_get_info(grn_ctx *ctx, grn_user_data *user_data,
 /* grn_table */
 
 static void
-calc_rec_size(grn_obj_flags flags, uint32_t *max_n_subrecs,
+calc_rec_size(grn_obj_flags flags, int with_calc_values, uint32_t *max_n_subrecs,
               uint8_t *subrec_size, uint8_t *subrec_offset,
               uint32_t *key_size, uint32_t *value_size)
 {
@@ -587,6 +599,9 @@ calc_rec_size(grn_obj_flags flags, uint32_t *max_n_subrecs,
     }
     *value_size = (uintptr_t)GRN_RSET_SUBRECS_NTH((((grn_rset_recinfo *)0)->subrecs),
                                                   *subrec_size, *max_n_subrecs);
+    if (with_calc_values) {
+      *value_size = GRN_RSET_CALC_VALUES_OFFSET(*value_size) + sizeof(grn_rset_calc_values);
+    }
   }
 }
 
@@ -594,10 +609,10 @@ static grn_obj *grn_view_create(grn_ctx *ctx, const char *path, grn_obj_flags fl
 static grn_obj *grn_view_transcript(grn_ctx *ctx, const char *path, grn_obj *key_type,
                                     grn_obj *value_type, grn_obj_flags flags);
 
-grn_obj *
-grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
-                 const char *path, grn_obj_flags flags,
-                 grn_obj *key_type, grn_obj *value_type)
+static grn_obj *
+grn_table_create_(grn_ctx *ctx, const char *name, unsigned name_size,
+                  const char *path, grn_obj_flags flags,
+                  grn_obj *key_type, grn_obj *value_type, int with_calc_values)
 {
   grn_id id;
   grn_id domain = GRN_ID_NIL, range = GRN_ID_NIL;
@@ -699,7 +714,7 @@ grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
       GRN_API_RETURN(NULL);
     }
   }
-  calc_rec_size(flags, &max_n_subrecs, &subrec_size,
+  calc_rec_size(flags, with_calc_values, &max_n_subrecs, &subrec_size,
                 &subrec_offset, &key_size, &value_size);
   switch (flags & GRN_OBJ_TABLE_TYPE_MASK) {
   case GRN_OBJ_TABLE_HASH_KEY :
@@ -734,7 +749,8 @@ grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
   }
   if (res) {
     DB_OBJ(res)->header.flags = flags;
-    DB_OBJ(res)->header.impl_flags = 0;
+    DB_OBJ(res)->header.impl_flags =
+      (with_calc_values && (flags & GRN_OBJ_WITH_SUBREC)) ? GRN_OBJ_WITH_CALC_VALUES : 0;
     DB_OBJ(res)->header.domain = domain;
     DB_OBJ(res)->range = range;
     DB_OBJ(res)->max_n_subrecs = max_n_subrecs;
@@ -743,6 +759,8 @@ grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
     if (grn_db_obj_init(ctx, db, id, DB_OBJ(res))) {
       grn_obj_remove(ctx, res);
       res = NULL;
+    } else {
+      grn_obj_touch(res);
     }
   } else {
     grn_obj_delete_by_id(ctx, db, id, 1);
@@ -750,6 +768,24 @@ grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
   GRN_API_RETURN(res);
 }
 
+grn_obj *
+grn_table_create(grn_ctx *ctx, const char *name, unsigned name_size,
+                 const char *path, grn_obj_flags flags,
+                 grn_obj *key_type, grn_obj *value_type)
+{
+  return grn_table_create_(ctx, name, name_size, path, flags,
+                           key_type, value_type, 0);
+}
+
+grn_obj *
+grn_table_create_with_calc_values(grn_ctx *ctx, const char *name, unsigned name_size,
+                                  const char *path, grn_obj_flags flags,
+                                  grn_obj *key_type, grn_obj *value_type)
+{
+  return grn_table_create_(ctx, name, name_size, path, flags|GRN_OBJ_WITH_SUBREC,
+                           key_type, value_type, 1);
+}
+
 grn_obj *
 grn_table_open(grn_ctx *ctx, const char *name, unsigned name_size, const char *path)
 {
@@ -827,7 +863,9 @@ grn_table_lcp_search(grn_ctx *ctx, grn_obj *table, const void *key, unsigned key
 grn_id
 grn_table_add(grn_ctx *ctx, grn_obj *table, const void *key, unsigned key_size, int *added)
 {
+  int added_ = 0;
   grn_id id = GRN_ID_NIL;
+  if (!added) { added = &added_; }
   GRN_API_ENTER;
   if (table) {
     switch (table->header.type) {
@@ -848,7 +886,9 @@ grn_table_add(grn_ctx *ctx, grn_obj *table, const void *key, unsigned key_size,
       {
         grn_hash *hash = (grn_hash *)table;
         WITH_NORMALIZE(hash, key, key_size, {
-          if (grn_io_lock(ctx, hash->io, 10000000)) {
+          if (hash->concurrent) {
+            id = grn_hash_add(ctx, hash, key, key_size, NULL, added);
+          } else if (grn_io_lock(ctx, hash->io, 10000000)) {
             id = GRN_ID_NIL;
           } else {
             id = grn_hash_add(ctx, hash, key, key_size, NULL, added);
@@ -859,9 +899,10 @@ grn_table_add(grn_ctx *ctx, grn_obj *table, const void *key, unsigned key_size,
       break;
     case GRN_TABLE_NO_KEY :
       id = grn_array_add(ctx, (grn_array *)table, NULL);
-      if (added) { *added = id ? 1 : 0; }
+      *added = id ? 1 : 0;
       break;
     }
+    if (*added) { grn_obj_touch(table); }
   }
   GRN_API_RETURN(id);
 }
@@ -1018,6 +1059,7 @@ grn_table_add_v(grn_ctx *ctx, grn_obj *table, const void *key, int key_size,
       if (added) { *added = id ? 1 : 0; }
       break;
     }
+    if (id) { grn_obj_touch(table); }
   }
   GRN_API_RETURN(id);
 }
@@ -1142,6 +1184,7 @@ grn_table_delete(grn_ctx *ctx, grn_obj *table, const void *key, unsigned key_siz
       break;
     }
     /* todo : clear_all_column_values */
+    if (!rc) { grn_obj_touch(table); }
   }
   GRN_API_RETURN(rc);
 }
@@ -1196,6 +1239,19 @@ grn_obj_io(grn_obj *obj)
   return io;
 }
 
+/* bumps the modification counter of the db which obj belongs to.
+   temporary objects don't count. the counter is kept in the header of
+   the db keys, so it is shared by all the processes which open the db. */
+static void
+grn_obj_touch(grn_obj *obj)
+{
+  grn_io *io = grn_obj_io(obj);
+  if (io && !(io->flags & GRN_IO_TEMPORARY) && DB_OBJ(obj)->db) {
+    uint32_t modified;
+    GRN_ATOMIC_ADD_EX(((grn_db *)DB_OBJ(obj)->db)->modified, 1, modified);
+  }
+}
+
 grn_rc
 grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id)
 {
@@ -1210,6 +1266,7 @@ grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id)
   } else {
     rc = _grn_table_delete_by_id(ctx, table, id, NULL);
   }
+  if (!rc) { grn_obj_touch(table); }
   GRN_API_RETURN(rc);
 }
 
@@ -1361,6 +1418,15 @@ grn_table_add_subrec(grn_obj *table, grn_rset_recinfo *ri, int score,
   }
 }
 
+static grn_rset_calc_values *
+rset_calc_values(grn_obj *table, grn_rset_recinfo *ri)
+{
+  uintptr_t offset = (uintptr_t)GRN_RSET_SUBRECS_NTH((((grn_rset_recinfo *)0)->subrecs),
+                                                     DB_OBJ(table)->subrec_size,
+                                                     DB_OBJ(table)->max_n_subrecs);
+  return (grn_rset_calc_values *)((byte *)ri + GRN_RSET_CALC_VALUES_OFFSET(offset));
+}
+
 typedef struct {
   grn_db_obj obj;
   grn_id curr_rec;
@@ -1424,6 +1490,8 @@ grn_view_cursor_open(grn_ctx *ctx, grn_obj *view,
   return NULL;
 }
 
+#define GRN_OBJ_GET_VALUE_IMD (0xffffffffU)
+
 const char *grn_obj_get_value_(grn_ctx *ctx, grn_obj *obj, grn_id id, uint32_t *size);
 
 const char *
@@ -1653,6 +1721,8 @@ grn_table_cursor_open(grn_ctx *ctx, grn_obj *table,
   GRN_API_RETURN(tc);
 }
 
+/* opens a cursor over the records whose ids are from min to max in the
+   order of ids. 0 means no bound. */
 grn_table_cursor *
 grn_table_cursor_open_by_id(grn_ctx *ctx, grn_obj *table,
                             grn_id min, grn_id max, int flags)
@@ -1662,12 +1732,12 @@ grn_table_cursor_open_by_id(grn_ctx *ctx, grn_obj *table,
   if (table) {
     switch (table->header.type) {
     case GRN_TABLE_PAT_KEY :
-      tc = (grn_table_cursor *)grn_pat_cursor_open(ctx, (grn_pat *)table,
-                                                   NULL, 0, NULL, 0, 0, 0, flags);
+      tc = (grn_table_cursor *)grn_pat_cursor_open_id_range(ctx, (grn_pat *)table,
+                                                            min, max, flags);
       break;
     case GRN_TABLE_HASH_KEY :
-      tc = (grn_table_cursor *)grn_hash_cursor_open(ctx, (grn_hash *)table,
-                                                    NULL, 0, NULL, 0, 0, 0, flags);
+      tc = (grn_table_cursor *)grn_hash_cursor_open_id_range(ctx, (grn_hash *)table,
+                                                             min, max, flags);
       break;
     case GRN_TABLE_NO_KEY :
       tc = (grn_table_cursor *)grn_array_cursor_open(ctx, (grn_array *)table,
@@ -2055,14 +2125,152 @@ grn_obj_search(grn_ctx *ctx, grn_obj *obj, grn_obj *query,
 #define GRN_TABLE_GROUP_FILTER_PREFIX    0
 #define GRN_TABLE_GROUP_FILTER_SUFFIX    (1L<<2)
 
+#define GRN_TABLE_GROUP_CALC_VALUES \
+  (GRN_TABLE_GROUP_CALC_MAX|GRN_TABLE_GROUP_CALC_MIN|\
+   GRN_TABLE_GROUP_CALC_SUM|GRN_TABLE_GROUP_CALC_AVG)
+
+static int
+calc_target_p(grn_ctx *ctx, grn_obj *target)
+{
+  switch (grn_obj_get_range(ctx, target)) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_FLOAT :
+  case GRN_DB_TIME :
+    return 1;
+  default :
+    return 0;
+  }
+}
+
+static double
+calc_target_value(grn_ctx *ctx, grn_obj *target, grn_id id)
+{
+  uint32_t size;
+  const char *v = grn_obj_get_value_(ctx, target, id, &size);
+  if (!v) { return 0; }
+  if (size == GRN_OBJ_GET_VALUE_IMD) { return (double)(uintptr_t)v; }
+  switch (grn_obj_get_range(ctx, target)) {
+  case GRN_DB_INT8 :
+    return *((int8_t *)v);
+  case GRN_DB_UINT8 :
+    return *((uint8_t *)v);
+  case GRN_DB_INT16 :
+    return *((int16_t *)v);
+  case GRN_DB_UINT16 :
+    return *((uint16_t *)v);
+  case GRN_DB_INT32 :
+    return *((int32_t *)v);
+  case GRN_DB_UINT32 :
+    return *((uint32_t *)v);
+  case GRN_DB_INT64 :
+    return *((int64_t *)v);
+  case GRN_DB_UINT64 :
+    return *((uint64_t *)v);
+  case GRN_DB_FLOAT :
+    return *((double *)v);
+  case GRN_DB_TIME :
+    return *((int64_t *)v) / 1000000.0;
+  default :
+    return 0;
+  }
+}
+
+inline static void
+grn_table_group_calc(grn_table_group_result *rp, grn_rset_recinfo *ri, double v)
+{
+  grn_rset_calc_values *cv = rset_calc_values(rp->table, ri);
+  int n_subrecs = GRN_RSET_N_SUBRECS(ri);
+  if (n_subrecs) {
+    if (cv->max < v) { cv->max = v; }
+    if (v < cv->min) { cv->min = v; }
+    cv->sum += v;
+  } else {
+    cv->max = cv->min = cv->sum = v;
+  }
+  cv->avg = cv->sum / (n_subrecs + 1);
+}
+
+typedef struct {
+  grn_obj value;
+  int idp;
+} group_key_value;
+
+inline static void
+group_add(grn_ctx *ctx, grn_table_group_result *rp, const void *key, uint32_t key_size,
+          grn_rset_recinfo *ri, double calc_value)
+{
+  void *value;
+  if (grn_table_add_v(ctx, rp->table, key, key_size, &value, NULL)) {
+    if (rp->flags & GRN_TABLE_GROUP_CALC_VALUES) {
+      grn_table_group_calc(rp, value, calc_value);
+    }
+    grn_table_add_subrec(rp->table, value, ri ? ri->score : 0, NULL, 0);
+  }
+}
+
+static void
+group_add_value(grn_ctx *ctx, grn_table_group_result *rp, group_key_value *kv,
+                grn_rset_recinfo *ri, double calc_value)
+{
+  switch (kv->value.header.type) {
+  case GRN_UVECTOR :
+    {
+      // todo : support objects except grn_id
+      grn_id *v = (grn_id *)GRN_BULK_HEAD(&kv->value);
+      grn_id *ve = (grn_id *)GRN_BULK_CURR(&kv->value);
+      for (; v < ve; v++) {
+        if (*v != GRN_ID_NIL) { group_add(ctx, rp, v, sizeof(grn_id), ri, calc_value); }
+      }
+    }
+    break;
+  case GRN_VECTOR :
+    if (kv->value.u.v.body) {
+      const char *head = GRN_BULK_HEAD(kv->value.u.v.body);
+      grn_section *vp = kv->value.u.v.sections;
+      grn_section *ve = vp + kv->value.u.v.n_sections;
+      for (; vp < ve; vp++) {
+        if (vp->length) { group_add(ctx, rp, head + vp->offset, vp->length, ri, calc_value); }
+      }
+    }
+    break;
+  case GRN_BULK :
+    if (!kv->idp || *((grn_id *)GRN_BULK_HEAD(&kv->value))) {
+      group_add(ctx, rp, GRN_BULK_HEAD(&kv->value), GRN_BULK_VSIZE(&kv->value),
+                ri, calc_value);
+    }
+    break;
+  default :
+    ERR(GRN_INVALID_ARGUMENT, "invalid column");
+    break;
+  }
+}
+
 static grn_rc grn_view_group(grn_ctx *ctx, grn_obj *table,
                              grn_table_sort_key *keys, int n_keys,
-                             grn_table_group_result *results, int n_results);
+                             grn_table_group_result *results, int n_results,
+                             grn_obj *calc_target);
 
 grn_rc
 grn_table_group(grn_ctx *ctx, grn_obj *table,
                 grn_table_sort_key *keys, int n_keys,
                 grn_table_group_result *results, int n_results)
+{
+  return grn_table_group_with_calc_target(ctx, table, keys, n_keys,
+                                          results, n_results, NULL);
+}
+
+grn_rc
+grn_table_group_with_calc_target(grn_ctx *ctx, grn_obj *table,
+                                 grn_table_sort_key *keys, int n_keys,
+                                 grn_table_group_result *results, int n_results,
+                                 grn_obj *calc_target)
 {
   grn_rc rc = GRN_SUCCESS;
   if (!table || !n_keys || !n_results) {
@@ -2071,14 +2279,14 @@ grn_table_group(grn_ctx *ctx, grn_obj *table,
   }
   GRN_API_ENTER;
   if (table->header.type == GRN_TABLE_VIEW) {
-    rc = grn_view_group(ctx, table, keys, n_keys, results, n_results);
+    rc = grn_view_group(ctx, table, keys, n_keys, results, n_results, calc_target);
   } else {
     int k, r;
-    void *key;
     grn_obj bulk;
     grn_table_cursor *tc;
     grn_table_sort_key *kp;
     grn_table_group_result *rp;
+    group_key_value *kvs;
     for (k = 0, kp = keys; k < n_keys; k++, kp++) {
       if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
         ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
@@ -2090,88 +2298,81 @@ grn_table_group(grn_ctx *ctx, grn_obj *table,
         ERR(GRN_INVALID_ARGUMENT, "table missing in (%d)", r);
         goto exit;
       }
+      if (rp->flags & GRN_TABLE_GROUP_CALC_VALUES) {
+        if (!(DB_OBJ(rp->table)->header.impl_flags & GRN_OBJ_WITH_CALC_VALUES)) {
+          ERR(GRN_INVALID_ARGUMENT, "table without calc values in (%d)", r);
+          goto exit;
+        }
+        if (!calc_target || !calc_target_p(ctx, calc_target)) {
+          ERR(GRN_INVALID_ARGUMENT, "calc target is not numeric in (%d)", r);
+          goto exit;
+        }
+      }
+    }
+    if (!(kvs = GRN_MALLOCN(group_key_value, n_keys))) { goto exit; }
+    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+      grn_id range_id = grn_obj_get_range(ctx, kp->key);
+      grn_obj *column = grn_obj_last_column(kp->key);
+      kvs[k].idp = GRN_OBJ_TABLEP(grn_ctx_at(ctx, range_id));
+      if (!kvs[k].idp && column && column->header.type == GRN_COLUMN_VAR_SIZE &&
+          (column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) == GRN_OBJ_COLUMN_VECTOR) {
+        GRN_OBJ_INIT(&kvs[k].value, GRN_VECTOR, 0, range_id);
+      } else {
+        GRN_TEXT_INIT(&kvs[k].value, 0);
+      }
     }
     GRN_TEXT_INIT(&bulk, 0);
-    if (n_keys == 1 && n_results == 1) {
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
-        grn_id id;
-        grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys->key));
-        int idp = GRN_OBJ_TABLEP(range);
-        while ((id = grn_table_cursor_next(ctx, tc))) {
-          void *value;
-          grn_rset_recinfo *ri = NULL;
-          GRN_BULK_REWIND(&bulk);
-          if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-            grn_table_cursor_get_value(ctx, tc, (void **)&ri);
-          }
-          grn_obj_get_value(ctx, keys->key, id, &bulk);
-          switch (bulk.header.type) {
-          case GRN_UVECTOR :
-            {
-              // todo : support objects except grn_id
-              grn_id *v = (grn_id *)GRN_BULK_HEAD(&bulk);
-              grn_id *ve = (grn_id *)GRN_BULK_CURR(&bulk);
-              while (v < ve) {
-                if ((*v != GRN_ID_NIL) &&
-                    grn_table_add_v(ctx, results->table, v, sizeof(grn_id), &value, NULL)) {
-                  grn_table_add_subrec(results->table, value, ri ? ri->score : 0, NULL, 0);
-                }
-                v++;
-              }
-            }
-            break;
-          case GRN_VECTOR :
-            ERR(GRN_OPERATION_NOT_SUPPORTED, "sorry.. not implemented yet");
-            /* todo */
-            break;
-          case GRN_BULK :
-            {
-              if ((!idp || *((grn_id *)GRN_BULK_HEAD(&bulk))) &&
-                  grn_table_add_v(ctx, results->table,
-                                  GRN_BULK_HEAD(&bulk), GRN_BULK_VSIZE(&bulk), &value, NULL)) {
-                grn_table_add_subrec(results->table, value, ri ? ri->score : 0, NULL, 0);
-              }
-            }
-            break;
-          default :
-            ERR(GRN_INVALID_ARGUMENT, "invalid column");
-            break;
+    /* all the results are filled in a single pass, reading each key once per record */
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
+      grn_id id;
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        grn_rset_recinfo *ri = NULL;
+        if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+          grn_table_cursor_get_value(ctx, tc, (void **)&ri);
+        }
+        for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+          if (kvs[k].value.header.type == GRN_VECTOR) {
+            kvs[k].value.u.v.n_sections = 0;
+            if (kvs[k].value.u.v.body) { GRN_BULK_REWIND(kvs[k].value.u.v.body); }
+          } else {
+            GRN_BULK_REWIND(&kvs[k].value);
           }
-        }
-        grn_table_cursor_close(ctx, tc);
-      }
-    } else {
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
-        grn_id id;
-        while ((id = grn_table_cursor_next(ctx, tc))) {
-          grn_rset_recinfo *ri = NULL;
-          GRN_BULK_REWIND(&bulk);
-          if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-            grn_table_cursor_get_value(ctx, tc, (void **)&ri);
+          grn_obj_get_value(ctx, kp->key, id, &kvs[k].value);
+        }
+        for (r = 0, rp = results; r < n_results; r++, rp++) {
+          int begin = rp->key_begin;
+          int end = rp->key_end >= n_keys ? n_keys : rp->key_end;
+          double calc_value = 0;
+          /* an empty range (e.g. 0..0) groups by all the keys */
+          if (end <= begin) {
+            begin = 0;
+            end = n_keys;
           }
-          for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-            kp->offset = GRN_BULK_VSIZE(&bulk);
-            grn_obj_get_value(ctx, kp->key, id, &bulk);
+          if (rp->flags & GRN_TABLE_GROUP_CALC_VALUES) {
+            calc_value = calc_target_value(ctx, calc_target, id);
           }
-          for (r = 0, rp = results; r < n_results; r++, rp++) {
-            void *value;
-            int begin = keys[rp->key_begin].offset;
-            int end = rp->key_end >= n_keys
-              ? GRN_BULK_VSIZE(&bulk)
-              : keys[rp->key_end].offset;
-            key = GRN_BULK_HEAD(&bulk) + begin;
-            // todo : cut off GRN_ID_NIL
-            if (grn_table_add_v(ctx, rp->table, key, end - begin, &value, NULL)) {
-              grn_table_add_subrec(rp->table, value, ri ? ri->score : 0, NULL, 0);
+          if (end - begin == 1) {
+            group_add_value(ctx, rp, &kvs[begin], ri, calc_value);
+          } else {
+            GRN_BULK_REWIND(&bulk);
+            for (k = begin; k < end; k++) {
+              grn_obj *v = kvs[k].value.header.type == GRN_VECTOR
+                ? kvs[k].value.u.v.body : &kvs[k].value;
+              if (v) { GRN_TEXT_PUT(ctx, &bulk, GRN_BULK_HEAD(v), GRN_BULK_VSIZE(v)); }
             }
+            // todo : cut off GRN_ID_NIL
+            group_add(ctx, rp, GRN_BULK_HEAD(&bulk), GRN_BULK_VSIZE(&bulk), ri, calc_value);
           }
         }
-        grn_table_cursor_close(ctx, tc);
       }
+      grn_table_cursor_close(ctx, tc);
     }
+    for (k = 0; k < n_keys; k++) { grn_obj_close(ctx, &kvs[k].value); }
+    GRN_FREE(kvs);
     grn_obj_close(ctx, &bulk);
   }
 exit :
+  if (!rc) { rc = ctx->rc; }
   GRN_API_RETURN(rc);
 }
 
@@ -2483,6 +2684,8 @@ grn_column_create(grn_ctx *ctx, grn_obj *table,
     if (grn_db_obj_init(ctx, db, id, DB_OBJ(res))) {
       grn_obj_remove(ctx, res);
       res = NULL;
+    } else {
+      grn_obj_touch(res);
     }
   }
 exit :
@@ -2889,12 +3092,28 @@ enum {
   GRN_ACCESSOR_GET_VALUE,
   GRN_ACCESSOR_GET_SCORE,
   GRN_ACCESSOR_GET_NSUBRECS,
+  GRN_ACCESSOR_GET_MAX,
+  GRN_ACCESSOR_GET_MIN,
+  GRN_ACCESSOR_GET_SUM,
+  GRN_ACCESSOR_GET_AVG,
   GRN_ACCESSOR_GET_COLUMN_VALUE,
   GRN_ACCESSOR_GET_DB_OBJ,
   GRN_ACCESSOR_LOOKUP,
   GRN_ACCESSOR_FUNCALL
 };
 
+/* returns the column whose value obj reads at last, or NULL */
+static grn_obj *
+grn_obj_last_column(grn_obj *obj)
+{
+  if (obj->header.type == GRN_ACCESSOR) {
+    grn_accessor *a;
+    for (a = (grn_accessor *)obj; a->next; a = a->next) ;
+    return a->action == GRN_ACCESSOR_GET_COLUMN_VALUE ? a->obj : NULL;
+  }
+  return obj;
+}
+
 static grn_accessor *
 accessor_new(grn_ctx *ctx)
 {
@@ -2911,6 +3130,22 @@ accessor_new(grn_ctx *ctx)
   return res;
 }
 
+static double *
+accessor_calc_value(grn_accessor *a, grn_rset_recinfo *ri)
+{
+  grn_rset_calc_values *cv = rset_calc_values(a->obj, ri);
+  switch (a->action) {
+  case GRN_ACCESSOR_GET_MAX :
+    return &cv->max;
+  case GRN_ACCESSOR_GET_MIN :
+    return &cv->min;
+  case GRN_ACCESSOR_GET_SUM :
+    return &cv->sum;
+  default :
+    return &cv->avg;
+  }
+}
+
 static grn_obj *
 grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned name_size)
 {
@@ -2929,6 +3164,10 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned name
     case GRN_ACCESSOR_GET_VALUE :
     case GRN_ACCESSOR_GET_SCORE :
     case GRN_ACCESSOR_GET_NSUBRECS :
+    case GRN_ACCESSOR_GET_MAX :
+    case GRN_ACCESSOR_GET_MIN :
+    case GRN_ACCESSOR_GET_SUM :
+    case GRN_ACCESSOR_GET_AVG :
       obj = grn_ctx_at(ctx, DB_OBJ(res->obj)->range);
       break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
@@ -2951,7 +3190,7 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned name
     }
     if (!(len = sp - name)) { goto exit; }
     if (*name == GRN_DB_PSEUDO_COLUMN_PREFIX || *name == ':') { /* pseudo column */
-      int done = 0;
+      int done = 0, calc = 0;
       switch (name[1]) {
       case 'k' : /* key */
       case 'K' :
@@ -3069,6 +3308,10 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned name
         break;
       case 's' : /* score */
       case 'S' :
+        if (len == 4 && !memcmp(name, "_sum", 4)) {
+          calc = GRN_ACCESSOR_GET_SUM;
+          break;
+        }
         for (rp = &res; !done; rp = &(*rp)->next) {
           *rp = accessor_new(ctx);
           (*rp)->obj = obj;
@@ -3127,10 +3370,58 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned name
           }
         }
         break;
+      case 'm' : /* max, min */
+      case 'M' :
+        if (len == 4 && !memcmp(name, "_max", 4)) {
+          calc = GRN_ACCESSOR_GET_MAX;
+        } else if (len == 4 && !memcmp(name, "_min", 4)) {
+          calc = GRN_ACCESSOR_GET_MIN;
+        } else {
+          res = NULL;
+          goto exit;
+        }
+        break;
+      case 'a' : /* avg */
+      case 'A' :
+        if (len != 4 || memcmp(name, "_avg", 4)) {
+          res = NULL;
+          goto exit;
+        }
+        calc = GRN_ACCESSOR_GET_AVG;
+        break;
       default :
         res = NULL;
         goto exit;
       }
+      if (calc) {
+        for (rp = &res; !done; rp = &(*rp)->next) {
+          *rp = accessor_new(ctx);
+          (*rp)->obj = obj;
+          if (DB_OBJ(obj)->header.impl_flags & GRN_OBJ_WITH_CALC_VALUES) {
+            (*rp)->action = calc;
+            done++;
+          } else {
+            switch (obj->header.type) {
+            case GRN_TABLE_PAT_KEY :
+            case GRN_TABLE_HASH_KEY :
+              (*rp)->action = GRN_ACCESSOR_GET_KEY;
+              break;
+            case GRN_TABLE_NO_KEY :
+              if (obj->header.domain) {
+                (*rp)->action = GRN_ACCESSOR_GET_VALUE;
+                break;
+              }
+              /* fallthru */
+            default :
+              /* lookup failed */
+              grn_obj_close(ctx, (grn_obj *)res);
+              res = NULL;
+              goto exit;
+            }
+            obj = grn_ctx_at(ctx, obj->header.domain);
+          }
+        }
+      }
     } else {
       /* if obj->header.type == GRN_TYPE ... lookup table */
       for (rp = &res; ; rp = &(*rp)->next) {
@@ -3238,11 +3529,13 @@ grn_accessor_view_close(grn_ctx *ctx, grn_obj *obj)
 grn_obj *
 grn_table_create_for_group(grn_ctx *ctx, const char *name, unsigned name_size,
                            const char *path, grn_obj_flags flags,
-                           grn_obj *group_key, grn_obj *value_type)
+                           grn_obj *group_key, grn_obj *value_type,
+                           int with_calc_values)
 {
   if (group_key->header.type != GRN_ACCESSOR_VIEW) {
     grn_obj *key_type = grn_ctx_at(ctx, grn_obj_get_range(ctx, group_key));
-    return grn_table_create(ctx, name, name_size, path, flags, key_type, value_type);
+    return grn_table_create_(ctx, name, name_size, path, flags,
+                             key_type, value_type, with_calc_values);
   } else {
     int n;
     grn_obj **ap;
@@ -3253,7 +3546,8 @@ grn_table_create_for_group(grn_ctx *ctx, const char *name, unsigned name_size,
     if (res) {
       for (n = a->naccessors, ap = a->accessors; n; n--, ap++) {
         grn_view_add(ctx, res,
-                     grn_table_create_for_group(ctx, NULL, 0, NULL, flags, *ap, value_type));
+                     grn_table_create_for_group(ctx, NULL, 0, NULL, flags, *ap, value_type,
+                                                with_calc_values));
       }
     }
     return res;
@@ -3263,7 +3557,8 @@ grn_table_create_for_group(grn_ctx *ctx, const char *name, unsigned name_size,
 static grn_rc
 grn_view_group(grn_ctx *ctx, grn_obj *table,
                grn_table_sort_key *keys, int n_keys,
-               grn_table_group_result *results, int n_results)
+               grn_table_group_result *results, int n_results,
+               grn_obj *calc_target)
 {
   if (n_keys != 1 || n_results != 1) {
     return GRN_FUNCTION_NOT_IMPLEMENTED;
@@ -3290,7 +3585,8 @@ grn_view_group(grn_ctx *ctx, grn_obj *table,
           }
           results_->table = r;
           /* todo : sampling */
-          grn_table_group(ctx, t, keys_, n_keys, results_, n_results);
+          grn_table_group_with_calc_target(ctx, t, keys_, n_keys, results_, n_results,
+                                           calc_target);
         });
         /* todo : merge */
         GRN_FREE(results_);
@@ -3319,6 +3615,12 @@ grn_obj_get_range(grn_ctx *ctx, grn_obj *obj)
       case GRN_ACCESSOR_GET_NSUBRECS :
         range = GRN_DB_INT32;
         break;
+      case GRN_ACCESSOR_GET_MAX :
+      case GRN_ACCESSOR_GET_MIN :
+      case GRN_ACCESSOR_GET_SUM :
+      case GRN_ACCESSOR_GET_AVG :
+        range = GRN_DB_FLOAT;
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         if (GRN_DB_OBJP(a->obj)) { range = DB_OBJ(a->obj)->range; }
         break;
@@ -3499,8 +3801,6 @@ grn_obj_cast(grn_ctx *ctx, grn_obj *src, grn_obj *dest, int addp)
   return rc;
 }
 
-#define GRN_OBJ_GET_VALUE_IMD (0xffffffffU)
-
 const char *
 grn_accessor_get_value_(grn_ctx *ctx, grn_accessor *a, grn_id id, uint32_t *size)
 {
@@ -3529,6 +3829,15 @@ grn_accessor_get_value_(grn_ctx *ctx, grn_accessor *a, grn_id id, uint32_t *size
         *size = sizeof(int);
       }
       break;
+    case GRN_ACCESSOR_GET_MAX :
+    case GRN_ACCESSOR_GET_MIN :
+    case GRN_ACCESSOR_GET_SUM :
+    case GRN_ACCESSOR_GET_AVG :
+      if ((value = grn_obj_get_value_(ctx, a->obj, id, size))) {
+        value = (const char *)accessor_calc_value(a, (grn_rset_recinfo *)value);
+        *size = sizeof(double);
+      }
+      break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
       /* todo : support vector */
       value = grn_obj_get_value_(ctx, a->obj, id, size);
@@ -3558,6 +3867,30 @@ grn_accessor_get_value(grn_ctx *ctx, grn_accessor *a, grn_id id, grn_obj *value)
   uint32_t vs = 0;
   uint32_t size0;
   void *vp = NULL;
+  if (value && value->header.type == GRN_VECTOR) {
+    /* follows the references up to the last column, which fills the vector */
+    for (; a->next; a = a->next) {
+      const char *v;
+      switch (a->action) {
+      case GRN_ACCESSOR_GET_KEY :
+        v = _grn_table_key(ctx, a->obj, id, &vs);
+        break;
+      case GRN_ACCESSOR_GET_VALUE :
+      case GRN_ACCESSOR_GET_COLUMN_VALUE :
+        v = grn_obj_get_value_(ctx, a->obj, id, &vs);
+        break;
+      default :
+        v = NULL;
+        break;
+      }
+      if (!v || vs < sizeof(grn_id)) { return value; }
+      id = *((grn_id *)v);
+    }
+    if (a->action == GRN_ACCESSOR_GET_COLUMN_VALUE) {
+      grn_obj_get_value(ctx, a->obj, id, value);
+    }
+    return value;
+  }
   if (!value) {
     if (!(value = grn_obj_open(ctx, GRN_BULK, 0, 0))) { return NULL; }
   } else {
@@ -3595,6 +3928,15 @@ grn_accessor_get_value(grn_ctx *ctx, grn_accessor *a, grn_id id, grn_obj *value)
         GRN_INT32_PUT(ctx, value, ri->n_subrecs);
       }
       break;
+    case GRN_ACCESSOR_GET_MAX :
+    case GRN_ACCESSOR_GET_MIN :
+    case GRN_ACCESSOR_GET_SUM :
+    case GRN_ACCESSOR_GET_AVG :
+      {
+        grn_rset_recinfo *ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, a->obj, id, &vs);
+        GRN_FLOAT_PUT(ctx, value, *accessor_calc_value(a, ri));
+      }
+      break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
       /* todo : support vector */
       grn_obj_get_value(ctx, a->obj, id, value);
@@ -3763,7 +4105,7 @@ grn_obj_size(grn_ctx *ctx, grn_obj *obj)
   case GRN_MSG :
     return GRN_BULK_VSIZE(obj);
   case GRN_VECTOR :
-    return GRN_BULK_VSIZE(obj->u.v.body);
+    return obj->u.v.body ? GRN_BULK_VSIZE(obj->u.v.body) : 0;
   default :
     return 0;
   }
@@ -3958,6 +4300,7 @@ grn_obj_set_value(grn_ctx *ctx, grn_obj *obj, grn_id id,
     }
   }
 exit :
+  if (!rc) { grn_obj_touch(obj); }
   GRN_API_RETURN(rc);
 }
 
@@ -4446,6 +4789,7 @@ grn_obj_set_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *value)
       ERR(GRN_INVALID_ARGUMENT, "only db_obj can accept GRN_INFO_SOURCE");
       goto exit;
     }
+    rc = GRN_SUCCESS;
     {
       void *v = GRN_BULK_HEAD(value);
       uint32_t s = GRN_BULK_VSIZE(value);
@@ -4461,6 +4805,7 @@ grn_obj_set_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *value)
 
         if (obj->header.type == GRN_COLUMN_INDEX) {
           update_source_hook(ctx, obj);
+          rc = grn_ii_build(ctx, (grn_ii *)obj);
         }
 
       } else {
@@ -4469,7 +4814,7 @@ grn_obj_set_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *value)
       }
     }
     grn_obj_spec_save(ctx, DB_OBJ(obj));
-    rc = GRN_SUCCESS;
+    grn_obj_touch(obj);
     break;
   case GRN_INFO_DEFAULT_TOKENIZER :
     if (!value || DB_OBJ(value)->header.type == GRN_PROC) {
@@ -4485,7 +4830,17 @@ grn_obj_set_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *value)
         rc = GRN_SUCCESS;
         break;
       }
+      if (!rc) { grn_obj_touch(obj); }
+    }
+    break;
+  case GRN_INFO_CONCURRENT_INSERT :
+    if (obj->header.type != GRN_TABLE_HASH_KEY) {
+      ERR(GRN_INVALID_ARGUMENT, "only hash table can accept GRN_INFO_CONCURRENT_INSERT");
+      goto exit;
     }
+    rc = grn_hash_set_concurrent(ctx, (grn_hash *)obj, value && GRN_BOOL_VALUE(value));
+    if (rc) { ERR(rc, "grn_hash_set_concurrent failed"); }
+    break;
   default :
     /* todo */
     break;
@@ -4614,6 +4969,7 @@ grn_obj_remove(grn_ctx *ctx, grn_obj *obj)
   GRN_API_ENTER;
   path = (char *)grn_obj_path(ctx, obj);
   if (path) { path = GRN_STRDUP(path); }
+  grn_obj_touch(obj);
   switch (obj->header.type) {
   case GRN_DB :
     /* todo : remove all tables and columns */
@@ -5209,6 +5565,18 @@ grn_column_name_(grn_ctx *ctx, grn_obj *obj, grn_obj *buf)
       case GRN_ACCESSOR_GET_NSUBRECS :
         GRN_TEXT_PUTS(ctx, buf, "_nsubrecs");
         break;
+      case GRN_ACCESSOR_GET_MAX :
+        GRN_TEXT_PUTS(ctx, buf, "_max");
+        break;
+      case GRN_ACCESSOR_GET_MIN :
+        GRN_TEXT_PUTS(ctx, buf, "_min");
+        break;
+      case GRN_ACCESSOR_GET_SUM :
+        GRN_TEXT_PUTS(ctx, buf, "_sum");
+        break;
+      case GRN_ACCESSOR_GET_AVG :
+        GRN_TEXT_PUTS(ctx, buf, "_avg");
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         grn_column_name_(ctx, a->obj, buf);
         if (a->next) { GRN_TEXT_PUTC(ctx, buf, '.'); }
@@ -5498,36 +5866,324 @@ pack(grn_ctx *ctx, grn_obj *table, sort_entry *head, sort_entry *tail,
   return i > 2 ? head : NULL;
 }
 
+/* bounded max heap which keeps the first m entries in sort order */
+
+#define SORT_HEAP_THRESHOLD 8
+
+inline static void
+heap_down(grn_ctx *ctx, sort_entry *heap, int n, int i,
+          grn_table_sort_key *keys, int n_keys)
+{
+  int c;
+  sort_entry e = heap[i];
+  while ((c = (i << 1) + 1) < n) {
+    if (c + 1 < n && compare_value(ctx, &heap[c + 1], &heap[c], keys, n_keys)) { c++; }
+    if (!compare_value(ctx, &heap[c], &e, keys, n_keys)) { break; }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = e;
+}
+
 static int
-compare_cursor(grn_ctx *ctx, grn_table_cursor *a, grn_table_cursor *b, int n_keys)
+heap_sort(grn_ctx *ctx, grn_obj *table, sort_entry *heap, int m,
+          grn_table_sort_key *keys, int n_keys)
 {
-  int i;
-  uint8_t type;
-  uint32_t as, bs, cs;
-  const char *ap, *bp, *cp;
-  grn_table_sort_key *ak, *bk;
-  for (i = 0; i < n_keys; i++) {
-    ap = grn_table_cursor_get_sort_key_value_(ctx, a, i, &as, &ak);
-    bp = grn_table_cursor_get_sort_key_value_(ctx, b, i, &bs, &bk);
-    if (ak->flags & GRN_TABLE_SORT_DESC) {
-      cp = ap; ap = bp; bp = cp;
-      cs = as; as = bs; bs = cs;
-    }
-    type = ak->offset;
-    switch (type) {
-    case KEY_ID :
-      if (ap != bp) { return ap > bp; }
-      break;
-    case KEY_BULK :
-      for (;; ap++, bp++, as--, bs--) {
-        if (!as) { if (bs) { return 0; } else { break; } }
-        if (!bs) { return 1; }
-        if (*ap < *bp) { return 0; }
-        if (*ap > *bp) { return 1; }
+  int i, n = 0;
+  sort_entry e;
+  grn_table_cursor *tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0);
+  if (!tc) { return 0; }
+  while ((e.id = grn_table_cursor_next(ctx, tc))) {
+    e.value = grn_obj_get_value_(ctx, keys->key, e.id, &e.size);
+    if (n < m) {
+      for (i = n++; i; i = (i - 1) >> 1) {
+        if (!compare_value(ctx, &e, &heap[(i - 1) >> 1], keys, n_keys)) { break; }
+        heap[i] = heap[(i - 1) >> 1];
       }
-      break;
-    case KEY_INT8 :
-      CMPNUM(int8_t);
+      heap[i] = e;
+    } else if (compare_value(ctx, heap, &e, keys, n_keys)) {
+      heap[0] = e;
+      heap_down(ctx, heap, n, 0, keys, n_keys);
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+  for (i = n - 1; i > 0; i--) {
+    swap(heap, heap + i);
+    heap_down(ctx, heap, i, 0, keys, n_keys);
+  }
+  return n;
+}
+
+/* LSD radix sort for a single fixed width numeric key */
+
+#define SORT_RADIX_MIN_RECORDS 0x100
+
+typedef struct {
+  uint64_t key;
+  grn_id id;
+} radix_entry;
+
+static int
+radix_key_size(grn_table_sort_key *key)
+{
+  switch (key->offset) {
+  case KEY_INT8 :
+  case KEY_UINT8 :
+    return 1;
+  case KEY_INT16 :
+  case KEY_UINT16 :
+    return 2;
+  case KEY_ID :
+  case KEY_INT32 :
+  case KEY_UINT32 :
+  case KEY_FLOAT32 :
+    return 4;
+  case KEY_INT64 :
+  case KEY_UINT64 :
+  case KEY_FLOAT64 :
+    return 8;
+  default :
+    return 0;
+  }
+}
+
+/* maps a key value to an unsigned integer which has the same order */
+inline static uint64_t
+radix_key(grn_table_sort_key *key, const char *v)
+{
+  uint64_t k;
+  if (key->offset == KEY_ID) { return (uint64_t)(uintptr_t)v; }
+  if (!v) { return 0; }
+  switch (key->offset) {
+  case KEY_INT8 :
+    return (uint8_t)(*((int8_t *)v) ^ 0x80);
+  case KEY_INT16 :
+    return (uint16_t)(*((int16_t *)v) ^ 0x8000);
+  case KEY_INT32 :
+    return (uint32_t)*((int32_t *)v) ^ 0x80000000U;
+  case KEY_INT64 :
+    return (uint64_t)*((int64_t *)v) ^ 0x8000000000000000ULL;
+  case KEY_UINT8 :
+    return *((uint8_t *)v);
+  case KEY_UINT16 :
+    return *((uint16_t *)v);
+  case KEY_UINT32 :
+    return *((uint32_t *)v);
+  case KEY_UINT64 :
+    return *((uint64_t *)v);
+  case KEY_FLOAT32 :
+    k = *((uint32_t *)v);
+    return (k & 0x80000000U) ? (~k & 0xffffffffU) : (k | 0x80000000U);
+  case KEY_FLOAT64 :
+    k = *((uint64_t *)v);
+    return (k & 0x8000000000000000ULL) ? ~k : (k | 0x8000000000000000ULL);
+  default :
+    return 0;
+  }
+}
+
+/* returns the number of records stored into result, or -1 if the key is
+   not suitable for radix sort. */
+static int
+radix_sort(grn_ctx *ctx, grn_obj *table, int n, int offset, int limit,
+           grn_obj *result, grn_table_sort_key *key)
+{
+  int i, m = 0, pass, key_size;
+  uint32_t count[0x100];
+  uint64_t mask;
+  radix_entry *array, *buf, *src, *dest;
+  grn_table_cursor *tc;
+  if (!(key_size = radix_key_size(key)) || n < SORT_RADIX_MIN_RECORDS) { return -1; }
+  if (!(array = GRN_MALLOC(sizeof(radix_entry) * n * 2))) { return -1; }
+  buf = array + n;
+  mask = (key->flags & GRN_TABLE_SORT_DESC)
+    ? (key_size == 8 ? ~0ULL : (1ULL << (key_size * 8)) - 1) : 0;
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
+    grn_id id;
+    uint32_t size;
+    while (m < n && (id = grn_table_cursor_next(ctx, tc))) {
+      array[m].id = id;
+      array[m].key = radix_key(key, grn_obj_get_value_(ctx, key->key, id, &size)) ^ mask;
+      m++;
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+  src = array;
+  dest = buf;
+  for (pass = 0; pass < key_size; pass++) {
+    int shift = pass * 8;
+    uint32_t sum = 0, c;
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < m; i++) { count[(src[i].key >> shift) & 0xff]++; }
+    if (count[(src[0].key >> shift) & 0xff] == (uint32_t)m) { continue; }
+    for (i = 0; i < 0x100; i++) {
+      c = count[i];
+      count[i] = sum;
+      sum += c;
+    }
+    for (i = 0; i < m; i++) { dest[count[(src[i].key >> shift) & 0xff]++] = src[i]; }
+    { radix_entry *t = src; src = dest; dest = t; }
+  }
+  {
+    grn_id *v;
+    if (offset + limit > m) { limit = m - offset; }
+    for (i = 0; i < limit; i++) {
+      if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+      *v = src[offset + i].id;
+    }
+  }
+  GRN_FREE(array);
+  return i;
+}
+
+/* parallel merge sort */
+
+#define SORT_MIN_RECORDS_PER_THREAD 0x10000
+
+typedef struct {
+  grn_ctx ctx;
+  grn_thread thread;
+  sort_entry *head;
+  sort_entry *tail;
+  sort_entry *curr;
+  int limit;
+  grn_table_sort_key *keys;
+  int n_keys;
+} sort_worker;
+
+static void * CALLBACK
+sort_worker_exec(void *arg)
+{
+  sort_worker *w = (sort_worker *)arg;
+  _sort(&w->ctx, w->head, w->tail, w->limit, w->keys, w->n_keys);
+  return NULL;
+}
+
+inline static void
+merge_down(grn_ctx *ctx, sort_worker **heap, int n, int i,
+           grn_table_sort_key *keys, int n_keys)
+{
+  int c;
+  sort_worker *w = heap[i];
+  while ((c = (i << 1) + 1) < n) {
+    if (c + 1 < n &&
+        compare_value(ctx, heap[c]->curr, heap[c + 1]->curr, keys, n_keys)) { c++; }
+    if (!compare_value(ctx, w->curr, heap[c]->curr, keys, n_keys)) { break; }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = w;
+}
+
+/* sorts each part of the records by a thread and merges the results.
+   returns the number of records stored into result, or -1 if the records
+   should be sorted by a single thread. */
+static int
+parallel_sort(grn_ctx *ctx, grn_obj *table, int n, int offset, int limit,
+              grn_obj *result, grn_table_sort_key *keys, int n_keys)
+{
+  int i, m = 0, n_workers, n_threads = grn_get_scan_threads();
+  sort_entry *array;
+  sort_worker *w, *workers, **heap;
+  grn_table_cursor *tc;
+  if (n_threads < 2 || !ctx->impl || !ctx->impl->db) { return -1; }
+  if (n / SORT_MIN_RECORDS_PER_THREAD < n_threads) {
+    n_threads = n / SORT_MIN_RECORDS_PER_THREAD;
+    if (n_threads < 2) { return -1; }
+  }
+  if (!(array = GRN_MALLOC(sizeof(sort_entry) * n))) { return -1; }
+  if (!(workers = GRN_CALLOC(sizeof(sort_worker) * n_threads +
+                             sizeof(sort_worker *) * n_threads))) {
+    GRN_FREE(array);
+    return -1;
+  }
+  heap = (sort_worker **)(workers + n_threads);
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
+    while (m < n && (array[m].id = grn_table_cursor_next(ctx, tc))) {
+      array[m].value = grn_obj_get_value_(ctx, keys->key, array[m].id, &array[m].size);
+      m++;
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+  for (i = 0, n_workers = 0; i < n_threads; i++) {
+    int b = (int)((int64_t)m * i / n_threads), e = (int)((int64_t)m * (i + 1) / n_threads);
+    if (b == e) { continue; }
+    w = &workers[i];
+    grn_ctx_init(&w->ctx, 0);
+    grn_ctx_use(&w->ctx, ctx->impl->db);
+    w->head = w->curr = array + b;
+    w->tail = array + e - 1;
+    w->limit = offset + limit;
+    w->keys = keys;
+    w->n_keys = n_keys;
+    if (THREAD_CREATE(w->thread, sort_worker_exec, w)) {
+      SERR("pthread_create");
+      w->thread = 0;
+      sort_worker_exec(w);
+    }
+    heap[n_workers++] = w;
+  }
+  for (i = 0; i < n_workers; i++) {
+    if (heap[i]->thread) { THREAD_JOIN(heap[i]->thread); }
+  }
+  for (i = n_workers >> 1; i--;) {
+    merge_down(ctx, heap, n_workers, i, keys, n_keys);
+  }
+  {
+    grn_id *v;
+    int k = 0;
+    i = 0;
+    while (n_workers && i < limit) {
+      w = heap[0];
+      if (k++ >= offset) {
+        if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+        *v = w->curr->id;
+        i++;
+      }
+      if (w->curr++ == w->tail) {
+        heap[0] = heap[--n_workers];
+      }
+      if (n_workers) { merge_down(ctx, heap, n_workers, 0, keys, n_keys); }
+    }
+  }
+  for (w = workers; w < workers + n_threads; w++) {
+    if (w->head) { grn_ctx_fin(&w->ctx); }
+  }
+  GRN_FREE(workers);
+  GRN_FREE(array);
+  return i;
+}
+
+static int
+compare_cursor(grn_ctx *ctx, grn_table_cursor *a, grn_table_cursor *b, int n_keys)
+{
+  int i;
+  uint8_t type;
+  uint32_t as, bs, cs;
+  const char *ap, *bp, *cp;
+  grn_table_sort_key *ak, *bk;
+  for (i = 0; i < n_keys; i++) {
+    ap = grn_table_cursor_get_sort_key_value_(ctx, a, i, &as, &ak);
+    bp = grn_table_cursor_get_sort_key_value_(ctx, b, i, &bs, &bk);
+    if (ak->flags & GRN_TABLE_SORT_DESC) {
+      cp = ap; ap = bp; bp = cp;
+      cs = as; as = bs; bs = cs;
+    }
+    type = ak->offset;
+    switch (type) {
+    case KEY_ID :
+      if (ap != bp) { return ap > bp; }
+      break;
+    case KEY_BULK :
+      for (;; ap++, bp++, as--, bs--) {
+        if (!as) { if (bs) { return 0; } else { break; } }
+        if (!bs) { return 1; }
+        if (*ap < *bp) { return 0; }
+        if (*ap > *bp) { return 1; }
+      }
+      break;
+    case KEY_INT8 :
+      CMPNUM(int8_t);
       break;
     case KEY_INT16 :
       CMPNUM(int16_t);
@@ -5683,6 +6339,7 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
                 ERR(GRN_INVALID_ARGUMENT, "unsupported uint value");
                 goto exit;
               }
+              break;
             case GRN_OBJ_KEY_INT :
               switch (GRN_TYPE_SIZE(DB_OBJ(range))) {
               case 1 :
@@ -5701,6 +6358,7 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
                 ERR(GRN_INVALID_ARGUMENT, "unsupported int value");
                 goto exit;
               }
+              break;
             case GRN_OBJ_KEY_FLOAT :
               switch (GRN_TYPE_SIZE(DB_OBJ(range))) {
               case 4 :
@@ -5713,6 +6371,7 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
                 ERR(GRN_INVALID_ARGUMENT, "unsupported float value");
                 goto exit;
               }
+              break;
             }
           }
         } else {
@@ -5721,14 +6380,30 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
       }
     }
   }
-  if (!(array = GRN_MALLOC(sizeof(sort_entry) * n))) {
-    goto exit;
-  }
-  if ((ep = pack(ctx, table, array, array + n - 1, keys, n_keys))) {
-    intptr_t rest = limit - 1 - (ep - array);
-    _sort(ctx, array, ep - 1, limit, keys, n_keys);
-    if (rest > 0 ) {
-      _sort(ctx, ep + 1, array + n - 1, (int)rest, keys, n_keys);
+  if ((offset + limit) * SORT_HEAP_THRESHOLD < n) {
+    int m = offset + limit;
+    if (!(array = GRN_MALLOC(sizeof(sort_entry) * m))) {
+      goto exit;
+    }
+    m = heap_sort(ctx, table, array, m, keys, n_keys);
+    if (m < offset + limit) { limit = m - offset; }
+  } else {
+    if (n_keys == 1 && (i = radix_sort(ctx, table, n, offset, limit, result, keys)) >= 0) {
+      goto exit;
+    }
+    if ((i = parallel_sort(ctx, table, n, offset, limit, result, keys, n_keys)) >= 0) {
+      goto exit;
+    }
+    i = 0;
+    if (!(array = GRN_MALLOC(sizeof(sort_entry) * n))) {
+      goto exit;
+    }
+    if ((ep = pack(ctx, table, array, array + n - 1, keys, n_keys))) {
+      intptr_t rest = offset + limit - 1 - (ep - array);
+      _sort(ctx, array, ep - 1, offset + limit, keys, n_keys);
+      if (rest > 0 ) {
+        _sort(ctx, ep + 1, array + n - 1, (int)rest, keys, n_keys);
+      }
     }
   }
   {
@@ -5846,11 +6521,26 @@ grn_column_index(grn_ctx *ctx, grn_obj *obj, grn_operator op, grn_obj **indexbuf
       grn_obj *target = grn_ctx_at(ctx, data->target);
       /* todo : data->section */
       if (target->header.type != GRN_COLUMN_INDEX) { continue; }
-      if (op == GRN_OP_EQUAL) {
-        grn_obj *tokenizer, *lexicon = grn_ctx_at(ctx, target->header.domain);
-        if (!lexicon) { continue; }
-        grn_table_get_info(ctx, lexicon, NULL, NULL, &tokenizer);
-        if (tokenizer) { continue; }
+      switch (op) {
+      case GRN_OP_LESS :
+      case GRN_OP_GREATER :
+      case GRN_OP_LESS_EQUAL :
+      case GRN_OP_GREATER_EQUAL :
+        {
+          grn_obj *lexicon = grn_ctx_at(ctx, target->header.domain);
+          if (!lexicon || lexicon->header.type != GRN_TABLE_PAT_KEY) { continue; }
+        }
+        /* fallthru */
+      case GRN_OP_EQUAL :
+        {
+          grn_obj *tokenizer, *lexicon = grn_ctx_at(ctx, target->header.domain);
+          if (!lexicon) { continue; }
+          grn_table_get_info(ctx, lexicon, NULL, NULL, &tokenizer);
+          if (tokenizer) { continue; }
+        }
+        break;
+      default :
+        break;
       }
       if (n < buf_size) {
         *ip++ = target;
@@ -6411,6 +7101,10 @@ grn_expr_get_var_by_offset(grn_ctx *ctx, grn_obj *expr, unsigned int offset)
   (c)->value = (v);\
   (c)->nargs = (n);\
   (c)->op = (o);\
+  if ((v) && (v)->header.type == GRN_PROC &&\
+      ((v)->header.impl_flags & GRN_OBJ_VOLATILE)) {\
+    ctx->impl->n_volatile_procs++;\
+  }\
 }
 
 grn_obj *
@@ -7968,6 +8662,7 @@ typedef enum {
   (si)->logical_op = GRN_OP_OR;\
   (si)->flags = SCAN_PUSH;\
   (si)->index = NULL;\
+  (si)->query = NULL;\
   (si)->nargs = 0;\
   (si)->start = (st);\
 }
@@ -8179,108 +8874,436 @@ scan_info_build(grn_ctx *ctx, grn_obj *expr, int *n,
   return sis;
 }
 
-static void
-grn_table_select_(grn_ctx *ctx, grn_obj *table, grn_obj *expr, grn_obj *v,
-                  grn_obj *res, grn_operator op)
-{
-  int32_t score;
-  grn_id id, *idp;
-  grn_table_cursor *tc;
-  grn_hash_cursor *hc;
-  grn_hash *s = (grn_hash *)res;
-  grn_obj *r;
-  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
-  switch (op) {
-  case GRN_OP_OR :
-    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
-      while ((id = grn_table_cursor_next(ctx, tc))) {
-        GRN_RECORD_SET(ctx, v, id);
-        grn_expr_exec(ctx, expr, 0);
-        r = grn_ctx_pop(ctx);
-        if (r && (score = GRN_UINT32_VALUE(r))) {
-          grn_rset_recinfo *ri;
-          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
-            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
-          }
-        }
-      }
-      grn_table_cursor_close(ctx, tc);
-    }
-    break;
-  case GRN_OP_AND :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        grn_expr_exec(ctx, expr, 0);
-        r = grn_ctx_pop(ctx);
-        if (r && (score = GRN_UINT32_VALUE(r))) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        } else {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
+static int
+select_range(grn_ctx *ctx, grn_obj *table, scan_info *si, grn_obj *res)
+{
+  int done = 0;
+  grn_obj *keys, *ii = NULL, dest;
+  grn_operator op = si->op;
+  if (!si->query) { return 0; }
+  if (si->flags & SCAN_ACCESSOR) {
+    grn_accessor *a = (grn_accessor *)si->index;
+    if (si->index->header.type != GRN_ACCESSOR || a->next ||
+        a->action != GRN_ACCESSOR_GET_KEY) { return 0; }
+    keys = table;
+  } else {
+    ii = si->index;
+    keys = grn_ctx_at(ctx, ii->header.domain);
+  }
+  if (!keys || keys->header.type != GRN_TABLE_PAT_KEY) { return 0; }
+  if (si->flags & SCAN_PRE_CONST) {
+    switch (op) {
+    case GRN_OP_LESS : op = GRN_OP_GREATER; break;
+    case GRN_OP_GREATER : op = GRN_OP_LESS; break;
+    case GRN_OP_LESS_EQUAL : op = GRN_OP_GREATER_EQUAL; break;
+    case GRN_OP_GREATER_EQUAL : op = GRN_OP_LESS_EQUAL; break;
+    default : break;
     }
-    break;
-  case GRN_OP_BUT :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        grn_expr_exec(ctx, expr, 0);
-        r = grn_ctx_pop(ctx);
-        if (r && (score = GRN_UINT32_VALUE(r))) {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
+  }
+  GRN_OBJ_INIT(&dest, GRN_BULK, 0, keys->header.domain);
+  if (!grn_obj_cast(ctx, si->query, &dest, 0)) {
+    grn_id tid;
+    grn_table_cursor *tc;
+    const void *min = NULL, *max = NULL;
+    unsigned min_size = 0, max_size = 0;
+    int flags = GRN_CURSOR_ASCENDING;
+    switch (op) {
+    case GRN_OP_LESS :
+      flags |= GRN_CURSOR_LT;
+      /* fallthru */
+    case GRN_OP_LESS_EQUAL :
+      max = GRN_BULK_HEAD(&dest);
+      max_size = GRN_BULK_VSIZE(&dest);
+      break;
+    case GRN_OP_GREATER :
+      flags |= GRN_CURSOR_GT;
+      /* fallthru */
+    case GRN_OP_GREATER_EQUAL :
+      min = GRN_BULK_HEAD(&dest);
+      min_size = GRN_BULK_VSIZE(&dest);
+      break;
+    default :
+      break;
     }
-    break;
-  case GRN_OP_ADJUST :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        grn_expr_exec(ctx, expr, 0);
-        r = grn_ctx_pop(ctx);
-        if (r && (score = GRN_UINT32_VALUE(r))) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+    if ((tc = grn_table_cursor_open(ctx, keys, min, min_size, max, max_size,
+                                    0, 0, flags))) {
+      while ((tid = grn_table_cursor_next(ctx, tc))) {
+        if (ii) {
+          grn_ii_at(ctx, (grn_ii *)ii, tid, (grn_hash *)res, si->logical_op);
+        } else {
+          grn_rset_posinfo pi;
+          memset(&pi, 0, sizeof(grn_rset_posinfo));
+          pi.rid = tid;
+          res_add(ctx, (grn_hash *)res, &pi, 1, si->logical_op);
         }
       }
-      grn_hash_cursor_close(ctx, hc);
+      grn_table_cursor_close(ctx, tc);
     }
-    break;
-  default :
-    break;
+    grn_ii_resolve_sel_and(ctx, (grn_hash *)res, si->logical_op);
+    done++;
   }
+  GRN_OBJ_FIN(ctx, &dest);
+  return done;
 }
 
-grn_obj *
-grn_view_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
-                grn_obj *res, grn_operator op)
+/* parallel scan */
+
+#define SCAN_MAX_THREADS               256
+#define SCAN_MIN_RECORDS_PER_THREAD    0x4000
+
+static int grn_scan_threads = 1;
+
+int
+grn_get_scan_threads(void)
 {
-  if (res) {
-    if (res->header.type != GRN_TABLE_VIEW ||
-        (res->header.domain != DB_OBJ(table)->id)) {
-      ERR(GRN_INVALID_ARGUMENT, "view table required");
-      return NULL;
-    }
-  } else {
-    if (!(res = grn_table_create(ctx, NULL, 0, NULL,
-                                 GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL))) {
-      return NULL;
-    }
+  return grn_scan_threads;
+}
+
+grn_rc
+grn_set_scan_threads(int n_threads)
+{
+  if (n_threads < 1 || SCAN_MAX_THREADS < n_threads) {
+    return GRN_INVALID_ARGUMENT;
   }
-  {
-    grn_obj *t, *r;
-    grn_id *tp, rid;
-    grn_view *tv = (grn_view *)table;
-    grn_view *rv = (grn_view *)res;
+  grn_scan_threads = n_threads;
+  return GRN_SUCCESS;
+}
+
+typedef struct {
+  grn_ctx ctx;
+  grn_thread thread;
+  grn_obj *table;
+  grn_expr *expr;
+  grn_id min;
+  grn_id max;
+  grn_obj hits;
+} scan_worker;
+
+static grn_id
+scan_max_id(grn_ctx *ctx, grn_obj *table)
+{
+  switch (table->header.type) {
+  case GRN_TABLE_PAT_KEY :
+    return grn_pat_curr_id(ctx, (grn_pat *)table);
+  case GRN_TABLE_HASH_KEY :
+    return grn_hash_curr_id(ctx, (grn_hash *)table);
+  case GRN_TABLE_NO_KEY :
+    return grn_array_curr_id(ctx, (grn_array *)table);
+  default :
+    return GRN_ID_NIL;
+  }
+}
+
+/* returns 1 if every code of expr can be evaluated without side effects
+   by a thread which doesn't own the objects referred from expr. */
+static int
+scan_parallel_safe(grn_ctx *ctx, grn_expr *e)
+{
+  grn_expr_code *c, *ce;
+  if (DB_OBJ(e)->id && !(DB_OBJ(e)->id & GRN_OBJ_TMP_OBJECT)) { return 0; }
+  for (c = e->codes, ce = &e->codes[e->codes_curr]; c < ce; c++) {
+    switch (c->op) {
+    case GRN_OP_PUSH :
+    case GRN_OP_POP :
+    case GRN_OP_NOP :
+    case GRN_OP_GET_VALUE :
+    case GRN_OP_AND :
+    case GRN_OP_BUT :
+    case GRN_OP_OR :
+    case GRN_OP_JUMP :
+    case GRN_OP_CJUMP :
+    case GRN_OP_BITWISE_OR :
+    case GRN_OP_BITWISE_XOR :
+    case GRN_OP_BITWISE_AND :
+    case GRN_OP_BITWISE_NOT :
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+    case GRN_OP_MATCH :
+    case GRN_OP_SHIFTL :
+    case GRN_OP_SHIFTR :
+    case GRN_OP_SHIFTRR :
+    case GRN_OP_PLUS :
+    case GRN_OP_MINUS :
+    case GRN_OP_STAR :
+    case GRN_OP_SLASH :
+    case GRN_OP_MOD :
+    case GRN_OP_NOT :
+      break;
+    default :
+      return 0;
+    }
+    if (c->value && GRN_DB_OBJP(c->value) &&
+        (DB_OBJ(c->value)->id & GRN_OBJ_TMP_OBJECT)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* duplicates the parts of expr which grn_expr_exec() modifies.
+   consts and db objects are shared with the original. */
+static grn_expr *
+scan_expr_dup(grn_ctx *ctx, grn_expr *e)
+{
+  uint32_t i;
+  grn_expr *d;
+  grn_expr_code *c, *ce;
+  if (!(d = GRN_MALLOCN(grn_expr, 1))) { return NULL; }
+  memcpy(d, e, sizeof(grn_expr));
+  d->consts = NULL;
+  d->nconsts = 0;
+  d->vars = NULL;
+  d->nvars = 0;
+  d->values = NULL;
+  d->values_curr = 0;
+  d->values_tail = 0;
+  d->codes = NULL;
+  d->codes_size = 0;
+  GRN_TEXT_INIT(&d->name_buf, 0);
+  GRN_TEXT_INIT(&d->dfi, 0);
+  GRN_PTR_INIT(&d->objs, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  if (!(d->vars = GRN_MALLOCN(grn_expr_var, e->nvars ? e->nvars : 1))) { goto exit; }
+  for (i = 0; i < e->nvars; i++) {
+    grn_expr_var *v0 = &e->vars[i], *v = &d->vars[i];
+    v->name = v0->name;
+    v->name_size = v0->name_size;
+    GRN_OBJ_INIT(&v->value, v0->value.header.type, 0, v0->value.header.domain);
+    GRN_TEXT_PUT(ctx, &v->value, GRN_TEXT_VALUE(&v0->value), GRN_TEXT_LEN(&v0->value));
+    d->nvars++;
+  }
+  if (!(d->values = GRN_MALLOCN(grn_obj, e->values_size))) { goto exit; }
+  for (i = 0; i < e->values_size; i++) {
+    GRN_OBJ_INIT(&d->values[i], GRN_BULK, GRN_OBJ_EXPRVALUE, GRN_ID_NIL);
+  }
+  if (!(d->codes = GRN_MALLOCN(grn_expr_code, e->codes_curr ? e->codes_curr : 1))) {
+    goto exit;
+  }
+  memcpy(d->codes, e->codes, sizeof(grn_expr_code) * e->codes_curr);
+  d->codes_size = e->codes_curr;
+  for (c = d->codes, ce = c + d->codes_curr; c < ce; c++) {
+    grn_obj *value = c->value;
+    if (!value) { continue; }
+    if ((byte *)e->vars <= (byte *)value &&
+        (byte *)value < (byte *)(e->vars + e->nvars)) {
+      i = ((byte *)value - (byte *)e->vars) / sizeof(grn_expr_var);
+      c->value = &d->vars[i].value;
+    } else if (e->values <= value && value < e->values + e->values_size) {
+      c->value = d->values + (value - e->values);
+    }
+  }
+  return d;
+exit :
+  d->values_tail = d->values ? d->values_size : 0;
+  grn_expr_close(ctx, (grn_obj *)d);
+  return NULL;
+}
+
+static void * CALLBACK
+scan_worker_exec(void *arg)
+{
+  scan_worker *w = (scan_worker *)arg;
+  grn_ctx *ctx = &w->ctx;
+  grn_expr *e;
+  if ((e = scan_expr_dup(ctx, w->expr))) {
+    int32_t score;
+    grn_id id;
+    grn_obj *v, *r;
+    grn_table_cursor *tc;
+    if ((v = grn_expr_get_var_by_offset(ctx, (grn_obj *)e, 0)) &&
+        (tc = grn_table_cursor_open_by_id(ctx, w->table, w->min, w->max,
+                                          GRN_CURSOR_ASCENDING))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        GRN_RECORD_SET(ctx, v, id);
+        grn_expr_exec(ctx, (grn_obj *)e, 0);
+        r = grn_ctx_pop(ctx);
+        if (r && (score = GRN_UINT32_VALUE(r))) {
+          GRN_UINT32_PUT(ctx, &w->hits, id);
+          GRN_UINT32_PUT(ctx, &w->hits, score);
+        }
+        if (ctx->rc) { break; }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    grn_expr_close(ctx, (grn_obj *)e);
+  }
+  return NULL;
+}
+
+/* evaluates expr over the id range of table split into contiguous chunks.
+   the hits are added to res in the order of ids, which differs from the
+   order of keys grn_table_select_() scans a patricia trie in.
+   returns 0 if the expression must be evaluated by grn_table_select_(). */
+static int
+scan_parallel(grn_ctx *ctx, grn_obj *table, grn_obj *expr, grn_obj *res)
+{
+  int i, n_threads = grn_scan_threads;
+  grn_id max_id, chunk;
+  scan_worker *workers;
+  grn_hash *s = (grn_hash *)res;
+  if (n_threads < 2) { return 0; }
+  switch (table->header.type) {
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_NO_KEY :
+    break;
+  default :
+    return 0;
+  }
+  if (DB_OBJ(table)->id & GRN_OBJ_TMP_OBJECT) { return 0; }
+  if (!scan_parallel_safe(ctx, (grn_expr *)expr)) { return 0; }
+  max_id = scan_max_id(ctx, table);
+  if (max_id / SCAN_MIN_RECORDS_PER_THREAD < n_threads) {
+    n_threads = max_id / SCAN_MIN_RECORDS_PER_THREAD;
+    if (n_threads < 2) { return 0; }
+  }
+  if (!(workers = GRN_CALLOC(sizeof(scan_worker) * n_threads))) { return 0; }
+  chunk = (max_id + n_threads - 1) / n_threads;
+  for (i = 0; i < n_threads; i++) {
+    scan_worker *w = &workers[i];
+    grn_ctx_init(&w->ctx, 0);
+    grn_ctx_use(&w->ctx, ctx->impl->db);
+    GRN_TEXT_INIT(&w->hits, 0);
+    w->table = table;
+    w->expr = (grn_expr *)expr;
+    w->min = chunk * i + 1;
+    w->max = (i == n_threads - 1) ? max_id : chunk * (i + 1);
+    if (THREAD_CREATE(w->thread, scan_worker_exec, w)) {
+      SERR("pthread_create");
+      w->thread = 0;
+      scan_worker_exec(w);
+    }
+  }
+  for (i = 0; i < n_threads; i++) {
+    scan_worker *w = &workers[i];
+    if (w->thread) { THREAD_JOIN(w->thread); }
+  }
+  for (i = 0; i < n_threads; i++) {
+    scan_worker *w = &workers[i];
+    uint32_t *p = (uint32_t *)GRN_BULK_HEAD(&w->hits);
+    uint32_t *pe = (uint32_t *)GRN_BULK_CURR(&w->hits);
+    if (w->ctx.rc && !ctx->rc) {
+      ERR(w->ctx.rc, "parallel scan failed: %s", w->ctx.errbuf);
+    }
+    for (; p < pe; p += 2) {
+      grn_rset_recinfo *ri;
+      if (grn_hash_add(ctx, s, p, s->key_size, (void **)&ri, NULL)) {
+        grn_table_add_subrec(res, ri, (int)p[1], (grn_rset_posinfo *)p, 1);
+      }
+    }
+    GRN_OBJ_FIN(&w->ctx, &w->hits);
+    grn_ctx_fin(&w->ctx);
+  }
+  GRN_FREE(workers);
+  return 1;
+}
+
+static void
+grn_table_select_(grn_ctx *ctx, grn_obj *table, grn_obj *expr, grn_obj *v,
+                  grn_obj *res, grn_operator op)
+{
+  int32_t score;
+  grn_id id, *idp;
+  grn_table_cursor *tc;
+  grn_hash_cursor *hc;
+  grn_hash *s = (grn_hash *)res;
+  grn_obj *r;
+  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
+  switch (op) {
+  case GRN_OP_OR :
+    if (scan_parallel(ctx, table, expr, res)) { break; }
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        GRN_RECORD_SET(ctx, v, id);
+        grn_expr_exec(ctx, expr, 0);
+        r = grn_ctx_pop(ctx);
+        if (r && (score = GRN_UINT32_VALUE(r))) {
+          grn_rset_recinfo *ri;
+          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+          }
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    break;
+  case GRN_OP_AND :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        GRN_RECORD_SET(ctx, v, *idp);
+        grn_expr_exec(ctx, expr, 0);
+        r = grn_ctx_pop(ctx);
+        if (r && (score = GRN_UINT32_VALUE(r))) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        } else {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_BUT :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        GRN_RECORD_SET(ctx, v, *idp);
+        grn_expr_exec(ctx, expr, 0);
+        r = grn_ctx_pop(ctx);
+        if (r && (score = GRN_UINT32_VALUE(r))) {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_ADJUST :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, 0, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        GRN_RECORD_SET(ctx, v, *idp);
+        grn_expr_exec(ctx, expr, 0);
+        r = grn_ctx_pop(ctx);
+        if (r && (score = GRN_UINT32_VALUE(r))) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  default :
+    break;
+  }
+}
+
+grn_obj *
+grn_view_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
+                grn_obj *res, grn_operator op)
+{
+  if (res) {
+    if (res->header.type != GRN_TABLE_VIEW ||
+        (res->header.domain != DB_OBJ(table)->id)) {
+      ERR(GRN_INVALID_ARGUMENT, "view table required");
+      return NULL;
+    }
+  } else {
+    if (!(res = grn_table_create(ctx, NULL, 0, NULL,
+                                 GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL))) {
+      return NULL;
+    }
+  }
+  {
+    grn_obj *t, *r;
+    grn_id *tp, rid;
+    grn_view *tv = (grn_view *)table;
+    grn_view *rv = (grn_view *)res;
     grn_hash *th = tv->hash;
     grn_hash *rh = rv->hash;
     grn_expr *e = (grn_expr *)expr;
@@ -8418,6 +9441,12 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
                 done++;
               }
               break;
+            case GRN_OP_LESS :
+            case GRN_OP_GREATER :
+            case GRN_OP_LESS_EQUAL :
+            case GRN_OP_GREATER_EQUAL :
+              done = select_range(ctx, table, si, res);
+              break;
             default :
               /* todo : implement */
               /* todo : handle SCAN_PRE_CONST */
@@ -8444,6 +9473,51 @@ exit :
   GRN_API_RETURN(res);
 }
 
+/* evaluates expr, which must be a chain of MATCH conditions on a single
+   index joined by either AND or OR, keeping only the k records with the
+   highest scores. returns NULL if expr can not be handled that way. */
+static grn_obj *
+select_top_k(grn_ctx *ctx, grn_obj *table, grn_obj *expr, int k, uint32_t *nhits)
+{
+  int i, n;
+  scan_info **sis;
+  grn_operator op = GRN_OP_OR;
+  grn_obj *res = NULL, *index = NULL, **queries;
+  if (table->header.type == GRN_TABLE_VIEW) { return NULL; }
+  if (!(sis = scan_info_build(ctx, expr, &n, GRN_OP_OR, 0))) { return NULL; }
+  if ((queries = GRN_MALLOCN(grn_obj *, n))) {
+    for (i = 0; i < n; i++) {
+      scan_info *si = sis[i];
+      if ((si->flags & (SCAN_ACCESSOR|SCAN_PUSH|SCAN_POP)) ||
+          si->op != GRN_OP_MATCH || !si->index ||
+          si->index->header.type != GRN_COLUMN_INDEX ||
+          (index && si->index != index) ||
+          !si->query || si->query->header.type != GRN_BULK) {
+        break;
+      }
+      if (i == 1) { op = si->logical_op; }
+      if (i && si->logical_op != op) { break; }
+      index = si->index;
+      queries[i] = si->query;
+    }
+    if (i == n && (op == GRN_OP_AND || op == GRN_OP_OR) &&
+        (res = grn_table_create(ctx, NULL, 0, NULL,
+                                GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL))) {
+      if (grn_ii_select_top_k(ctx, (grn_ii *)index, queries, n, op, k,
+                              (grn_hash *)res, nhits) ||
+          *nhits <= GROONGA_DEFAULT_QUERY_ESCALATION_THRESHOLD) {
+        grn_obj_close(ctx, res);
+        res = NULL;
+        ERRCLR(ctx);
+      }
+    }
+    GRN_FREE(queries);
+  }
+  for (i = 0; i < n; i++) { GRN_FREE(sis[i]); }
+  GRN_FREE(sis);
+  return res;
+}
+
 // todo : support view
 grn_rc
 grn_obj_columns(grn_ctx *ctx, grn_obj *table,
@@ -9084,8 +10158,58 @@ grn_table_sort_key_close(grn_ctx *ctx, grn_table_sort_key *keys, unsigned nkeys)
   return ctx->rc;
 }
 
+static int
+calc_type_equal(const char *str, unsigned str_len, const char *name)
+{
+  unsigned i;
+  for (i = 0; i < str_len; i++) {
+    char c = str[i];
+    if ('a' <= c && c <= 'z') { c -= 'a' - 'A'; }
+    if (!name[i] || c != name[i]) { return 0; }
+  }
+  return !name[i];
+}
+
+static grn_table_group_flags
+parse_calc_types(const char *str, unsigned str_len)
+{
+  grn_table_group_flags flags = 0;
+  const char *p = str, *pe = str + str_len, *t;
+  while (p < pe) {
+    while (p < pe && (*p == ',' || *p == ' ')) { p++; }
+    for (t = p; p < pe && *p != ',' && *p != ' '; p++) ;
+    if (calc_type_equal(t, p - t, "COUNT")) {
+      flags |= GRN_TABLE_GROUP_CALC_COUNT;
+    } else if (calc_type_equal(t, p - t, "MAX")) {
+      flags |= GRN_TABLE_GROUP_CALC_MAX;
+    } else if (calc_type_equal(t, p - t, "MIN")) {
+      flags |= GRN_TABLE_GROUP_CALC_MIN;
+    } else if (calc_type_equal(t, p - t, "SUM")) {
+      flags |= GRN_TABLE_GROUP_CALC_SUM;
+    } else if (calc_type_equal(t, p - t, "AVG")) {
+      flags |= GRN_TABLE_GROUP_CALC_AVG;
+    }
+  }
+  return flags;
+}
+
+static void
+search_output(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
+              grn_obj *table, grn_obj_format *format)
+{
+  switch (output_type) {
+  case GRN_CONTENT_MSGPACK :
+    grn_text_otomsgpack(ctx, outbuf, table, format);
+    break;
+  default :
+    GRN_TEXT_PUTC(ctx, outbuf, ',');
+    grn_text_otoj(ctx, outbuf, table, format);
+    break;
+  }
+}
+
 grn_rc
-grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
+grn_select(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
            const char *table, unsigned table_len,
            const char *match_column, unsigned match_column_len,
            const char *query, unsigned query_len,
@@ -9097,11 +10221,14 @@ grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
            const char *drilldown, unsigned drilldown_len,
            const char *drilldown_sortby, unsigned drilldown_sortby_len,
            const char *drilldown_output_columns, unsigned drilldown_output_columns_len,
-           int drilldown_offset, int drilldown_limit)
+           int drilldown_offset, int drilldown_limit,
+           const char *drilldown_calc_types, unsigned drilldown_calc_types_len,
+           const char *drilldown_calc_target, unsigned drilldown_calc_target_len,
+           int top_k)
 {
-  uint32_t nkeys, nhits;
+  uint32_t nkeys, nhits, top_k_nhits = 0, ngkeys = 0, ndrilldowns = 0;
   grn_obj_format format;
-  grn_table_sort_key *keys;
+  grn_table_sort_key *keys, *gkeys = NULL;
   grn_obj *table_, *match_column_, *cond, *foreach_, *res = NULL, *sorted;
   if ((table_ = grn_ctx_get(ctx, table, table_len))) {
     match_column_ = grn_obj_column(ctx, table_, match_column, match_column_len);
@@ -9129,7 +10256,14 @@ grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
         GRN_LOG(ctx, GRN_LOG_NOTICE, "query=(%s)", GRN_TEXT_VALUE(&strbuf));
         GRN_OBJ_FIN(ctx, &strbuf);
         */
-        if (!ctx->rc) { res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR); }
+        if (!ctx->rc && top_k && limit > 0 && query_len && !filter_len &&
+            !foreach_len && !drilldown_len &&
+            sortby_len == 7 && !memcmp(sortby, "-_score", 7)) {
+          res = select_top_k(ctx, table_, cond, offset + limit, &top_k_nhits);
+        }
+        if (!ctx->rc && !res) {
+          res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR);
+        }
         grn_obj_unlink(ctx, cond);
       } else {
         /* todo */
@@ -9138,59 +10272,107 @@ grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
     } else {
       res = table_;
     }
-    GRN_TEXT_PUTS(ctx, outbuf, "[[");
-    grn_text_itoa(ctx, outbuf, ctx->rc);
-    GRN_TEXT_PUTC(ctx, outbuf, ']');
-    if (res) {
-      if (foreach && foreach_len) {
-        grn_obj *v;
-        GRN_EXPR_CREATE_FOR_QUERY(ctx, res, foreach_, v);
-        if (foreach_ && v) {
-          grn_table_cursor *tc;
-          grn_expr_parse(ctx, foreach_, foreach, foreach_len,
-                         match_column_, GRN_OP_MATCH, GRN_OP_AND, 4);
-          if ((tc = grn_table_cursor_open(ctx, res, NULL, 0, NULL, 0, 0, 0, 0))) {
-            while (!grn_table_cursor_next_o(ctx, tc, v)) {
-              grn_expr_exec(ctx, foreach_, 0);
-              grn_ctx_pop(ctx);
-            }
-            grn_table_cursor_close(ctx, tc);
+    if (res && foreach && foreach_len) {
+      grn_obj *v;
+      GRN_EXPR_CREATE_FOR_QUERY(ctx, res, foreach_, v);
+      if (foreach_ && v) {
+        grn_table_cursor *tc;
+        grn_expr_parse(ctx, foreach_, foreach, foreach_len,
+                       match_column_, GRN_OP_MATCH, GRN_OP_AND, 4);
+        if ((tc = grn_table_cursor_open(ctx, res, NULL, 0, NULL, 0, 0, 0, 0))) {
+          while (!grn_table_cursor_next_o(ctx, tc, v)) {
+            grn_expr_exec(ctx, foreach_, 0);
+            grn_ctx_pop(ctx);
           }
-          grn_obj_unlink(ctx, foreach_);
+          grn_table_cursor_close(ctx, tc);
         }
+        grn_obj_unlink(ctx, foreach_);
       }
-      nhits = grn_table_size(ctx, res);
+    }
+    if (res && drilldown_len) {
+      gkeys = grn_table_sort_key_from_str(ctx, drilldown, drilldown_len, res, &ngkeys);
+      if (!gkeys) { ngkeys = 0; }
+    }
+    switch (output_type) {
+    case GRN_CONTENT_MSGPACK :
+      /* MessagePack needs the number of elements in advance. */
+      grn_text_msgpack_array(ctx, outbuf, res ? 2 + ngkeys : 1);
+      grn_text_msgpack_array(ctx, outbuf, 1);
+      grn_text_msgpack_int(ctx, outbuf, ctx->rc);
+      break;
+    default :
+      GRN_TEXT_PUTS(ctx, outbuf, "[[");
+      grn_text_itoa(ctx, outbuf, ctx->rc);
+      GRN_TEXT_PUTC(ctx, outbuf, ']');
+      break;
+    }
+    if (res) {
+      nhits = top_k_nhits ? top_k_nhits : grn_table_size(ctx, res);
       if (sortby_len) {
+        keys = NULL;
         if ((sorted = grn_table_create(ctx, NULL, 0, NULL,
                                        GRN_OBJ_TABLE_NO_KEY, NULL, res))) {
           if ((keys = grn_table_sort_key_from_str(ctx, sortby, sortby_len, res, &nkeys))) {
             grn_table_sort(ctx, res, offset, limit, sorted, keys, nkeys);
             GRN_OBJ_FORMAT_INIT(&format, nhits, 0, limit, GRN_OBJ_FORMAT_WTIH_COLUMN_NAMES);
             grn_obj_columns(ctx, sorted, output_columns, output_columns_len, &format.columns);
-            GRN_TEXT_PUTC(ctx, outbuf, ',');
-            grn_text_otoj(ctx, outbuf, sorted, &format);
+            search_output(ctx, outbuf, output_type, sorted, &format);
             GRN_OBJ_FORMAT_FIN(ctx, &format);
             grn_table_sort_key_close(ctx, keys, nkeys);
           }
           grn_obj_unlink(ctx, sorted);
         }
+        if (!keys && output_type == GRN_CONTENT_MSGPACK) {
+          grn_text_msgpack_nil(ctx, outbuf);
+        }
       } else {
         GRN_OBJ_FORMAT_INIT(&format, nhits, offset, limit, GRN_OBJ_FORMAT_WTIH_COLUMN_NAMES);
         grn_obj_columns(ctx, res, output_columns, output_columns_len, &format.columns);
-        GRN_TEXT_PUTC(ctx, outbuf, ',');
-        grn_text_otoj(ctx, outbuf, res, &format);
+        search_output(ctx, outbuf, output_type, res, &format);
         GRN_OBJ_FORMAT_FIN(ctx, &format);
       }
       if (drilldown_len) {
-        uint32_t i, ngkeys;
-        grn_table_sort_key *gkeys;
+        uint32_t i, ngs;
+        grn_table_group_result *gs;
+        grn_obj_flags gflags = GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC;
+        int with_calc_values = 0;
+        grn_obj *calc_target = NULL;
         grn_table_group_result g = {NULL, 0, 0, 1, GRN_TABLE_GROUP_CALC_COUNT, 0};
-        gkeys = grn_table_sort_key_from_str(ctx, drilldown, drilldown_len, res, &ngkeys);
-        for (i = 0; i < ngkeys; i++) {
-          if ((g.table = grn_table_create_for_group(ctx, NULL, 0, NULL,
-                                                    GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
-                                                    gkeys[i].key, NULL))) {
-            grn_table_group(ctx, res, &gkeys[i], 1, &g, 1);
+        if (drilldown_calc_types_len) {
+          g.flags = parse_calc_types(drilldown_calc_types, drilldown_calc_types_len);
+          if ((g.flags & GRN_TABLE_GROUP_CALC_VALUES) && drilldown_calc_target_len) {
+            calc_target = grn_obj_column(ctx, res,
+                                         drilldown_calc_target, drilldown_calc_target_len);
+          }
+          if (g.flags & GRN_TABLE_GROUP_CALC_VALUES) {
+            if (calc_target && calc_target_p(ctx, calc_target)) {
+              with_calc_values = 1;
+            } else {
+              g.flags &= ~GRN_TABLE_GROUP_CALC_VALUES;
+            }
+          }
+        }
+        if (gkeys && (gs = GRN_MALLOCN(grn_table_group_result, ngkeys))) {
+          for (i = 0, ngs = 0; i < ngkeys; i++) {
+            gs[ngs] = g;
+            gs[ngs].key_begin = i;
+            gs[ngs].key_end = i + 1;
+            if ((gs[ngs].table = grn_table_create_for_group(ctx, NULL, 0, NULL, gflags,
+                                                            gkeys[i].key, NULL,
+                                                            with_calc_values))) {
+              ngs++;
+            }
+          }
+          if (res->header.type == GRN_TABLE_VIEW) {
+            for (i = 0; i < ngs; i++) {
+              grn_table_group_with_calc_target(ctx, res, &gkeys[gs[i].key_begin], 1,
+                                               &gs[i], 1, calc_target);
+            }
+          } else if (ngs) {
+            grn_table_group_with_calc_target(ctx, res, gkeys, ngkeys, gs, ngs, calc_target);
+          }
+          for (i = 0; i < ngs; i++) {
+            g.table = gs[i].table;
             nhits = grn_table_size(ctx, g.table);
             if (drilldown_sortby_len) {
               if ((keys = grn_table_sort_key_from_str(ctx,
@@ -9205,10 +10387,10 @@ grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
                   grn_obj_columns(ctx, sorted,
                                   drilldown_output_columns, drilldown_output_columns_len,
                                   &format.columns);
-                  GRN_TEXT_PUTC(ctx, outbuf, ',');
-                  grn_text_otoj(ctx, outbuf, sorted, &format);
+                  search_output(ctx, outbuf, output_type, sorted, &format);
                   GRN_OBJ_FORMAT_FIN(ctx, &format);
                   grn_obj_unlink(ctx, sorted);
+                  ndrilldowns++;
                 }
                 grn_table_sort_key_close(ctx, keys, nkeys);
               }
@@ -9217,23 +10399,55 @@ grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
                                   GRN_OBJ_FORMAT_WTIH_COLUMN_NAMES);
               grn_obj_columns(ctx, g.table, drilldown_output_columns,
                               drilldown_output_columns_len, &format.columns);
-              GRN_TEXT_PUTC(ctx, outbuf, ',');
-              grn_text_otoj(ctx, outbuf, g.table, &format);
+              search_output(ctx, outbuf, output_type, g.table, &format);
               GRN_OBJ_FORMAT_FIN(ctx, &format);
+              ndrilldowns++;
             }
             grn_obj_unlink(ctx, g.table);
           }
+          GRN_FREE(gs);
         }
         grn_table_sort_key_close(ctx, gkeys, ngkeys);
+        if (calc_target) { grn_obj_unlink(ctx, calc_target); }
+        if (output_type == GRN_CONTENT_MSGPACK) {
+          while (ndrilldowns++ < ngkeys) { grn_text_msgpack_nil(ctx, outbuf); }
+        }
       }
       if (res != table_) { grn_obj_unlink(ctx, res); }
     }
-    GRN_TEXT_PUTC(ctx, outbuf, ']');
+    if (output_type != GRN_CONTENT_MSGPACK) {
+      GRN_TEXT_PUTC(ctx, outbuf, ']');
+    }
     grn_obj_unlink(ctx, table_);
   }
   return ctx->rc;
 }
 
+grn_rc
+grn_search(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
+           const char *table, unsigned table_len,
+           const char *match_column, unsigned match_column_len,
+           const char *query, unsigned query_len,
+           const char *filter, unsigned filter_len,
+           const char *foreach, unsigned foreach_len,
+           const char *sortby, unsigned sortby_len,
+           const char *output_columns, unsigned output_columns_len,
+           int offset, int limit,
+           const char *drilldown, unsigned drilldown_len,
+           const char *drilldown_sortby, unsigned drilldown_sortby_len,
+           const char *drilldown_output_columns, unsigned drilldown_output_columns_len,
+           int drilldown_offset, int drilldown_limit)
+{
+  return grn_select(ctx, outbuf, output_type, table, table_len,
+                    match_column, match_column_len, query, query_len,
+                    filter, filter_len, foreach, foreach_len,
+                    sortby, sortby_len, output_columns, output_columns_len,
+                    offset, limit, drilldown, drilldown_len,
+                    drilldown_sortby, drilldown_sortby_len,
+                    drilldown_output_columns, drilldown_output_columns_len,
+                    drilldown_offset, drilldown_limit, NULL, 0, NULL, 0, 0);
+}
+
 /* grn_load */
 
 static grn_obj *
@@ -9299,6 +10513,58 @@ loader_add(grn_ctx *ctx, const void *key, unsigned key_size)
   return id;
 }
 
+static grn_id
+loader_add_key(grn_ctx *ctx, grn_obj *key)
+{
+  grn_id id;
+  grn_obj buf, *table = ctx->impl->loader.table;
+  if (key->header.domain == GRN_DB_TEXT || key->header.domain == table->header.domain) {
+    return loader_add(ctx, GRN_BULK_HEAD(key), GRN_BULK_VSIZE(key));
+  }
+  /* typed keys (e.g. numbers in MessagePack) are converted to the key type. */
+  GRN_OBJ_INIT(&buf, GRN_BULK, 0, table->header.domain);
+  id = grn_obj_cast(ctx, key, &buf, 1)
+    ? GRN_ID_NIL : loader_add(ctx, GRN_BULK_HEAD(&buf), GRN_BULK_VSIZE(&buf));
+  GRN_OBJ_FIN(ctx, &buf);
+  return id;
+}
+
+static void
+loader_vector_add(grn_ctx *ctx, grn_obj *vector, grn_obj *element)
+{
+  if (element->header.domain == GRN_DB_TEXT) {
+    grn_vector_add_element(ctx, vector, GRN_TEXT_VALUE(element),
+                           GRN_TEXT_LEN(element), 0, GRN_ID_NIL);
+  } else if (!(element->header.domain & OPEN_BRACKET)) {
+    grn_obj buf;
+    GRN_TEXT_INIT(&buf, 0);
+    if (!grn_obj_cast(ctx, element, &buf, 0)) {
+      grn_vector_add_element(ctx, vector, GRN_TEXT_VALUE(&buf),
+                             GRN_TEXT_LEN(&buf), 0, GRN_ID_NIL);
+    }
+    GRN_OBJ_FIN(ctx, &buf);
+  } else {
+    // error
+  }
+}
+
+static void
+loader_set_value(grn_ctx *ctx, grn_obj *column, grn_id id, grn_obj *value)
+{
+  /* variable size columns store the given bytes as is, so that typed values
+     have to be converted to text in advance. */
+  if (value->header.domain != GRN_DB_TEXT &&
+      column->header.type == GRN_COLUMN_VAR_SIZE) {
+    grn_obj buf;
+    GRN_TEXT_INIT(&buf, 0);
+    if (grn_obj_cast(ctx, value, &buf, 0)) { GRN_BULK_REWIND(&buf); }
+    grn_obj_set_value(ctx, column, id, &buf, GRN_OBJ_SET);
+    GRN_OBJ_FIN(ctx, &buf);
+  } else {
+    grn_obj_set_value(ctx, column, id, value, GRN_OBJ_SET);
+  }
+}
+
 static void
 bracket_close(grn_ctx *ctx, grn_loader *loader)
 {
@@ -9319,7 +10585,7 @@ bracket_close(grn_ctx *ctx, grn_loader *loader)
       case GRN_TABLE_HASH_KEY :
       case GRN_TABLE_PAT_KEY :
         if (ndata == ncols + 1) {
-          id = loader_add(ctx, GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+          id = loader_add_key(ctx, value);
           ndata--;
           value++;
         } else if (!ncols) {
@@ -9353,13 +10619,7 @@ bracket_close(grn_ctx *ctx, grn_loader *loader)
             grn_obj buf, *v = value + 1;
             GRN_TEXT_INIT(&buf, GRN_OBJ_VECTOR);
             while (n--) {
-              if (v->header.domain == GRN_DB_TEXT) {
-                grn_vector_add_element(ctx, &buf,
-                                       GRN_TEXT_VALUE(v),
-                                       GRN_TEXT_LEN(v), 0, GRN_ID_NIL);
-              } else {
-                // error
-              }
+              loader_vector_add(ctx, &buf, v);
               v = values_next(ctx, v);
             }
             grn_obj_set_value(ctx, *cols, id, &buf, GRN_OBJ_SET);
@@ -9367,7 +10627,7 @@ bracket_close(grn_ctx *ctx, grn_loader *loader)
           } else if (value->header.domain == OPEN_BRACE) {
             /* todo */
           } else {
-            grn_obj_set_value(ctx, *cols, id, value, GRN_OBJ_SET);
+            loader_set_value(ctx, *cols, id, value);
           }
           value = values_next(ctx, value);
           cols++;
@@ -9406,8 +10666,8 @@ brace_close(grn_ctx *ctx, grn_loader *loader)
                 GRN_TEXT_LEN(v) == strlen(PKEY_NAME) &&
                 (*p == ':' || *p == '_') && !memcmp(p + 1, "key", 3)) {
               v++;
-              if (v->header.domain == GRN_DB_TEXT) {
-                id = loader_add(ctx, GRN_TEXT_VALUE(v), GRN_TEXT_LEN(v));
+              if (!(v->header.domain & OPEN_BRACKET)) {
+                id = loader_add_key(ctx, v);
               }
               break;
             } else {
@@ -9451,13 +10711,7 @@ brace_close(grn_ctx *ctx, grn_loader *loader)
               grn_obj buf, *v = value + 1;
               GRN_TEXT_INIT(&buf, GRN_OBJ_VECTOR);
               while (n--) {
-                if (v->header.domain == GRN_DB_TEXT) {
-                  grn_vector_add_element(ctx, &buf,
-                                         GRN_TEXT_VALUE(v),
-                                         GRN_TEXT_LEN(v), 0, GRN_ID_NIL);
-                } else {
-                  // error
-                }
+                loader_vector_add(ctx, &buf, v);
                 v = values_next(ctx, v);
               }
               grn_obj_set_value(ctx, col, id, &buf, GRN_OBJ_SET);
@@ -9465,7 +10719,7 @@ brace_close(grn_ctx *ctx, grn_loader *loader)
             } else if (value->header.domain == OPEN_BRACE) {
               /* todo */
             } else {
-              grn_obj_set_value(ctx, col, id, value, GRN_OBJ_SET);
+              loader_set_value(ctx, col, id, value);
             }
             grn_obj_unlink(ctx, col);
           }
@@ -9765,6 +11019,534 @@ json_read(grn_ctx *ctx, grn_loader *loader, const char *str, unsigned str_len)
   }
 }
 
+#define MSGPACK_NEED(n) if (pe - p < (n)) { goto exit; }
+/* for the len bytes after a header of h bytes, which MSGPACK_NEED(h) has
+   already checked. len may be as large as the whole of uint32_t. */
+#define MSGPACK_NEED_DATA(h,len) if ((size_t)(pe - p) - (h) < (len)) { goto exit; }
+
+static void
+msgpack_value(grn_ctx *ctx, grn_loader *loader, grn_id domain, const void *value, unsigned int size)
+{
+  grn_obj *v = values_add(ctx, loader);
+  v->header.domain = domain;
+  grn_bulk_write(ctx, v, value, size);
+}
+
+static int
+msgpack_open(grn_ctx *ctx, grn_loader *loader, uint32_t type, uint32_t n)
+{
+  GRN_UINT32_PUT(ctx, &loader->level, loader->values_size);
+  values_add(ctx, loader);
+  loader->last->header.domain = type;
+  if (n) {
+    GRN_UINT32_PUT(ctx, &loader->counts, n);
+    return 0;
+  }
+  if (type == OPEN_BRACE) {
+    brace_close(ctx, loader);
+  } else {
+    bracket_close(ctx, loader);
+  }
+  return 1;
+}
+
+static void
+msgpack_read(grn_ctx *ctx, grn_loader *loader, const char *str, unsigned str_len)
+{
+  const uint8_t *p, *pe;
+  if (GRN_BULK_VSIZE(&loader->rest)) {
+    GRN_TEXT_PUT(ctx, &loader->rest, str, str_len);
+    p = (uint8_t *)GRN_BULK_HEAD(&loader->rest);
+    pe = (uint8_t *)GRN_BULK_CURR(&loader->rest);
+  } else {
+    p = (uint8_t *)str;
+    pe = p + str_len;
+  }
+  while (p < pe) {
+    uint8_t c = *p;
+    uint32_t begin;
+    int done = 1;
+    if (c < 0x80) {
+      int64_t i = c;
+      msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+      p++;
+    } else if (c < 0x90) {
+      done = msgpack_open(ctx, loader, OPEN_BRACE, (c & 0x0f) * 2);
+      p++;
+    } else if (c < 0xa0) {
+      done = msgpack_open(ctx, loader, OPEN_BRACKET, c & 0x0f);
+      p++;
+    } else if (c < 0xc0) {
+      MSGPACK_NEED_DATA(1, c & 0x1f);
+      msgpack_value(ctx, loader, GRN_DB_TEXT, p + 1, c & 0x1f);
+      p += 1 + (c & 0x1f);
+    } else if (c >= 0xe0) {
+      int64_t i = (int8_t)c;
+      msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+      p++;
+    } else {
+      switch (c) {
+      case 0xc0 : /* nil */
+        msgpack_value(ctx, loader, GRN_DB_VOID, NULL, 0);
+        p++;
+        break;
+      case 0xc2 : /* false */
+      case 0xc3 : /* true */
+        {
+          unsigned char b = c == 0xc3;
+          msgpack_value(ctx, loader, GRN_DB_BOOL, &b, sizeof(b));
+          p++;
+        }
+        break;
+      case 0xc4 : /* bin 8 */
+      case 0xd9 : /* str 8 */
+        MSGPACK_NEED(2);
+        MSGPACK_NEED_DATA(2, p[1]);
+        msgpack_value(ctx, loader, GRN_DB_TEXT, p + 2, p[1]);
+        p += 2 + p[1];
+        break;
+      case 0xc5 : /* bin 16 */
+      case 0xda : /* raw 16 */
+        {
+          uint16_t len;
+          MSGPACK_NEED(3);
+          grn_ntoh(&len, p + 1, sizeof(len));
+          MSGPACK_NEED_DATA(3, len);
+          msgpack_value(ctx, loader, GRN_DB_TEXT, p + 3, len);
+          p += 3 + len;
+        }
+        break;
+      case 0xc6 : /* bin 32 */
+      case 0xdb : /* raw 32 */
+        {
+          uint32_t len;
+          MSGPACK_NEED(5);
+          grn_ntoh(&len, p + 1, sizeof(len));
+          MSGPACK_NEED_DATA(5, len);
+          msgpack_value(ctx, loader, GRN_DB_TEXT, p + 5, len);
+          p += 5 + len;
+        }
+        break;
+      case 0xca : /* float */
+        {
+          float f;
+          double d;
+          MSGPACK_NEED(5);
+          grn_ntoh(&f, p + 1, sizeof(f));
+          d = f;
+          msgpack_value(ctx, loader, GRN_DB_FLOAT, &d, sizeof(d));
+          p += 5;
+        }
+        break;
+      case 0xcb : /* double */
+        {
+          double d;
+          MSGPACK_NEED(9);
+          grn_ntoh(&d, p + 1, sizeof(d));
+          msgpack_value(ctx, loader, GRN_DB_FLOAT, &d, sizeof(d));
+          p += 9;
+        }
+        break;
+      case 0xcc : /* uint 8 */
+      case 0xd0 : /* int 8 */
+        {
+          int64_t i;
+          MSGPACK_NEED(2);
+          i = (c == 0xcc) ? (int64_t)p[1] : (int64_t)(int8_t)p[1];
+          msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+          p += 2;
+        }
+        break;
+      case 0xcd : /* uint 16 */
+      case 0xd1 : /* int 16 */
+        {
+          uint16_t v;
+          int64_t i;
+          MSGPACK_NEED(3);
+          grn_ntoh(&v, p + 1, sizeof(v));
+          i = (c == 0xcd) ? (int64_t)v : (int64_t)(int16_t)v;
+          msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+          p += 3;
+        }
+        break;
+      case 0xce : /* uint 32 */
+      case 0xd2 : /* int 32 */
+        {
+          uint32_t v;
+          int64_t i;
+          MSGPACK_NEED(5);
+          grn_ntoh(&v, p + 1, sizeof(v));
+          i = (c == 0xce) ? (int64_t)v : (int64_t)(int32_t)v;
+          msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+          p += 5;
+        }
+        break;
+      case 0xcf : /* uint 64 */
+        {
+          uint64_t v;
+          MSGPACK_NEED(9);
+          grn_ntoh(&v, p + 1, sizeof(v));
+          msgpack_value(ctx, loader, v > INT64_MAX ? GRN_DB_UINT64 : GRN_DB_INT64,
+                        &v, sizeof(v));
+          p += 9;
+        }
+        break;
+      case 0xd3 : /* int 64 */
+        {
+          int64_t i;
+          MSGPACK_NEED(9);
+          grn_ntoh(&i, p + 1, sizeof(i));
+          msgpack_value(ctx, loader, GRN_DB_INT64, &i, sizeof(i));
+          p += 9;
+        }
+        break;
+      case 0xdc : /* array 16 */
+      case 0xde : /* map 16 */
+        {
+          uint16_t n;
+          MSGPACK_NEED(3);
+          grn_ntoh(&n, p + 1, sizeof(n));
+          p += 3;
+          done = (c == 0xdc)
+            ? msgpack_open(ctx, loader, OPEN_BRACKET, n)
+            : msgpack_open(ctx, loader, OPEN_BRACE, (uint32_t)n * 2);
+        }
+        break;
+      case 0xdd : /* array 32 */
+      case 0xdf : /* map 32 */
+        {
+          uint32_t n;
+          MSGPACK_NEED(5);
+          grn_ntoh(&n, p + 1, sizeof(n));
+          p += 5;
+          done = (c == 0xdd)
+            ? msgpack_open(ctx, loader, OPEN_BRACKET, n)
+            : msgpack_open(ctx, loader, OPEN_BRACE, n * 2);
+        }
+        break;
+      default :
+        ERR(GRN_INVALID_ARGUMENT, "unsupported MessagePack type (%02x)", c);
+        GRN_BULK_REWIND(&loader->rest);
+        GRN_BULK_REWIND(&loader->counts);
+        loader->stat = GRN_LOADER_BEGIN;
+        return;
+      }
+    }
+    /* an element is completed. close the containers which it fills up. */
+    while (done && GRN_BULK_VSIZE(&loader->counts)) {
+      uint32_t *n = (uint32_t *)GRN_BULK_CURR(&loader->counts) - 1;
+      if (--(*n)) { break; }
+      GRN_BULK_INCR_LEN(&loader->counts, -(sizeof(uint32_t)));
+      begin = ((uint32_t *)GRN_BULK_CURR(&loader->level))[-1];
+      if (((grn_obj *)GRN_TEXT_VALUE(&loader->values))[begin].header.domain == OPEN_BRACE) {
+        brace_close(ctx, loader);
+      } else {
+        bracket_close(ctx, loader);
+      }
+    }
+  }
+exit :
+  if (GRN_BULK_VSIZE(&loader->rest)) {
+    memmove(GRN_BULK_HEAD(&loader->rest), p, pe - p);
+    grn_bulk_truncate(ctx, &loader->rest, pe - p);
+  } else if (p < pe) {
+    /* keep the incomplete element until the rest of it arrives. */
+    GRN_TEXT_PUT(ctx, &loader->rest, p, pe - p);
+  }
+  loader->stat = (GRN_BULK_VSIZE(&loader->level) || GRN_BULK_VSIZE(&loader->rest))
+    ? GRN_LOADER_TOKEN : GRN_LOADER_BEGIN;
+}
+
+/* TSV input. Each line is a record and fields are separated by tabs.
+   Unless columns are given, the first line names the columns. A field
+   which begins with '"' is read up to the closing quote with the escapes
+   grn_text_esc() writes, so that it may hold tabs and line breaks. The
+   other fields are taken as is except for backslash escapes. */
+
+#define TSV_ONES  0x0101010101010101ULL
+#define TSV_HIGHS 0x8080808080808080ULL
+#define TSV_HAS(w,c) \
+  ((((w) ^ (TSV_ONES * (c))) - TSV_ONES) & ~((w) ^ (TSV_ONES * (c))) & TSV_HIGHS)
+
+/* returns the first byte which ends a run of plain characters in a field.
+   Eight bytes are tested at a time. */
+static const char *
+tsv_scan(grn_ctx *ctx, const char *p, const char *pe, int quoted)
+{
+  if (ctx->encoding == GRN_ENC_SJIS) {
+    /* a trailing byte of Shift_JIS may be a backslash. */
+    int len;
+    while (p < pe) {
+      if ((len = grn_charlen(ctx, p, pe)) > 1) {
+        p += len;
+        continue;
+      }
+      if (quoted ? (*p == '"' || *p == '\\')
+          : (*p == '\t' || *p == '\n' || *p == '\r' || *p == '\\')) {
+        break;
+      }
+      p++;
+    }
+    return p;
+  }
+  while (p + sizeof(uint64_t) <= pe) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(uint64_t));
+    if (quoted ? (TSV_HAS(w, '"') | TSV_HAS(w, '\\'))
+        : (TSV_HAS(w, '\t') | TSV_HAS(w, '\n') | TSV_HAS(w, '\r') | TSV_HAS(w, '\\'))) {
+      break;
+    }
+    p += sizeof(uint64_t);
+  }
+  for (; p < pe; p++) {
+    if (quoted ? (*p == '"' || *p == '\\')
+        : (*p == '\t' || *p == '\n' || *p == '\r' || *p == '\\')) {
+      break;
+    }
+  }
+  return p;
+}
+
+static const char *
+tsv_unesc(grn_ctx *ctx, grn_obj *buf, const char *p, const char *pe)
+{
+  int len;
+  switch (*p) {
+  case 'b' :
+    GRN_TEXT_PUTC(ctx, buf, '\b');
+    return p + 1;
+  case 'f' :
+    GRN_TEXT_PUTC(ctx, buf, '\f');
+    return p + 1;
+  case 'n' :
+    GRN_TEXT_PUTC(ctx, buf, '\n');
+    return p + 1;
+  case 'r' :
+    GRN_TEXT_PUTC(ctx, buf, '\r');
+    return p + 1;
+  case 't' :
+    GRN_TEXT_PUTC(ctx, buf, '\t');
+    return p + 1;
+  case 'u' :
+    if (pe - p > 4) {
+      int i;
+      uint32_t u = 0;
+      for (i = 1; i <= 4; i++) {
+        char c = p[i];
+        if ('0' <= c && c <= '9') {
+          u = u * 0x10 + (c - '0');
+        } else if ('a' <= c && c <= 'f') {
+          u = u * 0x10 + (c - 'a' + 10);
+        } else if ('A' <= c && c <= 'F') {
+          u = u * 0x10 + (c - 'A' + 10);
+        } else {
+          break;
+        }
+      }
+      if (i > 4) {
+        if (u < 0x80) {
+          GRN_TEXT_PUTC(ctx, buf, u);
+        } else {
+          if (u < 0x800) {
+            GRN_TEXT_PUTC(ctx, buf, ((u >> 6) & 0x1f) | 0xc0);
+          } else {
+            GRN_TEXT_PUTC(ctx, buf, (u >> 12) | 0xe0);
+            GRN_TEXT_PUTC(ctx, buf, ((u >> 6) & 0x3f) | 0x80);
+          }
+          GRN_TEXT_PUTC(ctx, buf, (u & 0x3f) | 0x80);
+        }
+        return p + 5;
+      }
+    }
+    break;
+  default :
+    break;
+  }
+  if (!(len = grn_charlen(ctx, p, pe))) { len = 1; }
+  GRN_TEXT_PUT(ctx, buf, p, len);
+  return p + len;
+}
+
+static void
+tsv_field_open(grn_ctx *ctx, grn_loader *loader)
+{
+  values_add(ctx, loader);
+  loader->stat = GRN_LOADER_SYMBOL;
+}
+
+static void
+tsv_record_close(grn_ctx *ctx, grn_loader *loader)
+{
+  uint32_t begin = ((uint32_t *)GRN_BULK_CURR(&loader->level))[-1];
+  grn_obj *value = ((grn_obj *)(GRN_TEXT_VALUE(&loader->values))) + begin + 1;
+  uint32_t ndata = loader->values_size - begin - 1;
+  if ((ndata == 1 && !GRN_TEXT_LEN(value)) ||
+      (!GRN_BULK_VSIZE(&loader->columns) && loader->table)) {
+    if (ndata > 1 || GRN_TEXT_LEN(value)) {
+      /* the header line. "_key" may lead it though the key is implied. */
+      if (loader->table->header.type != GRN_TABLE_NO_KEY &&
+          GRN_TEXT_LEN(value) == strlen(PKEY_NAME) &&
+          !memcmp(GRN_TEXT_VALUE(value), PKEY_NAME, strlen(PKEY_NAME))) {
+        value++;
+        ndata--;
+      }
+      while (ndata--) {
+        grn_obj *col = grn_obj_column(ctx, loader->table,
+                                      GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+        if (!col) {
+          ERR(GRN_INVALID_ARGUMENT, "no such column: <%.*s>",
+              (int)GRN_TEXT_LEN(value), GRN_TEXT_VALUE(value));
+          /* the rest of the lines are read but not loaded */
+          loader->table = NULL;
+          break;
+        }
+        GRN_PTR_PUT(ctx, &loader->columns, col);
+        value++;
+      }
+    }
+    GRN_BULK_INCR_LEN(&loader->level, -(sizeof(uint32_t)));
+    loader->values_size = begin;
+  } else {
+    bracket_close(ctx, loader);
+  }
+  loader->stat = GRN_LOADER_TOKEN;
+}
+
+/* all the values of a load are given at once unless the first message is
+   empty. Then each following message holds lines, and an empty message
+   ends the load. */
+static void
+tsv_read(grn_ctx *ctx, grn_loader *loader, const char *str, unsigned str_len, int first)
+{
+  const char *p = str, *pe = str + str_len, *q;
+  if (first) {
+    if (!str_len) {
+      loader->stat = GRN_LOADER_TOKEN;
+      return;
+    }
+    loader->stat = GRN_LOADER_TOKEN;
+  } else {
+    switch (loader->stat) {
+    case GRN_LOADER_STRING :
+    case GRN_LOADER_STRING_ESC :
+      /* a quoted field goes on over the line break */
+      GRN_TEXT_PUTC(ctx, loader->last, '\n');
+      loader->stat = GRN_LOADER_STRING;
+      break;
+    default :
+      if (!str_len) {
+        loader->stat = GRN_LOADER_BEGIN;
+        return;
+      }
+      break;
+    }
+  }
+  while (p < pe) {
+    switch (loader->stat) {
+    case GRN_LOADER_STRING :
+      q = tsv_scan(ctx, p, pe, 1);
+      GRN_TEXT_PUT(ctx, loader->last, p, q - p);
+      if ((p = q) < pe) {
+        loader->stat = (*p == '"') ? GRN_LOADER_SYMBOL : GRN_LOADER_STRING_ESC;
+        p++;
+      }
+      break;
+    case GRN_LOADER_STRING_ESC :
+      p = tsv_unesc(ctx, loader->last, p, pe);
+      loader->stat = GRN_LOADER_STRING;
+      break;
+    case GRN_LOADER_SYMBOL :
+      q = tsv_scan(ctx, p, pe, 0);
+      GRN_TEXT_PUT(ctx, loader->last, p, q - p);
+      if ((p = q) == pe) { break; }
+      switch (*p++) {
+      case '\t' :
+        tsv_field_open(ctx, loader);
+        if (p < pe && *p == '"') {
+          loader->stat = GRN_LOADER_STRING;
+          p++;
+        }
+        break;
+      case '\n' :
+        tsv_record_close(ctx, loader);
+        break;
+      case '\r' :
+        if (p < pe && *p != '\n') { GRN_TEXT_PUTC(ctx, loader->last, '\r'); }
+        break;
+      case '\\' :
+        if (p < pe) {
+          p = tsv_unesc(ctx, loader->last, p, pe);
+        } else {
+          GRN_TEXT_PUTC(ctx, loader->last, '\\');
+        }
+        break;
+      }
+      break;
+    default :
+      /* the beginning of a line */
+      GRN_UINT32_PUT(ctx, &loader->level, loader->values_size);
+      values_add(ctx, loader);
+      loader->last->header.domain = OPEN_BRACKET;
+      tsv_field_open(ctx, loader);
+      if (*p == '"') {
+        loader->stat = GRN_LOADER_STRING;
+        p++;
+      }
+      break;
+    }
+  }
+  if (first || loader->stat == GRN_LOADER_SYMBOL) {
+    if (GRN_BULK_VSIZE(&loader->level)) { tsv_record_close(ctx, loader); }
+    loader->stat = first ? GRN_LOADER_BEGIN : GRN_LOADER_TOKEN;
+  }
+}
+
+/* puts the indexes which obj is a source of in bulk load mode */
+static void
+loader_bulk_begin_hooks(grn_ctx *ctx, grn_loader *loader, grn_obj *obj)
+{
+  grn_hook *hooks;
+  for (hooks = obj ? DB_OBJ(obj)->hooks[GRN_HOOK_SET] : NULL;
+       hooks; hooks = hooks->next) {
+    default_set_value_hook_data *data = (void *)NEXT_ADDR(hooks);
+    grn_obj *target = grn_ctx_at(ctx, data->target);
+    if (!target || target->header.type != GRN_COLUMN_INDEX) { continue; }
+    if (!grn_ii_bulk_begin(ctx, (grn_ii *)target)) {
+      GRN_PTR_PUT(ctx, &loader->indexes, target);
+    }
+  }
+}
+
+/* switches the indexes of the loading table to bulk load mode until the
+   top level value is closed. the indexes of _key are hooked on the table
+   itself. */
+static void
+loader_bulk_begin(grn_ctx *ctx, grn_loader *loader)
+{
+  grn_hash *cols;
+  if (!loader->table || GRN_BULK_VSIZE(&loader->indexes)) { return; }
+  loader_bulk_begin_hooks(ctx, loader, loader->table);
+  if ((cols = grn_hash_create(ctx, NULL, sizeof(grn_id), 0,
+                              GRN_OBJ_TABLE_HASH_KEY|GRN_HASH_TINY))) {
+    if (grn_table_columns(ctx, loader->table, "", 0, (grn_obj *)cols)) {
+      grn_id *key;
+      GRN_HASH_EACH(ctx, cols, id, &key, NULL, NULL, {
+        loader_bulk_begin_hooks(ctx, loader, grn_ctx_at(ctx, *key));
+      });
+    }
+    grn_hash_close(ctx, cols);
+  }
+}
+
+static void
+loader_bulk_end(grn_ctx *ctx, grn_loader *loader)
+{
+  grn_obj **p = (grn_obj **)GRN_BULK_HEAD(&loader->indexes);
+  grn_obj **pe = (grn_obj **)GRN_BULK_CURR(&loader->indexes);
+  while (p < pe) { grn_ii_bulk_end(ctx, (grn_ii *)*p++); }
+  GRN_BULK_REWIND(&loader->indexes);
+}
+
 grn_rc
 grn_load(grn_ctx *ctx, grn_content_type input_type,
          const char *table, unsigned table_len,
@@ -9779,30 +11561,40 @@ grn_load(grn_ctx *ctx, grn_content_type input_type,
   }
   GRN_API_ENTER;
   loader = &ctx->impl->loader;
-  switch (input_type) {
-  case GRN_CONTENT_JSON :
-    if (table && table_len) {
-      grn_ctx_loader_clear(ctx);
-      loader->table = grn_ctx_get(ctx, table, table_len);
-      if (loader->table && columns && columns_len) {
-        grn_obj_columns(ctx, loader->table, columns, columns_len, &loader->columns);
-      }
+  if (table && table_len) {
+    grn_ctx_loader_clear(ctx);
+    loader->table = grn_ctx_get(ctx, table, table_len);
+    if (loader->table && columns && columns_len) {
+      grn_obj_columns(ctx, loader->table, columns, columns_len, &loader->columns);
     }
-    if (ifexists && ifexists_len) {
-      grn_obj *v;
-      GRN_EXPR_CREATE_FOR_QUERY(ctx, loader->table, loader->ifexists, v);
-      if (loader->ifexists && v) {
-        grn_expr_parse(ctx, loader->ifexists, ifexists, ifexists_len,
-                       NULL, GRN_OP_EQUAL, GRN_OP_AND, 4);
-      }
+  }
+  if (ifexists && ifexists_len) {
+    grn_obj *v;
+    GRN_EXPR_CREATE_FOR_QUERY(ctx, loader->table, loader->ifexists, v);
+    if (loader->ifexists && v) {
+      grn_expr_parse(ctx, loader->ifexists, ifexists, ifexists_len,
+                     NULL, GRN_OP_EQUAL, GRN_OP_AND, 4);
     }
+  }
+  if (loader->stat == GRN_LOADER_BEGIN) {
+    loader->input_type = input_type;
+    loader_bulk_begin(ctx, loader);
+  } else {
+    /* the rest of the values comes without input_type */
+    input_type = loader->input_type;
+  }
+  switch (input_type) {
+  case GRN_CONTENT_JSON :
     json_read(ctx, loader, values, values_len);
     break;
+  case GRN_CONTENT_MSGPACK :
+    msgpack_read(ctx, loader, values, values_len);
+    break;
   case GRN_CONTENT_TSV :
-    ERR(GRN_FUNCTION_NOT_IMPLEMENTED, "unsupported input_type");
-    // todo
+    tsv_read(ctx, loader, values, values_len, table && table_len);
     break;
   }
+  if (loader->stat == GRN_LOADER_BEGIN) { loader_bulk_end(ctx, loader); }
   GRN_API_RETURN(ctx->rc);
 }
 
@@ -37,6 +37,13 @@ typedef struct {
   uint32_t pos;
 } grn_rset_posinfo;
 
+typedef struct {
+  double max;
+  double min;
+  double sum;
+  double avg;
+} grn_rset_calc_values;
+
 #define GRN_RSET_UTIL_BIT (0x80000000)
 
 #define GRN_RSET_SCORE_SIZE (sizeof(int))
@@ -48,6 +55,7 @@ typedef struct {
   ((int *)((byte *)subrecs + n * (size + GRN_RSET_SCORE_SIZE)))
 #define GRN_RSET_SUBRECS_COPY(subrecs,size,n,src) \
   (memcpy(GRN_RSET_SUBRECS_NTH(subrecs, size, n), src, size + GRN_RSET_SCORE_SIZE))
+#define GRN_RSET_CALC_VALUES_OFFSET(size) (((size) + 7) & ~7)
 
 typedef struct _grn_db grn_db;
 typedef struct _grn_proc grn_proc;
@@ -55,6 +63,7 @@ typedef struct _grn_proc grn_proc;
 grn_rc grn_db_close(grn_ctx *ctx, grn_obj *db);
 
 grn_obj *grn_db_keys(grn_obj *s);
+uint32_t grn_db_modified(grn_obj *db);
 
 grn_rc _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
                                grn_table_delete_optarg *optarg);
@@ -206,6 +215,8 @@ grn_rc grn_db_init_builtin_types(grn_ctx *ctx);
 #define GRN_OBJ_ALLOCATED              (0x01<<2) /* allocated by ctx */
 #define GRN_OBJ_EXPRVALUE              (0x01<<3) /* value allocated by grn_expr */
 #define GRN_OBJ_EXPRCONST              (0x01<<4) /* constant allocated by grn_expr */
+#define GRN_OBJ_WITH_CALC_VALUES       (0x01<<5) /* table which has calc values */
+#define GRN_OBJ_VOLATILE               (0x01<<6) /* proc which returns a different value each time */
 
 /* flag value used for grn_obj.header.flags */
 
@@ -191,6 +191,7 @@ typedef int grn_sock;
 typedef pthread_t grn_thread;
 typedef pthread_mutex_t grn_mutex;
 #define THREAD_CREATE(thread,func,arg) (pthread_create(&(thread), NULL, (func), (arg)))
+#define THREAD_JOIN(thread) (pthread_join((thread), NULL))
 #define MUTEX_INIT(m) pthread_mutex_init(&m, NULL)
 #define MUTEX_LOCK(m) pthread_mutex_lock(&m)
 #define MUTEX_UNLOCK(m) pthread_mutex_unlock(&m)
@@ -199,6 +200,7 @@ typedef pthread_mutex_t grn_mutex;
 typedef pthread_cond_t grn_cond;
 #define COND_INIT(c) pthread_cond_init(&c, NULL)
 #define COND_SIGNAL(c) pthread_cond_signal(&c)
+#define COND_BROADCAST(c) pthread_cond_broadcast(&c)
 #define COND_WAIT(c,m) pthread_cond_wait(&c, &m)
 
 typedef pthread_key_t grn_thread_key;
@@ -254,6 +256,8 @@ typedef int grn_thread_key;
 typedef uintptr_t grn_thread;
 typedef CRITICAL_SECTION grn_mutex;
 #define THREAD_CREATE(thread,func,arg) (((thread)=_beginthreadex(NULL, 0, (func), (arg), 0, NULL)) == NULL)
+#define THREAD_JOIN(thread) \
+  (WaitForSingleObject((HANDLE)(thread), INFINITE), CloseHandle((HANDLE)(thread)))
 #define MUTEX_INIT(m) InitializeCriticalSection(&m)
 #define MUTEX_LOCK(m) EnterCriticalSection(&m)
 #define MUTEX_UNLOCK(m) LeaveCriticalSection(&m)
@@ -266,6 +270,7 @@ typedef CRITICAL_SECTION grn_mutex;
 typedef int grn_cond;
 #define COND_INIT(c) ((c) = 0)
 #define COND_SIGNAL(c)
+#define COND_BROADCAST(c)
 #define COND_WAIT(c,m) do { MUTEX_UNLOCK(m); usleep(1000); MUTEX_LOCK(m); } while (0)
 /* todo : must be enhanced! */
 
@@ -277,6 +282,9 @@ typedef int grn_cond;
 
 #ifdef __GNUC__
 
+# define GRN_ATOMIC_CAS(p,o,n) __sync_bool_compare_and_swap((p), (o), (n))
+# define GRN_PREFETCH(p) __builtin_prefetch((p))
+
 # if (defined(__i386__) || defined(__x86_64__)) /* ATOMIC ADD */
 #  define GRN_ATOMIC_ADD_EX(p,i,r) \
   __asm__ __volatile__ ("lock; xaddl %0,%1" : "=r"(r), "=m"(*p) : "0"(i), "m" (*p))
@@ -319,6 +327,8 @@ typedef int grn_cond;
 
 # define GRN_ATOMIC_ADD_EX(p,i,r) \
   (r) = (uint32_t)InterlockedExchangeAdd((int32_t *)(p), (int32_t)(i));
+# define GRN_ATOMIC_CAS(p,o,n) \
+  ((uint32_t)InterlockedCompareExchange((LONG volatile *)(p), (LONG)(n), (LONG)(o)) == (uint32_t)(o))
 # if defined(_WIN64) /* ATOMIC 64BIT SET */
 #  define GRN_SET_64BIT(p,v) \
   *(p) = (v);
@@ -352,6 +362,7 @@ typedef int grn_cond;
 #  include <atomic.h>
 #  define GRN_ATOMIC_ADD_EX(p,i,r) \
   r = atomic_add_32_nv(p, i) - i
+#  define GRN_ATOMIC_CAS(p,o,n) (atomic_cas_32((p), (o), (n)) == (o))
 /* todo */
 #  define GRN_BIT_SCAN_REV(v,r)   for (r = 31; r && !((1 << r) & v); r--)
 #  define GRN_BIT_SCAN_REV0 GRN_BIT_SCAN_REV
@@ -364,6 +375,10 @@ typedef int grn_cond;
 # define GRN_BIT_SCAN_REV0 GRN_BIT_SCAN_REV
 #endif /* __GNUC__ */
 
+#ifndef GRN_PREFETCH
+# define GRN_PREFETCH(p)
+#endif /* GRN_PREFETCH */
+
 typedef uint8_t byte;
 
 #define GRN_ID_WIDTH 30
@@ -420,22 +435,19 @@ grn_str_greater(const uint8_t *ap, uint32_t as, const uint8_t *bp, uint32_t bs)
 #define grn_ntoh grn_hton
 
 #ifdef USE_FUTEX
+#include <errno.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
 
 #define GRN_FUTEX_WAIT(p) do {\
   int err;\
   struct timespec timeout = {1, 0};\
-  while (1) {\
-    if (!(err = syscall(SYS_futex, p, FUTEX_WAIT, *p, &timeout))) {\
-      break;\
-    }\
-    if (err == ETIMEDOUT) {\
+  if (syscall(SYS_futex, p, FUTEX_WAIT, *p, &timeout)) {\
+    /* EWOULDBLOCK means *p has changed already. */\
+    if ((err = errno) == ETIMEDOUT) {\
       GRN_LOG(ctx, GRN_LOG_CRIT, "timeout in GRN_FUTEX_WAIT(%p)", p);\
-      break;\
-    } else if (err != EWOULDBLOCK) {\
-      GRN_LOG(ctx, GRN_LOG_CRIT, "error %d in GRN_FUTEX_WAIT(%p)", err);\
-      break;\
+    } else if (err != EWOULDBLOCK && err != EINTR) {\
+      GRN_LOG(ctx, GRN_LOG_CRIT, "error %d in GRN_FUTEX_WAIT(%p)", err, p);\
     }\
   }\
 } while(0)
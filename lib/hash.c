@@ -470,6 +470,12 @@ grn_array_cursor_next(grn_ctx *ctx, grn_array_cursor *c)
   return GRN_ID_NIL;
 }
 
+grn_id
+grn_array_curr_id(grn_ctx *ctx, grn_array *array)
+{
+  return ARRAY_CURR_MAX(array);
+}
+
 grn_id
 grn_array_next(grn_ctx *ctx, grn_array *array, grn_id id)
 {
@@ -751,6 +757,11 @@ match_key(grn_ctx *ctx, grn_hash *hash, entry_str *ee, uint32_t h, const char *k
 
 #define GARBAGE (0xffffffff)
 
+/* hash functions of keys other than uint32_t, recorded in the header.
+   files created before hash_func was introduced have 0. */
+#define HASH_FUNC_BIN 0
+#define HASH_FUNC_MIX 1
+
 #define STEP(x) (((x) >> 2) | 0x1010101)
 
 inline static grn_rc
@@ -789,6 +800,9 @@ io_hash_init(grn_hash *ih, grn_ctx *ctx, const char *path, uint32_t key_size,
   if (encoding == GRN_ENC_DEFAULT) { encoding = ctx->encoding; }
   header = grn_io_header(io);
   grn_io_set_type(io, GRN_TABLE_HASH_KEY);
+  /* builds without HASH_FUNC_MIX would ignore hash_func and look keys up
+     with bin_hash(), so they must refuse the file. */
+  grn_io_set_version(io, 2);
   header->flags = flags;
   header->encoding = encoding;
   header->key_size = key_size;
@@ -802,6 +816,10 @@ io_hash_init(grn_hash *ih, grn_ctx *ctx, const char *path, uint32_t key_size,
   header->n_entries = 0;
   header->n_garbages = 0;
   header->tokenizer = 0;
+  header->resize_stat = 0;
+  header->resize_pos = 0;
+  header->resize_max_offset = 0;
+  header->hash_func = HASH_FUNC_MIX;
   GRN_DB_OBJ_SET_TYPE(ih, GRN_TABLE_HASH_KEY);
   ih->obj.header.flags = flags;
   ih->ctx = ctx;
@@ -809,12 +827,14 @@ io_hash_init(grn_hash *ih, grn_ctx *ctx, const char *path, uint32_t key_size,
   ih->encoding = encoding;
   ih->value_size = value_size;
   ih->entry_size = entry_size;
+  ih->hash_func = HASH_FUNC_MIX;
   ih->n_garbages = &header->n_garbages;
   ih->n_entries = &header->n_entries;
   ih->max_offset = &header->max_offset;
   ih->io = io;
   ih->header = header;
   ih->lock = &header->lock;
+  ih->concurrent = NULL;
   ih->tokenizer = grn_ctx_at(ctx, header->tokenizer);
   return GRN_SUCCESS;
 }
@@ -849,11 +869,13 @@ tiny_hash_init(grn_hash *ah, grn_ctx *ctx, const char *path, uint32_t key_size,
   ah->encoding = encoding;
   ah->value_size = value_size;
   ah->entry_size = entry_size;
+  ah->hash_func = HASH_FUNC_MIX;
   ah->n_garbages = &ah->n_garbages_;
   ah->n_entries = &ah->n_entries_;
   ah->max_offset = &ah->max_offset_;
   ah->max_offset_ = INITIAL_INDEX_SIZE - 1;
   ah->io = NULL;
+  ah->concurrent = NULL;
   ah->n_garbages_ = 0;
   ah->n_entries_ = 0;
   ah->garbages = GRN_ID_NIL;
@@ -890,7 +912,9 @@ grn_hash_open(grn_ctx *ctx, const char *path)
     if (grn_io_get_type(io) == GRN_TABLE_HASH_KEY) {
       grn_hash *hash = GRN_MALLOC(sizeof(grn_hash));
       if (hash) {
-        if (!(header->flags & GRN_HASH_TINY)) {
+        if (header->hash_func > HASH_FUNC_MIX) {
+          ERR(GRN_INCOMPATIBLE_FILE_FORMAT, "unknown hash function. (%u)", header->hash_func);
+        } else if (!(header->flags & GRN_HASH_TINY)) {
           GRN_DB_OBJ_SET_TYPE(hash, GRN_TABLE_HASH_KEY);
           hash->obj.header.flags = header->flags;
           hash->ctx = ctx;
@@ -898,12 +922,14 @@ grn_hash_open(grn_ctx *ctx, const char *path)
           hash->encoding = header->encoding;
           hash->value_size = header->value_size;
           hash->entry_size = header->entry_size;
+          hash->hash_func = header->hash_func;
           hash->n_garbages = &header->n_garbages;
           hash->n_entries = &header->n_entries;
           hash->max_offset = &header->max_offset;
           hash->io = io;
           hash->header = header;
           hash->lock = &header->lock;
+          hash->concurrent = NULL;
           hash->tokenizer = grn_ctx_at(ctx, header->tokenizer);
           return (grn_hash *)hash;
         } else {
@@ -946,12 +972,15 @@ tiny_hash_fin(grn_ctx *ctx, grn_hash *hash)
   }
 }
 
+inline static void concurrent_fin(grn_ctx *ctx, grn_hash *hash);
+
 grn_rc
 grn_hash_close(grn_ctx *ctx, grn_hash *hash)
 {
   grn_rc rc;
   if (!hash) { return GRN_INVALID_ARGUMENT; }
   if (IO_HASHP(hash)) {
+    if (hash->concurrent) { concurrent_fin(ctx, hash); }
     rc = grn_io_close(ctx, hash->io);
   } else {
     GRN_ASSERT(ctx == hash->ctx);
@@ -968,12 +997,113 @@ grn_hash_remove(grn_ctx *ctx, const char *path)
   return grn_io_remove(ctx, path);
 }
 
+/* incremental resize of the index of io_hash.
+   the new index is built in the other half of segment_index, as
+   grn_hash_reset() does, but grn_hash_add() clears it and then moves the
+   entries into it a bounded number of slots at a time. moved slots of the
+   old index are marked as GARBAGE, so lookups probe the old index first
+   and then the new one. */
+
+#define RESIZE_CLEAR 1 /* clearing the new index */
+#define RESIZE_MOVE  2 /* moving entries to the new index */
+
+#define RESIZE_CLEAR_UNIT 0x4000
+#define RESIZE_MOVE_UNIT  0x100
+
+#define RESIZING(h) (IO_HASHP(h) && (h)->header->resize_stat == RESIZE_MOVE)
+
+#define NEW_IDX_AT(h,i) idx_at_(ctx, h, ((i) & (h)->header->resize_max_offset)\
+                                + MAX_INDEX_SIZE - (h)->header->idx_offset)
+
+#define IDX_AT2(h,i,newp) ((newp) ? NEW_IDX_AT(h,i) : IDX_AT(h,i))
+
+/* grn_hash_add() takes a step of the resize for each entry it adds, and
+   the new index has to keep room for those entries as well. after many
+   deletes they outnumber the entries to move, because the whole old index
+   has to be scanned. */
+inline static void
+resize_begin(grn_ctx *ctx, grn_hash *hash)
+{
+  struct grn_hash_header *hh = hash->header;
+  uint32_t n, ne = *hash->n_entries;
+  ne += (*hash->max_offset + 1) / RESIZE_MOVE_UNIT + 1;
+  if (ne > INT_MAX / 2) { return; }
+  for (n = INITIAL_INDEX_SIZE; n <= (ne + n / RESIZE_CLEAR_UNIT) * 2; n *= 2);
+  hh->resize_max_offset = n - 1;
+  hh->resize_pos = 0;
+  hh->resize_stat = RESIZE_CLEAR;
+}
+
+inline static grn_rc
+resize_step(grn_ctx *ctx, grn_hash *hash)
+{
+  struct grn_hash_header *hh = hash->header;
+  uint32_t offd = MAX_INDEX_SIZE - hh->idx_offset, m = hh->resize_max_offset;
+  if (hh->resize_stat == RESIZE_CLEAR) {
+    grn_id *dp;
+    uint32_t n = m + 1 - hh->resize_pos;
+    if (n > RESIZE_CLEAR_UNIT) { n = RESIZE_CLEAR_UNIT; }
+    if (!(dp = idx_at_(ctx, hash, hh->resize_pos + offd))) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    memset(dp, 0, n * sizeof(grn_id));
+    if ((hh->resize_pos += n) > m) {
+      hh->resize_pos = 0;
+      *hash->n_garbages = 0;
+      hh->resize_stat = RESIZE_MOVE;
+    }
+  } else if (hh->resize_stat == RESIZE_MOVE) {
+    entry *ee;
+    grn_id e, *sp, *dp;
+    uint32_t i, j, s, je = hh->resize_pos + RESIZE_MOVE_UNIT, m0 = *hash->max_offset;
+    if (je > m0 + 1) { je = m0 + 1; }
+    for (j = hh->resize_pos; j < je; j++) {
+      if (!(sp = idx_at_(ctx, hash, j + hh->idx_offset))) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+      e = *sp;
+      if (!e || (e == GARBAGE)) { continue; }
+      ENTRY_AT(hash, e, ee, GRN_TABLE_ADD);
+      if (!ee) { return GRN_NO_MEMORY_AVAILABLE; }
+      for (i = ee->key, s = STEP(i); ; i += s) {
+        if (!(dp = idx_at_(ctx, hash, (i & m) + offd))) {
+          return GRN_NO_MEMORY_AVAILABLE;
+        }
+        if (!*dp) { break; }
+      }
+      *dp = e;
+      *sp = GARBAGE;
+    }
+    if ((hh->resize_pos = je) > m0) {
+      *hash->max_offset = m;
+      hh->idx_offset = offd;
+      hh->resize_stat = 0;
+    }
+  }
+  return GRN_SUCCESS;
+}
+
+inline static grn_rc
+resize_finish(grn_ctx *ctx, grn_hash *hash)
+{
+  grn_rc rc;
+  while (hash->header->resize_stat) {
+    if ((rc = resize_step(ctx, hash))) { return rc; }
+  }
+  return GRN_SUCCESS;
+}
+
 grn_rc
 grn_hash_reset(grn_ctx *ctx, grn_hash *hash, uint32_t ne)
 {
   entry *ee;
   grn_id e, *index = NULL, *sp = NULL, *dp;
-  uint32_t n, n0 = *hash->n_entries, offs = 0, offd = 0;
+  uint32_t n, n0, offs = 0, offd = 0;
+  if (IO_HASHP(hash) && hash->header->resize_stat) {
+    grn_rc rc = resize_finish(ctx, hash);
+    if (rc) { return rc; }
+  }
+  n0 = *hash->n_entries;
   if (!ne) { ne = n0 * 2; }
   if (ne > INT_MAX) { return GRN_NO_MEMORY_AVAILABLE; }
   for (n = INITIAL_INDEX_SIZE; n <= ne; n *= 2);
@@ -1037,6 +1167,73 @@ bin_hash(const uint8_t *p, uint32_t length)
   return r;
 }
 
+/* mixes 8 bytes at a time with 64x64->128 bit multiplications in the
+   manner of wyhash. */
+
+#define MIX_P0 0xa0761d6478bd642fULL
+#define MIX_P1 0xe7037ed1a0b428dbULL
+#define MIX_P2 0x8ebc6af09c88c6e3ULL
+
+inline static uint64_t
+mix_mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else /* __SIZEOF_INT128__ */
+  uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), lo, hi;
+  hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl);
+  lo = t + (rm1 << 32);
+  hi += (lo < t);
+  return lo ^ hi;
+#endif /* __SIZEOF_INT128__ */
+}
+
+inline static uint64_t
+mix_r8(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(uint64_t));
+  return v;
+}
+
+inline static uint64_t
+mix_r4(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+
+inline static uint32_t
+mix_hash(const uint8_t *p, uint32_t length)
+{
+  uint64_t a, b, r, seed = MIX_P0 ^ length;
+  for (; length > 16; p += 16, length -= 16) {
+    seed = mix_mum(mix_r8(p) ^ MIX_P1, mix_r8(p + 8) ^ seed);
+  }
+  if (length >= 8) {
+    a = mix_r8(p);
+    b = mix_r8(p + length - 8);
+  } else if (length >= 4) {
+    a = mix_r4(p);
+    b = mix_r4(p + length - 4);
+  } else if (length) {
+    a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+    b = 0;
+  } else {
+    a = b = 0;
+  }
+  r = mix_mum(mix_mum(a ^ MIX_P1, b ^ seed) ^ MIX_P2, seed ^ MIX_P1);
+  return (uint32_t)(r ^ (r >> 32));
+}
+
+#define BIN_HASH(hash,key,size) (((hash)->hash_func == HASH_FUNC_MIX)\
+  ? mix_hash((unsigned char *)(key), (size))\
+  : bin_hash((unsigned char *)(key), (size)))
+
 inline static grn_id
 entry_new(grn_ctx *ctx, grn_hash *hash, uint32_t size)
 {
@@ -1112,12 +1309,145 @@ grn_hash_clear_lock(grn_ctx *ctx, grn_hash *hash)
   return GRN_SUCCESS;
 }
 
+/* concurrent insertion */
+
+/* grn_hash_add() calls with the same key hash to the same stripe, so a key
+   is never added twice. index slots are claimed by compare-and-swap since
+   the probe sequences of different stripes overlap, and the entry, key and
+   bitmap segments are allocated under the alloc mutex. */
+
+#define N_STRIPES 64
+
+struct grn_hash_concurrent {
+  grn_mutex alloc;
+  grn_mutex stripes[N_STRIPES];
+};
+
+inline static void
+concurrent_lock_all(struct grn_hash_concurrent *c)
+{
+  int i;
+  for (i = 0; i < N_STRIPES; i++) { MUTEX_LOCK(c->stripes[i]); }
+}
+
+inline static void
+concurrent_unlock_all(struct grn_hash_concurrent *c)
+{
+  int i;
+  for (i = N_STRIPES; i--;) { MUTEX_UNLOCK(c->stripes[i]); }
+}
+
+inline static void
+concurrent_fin(grn_ctx *ctx, grn_hash *hash)
+{
+  int i;
+  struct grn_hash_concurrent *c = hash->concurrent;
+  MUTEX_DESTROY(c->alloc);
+  for (i = 0; i < N_STRIPES; i++) { MUTEX_DESTROY(c->stripes[i]); }
+  hash->concurrent = NULL;
+  GRN_FREE(c);
+}
+
+grn_rc
+grn_hash_set_concurrent(grn_ctx *ctx, grn_hash *hash, int enable)
+{
+#ifdef GRN_ATOMIC_CAS
+  if (!hash || !IO_HASHP(hash)) { return GRN_INVALID_ARGUMENT; }
+  if (enable) {
+    if (!hash->concurrent) {
+      int i;
+      uint32_t j;
+      struct grn_hash_concurrent *c;
+      grn_rc rc;
+      /* resizes with grn_hash_reset() from now on */
+      if ((rc = resize_finish(ctx, hash))) { return rc; }
+      /* index segments must not be allocated by racing threads */
+      for (j = 0; j <= *hash->max_offset; j += (IDX_MASK_IN_A_SEGMENT + 1)) {
+        if (!idx_at_(ctx, hash, j + hash->header->idx_offset)) {
+          return GRN_NO_MEMORY_AVAILABLE;
+        }
+      }
+      if (!(c = GRN_MALLOC(sizeof(struct grn_hash_concurrent)))) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+      MUTEX_INIT(c->alloc);
+      for (i = 0; i < N_STRIPES; i++) { MUTEX_INIT(c->stripes[i]); }
+      hash->concurrent = c;
+    }
+  } else {
+    if (hash->concurrent) { concurrent_fin(ctx, hash); }
+  }
+  return GRN_SUCCESS;
+#else /* GRN_ATOMIC_CAS */
+  return GRN_FUNCTION_NOT_IMPLEMENTED;
+#endif /* GRN_ATOMIC_CAS */
+}
+
+#ifdef GRN_ATOMIC_CAS
+inline static grn_id
+concurrent_add(grn_ctx *ctx, grn_hash *hash, const void *key,
+               unsigned int key_size, uint32_t h, void **value, int *added)
+{
+  entry_str *ee, *nee = NULL;
+  uint32_t i, n, s = STEP(h);
+  grn_id e, ne = GRN_ID_NIL, *ep;
+  struct grn_hash_concurrent *c = hash->concurrent;
+  grn_mutex *stripe = &c->stripes[h % N_STRIPES];
+  if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
+    concurrent_lock_all(c);
+    if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
+      grn_hash_reset(ctx, hash, 0);
+    }
+    concurrent_unlock_all(c);
+  }
+  MUTEX_LOCK(*stripe);
+  for (i = h; ; i += s) {
+    if (!(ep = IDX_AT(hash, i))) { e = GRN_ID_NIL; goto exit; }
+    if (!(e = *ep)) {
+      if (!ne) {
+        MUTEX_LOCK(c->alloc);
+        if ((ne = entry_new(ctx, hash, key_size))) {
+          ENTRY_AT(hash, ne, nee, GRN_TABLE_ADD);
+          if (nee) {
+            put_key(ctx, hash, nee, h, key, key_size);
+          } else {
+            ne = GRN_ID_NIL;
+          }
+        }
+        MUTEX_UNLOCK(c->alloc);
+        if (!ne) { goto exit; }
+      }
+      if (GRN_ATOMIC_CAS(ep, GRN_ID_NIL, ne)) { break; }
+      /* taken by another stripe */
+      e = *ep;
+    }
+    /* deleted slots are not reused, as another stripe may claim them */
+    if (e == GARBAGE) { continue; }
+    ENTRY_AT(hash, e, ee, GRN_TABLE_ADD);
+    if (!ee) { e = GRN_ID_NIL; goto exit; }
+    if (match_key(ctx, hash, ee, h, key, key_size)) {
+      if (added) { *added = 0; }
+      if (value) { *value = get_value(hash, ee); }
+      goto exit;
+    }
+  }
+  GRN_ATOMIC_ADD_EX(hash->n_entries, 1, n);
+  e = ne;
+  if (added) { *added = 1; }
+  if (value) { *value = get_value(hash, nee); }
+exit :
+  MUTEX_UNLOCK(*stripe);
+  return e;
+}
+#endif /* GRN_ATOMIC_CAS */
+
 grn_id
 grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
              unsigned int key_size, void **value, int *added)
 {
   entry_str *ee;
   uint32_t h, i, m, s;
+  int newp, resizing;
   grn_id e, *ep, *np = NULL;
   if (!key || !key_size) { return GRN_ID_NIL; }
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
@@ -1125,7 +1455,7 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
       ERR(GRN_INVALID_ARGUMENT, "too long key");
       return GRN_ID_NIL;
     }
-    h = bin_hash((unsigned char *)key, key_size);
+    h = BIN_HASH(hash, key, key_size);
   } else {
     if (key_size != hash->key_size) {
       ERR(GRN_INVALID_ARGUMENT, "key size unmatch");
@@ -1134,27 +1464,42 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
     if (key_size == sizeof(uint32_t)) {
       h = *((uint32_t *)key);
     } else {
-      h = bin_hash((unsigned char *)key, key_size);
+      h = BIN_HASH(hash, key, key_size);
     }
   }
+#ifdef GRN_ATOMIC_CAS
+  if (hash->concurrent) {
+    return concurrent_add(ctx, hash, key, key_size, h, value, added);
+  }
+#endif /* GRN_ATOMIC_CAS */
   s = STEP(h);
   /* lock */
-  if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
-    grn_hash_reset(ctx, hash, 0);
+  if (IO_HASHP(hash) && hash->header->resize_stat) {
+    resize_step(ctx, hash);
+  } else if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
+    if (IO_HASHP(hash)) {
+      resize_begin(ctx, hash);
+    } else {
+      grn_hash_reset(ctx, hash, 0);
+    }
   }
   m = *hash->max_offset;
-  for (i = h; ; i += s) {
-    if (!(ep = IDX_AT(hash, i))) { return GRN_ID_NIL; }
-    if (!(e = *ep)) { break; }
-    if (e == GARBAGE) {
-      if (!np) { np = ep; }
-      continue;
-    }
-    ENTRY_AT(hash, e, ee, GRN_TABLE_ADD);
-    if (!ee) { return GRN_ID_NIL; }
-    if (match_key(ctx, hash, ee, h, key, key_size)) {
-      if (added) { *added = 0; }
-      goto exit;
+  resizing = RESIZING(hash);
+  for (newp = 0; newp <= resizing; newp++) {
+    for (i = h; ; i += s) {
+      if (!(ep = IDX_AT2(hash, i, newp))) { return GRN_ID_NIL; }
+      if (!(e = *ep)) { break; }
+      if (e == GARBAGE) {
+        /* moved entries leave GARBAGE in the old index */
+        if (!np && newp == resizing) { np = ep; }
+        continue;
+      }
+      ENTRY_AT(hash, e, ee, GRN_TABLE_ADD);
+      if (!ee) { return GRN_ID_NIL; }
+      if (match_key(ctx, hash, ee, h, key, key_size)) {
+        if (added) { *added = 0; }
+        goto exit;
+      }
     }
   }
   if (!(e = entry_new(ctx, hash, key_size))) { /* unlock */ return GRN_ID_NIL; }
@@ -1180,29 +1525,33 @@ grn_hash_get(grn_ctx *ctx, grn_hash *hash, const void *key,
 {
   grn_id e, *ep;
   uint32_t h, i, m, s;
+  int newp, resizing;
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
     if (key_size > hash->key_size) { return GRN_ID_NIL; }
-    h = bin_hash((unsigned char *)key, key_size);
+    h = BIN_HASH(hash, key, key_size);
   } else {
     if (key_size != hash->key_size) { return GRN_ID_NIL; }
     if (key_size == sizeof(uint32_t)) {
       h = *((uint32_t *)key);
     } else {
-      h = bin_hash((unsigned char *)key, key_size);
+      h = BIN_HASH(hash, key, key_size);
     }
   }
   s = STEP(h);
   m = *hash->max_offset;
-  for (i = h; ; i += s) {
-    if (!(ep = IDX_AT(hash, i))) { return GRN_ID_NIL; }
-    if (!(e = *ep)) { break; }
-    if (e == GARBAGE) { continue; }
-    {
-      entry_str *ee;
-      ENTRY_AT(hash,e,ee, 0);
-      if (ee && match_key(ctx, hash, ee, h, key, key_size)) {
-        if (value) { *value = get_value(hash,ee); }
-        return e;
+  resizing = RESIZING(hash);
+  for (newp = 0; newp <= resizing; newp++) {
+    for (i = h; ; i += s) {
+      if (!(ep = IDX_AT2(hash, i, newp))) { return GRN_ID_NIL; }
+      if (!(e = *ep)) { break; }
+      if (e == GARBAGE) { continue; }
+      {
+        entry_str *ee;
+        ENTRY_AT(hash,e,ee, 0);
+        if (ee && match_key(ctx, hash, ee, h, key, key_size)) {
+          if (value) { *value = get_value(hash,ee); }
+          return e;
+        }
       }
     }
   }
@@ -1406,21 +1755,26 @@ grn_hash_delete_by_id(grn_ctx *ctx, grn_hash *hash, grn_id id,
   grn_rc rc = GRN_INVALID_ARGUMENT;
   if (!hash || !id) { return rc; }
   /* lock */
+  if (hash->concurrent) { concurrent_lock_all(hash->concurrent); }
   ENTRY_AT(hash, id, ee, 0);
   if (ee) {
     grn_id e, *ep;
     uint32_t i, key_size, h = ee->key, s = STEP(h);
+    int newp, resizing = RESIZING(hash);
     key_size = (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) ? ee->size : hash->key_size;
-    for (i = h; ; i += s) {
-      if (!(ep = IDX_AT(hash, i))) { return GRN_NO_MEMORY_AVAILABLE; }
-      if (!(e = *ep)) { break; }
-      if (e == id) {
-        DELETE_IT;
-        break;
+    for (newp = 0; newp <= resizing && rc == GRN_INVALID_ARGUMENT; newp++) {
+      for (i = h; ; i += s) {
+        if (!(ep = IDX_AT2(hash, i, newp))) { rc = GRN_NO_MEMORY_AVAILABLE; break; }
+        if (!(e = *ep)) { break; }
+        if (e == id) {
+          DELETE_IT;
+          break;
+        }
       }
     }
   }
   /* unlock */
+  if (hash->concurrent) { concurrent_unlock_all(hash->concurrent); }
   return rc;
 }
 
@@ -1432,34 +1786,40 @@ grn_hash_delete(grn_ctx *ctx, grn_hash *hash, const void *key, uint32_t key_size
   grn_rc rc = GRN_INVALID_ARGUMENT;
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
     if (key_size > hash->key_size) { return GRN_INVALID_ARGUMENT; }
-    h = bin_hash((unsigned char *)key, key_size);
+    h = BIN_HASH(hash, key, key_size);
   } else {
     if (key_size != hash->key_size) { return GRN_INVALID_ARGUMENT; }
     if (key_size == sizeof(uint32_t)) {
       h = *((uint32_t *)key);
     } else {
-      h = bin_hash((unsigned char *)key, key_size);
+      h = BIN_HASH(hash, key, key_size);
     }
   }
   s = STEP(h);
   {
     grn_id e, *ep;
+    int newp, resizing;
     /* lock */
+    if (hash->concurrent) { concurrent_lock_all(hash->concurrent); }
     m = *hash->max_offset;
-    for (i = h; ; i += s) {
-      if (!(ep = IDX_AT(hash, i))) { return GRN_NO_MEMORY_AVAILABLE; }
-      if (!(e = *ep)) { break; }
-      if (e == GARBAGE) { continue; }
-      {
-        entry_str *ee;
-        ENTRY_AT(hash, e, ee, 0);
-        if (ee && match_key(ctx, hash, ee, h, key, key_size)) {
-          DELETE_IT;
-          break;
+    resizing = RESIZING(hash);
+    for (newp = 0; newp <= resizing && rc == GRN_INVALID_ARGUMENT; newp++) {
+      for (i = h; ; i += s) {
+        if (!(ep = IDX_AT2(hash, i, newp))) { rc = GRN_NO_MEMORY_AVAILABLE; break; }
+        if (!(e = *ep)) { break; }
+        if (e == GARBAGE) { continue; }
+        {
+          entry_str *ee;
+          ENTRY_AT(hash, e, ee, 0);
+          if (ee && match_key(ctx, hash, ee, h, key, key_size)) {
+            DELETE_IT;
+            break;
+          }
         }
       }
     }
     /* unlock */
+    if (hash->concurrent) { concurrent_unlock_all(hash->concurrent); }
     return rc;
   }
 }
@@ -1555,6 +1915,36 @@ exit :
   return c;
 }
 
+/* opens a cursor over the ids from min to max. 0 means no bound. */
+grn_hash_cursor *
+grn_hash_cursor_open_id_range(grn_ctx *ctx, grn_hash *hash,
+                              grn_id min, grn_id max, int flags)
+{
+  grn_hash_cursor *c;
+  grn_id curr_max;
+  if (!hash || !ctx) { return NULL; }
+  if (!(c = GRN_MALLOCN(grn_hash_cursor, 1))) { return NULL; }
+  GRN_DB_OBJ_SET_TYPE(c, GRN_CURSOR_TABLE_HASH_KEY);
+  c->hash = hash;
+  c->ctx = ctx;
+  c->obj.header.flags = flags;
+  c->obj.header.domain = GRN_ID_NIL;
+  curr_max = HASH_CURR_MAX(hash);
+  if (!max || curr_max < max) { max = curr_max; }
+  if (!min) { min = GRN_ID_NIL + 1; }
+  if (flags & GRN_CURSOR_DESCENDING) {
+    c->dir = -1;
+    c->curr_rec = max + 1;
+    c->tail = (min <= max) ? min : c->curr_rec;
+  } else {
+    c->dir = 1;
+    c->curr_rec = min - 1;
+    c->tail = (min <= max) ? max : c->curr_rec;
+  }
+  c->rest = GRN_ID_MAX;
+  return c;
+}
+
 grn_id
 grn_hash_cursor_next(grn_ctx *ctx, grn_hash_cursor *c)
 {
@@ -1573,6 +1963,12 @@ grn_hash_cursor_next(grn_ctx *ctx, grn_hash_cursor *c)
   return GRN_ID_NIL;
 }
 
+grn_id
+grn_hash_curr_id(grn_ctx *ctx, grn_hash *hash)
+{
+  return HASH_CURR_MAX(hash);
+}
+
 grn_id
 grn_hash_next(grn_ctx *ctx, grn_hash *hash, grn_id id)
 {
@@ -1929,16 +2325,19 @@ entry2id(grn_ctx *ctx, grn_hash *hash, entry *e)
   entry *e2;
   grn_id id, *ep;
   uint32_t i, h = e->key, s = STEP(h);
-  for (i = h; ; i += s) {
-    if (!(ep = IDX_AT(hash, i))) { return GRN_ID_NIL; }
-    if (!(id = *ep)) { break; }
-    if (id != GARBAGE) {
-      ENTRY_AT(hash, id, e2, 0);
-      if (!e2) { return GRN_ID_NIL; }
-      if (e2 == e) { break; }
+  int newp, resizing = RESIZING(hash);
+  for (newp = 0; newp <= resizing; newp++) {
+    for (i = h; ; i += s) {
+      if (!(ep = IDX_AT2(hash, i, newp))) { return GRN_ID_NIL; }
+      if (!(id = *ep)) { break; }
+      if (id != GARBAGE) {
+        ENTRY_AT(hash, id, e2, 0);
+        if (!e2) { return GRN_ID_NIL; }
+        if (e2 == e) { return id; }
+      }
     }
   }
-  return id;
+  return GRN_ID_NIL;
 }
 
 int
@@ -171,6 +171,7 @@ struct _grn_array_cursor {
 
 grn_rc grn_array_copy_sort_key(grn_ctx *ctx, grn_array *array,
                                grn_table_sort_key *keys, int n_keys);
+grn_id grn_array_curr_id(grn_ctx *ctx, grn_array *array);
 
 /**** grn_hash ****/
 
@@ -184,6 +185,7 @@ struct _grn_hash {
   grn_encoding encoding;
   uint32_t value_size;
   uint32_t entry_size;
+  uint32_t hash_func;
   uint32_t *n_garbages;
   uint32_t *n_entries;
   uint32_t *max_offset;
@@ -192,6 +194,7 @@ struct _grn_hash {
   grn_io *io;
   struct grn_hash_header *header;
   uint32_t *lock;
+  struct grn_hash_concurrent *concurrent;
   // uint32_t nref;
   // unsigned int max_n_subrecs;
   // unsigned int record_size;
@@ -228,7 +231,11 @@ struct grn_hash_header {
   uint32_t n_entries;
   uint32_t n_garbages;
   uint32_t lock;
-  uint32_t reserved[16];
+  uint32_t resize_stat;
+  uint32_t resize_pos;
+  uint32_t resize_max_offset;
+  uint32_t hash_func;
+  uint32_t reserved[12];
   grn_id garbages[GRN_HASH_MAX_KEY_SIZE];
 };
 
@@ -278,6 +285,10 @@ grn_rc grn_hash_lock(grn_ctx *ctx, grn_hash *hash, int timeout);
 grn_rc grn_hash_unlock(grn_ctx *ctx, grn_hash *hash);
 grn_rc grn_hash_clear_lock(grn_ctx *ctx, grn_hash *hash);
 
+/* lets threads of a process call grn_hash_add() on an io hash without
+   grn_io_lock(). must be switched while no other thread touches the hash. */
+grn_rc grn_hash_set_concurrent(grn_ctx *ctx, grn_hash *hash, int enable);
+
 #define GRN_HASH_SIZE(hash) (*((hash)->n_entries))
 
 /* private */
@@ -303,6 +314,9 @@ int _grn_hash_get_key_value(grn_ctx *ctx, grn_hash *hash, grn_id id,
                             void **key, void **value);
 
 grn_id grn_hash_next(grn_ctx *ctx, grn_hash *hash, grn_id id);
+grn_id grn_hash_curr_id(grn_ctx *ctx, grn_hash *hash);
+grn_hash_cursor *grn_hash_cursor_open_id_range(grn_ctx *ctx, grn_hash *hash,
+                                               grn_id min, grn_id max, int flags);
 
 /* only valid for hash tables, GRN_OBJ_KEY_VAR_SIZE && GRN_HASH_TINY */
 const char *_grn_hash_strkey_by_val(void *v, uint16_t *size);
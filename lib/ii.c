@@ -27,6 +27,12 @@
 #include "pat.h"
 #include "db.h"
 
+#if defined(HAVE_IMMINTRIN_H) && (defined(__x86_64__) || defined(__i386__)) &&\
+  (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_UNPACK_AVX2
+#include <immintrin.h>
+#endif /* HAVE_IMMINTRIN_H */
+
 #define MAX_LSEG                 0x10000
 #define MAX_PSEG                 0x20000
 #define W_CHUNK                  22
@@ -65,7 +71,8 @@ struct grn_ii_header {
   uint32_t smax;
   uint32_t param1;
   uint32_t param2;
-  uint32_t reserved[307];
+  uint32_t ub_version;
+  uint32_t reserved[306];
   uint32_t ainfo[MAX_LSEG];
   uint32_t binfo[MAX_LSEG];
   uint32_t free_chunks[N_CHUNK_VARIATION + 1];
@@ -1304,6 +1311,96 @@ unpack_32(uint32_t *p, uint8_t *dp)
 }
 /* </generated> */
 
+#ifdef USE_UNPACK_AVX2
+/* decodes 8 values of w bits at a time. each 32bit lane takes the 4 bytes
+   which contain its value in big endian order, then the value is shifted
+   down and masked. values 4..7 are loaded from (w >> 1) bytes ahead, so
+   that all 8 windows fit into two 16 bytes loads when w <= 25. */
+
+#define UNPACK_AVX2_MAX_W 25
+
+#define UNPACK_OFF(w,j) ((((j) * (w)) >> 3) - ((j) < 4 ? 0 : ((w) >> 1)))
+#define UNPACK_SHUFFLE_LANE(w,j) \
+  UNPACK_OFF(w,j) + 3, UNPACK_OFF(w,j) + 2, UNPACK_OFF(w,j) + 1, UNPACK_OFF(w,j)
+#define UNPACK_SHUFFLE(w) {\
+  UNPACK_SHUFFLE_LANE(w,0), UNPACK_SHUFFLE_LANE(w,1),\
+  UNPACK_SHUFFLE_LANE(w,2), UNPACK_SHUFFLE_LANE(w,3),\
+  UNPACK_SHUFFLE_LANE(w,4), UNPACK_SHUFFLE_LANE(w,5),\
+  UNPACK_SHUFFLE_LANE(w,6), UNPACK_SHUFFLE_LANE(w,7)\
+}
+#define UNPACK_SHIFT_LANE(w,j) (32 - (w) - (((j) * (w)) & 7))
+#define UNPACK_SHIFT(w) {\
+  UNPACK_SHIFT_LANE(w,0), UNPACK_SHIFT_LANE(w,1),\
+  UNPACK_SHIFT_LANE(w,2), UNPACK_SHIFT_LANE(w,3),\
+  UNPACK_SHIFT_LANE(w,4), UNPACK_SHIFT_LANE(w,5),\
+  UNPACK_SHIFT_LANE(w,6), UNPACK_SHIFT_LANE(w,7)\
+}
+
+static const uint8_t unpack_shuffle[UNPACK_AVX2_MAX_W + 1][32] = {
+  UNPACK_SHUFFLE(0),  UNPACK_SHUFFLE(1),  UNPACK_SHUFFLE(2),  UNPACK_SHUFFLE(3),
+  UNPACK_SHUFFLE(4),  UNPACK_SHUFFLE(5),  UNPACK_SHUFFLE(6),  UNPACK_SHUFFLE(7),
+  UNPACK_SHUFFLE(8),  UNPACK_SHUFFLE(9),  UNPACK_SHUFFLE(10), UNPACK_SHUFFLE(11),
+  UNPACK_SHUFFLE(12), UNPACK_SHUFFLE(13), UNPACK_SHUFFLE(14), UNPACK_SHUFFLE(15),
+  UNPACK_SHUFFLE(16), UNPACK_SHUFFLE(17), UNPACK_SHUFFLE(18), UNPACK_SHUFFLE(19),
+  UNPACK_SHUFFLE(20), UNPACK_SHUFFLE(21), UNPACK_SHUFFLE(22), UNPACK_SHUFFLE(23),
+  UNPACK_SHUFFLE(24), UNPACK_SHUFFLE(25)
+};
+
+static const uint32_t unpack_shift[UNPACK_AVX2_MAX_W + 1][8] = {
+  UNPACK_SHIFT(0),  UNPACK_SHIFT(1),  UNPACK_SHIFT(2),  UNPACK_SHIFT(3),
+  UNPACK_SHIFT(4),  UNPACK_SHIFT(5),  UNPACK_SHIFT(6),  UNPACK_SHIFT(7),
+  UNPACK_SHIFT(8),  UNPACK_SHIFT(9),  UNPACK_SHIFT(10), UNPACK_SHIFT(11),
+  UNPACK_SHIFT(12), UNPACK_SHIFT(13), UNPACK_SHIFT(14), UNPACK_SHIFT(15),
+  UNPACK_SHIFT(16), UNPACK_SHIFT(17), UNPACK_SHIFT(18), UNPACK_SHIFT(19),
+  UNPACK_SHIFT(20), UNPACK_SHIFT(21), UNPACK_SHIFT(22), UNPACK_SHIFT(23),
+  UNPACK_SHIFT(24), UNPACK_SHIFT(25)
+};
+
+/* n must be a multiple of 8. the last groups are copied to a local buffer
+   so as not to read beyond the end of the packed data. */
+__attribute__((target("avx2"))) static uint8_t *
+unpack_avx2(uint32_t *p, uint32_t n, int w, uint8_t *dp)
+{
+  uint8_t buf[32], *sp;
+  __m128i lo, hi;
+  __m256i v;
+  __m256i shuffle = _mm256_loadu_si256((const __m256i *)unpack_shuffle[w]);
+  __m256i shift = _mm256_loadu_si256((const __m256i *)unpack_shift[w]);
+  __m256i mask = _mm256_set1_epi32((1 << w) - 1);
+  for (; n; n -= 8, p += 8, dp += w) {
+    if ((n >> 3) * w < sizeof(buf)) {
+      memcpy(buf, dp, w);
+      sp = buf;
+    } else {
+      sp = dp;
+    }
+    lo = _mm_loadu_si128((const __m128i *)sp);
+    hi = _mm_loadu_si128((const __m128i *)(sp + (w >> 1)));
+    v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    v = _mm256_shuffle_epi8(v, shuffle);
+    v = _mm256_srlv_epi32(v, shift);
+    v = _mm256_and_si256(v, mask);
+    _mm256_storeu_si256((__m256i *)p, v);
+  }
+  return dp;
+}
+
+static int unpack_avx2_enabled = 1;
+#endif /* USE_UNPACK_AVX2 */
+
+/* switches the AVX2 decoder of packed units on or off, so that tests can
+   compare it with the scalar one. returns whether it is actually used. */
+int
+grn_p_dec_avx2(int enable)
+{
+#ifdef USE_UNPACK_AVX2
+  unpack_avx2_enabled = enable;
+  return enable && __builtin_cpu_supports("avx2");
+#else /* USE_UNPACK_AVX2 */
+  return 0;
+#endif /* USE_UNPACK_AVX2 */
+}
+
 static uint8_t *
 pack_(uint32_t *p, uint32_t i, int w, uint8_t *rp)
 {
@@ -1560,8 +1657,18 @@ unpack(uint8_t *dp, int i, uint32_t *rp)
     m = (1 << w) - 1;
     if (m >= UNIT_MASK) { k = *dp++; }
   } else {
-    m = (1 << w) - 1;
-  }
+    /* 1 << 32 is undefined, and is 1 on x86 */
+    m = (w < 32) ? (1 << w) - 1 : 0xffffffff;
+  }
+#ifdef USE_UNPACK_AVX2
+  if (i >= 8 && w && w <= UNPACK_AVX2_MAX_W && unpack_avx2_enabled &&
+      __builtin_cpu_supports("avx2")) {
+    int n = i & ~7;
+    dp = unpack_avx2(p, n, w, dp);
+    p += n;
+    i -= n;
+  }
+#endif /* USE_UNPACK_AVX2 */
   while (i >= 8) {
     switch (w) {
     case 0 : memset(p, 0, sizeof(uint32_t) * 8); break;
@@ -3185,6 +3292,10 @@ grn_ii_create(grn_ctx *ctx, const char *path, grn_obj *lexicon, uint32_t flags)
   if ((flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
   if ((flags & GRN_OBJ_WITH_POSITION)) { ii->n_elements++; }
+  grn_tiny_array_init(&grn_gctx, &ii->ubs, sizeof(uint64_t),
+                      GRN_TINY_ARRAY_CLEAR|GRN_TINY_ARRAY_THREADSAFE|
+                      GRN_TINY_ARRAY_USE_MALLOC);
+  ii->n_bulk_loaders = 0;
   return ii;
 }
 
@@ -3245,6 +3356,10 @@ grn_ii_open(grn_ctx *ctx, const char *path, grn_obj *lexicon)
   if ((header->flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_POSITION)) { ii->n_elements++; }
+  grn_tiny_array_init(&grn_gctx, &ii->ubs, sizeof(uint64_t),
+                      GRN_TINY_ARRAY_CLEAR|GRN_TINY_ARRAY_THREADSAFE|
+                      GRN_TINY_ARRAY_USE_MALLOC);
+  ii->n_bulk_loaders = 0;
   return ii;
 }
 
@@ -3256,6 +3371,7 @@ grn_ii_close(grn_ctx *ctx, grn_ii *ii)
   grn_del(grn_io_path(ii->seg));
   if ((rc = grn_io_close(ctx, ii->seg))) { return rc; }
   if ((rc = grn_io_close(ctx, ii->chunk))) { return rc; }
+  grn_tiny_array_fin(&ii->ubs);
   GRN_GFREE(ii);
   /*
   {
@@ -3299,6 +3415,33 @@ grn_ii_expire(grn_ctx *ctx, grn_ii *ii)
   grn_io_expire(ctx, ii->chunk, 0, 1000000);
 }
 
+/* grn_ii_expire() walks over all mapped chunk segments. While a bulk load
+   is running, it is done once at grn_ii_bulk_end() instead of after every
+   posting, or as soon as more than MAX_BULK_NMAPS chunk segments are
+   mapped. */
+
+#define MAX_BULK_NMAPS           256
+
+grn_rc
+grn_ii_bulk_begin(grn_ctx *ctx, grn_ii *ii)
+{
+  if (!ii) { return GRN_INVALID_ARGUMENT; }
+  if (grn_io_lock(ctx, ii->seg, 10000000)) { return ctx->rc; }
+  ii->n_bulk_loaders++;
+  grn_io_unlock(ii->seg);
+  return GRN_SUCCESS;
+}
+
+grn_rc
+grn_ii_bulk_end(grn_ctx *ctx, grn_ii *ii)
+{
+  if (!ii) { return GRN_INVALID_ARGUMENT; }
+  if (grn_io_lock(ctx, ii->seg, 10000000)) { return ctx->rc; }
+  if (ii->n_bulk_loaders && !--ii->n_bulk_loaders) { grn_ii_expire(ctx, ii); }
+  grn_io_unlock(ii->seg);
+  return GRN_SUCCESS;
+}
+
 #define BIT11_01(x) ((x >> 1) & 0x7ff)
 #define BIT31_12(x) (x >> 12)
 
@@ -3437,10 +3580,18 @@ grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
 exit :
   array_unref(ii, tid);
   if (bs) { GRN_FREE(bs); }
+  {
+    /* the postings have landed, so that the upper bounds cached by any
+       process up to now are stale. */
+    uint32_t version;
+    GRN_ATOMIC_ADD_EX(&ii->header->ub_version, 1, version);
+  }
   if (u->tf != u->atf) {
     GRN_LOG(ctx, GRN_LOG_WARNING, "too many postings(%d) on %u. discarded %d.", u->atf, tid, u->atf - u->tf);
   }
-  grn_ii_expire(ctx, ii);
+  if (!ii->n_bulk_loaders || ii->chunk->nmaps > MAX_BULK_NMAPS) {
+    grn_ii_expire(ctx, ii);
+  }
   return rc;
 }
 
@@ -3547,6 +3698,7 @@ struct _grn_ii_cursor {
   uint32_t nchunks;
   uint32_t curr_chunk;
   chunk_info *cinfo;
+  grn_id *crids;
   grn_io_win iw;
   uint8_t *cp;
   uint8_t *cpe;
@@ -3625,11 +3777,20 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
           c = NULL;
           goto exit;
         }
+        if (!(c->crids = GRN_MALLOCN(grn_id, c->nchunks))) {
+          GRN_FREE(c->cinfo);
+          buffer_close(ctx, ii, c->buffer_pseg);
+          grn_io_win_unmap2(&c->iw);
+          GRN_FREE(c);
+          c = NULL;
+          goto exit;
+        }
         for (i = 0, crid = GRN_ID_NIL; i < c->nchunks; i++) {
           GRN_B_DEC(c->cinfo[i].segno, c->cp);
           GRN_B_DEC(c->cinfo[i].size, c->cp);
           GRN_B_DEC(c->cinfo[i].dgap, c->cp);
           crid += c->cinfo[i].dgap;
+          c->crids[i] = crid;
           if (crid < min) { c->curr_chunk = i + 1; }
         }
       }
@@ -3867,6 +4028,50 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
   return c->post;
 }
 
+#define POSTING_GE(p,rid,sid) \
+  ((p)->rid > (rid) || ((p)->rid == (rid) && (p)->sid >= (sid)))
+
+/* moves the cursor to the first posting not less than (rid, sid).
+   split chunks whose last rid is less than rid are not even mapped,
+   and postings of the decoded chunk are passed over without merging
+   them with the buffer. */
+grn_ii_posting *
+grn_ii_cursor_skip(grn_ctx *ctx, grn_ii_cursor *c, grn_id rid, uint32_t sid)
+{
+  grn_ii_posting *p;
+  if (c->post && POSTING_GE(c->post, rid, sid)) { return c->post; }
+  if (c->buf && c->pc.rid < rid) {
+    if (c->crp >= c->cdp + c->cdf ||
+        (c->curr_chunk && c->curr_chunk <= c->nchunks &&
+         c->crids[c->curr_chunk - 1] < rid)) {
+      while (c->curr_chunk < c->nchunks && c->crids[c->curr_chunk] < rid) {
+        c->curr_chunk++;
+      }
+      c->crp = c->cdp + c->cdf;
+      c->pc.rest = 0;
+    } else {
+      while (c->crp < c->cdp + c->cdf && c->pc.rid + *c->crp < rid) {
+        uint32_t dgap = *c->crp++;
+        c->pc.rid += dgap;
+        if (dgap) { c->pc.sid = 0; }
+        if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+          c->pc.sid += 1 + *c->csp++;
+        } else {
+          c->pc.sid = 1;
+        }
+        c->cpp += c->pc.rest;
+        c->pc.rest = c->pc.tf = 1 + *c->ctp++;
+        if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) { c->cwp++; }
+      }
+    }
+    c->stat |= CHUNK_USED;
+  }
+  while ((p = grn_ii_cursor_next(ctx, c))) {
+    if (POSTING_GE(p, rid, sid)) { break; }
+  }
+  return p;
+}
+
 grn_ii_posting *
 grn_ii_cursor_next_pos(grn_ctx *ctx, grn_ii_cursor *c)
 {
@@ -3916,6 +4121,7 @@ grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c)
   if (!c) { return GRN_INVALID_ARGUMENT; }
   datavec_fin(ctx, c->rdv);
   if (c->cinfo) { GRN_FREE(c->cinfo); }
+  if (c->crids) { GRN_FREE(c->crids); }
   if (c->buf) { buffer_close(ctx, c->ii, c->buffer_pseg); }
   if (c->cp) { grn_io_win_unmap2(&c->iw); }
   GRN_FREE(c);
@@ -4194,6 +4400,23 @@ cursor_heap_pop(grn_ctx *ctx, cursor_heap *h)
   }
 }
 
+static inline void
+cursor_heap_pop_skip(grn_ctx *ctx, cursor_heap *h, grn_id rid, uint32_t sid)
+{
+  if (h->n_entries) {
+    grn_ii_cursor *c = h->bins[0];
+    if (!grn_ii_cursor_skip(ctx, c, rid, sid)) {
+      grn_ii_cursor_close(ctx, c);
+      h->bins[0] = h->bins[--h->n_entries];
+    } else if (!grn_ii_cursor_next_pos(ctx, c)) {
+      GRN_LOG(ctx, GRN_LOG_ERROR, "invalid ii_cursor e");
+      grn_ii_cursor_close(ctx, c);
+      h->bins[0] = h->bins[--h->n_entries];
+    }
+    if (h->n_entries > 1) { cursor_heap_recalc_min(h); }
+  }
+}
+
 static inline void
 cursor_heap_pop_pos(grn_ctx *ctx, cursor_heap *h)
 {
@@ -4723,6 +4946,768 @@ exit :
   return ctx->rc;
 }
 
+/* builder */
+
+/* grn_ii_build() fills an empty index from the records already stored in
+   its sources. Postings are collected into a block, the block is sorted by
+   term and spilled to a temporary file as a run when it gets full, and the
+   runs are merged in term order. Each posting list is then encoded once,
+   straight into buffer segments and chunks, instead of going through the
+   buffer_flush() cycle of grn_ii_update_one() again and again. */
+
+#define II_BUILD_BLOCK_SIZE      (1 << 24)   /* words of postings in memory */
+#define II_BUILD_NTERMS          1024        /* terms per buffer segment */
+#define II_BUILD_CHUNK_SIZE      S_CHUNK     /* chunk bytes per buffer segment */
+
+typedef struct {
+  grn_id tid;
+  uint32_t offset;
+} ii_build_entry;
+
+typedef struct {
+  grn_id tid;
+  uint32_t pos;
+  int32_t weight;
+} ii_build_token;
+
+typedef struct {
+  uint32_t serial;
+  uint32_t post;
+} ii_build_mark;
+
+typedef struct {
+  grn_id tid;
+  uint32_t tf;
+  int32_t weight;
+  uint32_t offset;
+  uint32_t lpos;
+  uint32_t rest;
+} ii_build_post;
+
+typedef struct {
+  FILE *fp;
+  ii_build_entry *entries;
+  uint32_t nentries;
+  uint32_t curr;
+  grn_id tid;
+  uint32_t *rec;
+  uint32_t *buf;
+  uint32_t buf_size;
+} ii_build_run;
+
+typedef struct {
+  grn_ii *ii;
+  /* postings collected from the sources */
+  uint32_t *block;
+  uint32_t block_size;
+  uint32_t block_curr;
+  ii_build_entry *entries;
+  uint32_t nentries;
+  uint32_t max_entries;
+  ii_build_run *runs;
+  uint32_t nruns;
+  ii_build_token *tokens;
+  uint32_t ntokens;
+  uint32_t max_tokens;
+  ii_build_mark *marks;       /* indexed by tid */
+  uint32_t max_tids;
+  uint32_t serial;
+  ii_build_post *posts;
+  uint32_t max_posts;
+  /* posting list of the current term */
+  grn_id tid;
+  uint32_t df;
+  uint32_t ndf;
+  uint32_t np;
+  uint32_t max_ndf;
+  uint32_t max_np;
+  uint64_t spos;
+  docinfo lid;
+  uint32_t *dvs[4];           /* rid gaps, sid gaps, tfs and weights */
+  uint32_t *poss;
+  chunk_info *cinfo;
+  uint32_t nchunks;
+  uint32_t max_chunks;
+  grn_id crid;
+  /* buffer segment being filled */
+  buffer *b;
+  uint32_t lseg;
+  uint32_t pseg;
+  uint8_t *dc;
+  uint32_t dc_curr;
+} ii_builder;
+
+#define II_BUILD_REC_SIZE(ii,rec) \
+  (4 + (((ii)->header->flags & GRN_OBJ_WITH_POSITION) ? (rec)[2] : 0))
+
+static grn_rc
+ii_build_reserve(grn_ctx *ctx, void **p, uint32_t *max, uint32_t n, size_t unit)
+{
+  if (n > *max) {
+    void *q;
+    uint32_t m = *max ? *max : 256;
+    while (m < n) { m <<= 1; }
+    if (!(q = GRN_REALLOC(*p, m * unit))) { return GRN_NO_MEMORY_AVAILABLE; }
+    *p = q;
+    *max = m;
+  }
+  return GRN_SUCCESS;
+}
+
+/* orders the entries of the block by term. Entries of a term keep the
+   order they were collected in, which is the order of record ids. */
+static grn_rc
+ii_build_sort(grn_ctx *ctx, ii_builder *b)
+{
+  uint32_t i, *counts;
+  ii_build_entry *sorted;
+  if (!b->nentries) { return GRN_SUCCESS; }
+  if (!(counts = GRN_CALLOC(sizeof(uint32_t) * (b->max_tids + 1)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  if (!(sorted = GRN_MALLOC(sizeof(ii_build_entry) * b->max_entries))) {
+    GRN_FREE(counts);
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  for (i = 0; i < b->nentries; i++) { counts[b->entries[i].tid + 1]++; }
+  for (i = 1; i <= b->max_tids; i++) { counts[i] += counts[i - 1]; }
+  for (i = 0; i < b->nentries; i++) {
+    sorted[counts[b->entries[i].tid]++] = b->entries[i];
+  }
+  GRN_FREE(counts);
+  GRN_FREE(b->entries);
+  b->entries = sorted;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_spill(grn_ctx *ctx, ii_builder *b)
+{
+  grn_rc rc;
+  FILE *fp;
+  ii_build_entry *e, *ee;
+  ii_build_run *run;
+  if (!b->nentries) { return GRN_SUCCESS; }
+  if (!(run = GRN_REALLOC(b->runs, sizeof(ii_build_run) * (b->nruns + 1)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  b->runs = run;
+  run += b->nruns;
+  memset(run, 0, sizeof(ii_build_run));
+  if (!(fp = tmpfile())) {
+    SERR("tmpfile");
+    return ctx->rc;
+  }
+  run->fp = fp;
+  b->nruns++;
+  if ((rc = ii_build_sort(ctx, b))) { return rc; }
+  for (e = b->entries, ee = e + b->nentries; e < ee; e++) {
+    uint32_t *rec = b->block + e->offset;
+    uint32_t size = II_BUILD_REC_SIZE(b->ii, rec);
+    if (fwrite(&e->tid, sizeof(grn_id), 1, fp) != 1 ||
+        fwrite(rec, sizeof(uint32_t), size, fp) != size) {
+      SERR("fwrite");
+      return ctx->rc;
+    }
+  }
+  if (fflush(fp) || fseek(fp, 0, SEEK_SET)) {
+    SERR("fseek");
+    return ctx->rc;
+  }
+  b->block_curr = 0;
+  b->nentries = 0;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_token_add(grn_ctx *ctx, ii_builder *b, grn_id tid, uint32_t pos, int32_t weight)
+{
+  grn_rc rc;
+  ii_build_token *t;
+  if ((rc = ii_build_reserve(ctx, (void **)&b->tokens, &b->max_tokens,
+                             b->ntokens + 1, sizeof(ii_build_token)))) {
+    return rc;
+  }
+  t = &b->tokens[b->ntokens];
+  t->tid = tid;
+  t->pos = pos;
+  t->weight = weight;
+  b->ntokens++;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_tokenize(grn_ctx *ctx, ii_builder *b, const char *str, unsigned int str_len,
+                  int32_t weight)
+{
+  grn_id tid;
+  grn_rc rc = GRN_SUCCESS;
+  grn_token *token;
+  if (!str_len) { return GRN_SUCCESS; }
+  if (!(token = grn_token_open(ctx, b->ii->lexicon, str, str_len, 1))) {
+    return ctx->rc ? ctx->rc : GRN_NO_MEMORY_AVAILABLE;
+  }
+  while (!rc && !token->status) {
+    if ((tid = grn_token_next(ctx, token))) {
+      rc = ii_build_token_add(ctx, b, tid, token->pos, weight);
+    }
+  }
+  grn_token_close(ctx, token);
+  return rc;
+}
+
+/* tokenizes a value the same way grn_ii_column_update() does, but keeps
+   the tokens in a flat array instead of a hash of updspecs. */
+static grn_rc
+ii_build_value(grn_ctx *ctx, ii_builder *b, grn_obj *value)
+{
+  grn_rc rc = GRN_SUCCESS;
+  switch (value->header.type) {
+  case GRN_BULK :
+    rc = ii_build_tokenize(ctx, b, GRN_BULK_HEAD(value), GRN_BULK_VSIZE(value), 0);
+    break;
+  case GRN_VECTOR :
+    if (value->u.v.body) {
+      int j;
+      grn_section *v;
+      const char *head = GRN_BULK_HEAD(value->u.v.body);
+      for (j = value->u.v.n_sections, v = value->u.v.sections; !rc && j; j--, v++) {
+        rc = ii_build_tokenize(ctx, b, head + v->offset, v->length, v->weight);
+      }
+    }
+    break;
+  case GRN_UVECTOR :
+    {
+      uint32_t j;
+      const grn_id *rp = (const grn_id *)GRN_BULK_HEAD(value);
+      const grn_id *re = (const grn_id *)GRN_BULK_CURR(value);
+      for (j = 0; !rc && rp < re; j++, rp++) {
+        rc = ii_build_token_add(ctx, b, *rp, j, 0);
+      }
+    }
+    break;
+  }
+  return rc;
+}
+
+/* turns the tokens of a record into one posting per term. Postings are
+   laid out in the order their terms first appear; the block is sorted by
+   term only when it is spilled. */
+static grn_rc
+ii_build_collect(grn_ctx *ctx, ii_builder *b, grn_id rid, uint32_t sid)
+{
+  grn_rc rc;
+  grn_ii *ii = b->ii;
+  uint32_t i, nposts = 0, size = 0, offset;
+  ii_build_token *t, *te = b->tokens + b->ntokens;
+  if (!b->ntokens) { return GRN_SUCCESS; }
+  if (sid > ii->header->smax) { ii->header->smax = sid; }
+  b->serial++;
+  for (t = b->tokens; t < te; t++) {
+    ii_build_post *p;
+    if (t->tid >= b->max_tids) {
+      uint32_t max = b->max_tids;
+      if ((rc = ii_build_reserve(ctx, (void **)&b->marks, &b->max_tids,
+                                 t->tid + 1, sizeof(ii_build_mark)))) {
+        return rc;
+      }
+      memset(b->marks + max, 0, sizeof(ii_build_mark) * (b->max_tids - max));
+    }
+    if (b->marks[t->tid].serial != b->serial) {
+      if ((rc = ii_build_reserve(ctx, (void **)&b->posts, &b->max_posts,
+                                 nposts + 1, sizeof(ii_build_post)))) {
+        return rc;
+      }
+      b->marks[t->tid].serial = b->serial;
+      b->marks[t->tid].post = nposts;
+      p = &b->posts[nposts++];
+      p->tid = t->tid;
+      p->tf = 0;
+      p->weight = 0;
+    } else {
+      p = &b->posts[b->marks[t->tid].post];
+    }
+    if (p->tf < GRN_II_MAX_TF) {
+      p->tf++;
+      p->weight += t->weight;
+    }
+  }
+  for (i = 0; i < nposts; i++) {
+    size += 4;
+    if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) { size += b->posts[i].tf; }
+  }
+  if (b->block_curr + size > b->block_size) {
+    if ((rc = ii_build_spill(ctx, b))) { return rc; }
+    /* a record larger than a block is spilled alone in a block of its own */
+    if (size > b->block_size) {
+      uint32_t *block = GRN_REALLOC(b->block, sizeof(uint32_t) * size);
+      if (!block) { return GRN_NO_MEMORY_AVAILABLE; }
+      b->block = block;
+      b->block_size = size;
+    }
+  }
+  if ((rc = ii_build_reserve(ctx, (void **)&b->entries, &b->max_entries,
+                             b->nentries + nposts, sizeof(ii_build_entry)))) {
+    return rc;
+  }
+  for (i = 0, offset = b->block_curr; i < nposts; i++) {
+    ii_build_post *p = &b->posts[i];
+    uint32_t *rec = b->block + offset;
+    b->entries[b->nentries].tid = p->tid;
+    b->entries[b->nentries++].offset = offset;
+    rec[0] = rid;
+    rec[1] = (ii->header->flags & GRN_OBJ_WITH_SECTION) ? sid : 1;
+    rec[2] = p->tf;
+    rec[3] = (ii->header->flags & GRN_OBJ_WITH_WEIGHT) ? p->weight : 0;
+    p->offset = offset + 4;
+    p->lpos = 0;
+    p->rest = p->tf;
+    offset += 4;
+    if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) { offset += p->tf; }
+  }
+  if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
+    for (t = b->tokens; t < te; t++) {
+      ii_build_post *p = &b->posts[b->marks[t->tid].post];
+      if (p->rest) {
+        b->block[p->offset++] = t->pos - p->lpos;
+        p->lpos = t->pos;
+        p->rest--;
+      }
+    }
+  }
+  b->block_curr = offset;
+  b->ntokens = 0;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_scan(grn_ctx *ctx, ii_builder *b)
+{
+  grn_id rid;
+  grn_rc rc = GRN_SUCCESS;
+  grn_ii *ii = b->ii;
+  grn_obj **sources, *table = NULL;
+  grn_table_cursor *tc;
+  grn_id *s = ii->obj.source;
+  int i, n = ii->obj.source_size / sizeof(grn_id);
+  if (!(sources = GRN_MALLOCN(grn_obj *, n))) { return GRN_NO_MEMORY_AVAILABLE; }
+  for (i = 0; i < n; i++) {
+    if (!(sources[i] = grn_ctx_at(ctx, s[i]))) {
+      ERR(GRN_INVALID_ARGUMENT, "invalid source: <%d>", s[i]);
+      GRN_FREE(sources);
+      return ctx->rc;
+    }
+  }
+  table = GRN_OBJ_TABLEP(sources[0])
+    ? sources[0] : grn_ctx_at(ctx, sources[0]->header.domain);
+  if (!table || !grn_table_size(ctx, table)) {
+    GRN_FREE(sources);
+    return GRN_SUCCESS;
+  }
+  if (!(tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 0,
+                                   GRN_CURSOR_ASCENDING|GRN_CURSOR_BY_ID))) {
+    GRN_FREE(sources);
+    return ctx->rc ? ctx->rc : GRN_NO_MEMORY_AVAILABLE;
+  }
+  while (!rc && (rid = grn_table_cursor_next(ctx, tc))) {
+    uint32_t base = 0;
+    for (i = 0; !rc && i < n; i++) {
+      grn_obj buf, *value;
+      uint32_t ntokens = b->ntokens;
+      GRN_TEXT_INIT(&buf, 0);
+      /* the value of a table is not its key */
+      if (GRN_OBJ_TABLEP(sources[i])) {
+        if (grn_table_get_key2(ctx, sources[i], rid, &buf)) {
+          rc = ii_build_value(ctx, b, &buf);
+        }
+      } else if ((value = grn_obj_get_value(ctx, sources[i], rid, &buf))) {
+        rc = ii_build_value(ctx, b, value);
+      }
+      grn_obj_close(ctx, &buf);
+      if (!rc && !(ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+        /* positions of a source follow the ones of the previous sources, so
+           that the positions of a shared posting never go backwards */
+        uint32_t next = base;
+        ii_build_token *t, *te = b->tokens + b->ntokens;
+        for (t = b->tokens + ntokens; t < te; t++) {
+          t->pos += base;
+          if (t->pos >= next) { next = t->pos + 1; }
+        }
+        base = next;
+      }
+      /* sections of a record share a posting unless the index keeps them */
+      if (!rc && ((ii->header->flags & GRN_OBJ_WITH_SECTION) || i == n - 1)) {
+        rc = ii_build_collect(ctx, b, rid, i + 1);
+      }
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+  GRN_FREE(sources);
+  return rc;
+}
+
+static void
+ii_build_run_next(grn_ctx *ctx, ii_builder *b, ii_build_run *run)
+{
+  if (run->fp) {
+    uint32_t head[5], size;
+    if (fread(head, sizeof(uint32_t), 5, run->fp) != 5) {
+      run->tid = GRN_ID_NIL;
+      return;
+    }
+    size = II_BUILD_REC_SIZE(b->ii, head + 1);
+    if (ii_build_reserve(ctx, (void **)&run->buf, &run->buf_size,
+                         size, sizeof(uint32_t))) {
+      run->tid = GRN_ID_NIL;
+      return;
+    }
+    memcpy(run->buf, head + 1, sizeof(uint32_t) * 4);
+    if (size > 4 &&
+        fread(run->buf + 4, sizeof(uint32_t), size - 4, run->fp) != size - 4) {
+      GRN_LOG(ctx, GRN_LOG_ERROR, "truncated run in grn_ii_build");
+      run->tid = GRN_ID_NIL;
+      return;
+    }
+    run->tid = head[0];
+    run->rec = run->buf;
+  } else {
+    if (run->curr == run->nentries) {
+      run->tid = GRN_ID_NIL;
+      return;
+    }
+    run->tid = run->entries[run->curr].tid;
+    run->rec = b->block + run->entries[run->curr].offset;
+    run->curr++;
+  }
+}
+
+static uint8_t *
+ii_build_encode(grn_ctx *ctx, ii_builder *b, uint32_t *encsize)
+{
+  int j = 0;
+  uint8_t *enc;
+  grn_ii *ii = b->ii;
+  datavec dv[MAX_N_ELEMENTS + 1];
+  uint32_t ndf = b->ndf, np = b->np;
+  uint32_t f_s = (ndf < 3) ? 0 : USE_P_ENC;
+  uint32_t f_d = ((ndf < 16) || (ndf <= (b->lid.rid >> 8))) ? 0 : USE_P_ENC;
+  dv[j].data = b->dvs[0]; dv[j].data_size = ndf; dv[j++].flags = f_d;
+  if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+    dv[j].data = b->dvs[1]; dv[j].data_size = ndf; dv[j++].flags = f_s;
+  }
+  dv[j].data = b->dvs[2]; dv[j].data_size = ndf; dv[j++].flags = f_s;
+  if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
+    dv[j].data = b->dvs[3]; dv[j].data_size = ndf; dv[j++].flags = f_s;
+  }
+  if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
+    uint32_t f_p = ((np < 32) || (np <= (b->spos >> 13))) ? 0 : USE_P_ENC;
+    dv[j].data = b->poss; dv[j].data_size = np; dv[j].flags = f_p|ODD;
+  }
+  if ((enc = GRN_MALLOC((ndf * 4 + np) * 5 + 16))) {
+    *encsize = grn_p_encv(ctx, dv, ii->n_elements, enc);
+  }
+  return enc;
+}
+
+/* moves the postings encoded so far into a chunk of their own, in the
+   same layout buffer_merge() uses for posting lists over
+   CHUNK_SPLIT_THRESHOLD. */
+static grn_rc
+ii_build_split(grn_ctx *ctx, ii_builder *b, uint8_t *enc, uint32_t encsize)
+{
+  grn_rc rc;
+  if ((rc = ii_build_reserve(ctx, (void **)&b->cinfo, &b->max_chunks,
+                             b->nchunks + 1, sizeof(chunk_info)))) {
+    return rc;
+  }
+  if ((rc = chunk_flush(ctx, b->ii, &b->cinfo[b->nchunks], enc, encsize))) {
+    return rc;
+  }
+  b->cinfo[b->nchunks++].dgap = b->lid.rid - b->crid;
+  b->crid = b->lid.rid;
+  b->ndf = 0;
+  b->np = 0;
+  b->spos = 0;
+  b->lid.rid = 0;
+  b->lid.sid = 0;
+  return GRN_SUCCESS;
+}
+
+
+static grn_rc
+ii_build_add(grn_ctx *ctx, ii_builder *b, uint32_t *rec)
+{
+  grn_rc rc;
+  grn_ii *ii = b->ii;
+  uint32_t rid = rec[0], sid = rec[1], tf = rec[2], dgap, i;
+  if (b->ndf * ii->n_elements + b->np >= CHUNK_SPLIT_THRESHOLD &&
+      rid != b->lid.rid) {
+    uint8_t *enc;
+    uint32_t encsize;
+    if (!(enc = ii_build_encode(ctx, b, &encsize))) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    rc = ii_build_split(ctx, b, enc, encsize);
+    GRN_FREE(enc);
+    if (rc) { return rc; }
+  }
+  if (b->ndf == b->max_ndf) {
+    uint32_t max = b->max_ndf ? b->max_ndf * 2 : 256;
+    for (i = 0; i < 4; i++) {
+      uint32_t *p = GRN_REALLOC(b->dvs[i], sizeof(uint32_t) * max);
+      if (!p) { return GRN_NO_MEMORY_AVAILABLE; }
+      b->dvs[i] = p;
+    }
+    b->max_ndf = max;
+  }
+  dgap = rid - b->lid.rid;
+  b->dvs[0][b->ndf] = dgap;
+  b->dvs[1][b->ndf] = (dgap ? sid : sid - b->lid.sid) - 1;
+  b->dvs[2][b->ndf] = tf - 1;
+  b->dvs[3][b->ndf] = rec[3];
+  b->ndf++;
+  b->df++;
+  if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
+    if ((rc = ii_build_reserve(ctx, (void **)&b->poss, &b->max_np,
+                               b->np + tf, sizeof(uint32_t)))) {
+      return rc;
+    }
+    for (i = 0; i < tf; i++) {
+      b->poss[b->np++] = rec[4 + i];
+      b->spos += rec[4 + i];
+    }
+  }
+  b->lid.rid = rid;
+  b->lid.sid = sid;
+  b->lid.tf = tf;
+  b->lid.weight = rec[3];
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_segment_flush(grn_ctx *ctx, ii_builder *b)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_ii *ii = b->ii;
+  if (!b->b) { return GRN_SUCCESS; }
+  if (b->dc_curr) {
+    uint32_t dcn;
+    grn_io_win dw;
+    if (!(rc = chunk_new(ctx, ii, &dcn, b->dc_curr))) {
+      fake_map2(ctx, ii->chunk, &dw, b->dc, dcn, b->dc_curr);
+      if (!(rc = grn_io_win_unmap2(&dw))) {
+        b->dc = NULL;
+        b->b->header.chunk = dcn;
+        b->b->header.chunk_size = b->dc_curr;
+        ii->header->total_chunk_size += b->dc_curr;
+      } else {
+        chunk_free(ctx, ii, dcn, 0, b->dc_curr);
+      }
+    }
+  }
+  b->b->header.buffer_free =
+    S_SEGMENT - sizeof(buffer_header) - b->b->header.nterms * sizeof(buffer_term);
+  buffer_close(ctx, ii, b->pseg);
+  b->b = NULL;
+  b->dc_curr = 0;
+  return rc;
+}
+
+static grn_rc
+ii_build_segment_open(grn_ctx *ctx, ii_builder *b)
+{
+  grn_rc rc;
+  grn_ii *ii = b->ii;
+  if (!b->dc && !(b->dc = GRN_MALLOC(II_BUILD_CHUNK_SIZE))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  b->lseg = NOT_ASSIGNED;
+  if ((rc = buffer_segment_new(ctx, ii, &b->lseg))) { return rc; }
+  if ((b->pseg = buffer_open(ctx, ii, SEG2POS(b->lseg, 0), NULL, &b->b)) == NOT_ASSIGNED) {
+    b->b = NULL;
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  memset(b->b, 0, S_SEGMENT);
+  b->b->header.chunk = NOT_ASSIGNED;
+  b->dc_curr = 0;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+ii_build_term_flush(grn_ctx *ctx, ii_builder *b)
+{
+  uint32_t *a;
+  grn_rc rc = GRN_SUCCESS;
+  grn_ii *ii = b->ii;
+  if (!b->df) { return GRN_SUCCESS; }
+  if (!(a = array_get(ctx, ii, b->tid))) { return GRN_NO_MEMORY_AVAILABLE; }
+  if ((ii->header->flags & GRN_OBJ_WITH_SECTION)
+      && !b->nchunks && b->ndf == 1 && b->lid.rid < 0x100000 &&
+      b->lid.sid < 0x800 && b->lid.tf == 1 && b->lid.weight == 0) {
+    a[0] = (b->lid.rid << 12) + (b->lid.sid << 1) + 1;
+    a[1] = (ii->header->flags & GRN_OBJ_WITH_POSITION) ? b->poss[0] : 0;
+  } else if (!(ii->header->flags & GRN_OBJ_WITH_SECTION)
+             && !b->nchunks && b->ndf == 1 && b->lid.tf == 1 && b->lid.weight == 0) {
+    a[0] = (b->lid.rid << 1) + 1;
+    a[1] = (ii->header->flags & GRN_OBJ_WITH_POSITION) ? b->poss[0] : 0;
+  } else {
+    uint8_t *enc, *dcp;
+    uint32_t i, encsize, size;
+    buffer_term *bt;
+    if (!(enc = ii_build_encode(ctx, b, &encsize))) {
+      rc = GRN_NO_MEMORY_AVAILABLE;
+      goto exit;
+    }
+    if (encsize > CHUNK_SPLIT_THRESHOLD) {
+      rc = ii_build_split(ctx, b, enc, encsize);
+      encsize = 0;
+    }
+    if (!rc) {
+      size = encsize + (b->nchunks ? (b->nchunks * 3 + 1) * 5 : 0);
+      if (b->b && (b->b->header.nterms == II_BUILD_NTERMS ||
+                   b->dc_curr + size > II_BUILD_CHUNK_SIZE)) {
+        rc = ii_build_segment_flush(ctx, b);
+      }
+      if (!rc && !b->b) { rc = ii_build_segment_open(ctx, b); }
+    }
+    if (!rc) {
+      dcp = b->dc + b->dc_curr;
+      if (b->nchunks) {
+        GRN_B_ENC(b->nchunks, dcp);
+        for (i = 0; i < b->nchunks; i++) {
+          GRN_B_ENC(b->cinfo[i].segno, dcp);
+          GRN_B_ENC(b->cinfo[i].size, dcp);
+          GRN_B_ENC(b->cinfo[i].dgap, dcp);
+        }
+      }
+      memcpy(dcp, enc, encsize);
+      dcp += encsize;
+      bt = &b->b->terms[b->b->header.nterms];
+      bt->tid = b->nchunks ? (b->tid | CHUNK_SPLIT) : b->tid;
+      bt->pos_in_chunk = b->dc_curr;
+      bt->size_in_chunk = (uint32_t)(dcp - (b->dc + b->dc_curr));
+      bt->pos_in_buffer = 0;
+      bt->size_in_buffer = 0;
+      a[0] = SEG2POS(b->lseg, (sizeof(buffer_header) +
+                               sizeof(buffer_term) * b->b->header.nterms));
+      a[1] = b->df;
+      b->b->header.nterms++;
+      b->dc_curr = (uint32_t)(dcp - b->dc);
+    }
+    GRN_FREE(enc);
+  }
+exit :
+  array_unref(ii, b->tid);
+  b->df = 0;
+  b->ndf = 0;
+  b->np = 0;
+  b->spos = 0;
+  b->nchunks = 0;
+  b->crid = GRN_ID_NIL;
+  memset(&b->lid, 0, sizeof(docinfo));
+  return rc;
+}
+
+static grn_rc
+ii_build_merge(grn_ctx *ctx, ii_builder *b)
+{
+  uint32_t i;
+  grn_rc rc = GRN_SUCCESS;
+  ii_build_run *run, *runs = b->runs, *rune = runs + b->nruns;
+  for (run = runs; run < rune; run++) { ii_build_run_next(ctx, b, run); }
+  for (;;) {
+    ii_build_run *min = NULL;
+    /* runs hold ascending record ids, so ties go to the earlier run */
+    for (run = runs; run < rune; run++) {
+      if (run->tid && (!min || run->tid < min->tid)) { min = run; }
+    }
+    if (!min) { break; }
+    if (min->tid != b->tid) {
+      if ((rc = ii_build_term_flush(ctx, b))) { return rc; }
+      b->tid = min->tid;
+    }
+    if ((rc = ii_build_add(ctx, b, min->rec))) { return rc; }
+    ii_build_run_next(ctx, b, min);
+  }
+  if ((rc = ii_build_term_flush(ctx, b))) { return rc; }
+  for (i = 0; i < b->nruns; i++) {
+    if (runs[i].fp && ferror(runs[i].fp)) {
+      SERR("fread");
+      return ctx->rc;
+    }
+  }
+  return ii_build_segment_flush(ctx, b);
+}
+
+grn_rc
+grn_ii_build(grn_ctx *ctx, grn_ii *ii)
+{
+  int i;
+  grn_rc rc;
+  grn_obj *table;
+  ii_builder b;
+  if (!ii || !ii->lexicon) {
+    ERR(GRN_INVALID_ARGUMENT, "grn_ii_build: invalid argument");
+    return ctx->rc;
+  }
+  /* a populated index is maintained by the set_value hooks */
+  if (!ii->obj.source_size || ii->header->amax || ii->header->bmax) {
+    return GRN_SUCCESS;
+  }
+  /* nothing to build, and no reason to allocate the block */
+  if (!(table = grn_ctx_at(ctx, ii->obj.range)) || !grn_table_size(ctx, table)) {
+    return GRN_SUCCESS;
+  }
+  memset(&b, 0, sizeof(ii_builder));
+  b.ii = ii;
+  if (!(b.block = GRN_MALLOC(sizeof(uint32_t) * II_BUILD_BLOCK_SIZE))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  b.block_size = II_BUILD_BLOCK_SIZE;
+  if (grn_io_lock(ctx, ii->seg, 10000000)) {
+    GRN_FREE(b.block);
+    return ctx->rc;
+  }
+  if (!(rc = ii_build_scan(ctx, &b))) {
+    if (b.nruns) {
+      rc = ii_build_spill(ctx, &b);
+    } else if (!(rc = ii_build_sort(ctx, &b))) {
+      /* everything fits in a block: merge it without touching the disk */
+      if ((b.runs = GRN_CALLOC(sizeof(ii_build_run)))) {
+        b.runs->entries = b.entries;
+        b.runs->nentries = b.nentries;
+        b.nruns = 1;
+      } else {
+        rc = GRN_NO_MEMORY_AVAILABLE;
+      }
+    }
+    if (!rc) { rc = ii_build_merge(ctx, &b); }
+  }
+  if (b.b) { buffer_close(ctx, ii, b.pseg); }
+  {
+    uint32_t version;
+    GRN_ATOMIC_ADD_EX(&ii->header->ub_version, 1, version);
+  }
+  grn_io_unlock(ii->seg);
+  for (i = 0; i < b.nruns; i++) {
+    if (b.runs[i].fp) { fclose(b.runs[i].fp); }
+    if (b.runs[i].buf) { GRN_FREE(b.runs[i].buf); }
+  }
+  for (i = 0; i < 4; i++) {
+    if (b.dvs[i]) { GRN_FREE(b.dvs[i]); }
+  }
+  if (b.runs) { GRN_FREE(b.runs); }
+  if (b.entries) { GRN_FREE(b.entries); }
+  if (b.tokens) { GRN_FREE(b.tokens); }
+  if (b.marks) { GRN_FREE(b.marks); }
+  if (b.posts) { GRN_FREE(b.posts); }
+  if (b.poss) { GRN_FREE(b.poss); }
+  if (b.cinfo) { GRN_FREE(b.cinfo); }
+  if (b.dc) { GRN_FREE(b.dc); }
+  GRN_FREE(b.block);
+  return rc;
+}
+
 /* token_info */
 
 typedef struct {
@@ -4890,8 +5875,8 @@ token_info_skip(grn_ctx *ctx, token_info *ti, uint32_t rid, uint32_t sid)
   for (;;) {
     if (!(c = cursor_heap_min(ti->cursors))) { return GRN_END_OF_DATA; }
     p = c->post;
-    if (p->rid > rid || (p->rid == rid && p->sid >= sid)) { break; }
-    cursor_heap_pop(ctx, ti->cursors);
+    if (POSTING_GE(p, rid, sid)) { break; }
+    cursor_heap_pop_skip(ctx, ti->cursors, rid, sid);
   }
   ti->pos = p->pos - ti->offset;
   ti->p = p;
@@ -5611,6 +6596,229 @@ grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len
   }
 }
 
+/* top-k */
+
+typedef struct {
+  token_info *ti;
+  grn_id rid;
+  uint64_t ub;
+} topk_term;
+
+typedef struct {
+  grn_id rid;
+  uint32_t score;
+} topk_rec;
+
+/* returns the maximum score a record can get from tid, which is the sum of
+   (tf + weight) over its sections. computed by a full scan of the posting
+   list and cached with header->ub_version, which grn_ii_update_one() of
+   any process increments after its update. a bound whose version is not
+   the current one is computed again. */
+static uint32_t
+term_upper_bound(grn_ctx *ctx, grn_ii *ii, grn_id tid)
+{
+  uint64_t *ub, cached;
+  uint32_t version, score = 0, max = 0;
+  grn_id rid = GRN_ID_NIL;
+  grn_ii_cursor *c;
+  grn_ii_posting *p;
+  GRN_TINY_ARRAY_AT(&ii->ubs, tid, ub);
+  if (!ub) { return 0xffffffff; }
+  version = *((volatile uint32_t *)&ii->header->ub_version);
+  cached = *ub;
+  if ((uint32_t)cached && (uint32_t)(cached >> 32) == version) {
+    return (uint32_t)cached;
+  }
+  if ((c = grn_ii_cursor_open(ctx, ii, tid, GRN_ID_NIL, GRN_ID_MAX,
+                              ii->n_elements - 1, 0))) {
+    while ((p = grn_ii_cursor_next(ctx, c))) {
+      if (p->rid != rid) {
+        if (score > max) { max = score; }
+        score = 0;
+        rid = p->rid;
+      }
+      score += p->tf + p->weight;
+    }
+    if (score > max) { max = score; }
+    grn_ii_cursor_close(ctx, c);
+  }
+  /* the bound and its version are stored at once. when an update landed
+     during the scan, the version is already stale. */
+  *ub = ((uint64_t)version << 32) | max;
+  return max;
+}
+
+inline static void
+topk_term_rewind(topk_term *t)
+{
+  grn_ii_cursor *c = cursor_heap_min(t->ti->cursors);
+  t->rid = c ? c->post->rid : GRN_ID_NIL;
+}
+
+inline static void
+topk_term_skip(grn_ctx *ctx, topk_term *t, grn_id rid)
+{
+  if (token_info_skip(ctx, t->ti, rid, 1)) {
+    t->rid = GRN_ID_NIL;
+  } else {
+    t->rid = t->ti->p->rid;
+  }
+}
+
+/* consumes all the postings of t->rid and returns their score. */
+inline static uint32_t
+topk_term_score(grn_ctx *ctx, topk_term *t)
+{
+  uint32_t score = 0;
+  grn_ii_cursor *c;
+  while ((c = cursor_heap_min(t->ti->cursors)) && c->post->rid == t->rid) {
+    score += c->post->tf + c->post->weight;
+    cursor_heap_pop(ctx, t->ti->cursors);
+  }
+  topk_term_rewind(t);
+  return score;
+}
+
+/* min-heap on score. a record is not added unless its score exceeds the
+   minimum score of a full heap. */
+inline static void
+topk_push(topk_rec *recs, int *nrecs, int k, grn_id rid, uint32_t score)
+{
+  int i, j;
+  if (*nrecs < k) {
+    for (i = (*nrecs)++; i; i = j) {
+      j = (i - 1) >> 1;
+      if (recs[j].score <= score) { break; }
+      recs[i] = recs[j];
+    }
+  } else {
+    if (score <= recs[0].score) { return; }
+    for (i = 0; (j = i * 2 + 1) < k; i = j) {
+      if (j + 1 < k && recs[j + 1].score < recs[j].score) { j++; }
+      if (score <= recs[j].score) { break; }
+      recs[i] = recs[j];
+    }
+  }
+  recs[i].rid = rid;
+  recs[i].score = score;
+}
+
+inline static int
+topk_term_compare(const void *a, const void *b)
+{
+  const topk_term *t1 = (const topk_term *)a, *t2 = (const topk_term *)b;
+  if (t1->rid == t2->rid) { return 0; }
+  if (!t1->rid) { return 1; }
+  if (!t2->rid) { return -1; }
+  return t1->rid < t2->rid ? -1 : 1;
+}
+
+/* adds to s only the k records with the highest scores for the AND/OR of
+   queries, skipping records which can not get into them by the upper
+   bounds of term scores (WAND). each query must be a single token.
+   nhits is set to the number of scored records, which is exact for AND
+   unless the scan stopped early and a lower bound for OR. */
+grn_rc
+grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii, grn_obj **queries, int nqueries,
+                    grn_operator op, int k, grn_hash *s, uint32_t *nhits)
+{
+  int i, m, n = 0, nrecs = 0;
+  uint64_t ubsum = 0, acc, theta;
+  grn_rc rc = GRN_SUCCESS;
+  topk_term *terms;
+  topk_rec *recs;
+  *nhits = 0;
+  if (!ii || !s || k <= 0 || (op != GRN_OP_AND && op != GRN_OP_OR)) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  if (!(terms = GRN_MALLOCN(topk_term, nqueries))) { return GRN_NO_MEMORY_AVAILABLE; }
+  if (!(recs = GRN_MALLOCN(topk_rec, k))) {
+    GRN_FREE(terms);
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  for (i = 0; i < nqueries; i++) {
+    uint32_t ntis = 0;
+    token_info **tis;
+    const char *str = GRN_BULK_HEAD(queries[i]);
+    unsigned int str_len = GRN_BULK_VSIZE(queries[i]);
+    if (!(tis = GRN_MALLOC(sizeof(token_info *) * (str_len * 2 + 1)))) {
+      rc = GRN_NO_MEMORY_AVAILABLE;
+      goto exit;
+    }
+    token_info_build(ctx, ii->lexicon, ii, str, str_len, tis, &ntis, GRN_OP_EXACT);
+    if (ntis == 1) {
+      int j;
+      cursor_heap *h = tis[0]->cursors;
+      terms[n].ti = tis[0];
+      terms[n].ub = 0;
+      for (j = 0; j < h->n_entries; j++) {
+        terms[n].ub += term_upper_bound(ctx, ii, h->bins[j]->id);
+      }
+      topk_term_rewind(&terms[n]);
+      ubsum += terms[n++].ub;
+    } else {
+      /* phrases and missing terms are left to grn_ii_sel() */
+      while (ntis--) { token_info_close(ctx, tis[ntis]); }
+      rc = GRN_OPERATION_NOT_SUPPORTED;
+    }
+    GRN_FREE(tis);
+    if (rc) { goto exit; }
+  }
+  if (op == GRN_OP_AND) {
+    for (;;) {
+      grn_id rid = GRN_ID_NIL;
+      uint32_t score = 0;
+      if (nrecs == k && ubsum <= recs[0].score) { break; }
+      for (i = 0; i < n; i++) {
+        if (!terms[i].rid) { goto done; }
+        if (terms[i].rid > rid) { rid = terms[i].rid; }
+      }
+      for (i = 0; i < n; i++) {
+        if (terms[i].rid < rid) { topk_term_skip(ctx, &terms[i], rid); }
+        if (terms[i].rid != rid) { break; }
+      }
+      if (i < n) { continue; }
+      for (i = 0; i < n; i++) { score += topk_term_score(ctx, &terms[i]); }
+      (*nhits)++;
+      topk_push(recs, &nrecs, k, rid, score);
+    }
+  } else {
+    for (;;) {
+      grn_id pivot;
+      theta = (nrecs == k) ? recs[0].score : 0;
+      qsort(terms, n, sizeof(topk_term), topk_term_compare);
+      for (m = 0; m < n && terms[m].rid; m++);
+      for (i = 0, acc = 0; i < m; i++) {
+        if ((acc += terms[i].ub) > theta) { break; }
+      }
+      if (i == m) { break; }
+      pivot = terms[i].rid;
+      if (terms[0].rid == pivot) {
+        uint32_t score = 0;
+        for (i = 0; i < m && terms[i].rid == pivot; i++) {
+          score += topk_term_score(ctx, &terms[i]);
+        }
+        (*nhits)++;
+        topk_push(recs, &nrecs, k, pivot, score);
+      } else {
+        while (i--) {
+          if (terms[i].rid < pivot) { topk_term_skip(ctx, &terms[i], pivot); }
+        }
+      }
+    }
+  }
+done :
+  for (i = 0; i < nrecs; i++) {
+    grn_rset_posinfo pi = {recs[i].rid, 0, 0};
+    res_add(ctx, s, &pi, recs[i].score, GRN_OP_OR);
+  }
+exit :
+  for (i = 0; i < n; i++) { token_info_close(ctx, terms[i].ti); }
+  GRN_FREE(recs);
+  GRN_FREE(terms);
+  return rc;
+}
+
 grn_rc
 grn_ii_at(grn_ctx *ctx, grn_ii *ii, grn_id id, grn_hash *s, grn_operator op)
 {
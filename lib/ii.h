@@ -50,6 +50,8 @@ struct _grn_ii {
   grn_encoding encoding;
   uint32_t n_elements;
   struct grn_ii_header *header;
+  grn_tiny_array ubs;         /* cached upper bounds of term scores and their versions */
+  uint32_t n_bulk_loaders;    /* chunk expiration is deferred while nonzero */
 };
 
 struct grn_ii_header;
@@ -91,6 +93,14 @@ uint32_t grn_ii_estimate_size(grn_ctx *ctx, grn_ii *ii, uint32_t key);
 
 void grn_ii_expire(grn_ctx *ctx, grn_ii *ii);
 
+grn_rc grn_ii_bulk_begin(grn_ctx *ctx, grn_ii *ii);
+grn_rc grn_ii_bulk_end(grn_ctx *ctx, grn_ii *ii);
+grn_rc grn_ii_build(grn_ctx *ctx, grn_ii *ii);
+
+int grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res);
+int grn_p_dec(grn_ctx *ctx, uint8_t *data, uint32_t data_size, uint32_t nreq, uint32_t **res);
+int grn_p_dec_avx2(int enable);
+
 typedef struct {
   grn_id rid;
   uint32_t sid;
@@ -108,8 +118,13 @@ grn_ii_cursor *grn_ii_cursor_openv1(grn_ii *ii, uint32_t key);
 grn_rc grn_ii_cursor_openv2(grn_ii_cursor **cursors, int ncursors);
 grn_ii_posting *grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c);
 grn_ii_posting *grn_ii_cursor_next_pos(grn_ctx *ctx, grn_ii_cursor *c);
+grn_ii_posting *grn_ii_cursor_skip(grn_ctx *ctx, grn_ii_cursor *c,
+                                   grn_id rid, uint32_t sid);
 grn_rc grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c);
 
+grn_rc grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii, grn_obj **queries, int nqueries,
+                           grn_operator op, int k, grn_hash *s, uint32_t *nhits);
+
 uint32_t grn_ii_max_section(grn_ii *ii);
 
 int grn_ii_check(grn_ii *ii);
@@ -25,6 +25,10 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif /* defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) */
 
 #include "ctx.h"
 #include "io.h"
@@ -32,6 +36,23 @@
 #include "ql.h"
 
 #define GRN_IO_IDSTR "GROONGA:IO:00001"
+/* the last digits of idstr are the version of the file format. builds
+   which only know GRN_IO_IDSTR refuse files of later versions. */
+#define GRN_IO_IDSTR_PREFIX_LEN 11
+#define GRN_IO_MAX_VERSION 2
+
+inline static uint32_t
+idstr_version(const char *idstr)
+{
+  uint32_t version = 0;
+  int i;
+  if (memcmp(idstr, GRN_IO_IDSTR, GRN_IO_IDSTR_PREFIX_LEN)) { return 0; }
+  for (i = GRN_IO_IDSTR_PREFIX_LEN; i < 16; i++) {
+    if (idstr[i] < '0' || '9' < idstr[i]) { return 0; }
+    version = version * 10 + (idstr[i] - '0');
+  }
+  return version <= GRN_IO_MAX_VERSION ? version : 0;
+}
 
 /* VA hack */
 /* max aio request (/proc/sys/fs/aio-max-nr) */
@@ -64,6 +85,7 @@ typedef struct _grn_io_header {
   uint32_t n_arrays;
   uint32_t lock;
   uint64_t curr_size;
+  uint32_t nwaiters; /* processes/threads sleeping in grn_io_lock() */
 } io_header;
 
 #define IO_HEADER_SIZE 64
@@ -149,6 +171,7 @@ grn_io_create_tmp(uint32_t header_size, uint32_t segment_size,
     header->n_arrays = 0;
     header->flags = flags;
     header->lock = 0;
+    header->nwaiters = 0;
     memcpy(header->idstr, GRN_IO_IDSTR, 16);
     if ((io = GRN_GMALLOCN(grn_io, 1))) {
       grn_io_mapinfo *maps = NULL;
@@ -223,6 +246,7 @@ grn_io_create(grn_ctx *ctx, const char *path, uint32_t header_size, uint32_t seg
         header->n_arrays = 0;
         header->flags = flags;
         header->lock = 0;
+        header->nwaiters = 0;
         memcpy(header->idstr, GRN_IO_IDSTR, 16);
         grn_msync(ctx, header, b);
         if ((io = GRN_GMALLOCN(grn_io, 1))) {
@@ -394,7 +418,7 @@ grn_io_detect_type(grn_ctx *ctx, const char *path)
     struct stat s;
     if (fstat(fd, &s) != -1 && s.st_size >= sizeof(io_header)) {
       if (read(fd, &h, sizeof(io_header)) == sizeof(io_header)) {
-        if (!memcmp(h.idstr, GRN_IO_IDSTR, 16)) {
+        if (idstr_version(h.idstr)) {
           res = h.type;
         } else {
           ERR(GRN_INCOMPATIBLE_FILE_FORMAT, "incompatible file format");
@@ -429,7 +453,7 @@ grn_io_open(grn_ctx *ctx, const char *path, grn_io_mode mode)
     if (fd == -1) { SERR(path); return NULL; }
     if (fstat(fd, &s) != -1 && s.st_size >= sizeof(io_header)) {
       if (read(fd, &h, sizeof(io_header)) == sizeof(io_header)) {
-        if (!memcmp(h.idstr, GRN_IO_IDSTR, 16)) {
+        if (idstr_version(h.idstr)) {
           header_size = h.header_size;
           segment_size = h.segment_size;
           max_segment = h.max_segment;
@@ -565,6 +589,27 @@ grn_io_get_type(grn_io *io)
   return io->header->type;
 }
 
+grn_rc
+grn_io_set_version(grn_io *io, uint32_t version)
+{
+  int i;
+  if (!io || !io->header || !version || version > GRN_IO_MAX_VERSION) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  for (i = 15; i >= GRN_IO_IDSTR_PREFIX_LEN; i--) {
+    io->header->idstr[i] = '0' + version % 10;
+    version /= 10;
+  }
+  return GRN_SUCCESS;
+}
+
+uint32_t
+grn_io_get_version(grn_io *io)
+{
+  if (!io || !io->header) { return 0; }
+  return idstr_version(io->header->idstr);
+}
+
 inline static void
 gen_pathname(const char *path, char *buffer, int fno)
 {
@@ -1453,33 +1498,78 @@ grn_io_anon_unmap(grn_ctx *ctx, grn_io_mapinfo *mi, size_t length)
   GRN_MUNMAP(ctx, &mi->fmo, mi->map, length);
 }
 
+/* grn_io_lock() spins for a while when the lock is taken, and then sleeps
+   until grn_io_unlock() wakes it up. A sleep lasts 1msec at most, so that
+   a missed wake up costs no more than the usleep() it replaces. A sleep
+   also ends as soon as the lock word changes, so timeout is counted with
+   the time actually slept rather than with the number of sleeps.
+   The futex is used here regardless of USE_FUTEX, which also turns on
+   GRN_FUTEX_WAIT/WAKE for segment references. */
+
+#define IO_LOCK_SPIN_COUNT 1000
+
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H)
+#define IO_LOCK_WAIT(io,lock) do {\
+  struct timespec timeout_ = {0, 1000000};\
+  syscall(SYS_futex, (io)->lock, FUTEX_WAIT, (lock), &timeout_);\
+} while (0)
+#define IO_LOCK_WAKE(io) syscall(SYS_futex, (io)->lock, FUTEX_WAKE, 1)
+#else /* defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) */
+#define IO_LOCK_WAIT(io,lock) usleep(1000)
+#define IO_LOCK_WAKE(io)
+#endif /* defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) */
+
+static grn_io_lock_statistics grn_io_lock_stat;
+
+#define IO_LOCK_USEC(begin,end)\
+  (((int64_t)(end).tv_sec - (begin).tv_sec) * 1000000 +\
+   ((int64_t)(end).tv_usec - (begin).tv_usec))
+
 grn_rc
 grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout)
 {
-  static int _ncalls = 0, _ncolls = 0;
-  uint32_t count;
-  _ncalls++;
+  uint32_t count, spin;
+  grn_timeval tv_begin, tv_start, tv_end;
   if (!io) { return GRN_INVALID_ARGUMENT; }
+  grn_io_lock_stat.nlocks++;
   for (count = 0;; count++) {
-    uint32_t lock;
-    GRN_ATOMIC_ADD_EX(io->lock, 1, lock);
-    if (lock) {
-      GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
-      if (!timeout || (timeout > 0 && timeout == count)) { break; }
-      if (!(++_ncolls % 1000000) && (_ncolls > _ncalls)) {
-        if (_ncolls < 0 || _ncalls < 0) {
-          _ncolls = 0; _ncalls = 0;
-        } else {
-          GRN_LOG(ctx, GRN_LOG_NOTICE, "io(%p) collisions(%d/%d)", io, _ncolls, _ncalls);
-        }
+    uint32_t lock, nwaiters;
+    for (spin = 0;; spin++) {
+      GRN_ATOMIC_ADD_EX(io->lock, 1, lock);
+      if (!lock) {
+        if (count || spin) { grn_io_lock_stat.ncollisions++; }
+        return GRN_SUCCESS;
       }
-      usleep(1000);
-      continue;
+      GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
+      if (!timeout || spin >= IO_LOCK_SPIN_COUNT) { break; }
+      while (spin < IO_LOCK_SPIN_COUNT && *(volatile uint32_t *)io->lock) { spin++; }
     }
-    return GRN_SUCCESS;
+    if (!timeout) { break; }
+    /* the timeout is measured from the first wait, because FUTEX_WAIT
+       returns at once while other waiters keep changing the lock. */
+    if (!count) {
+      grn_timeval_now(ctx, &tv_begin);
+    } else if (timeout > 0) {
+      grn_timeval_now(ctx, &tv_end);
+      if (IO_LOCK_USEC(tv_begin, tv_end) >= (int64_t)timeout * 1000) { break; }
+    }
+    /* nwaiters has to be raised before the lock is read for the wait, so
+       that grn_io_unlock() never misses a sleeper. */
+    GRN_ATOMIC_ADD_EX(&io->header->nwaiters, 1, nwaiters);
+    if ((lock = *(volatile uint32_t *)io->lock)) {
+      grn_timeval_now(ctx, &tv_start);
+      IO_LOCK_WAIT(io, lock);
+      grn_timeval_now(ctx, &tv_end);
+      grn_io_lock_stat.nwaits++;
+      grn_io_lock_stat.wait_time += IO_LOCK_USEC(tv_start, tv_end);
+    }
+    GRN_ATOMIC_ADD_EX(&io->header->nwaiters, -1, nwaiters);
   }
+  grn_io_lock_stat.ncollisions++;
+  if (timeout) { grn_io_lock_stat.ntimeouts++; }
   ERR(GRN_RESOURCE_DEADLOCK_AVOIDED, "grn_io_lock failed");
-  return ctx->rc;
+  /* not ctx->rc, which the backtrace logging of ERR() may have cleared */
+  return GRN_RESOURCE_DEADLOCK_AVOIDED;
 }
 
 void
@@ -1488,9 +1578,16 @@ grn_io_unlock(grn_io *io)
   if (io) {
     uint32_t lock;
     GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
+    if (*(volatile uint32_t *)&io->header->nwaiters) { IO_LOCK_WAKE(io); }
   }
 }
 
+void
+grn_io_get_lock_statistics(grn_io_lock_statistics *statistics)
+{
+  memcpy(statistics, &grn_io_lock_stat, sizeof(grn_io_lock_statistics));
+}
+
 void
 grn_io_clear_lock(grn_io *io)
 {
@@ -289,10 +289,20 @@ void *grn_io_array_at(grn_ctx *ctx, grn_io *io, uint32_t array, off_t offset, in
 void grn_io_segment_alloc(grn_ctx *ctx, grn_io *io, grn_io_array_info *ai,
                           uint32_t lseg, int *flags, void **p);
 
+/* counted without synchronization, so that they are approximate. */
+typedef struct {
+  uint64_t nlocks;      /* grn_io_lock() calls */
+  uint64_t ncollisions; /* calls which found the lock taken */
+  uint64_t nwaits;      /* sleeps until the lock is released */
+  uint64_t wait_time;   /* total time of the sleeps in usec */
+  uint64_t ntimeouts;
+} grn_io_lock_statistics;
+
 grn_rc grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout);
 void grn_io_unlock(grn_io *io);
 void grn_io_clear_lock(grn_io *io);
 uint32_t grn_io_is_locked(grn_io *io);
+void grn_io_get_lock_statistics(grn_io_lock_statistics *statistics);
 
 #define GRN_IO_ARRAY_AT(io,array,offset,flags,res) do {\
   grn_io_array_info *ainfo = &(io)->ainfo[array];\
@@ -343,6 +353,8 @@ void grn_io_anon_unmap(grn_ctx *ctx, grn_io_mapinfo *mi, size_t length);
 uint32_t grn_io_detect_type(grn_ctx *ctx, const char *path);
 grn_rc grn_io_set_type(grn_io *io, uint32_t type);
 uint32_t grn_io_get_type(grn_io *io);
+grn_rc grn_io_set_version(grn_io *io, uint32_t version);
+uint32_t grn_io_get_version(grn_io *io);
 
 grn_rc grn_io_init(void);
 grn_rc grn_io_fin(void);
@@ -46,6 +46,13 @@ typedef struct {
 #define PAT_DELETING  (1<<1)
 #define PAT_IMMEDIATE (1<<2)
 
+/* tables created with GRN_OBJ_KEY_INLINE have nodes of 32 bytes, which
+   keep keys up to PAT_INLINE_SIZE bytes after the pat_node instead of in
+   segment_key. */
+#define PAT_INLINE_SIZE 16
+#define PAT_INLINE(pat) ((pat)->obj.header.flags & GRN_OBJ_KEY_INLINE)
+#define PAT_IMD_SIZE(pat) (PAT_INLINE(pat) ? PAT_INLINE_SIZE : sizeof(uint32_t))
+
 #define PAT_DEL(x) ((x)->bits & PAT_DELETING)
 #define PAT_IMD(x) ((x)->bits & PAT_IMMEDIATE)
 #define PAT_LEN(x) (((x)->bits >> 3) + 1)
@@ -181,7 +188,7 @@ inline static uint8_t *
 pat_node_get_key(grn_ctx *ctx, grn_pat *pat, pat_node *n)
 {
   if (PAT_IMD(n)) {
-    return (uint8_t *) &n->key;
+    return PAT_INLINE(pat) ? (uint8_t *)(n + 1) : (uint8_t *) &n->key;
   } else {
     uint8_t *res;
     KEY_AT(pat, n->key, res, 0);
@@ -194,9 +201,9 @@ pat_node_set_key(grn_ctx *ctx, grn_pat *pat, pat_node *n, const uint8_t *key, un
 {
   if (!key || !len) { return GRN_INVALID_ARGUMENT; }
   PAT_LEN_SET(n, len);
-  if (len <= sizeof(uint32_t)) {
+  if (len <= PAT_IMD_SIZE(pat)) {
     PAT_IMD_ON(n);
-    memcpy(&n->key, key, len);
+    memcpy(pat_node_get_key(ctx, pat, n), key, len);
   } else {
     PAT_IMD_OFF(n);
     n->key = key_put(ctx, pat, key, len);
@@ -367,10 +374,11 @@ grn_pat_create(grn_ctx *ctx, const char *path, uint32_t key_size,
   for (w_of_element = 0; (1 << w_of_element) < entry_size; w_of_element++);
   {
     grn_io_array_spec array_spec[3];
+    uint32_t w_of_node = (flags & GRN_OBJ_KEY_INLINE) ? 5 : 4;
     array_spec[segment_key].w_of_element = 0;
     array_spec[segment_key].max_n_segments = 0x400;
-    array_spec[segment_pat].w_of_element = 4;
-    array_spec[segment_pat].max_n_segments = 1 << (30 - (22 - 4));
+    array_spec[segment_pat].w_of_element = w_of_node;
+    array_spec[segment_pat].max_n_segments = 1 << (30 - (22 - w_of_node));
     array_spec[segment_sis].w_of_element = w_of_element;
     array_spec[segment_sis].max_n_segments = 1 << (30 - (22 - w_of_element));
     io = grn_io_create_with_array(ctx, path, sizeof(struct grn_pat_header),
@@ -547,7 +555,7 @@ _grn_pat_add(grn_ctx *ctx, grn_pat *pat, const uint8_t *key, uint32_t size, uint
     c = len - 2;
   }
   {
-    uint32_t size2 = size > sizeof(uint32_t) ? size : 0;
+    uint32_t size2 = size > PAT_IMD_SIZE(pat) ? size : 0;
     if (*lkey && size2) {
       if (pat->header->garbages[0]) {
         r = pat->header->garbages[0];
@@ -752,7 +760,7 @@ grn_pat_nextid(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size)
 {
   grn_id r = GRN_ID_NIL;
   if (pat && key) {
-    if (!(r = pat->header->garbages[key_size > sizeof(uint32_t) ? key_size : 0])) {
+    if (!(r = pat->header->garbages[key_size > PAT_IMD_SIZE(pat) ? key_size : 0])) {
       r = pat->header->curr_rec + 1;
     }
   }
@@ -873,39 +881,69 @@ grn_pat_suffix_search2(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key
   return h;
 }
 
+#define LCP_NCANDS 16
+
+typedef struct {
+  grn_id id;
+  uint32_t len;
+  const uint8_t *key;
+} lcp_cand;
+
+/* returns the last candidate whose key is a prefix of key. */
+inline static grn_id
+lcp_verify(lcp_cand *cands, int n, const void *key)
+{
+  while (n--) {
+    if (!memcmp(cands[n].key, key, cands[n].len)) { return cands[n].id; }
+  }
+  return GRN_ID_NIL;
+}
+
+/* the keys of the nodes passed on the way are prefetched and compared
+   after the descent, so that their cache misses overlap. */
 grn_id
 grn_pat_lcp_search(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size)
 {
   pat_node *rn;
   grn_id r, r2 = GRN_ID_NIL;
   uint32_t len = key_size * 16;
-  int c0 = -1, c;
+  int c0 = -1, c, n = 0;
+  lcp_cand cands[LCP_NCANDS];
   if (!pat || !key || !(pat->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE)) { return GRN_ID_NIL; }
   PAT_AT(pat, 0, rn);
   for (r = rn->lr[1]; r;) {
     PAT_AT(pat, r, rn);
     if (!rn) { break; /* corrupt? */ }
     c = PAT_CHK(rn);
-    if (c <= c0) {
+    if (c <= c0 || ((c & 1) && len > c)) {
       if (PAT_LEN(rn) <= key_size) {
-        uint8_t *p = pat_node_get_key(ctx, pat, rn);
+        const uint8_t *p = pat_node_get_key(ctx, pat, rn);
         if (!p) { break; }
-        if (!memcmp(p, key, PAT_LEN(rn))) { return r; }
+        GRN_PREFETCH(p);
+        if (n == LCP_NCANDS) {
+          grn_id r3 = lcp_verify(cands, n, key);
+          if (r3) { r2 = r3; }
+          n = 0;
+        }
+        cands[n].id = r;
+        cands[n].len = PAT_LEN(rn);
+        cands[n].key = p;
+        n++;
       }
-      break;
+      if (c <= c0) { break; }
     }
     if (len <= c) { break; }
     if (c & 1) {
-      uint8_t *p = pat_node_get_key(ctx, pat, rn);
-      if (!p) { break; }
-      if (PAT_LEN(rn) <= key_size && !memcmp(p, key, PAT_LEN(rn))) { r2 = r; }
       r = (c + 1 < len) ? rn->lr[1] : rn->lr[0];
     } else {
       r = rn->lr[nth_bit((uint8_t *)key, c, len)];
     }
     c0 = c;
   }
-  return r2;
+  {
+    grn_id r3 = lcp_verify(cands, n, key);
+    return r3 ? r3 : r2;
+  }
 }
 
 inline static grn_rc
@@ -1426,6 +1464,22 @@ pop(grn_pat_cursor *c)
   return c->sp ? &c->ss[--c->sp] : NULL;
 }
 
+/* returns 1 if id is not deleted. the stored keys of fixed size keys are
+   encoded, so they must be decoded before looked up again. */
+inline static int
+grn_pat_id_exists(grn_ctx *ctx, grn_pat *pat, grn_id id)
+{
+  uint32_t key_size;
+  uint8_t keybuf[MAX_FIXED_KEY_SIZE];
+  const void *key = _grn_pat_key(ctx, pat, id, &key_size);
+  if (!key) { return 0; }
+  if (KEY_NEEDS_CONVERT(pat, key_size)) {
+    KEY_DEC(pat, keybuf, key, key_size);
+    key = keybuf;
+  }
+  return grn_pat_get(ctx, pat, key, key_size, NULL) == id;
+}
+
 static grn_id
 grn_pat_cursor_next_by_id(grn_ctx *ctx, grn_pat_cursor *c)
 {
@@ -1434,12 +1488,7 @@ grn_pat_cursor_next_by_id(grn_ctx *ctx, grn_pat_cursor *c)
   while (c->curr_rec != c->tail) {
     c->curr_rec += dir;
     if (pat->header->n_garbages) {
-      uint32_t key_size;
-      if (grn_pat_get(ctx, pat,
-                      _grn_pat_key(ctx, pat, c->curr_rec, &key_size),
-                      key_size, NULL) != c->curr_rec) {
-        continue;
-      }
+      if (!grn_pat_id_exists(ctx, pat, c->curr_rec)) { continue; }
     }
     c->rest--;
     return c->curr_rec;
@@ -1739,13 +1788,8 @@ grn_pat_cursor_open_by_id(grn_ctx *ctx, grn_pat *pat,
   }
   if (pat->header->n_garbages) {
     while (offset && c->curr_rec != c->tail) {
-      uint32_t key_size;
       c->curr_rec += dir;
-      if (grn_pat_get(ctx, pat,
-                      _grn_pat_key(ctx, pat, c->curr_rec, &key_size),
-                      key_size, NULL) == c->curr_rec) {
-        offset--;
-      }
+      if (grn_pat_id_exists(ctx, pat, c->curr_rec)) { offset--; }
     }
   } else {
     c->curr_rec += dir * offset;
@@ -1755,6 +1799,36 @@ exit :
   return c;
 }
 
+/* opens a cursor over the ids from min to max in the order of ids.
+   0 means no bound. */
+grn_pat_cursor *
+grn_pat_cursor_open_id_range(grn_ctx *ctx, grn_pat *pat,
+                             grn_id min, grn_id max, int flags)
+{
+  grn_pat_cursor *c;
+  if (!pat || !ctx) { return NULL; }
+  if (!(c = GRN_MALLOCN(grn_pat_cursor, 1))) { return NULL; }
+  GRN_DB_OBJ_SET_TYPE(c, GRN_CURSOR_TABLE_PAT_KEY);
+  c->pat = pat;
+  c->ctx = ctx;
+  c->obj.header.flags = flags|GRN_CURSOR_BY_ID;
+  c->obj.header.domain = GRN_ID_NIL;
+  c->size = 0;
+  c->sp = 0;
+  c->ss = NULL;
+  if (!max || pat->header->curr_rec < max) { max = pat->header->curr_rec; }
+  if (!min) { min = GRN_ID_NIL + 1; }
+  if (flags & GRN_CURSOR_DESCENDING) {
+    c->curr_rec = max + 1;
+    c->tail = (min <= max) ? min : c->curr_rec;
+  } else {
+    c->curr_rec = min - 1;
+    c->tail = (min <= max) ? max : c->curr_rec;
+  }
+  c->rest = GRN_ID_MAX;
+  return c;
+}
+
 grn_pat_cursor *
 grn_pat_cursor_open(grn_ctx *ctx, grn_pat *pat,
                     const void *min, uint32_t min_size,
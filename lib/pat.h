@@ -62,7 +62,8 @@ struct grn_pat_header {
   int32_t curr_del2;
   int32_t curr_del3;
   uint32_t n_garbages;
-  uint32_t reserved[1005];
+  uint32_t modified;
+  uint32_t reserved[1004];
   grn_pat_delinfo delinfos[GRN_PAT_NDELINFOS];
   grn_id garbages[GRN_PAT_MAX_KEY_SIZE + 1];
 };
@@ -88,6 +89,8 @@ struct _grn_pat_cursor {
 };
 
 grn_id grn_pat_curr_id(grn_ctx *ctx, grn_pat *pat);
+grn_pat_cursor *grn_pat_cursor_open_id_range(grn_ctx *ctx, grn_pat *pat,
+                                             grn_id min, grn_id max, int flags);
 
 /* private */
 const char *_grn_pat_key(grn_ctx *ctx, grn_pat *pat, grn_id id, uint32_t *key_size);
@@ -28,11 +28,19 @@ const char *admin_html_path = NULL;
 /**** procs ****/
 
 #define GET_OTYPE(var) \
-  ((GRN_TEXT_LEN(var) && *(GRN_TEXT_VALUE(var)) == 't') ? GRN_CONTENT_TSV : GRN_CONTENT_JSON)
+  (!GRN_TEXT_LEN(var) ? GRN_CONTENT_JSON :\
+   *(GRN_TEXT_VALUE(var)) == 't' ? GRN_CONTENT_TSV :\
+   *(GRN_TEXT_VALUE(var)) == 'm' ? GRN_CONTENT_MSGPACK : GRN_CONTENT_JSON)
 
 #define DEFAULT_LIMIT           10
 #define DEFAULT_OUTPUT_COLUMNS  "_id _key _value *"
 
+#define PUT_CACHE_KEY(ctx,key,value,len) {\
+  grn_text_itoa((ctx), (key), (len));\
+  GRN_TEXT_PUTC((ctx), (key), ':');\
+  grn_bulk_write((ctx), (key), (value), (len));\
+}
+
 static grn_obj *
 proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
 {
@@ -40,7 +48,14 @@ proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   grn_expr_var *vars;
   grn_obj *outbuf = args[0];
   grn_proc_get_info(ctx, user_data, &vars, &nvars, NULL);
-  if (nvars == 15) {
+  if (nvars == 18) {
+    uint32_t i, start, n_output_flushes, n_volatile_procs;
+    grn_obj key;
+    grn_obj *db = grn_ctx_db(ctx);
+    uint32_t modified = grn_db_modified(db);
+    /* foreach may modify records, so that its result is never cached. */
+    int cacheable = !GRN_TEXT_LEN(&vars[4].value);
+    grn_content_type otype = GET_OTYPE(&vars[14].value);
     int offset = GRN_TEXT_LEN(&vars[7].value)
       ? grn_atoi(GRN_TEXT_VALUE(&vars[7].value), GRN_BULK_CURR(&vars[7].value), NULL)
       : 0;
@@ -53,7 +68,38 @@ proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
       output_columns = DEFAULT_OUTPUT_COLUMNS;
       output_columns_len = strlen(DEFAULT_OUTPUT_COLUMNS);
     }
-    grn_search(ctx, outbuf, GET_OTYPE(&vars[14].value),
+    GRN_TEXT_INIT(&key, 0);
+    if (cacheable) {
+      for (i = 0; i < nvars; i++) {
+        switch (i) {
+        case 6 : /* output_columns */
+          PUT_CACHE_KEY(ctx, &key, output_columns, output_columns_len);
+          break;
+        case 7 : /* offset */
+          grn_text_itoa(ctx, &key, offset);
+          break;
+        case 8 : /* limit */
+          grn_text_itoa(ctx, &key, limit);
+          break;
+        case 14 : /* output_type */
+          grn_text_itoa(ctx, &key, otype);
+          break;
+        default :
+          PUT_CACHE_KEY(ctx, &key, GRN_TEXT_VALUE(&vars[i].value),
+                        GRN_TEXT_LEN(&vars[i].value));
+          break;
+        }
+        GRN_TEXT_PUTC(ctx, &key, '\0');
+      }
+      if (grn_cache_fetch(ctx, db, GRN_TEXT_VALUE(&key), GRN_TEXT_LEN(&key), outbuf)) {
+        GRN_OBJ_FIN(ctx, &key);
+        return outbuf;
+      }
+    }
+    start = GRN_TEXT_LEN(outbuf);
+    n_output_flushes = ctx->impl->n_output_flushes;
+    n_volatile_procs = ctx->impl->n_volatile_procs;
+    grn_select(ctx, outbuf, otype,
                GRN_TEXT_VALUE(&vars[0].value), GRN_TEXT_LEN(&vars[0].value),
                GRN_TEXT_VALUE(&vars[1].value), GRN_TEXT_LEN(&vars[1].value),
                GRN_TEXT_VALUE(&vars[2].value), GRN_TEXT_LEN(&vars[2].value),
@@ -66,7 +112,18 @@ proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
                GRN_TEXT_VALUE(&vars[10].value), GRN_TEXT_LEN(&vars[10].value),
                GRN_TEXT_VALUE(&vars[11].value), GRN_TEXT_LEN(&vars[11].value),
                grn_atoi(GRN_TEXT_VALUE(&vars[12].value), GRN_BULK_CURR(&vars[12].value), NULL),
-               grn_atoi(GRN_TEXT_VALUE(&vars[13].value), GRN_BULK_CURR(&vars[13].value), NULL));
+               grn_atoi(GRN_TEXT_VALUE(&vars[13].value), GRN_BULK_CURR(&vars[13].value), NULL),
+               GRN_TEXT_VALUE(&vars[16].value), GRN_TEXT_LEN(&vars[16].value),
+               GRN_TEXT_VALUE(&vars[17].value), GRN_TEXT_LEN(&vars[17].value),
+               grn_atoi(GRN_TEXT_VALUE(&vars[15].value), GRN_BULK_CURR(&vars[15].value), NULL));
+    /* a part of the result has already been flushed out of outbuf, or
+       the expressions refer to rand() or now(). */
+    if (cacheable && !ctx->rc && n_output_flushes == ctx->impl->n_output_flushes &&
+        n_volatile_procs == ctx->impl->n_volatile_procs) {
+      grn_cache_update(ctx, db, modified, GRN_TEXT_VALUE(&key), GRN_TEXT_LEN(&key),
+                       GRN_TEXT_VALUE(outbuf) + start, GRN_TEXT_LEN(outbuf) - start);
+    }
+    GRN_OBJ_FIN(ctx, &key);
   }
   return outbuf;
 }
@@ -130,8 +187,73 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
       grn_text_itoa(ctx, outbuf, grn_starttime.tv_sec);
       GRN_TEXT_PUTS(ctx, outbuf, ",\"uptime\":");
       grn_text_itoa(ctx, outbuf, now.tv_sec - grn_starttime.tv_sec);
+      {
+        grn_cache_statistics cache;
+        grn_cache_get_statistics(&cache);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"cache_entries\":");
+        grn_text_itoa(ctx, outbuf, cache.nentries);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"cache_size\":");
+        grn_text_lltoa(ctx, outbuf, cache.size);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"cache_fetches\":");
+        grn_text_lltoa(ctx, outbuf, cache.nfetches);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"cache_hits\":");
+        grn_text_lltoa(ctx, outbuf, cache.nhits);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"cache_hit_rate\":");
+        grn_text_ftoa(ctx, outbuf, cache.nfetches
+                      ? (double)cache.nhits / cache.nfetches : 0.0);
+      }
+      {
+        grn_io_lock_statistics lock;
+        grn_io_get_lock_statistics(&lock);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"lock_count\":");
+        grn_text_lltoa(ctx, outbuf, lock.nlocks);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"lock_collisions\":");
+        grn_text_lltoa(ctx, outbuf, lock.ncollisions);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"lock_waits\":");
+        grn_text_lltoa(ctx, outbuf, lock.nwaits);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"lock_wait_time\":");
+        grn_text_lltoa(ctx, outbuf, lock.wait_time);
+        GRN_TEXT_PUTS(ctx, outbuf, ",\"lock_timeouts\":");
+        grn_text_lltoa(ctx, outbuf, lock.ntimeouts);
+      }
       GRN_TEXT_PUTC(ctx, outbuf, '}');
       break;
+    case GRN_CONTENT_MSGPACK:
+      {
+        grn_cache_statistics cache;
+        grn_io_lock_statistics lock;
+        grn_cache_get_statistics(&cache);
+        grn_io_get_lock_statistics(&lock);
+        grn_text_msgpack_map(ctx, outbuf, 13);
+        grn_text_msgpack_raw(ctx, outbuf, "alloc_count", 11);
+        grn_text_msgpack_int(ctx, outbuf, grn_alloc_count());
+        grn_text_msgpack_raw(ctx, outbuf, "starttime", 9);
+        grn_text_msgpack_int(ctx, outbuf, grn_starttime.tv_sec);
+        grn_text_msgpack_raw(ctx, outbuf, "uptime", 6);
+        grn_text_msgpack_int(ctx, outbuf, now.tv_sec - grn_starttime.tv_sec);
+        grn_text_msgpack_raw(ctx, outbuf, "cache_entries", 13);
+        grn_text_msgpack_uint(ctx, outbuf, cache.nentries);
+        grn_text_msgpack_raw(ctx, outbuf, "cache_size", 10);
+        grn_text_msgpack_uint(ctx, outbuf, cache.size);
+        grn_text_msgpack_raw(ctx, outbuf, "cache_fetches", 13);
+        grn_text_msgpack_uint(ctx, outbuf, cache.nfetches);
+        grn_text_msgpack_raw(ctx, outbuf, "cache_hits", 10);
+        grn_text_msgpack_uint(ctx, outbuf, cache.nhits);
+        grn_text_msgpack_raw(ctx, outbuf, "cache_hit_rate", 14);
+        grn_text_msgpack_float(ctx, outbuf, cache.nfetches
+                               ? (double)cache.nhits / cache.nfetches : 0.0);
+        grn_text_msgpack_raw(ctx, outbuf, "lock_count", 10);
+        grn_text_msgpack_uint(ctx, outbuf, lock.nlocks);
+        grn_text_msgpack_raw(ctx, outbuf, "lock_collisions", 15);
+        grn_text_msgpack_uint(ctx, outbuf, lock.ncollisions);
+        grn_text_msgpack_raw(ctx, outbuf, "lock_waits", 10);
+        grn_text_msgpack_uint(ctx, outbuf, lock.nwaits);
+        grn_text_msgpack_raw(ctx, outbuf, "lock_wait_time", 14);
+        grn_text_msgpack_uint(ctx, outbuf, lock.wait_time);
+        grn_text_msgpack_raw(ctx, outbuf, "lock_timeouts", 13);
+        grn_text_msgpack_uint(ctx, outbuf, lock.ntimeouts);
+      }
+      break;
     }
   }
   return outbuf;
@@ -278,6 +400,16 @@ print_columninfo(grn_ctx *ctx, grn_obj *column, grn_obj *buf, grn_content_type o
     /* TODO: flags to str, domain to str */
     GRN_TEXT_PUTC(ctx, buf, ']');
     break;
+  case GRN_CONTENT_MSGPACK:
+    grn_text_msgpack_array(ctx, buf, 6);
+    grn_text_msgpack_uint(ctx, buf, id);
+    grn_text_msgpack_raw(ctx, buf, name, name_len);
+    grn_text_msgpack_raw(ctx, buf, path, GRN_STRLEN(path));
+    /* without the quotes */
+    grn_text_msgpack_raw(ctx, buf, type + 1, strlen(type) - 2);
+    grn_text_msgpack_uint(ctx, buf, column->header.flags);
+    grn_text_msgpack_uint(ctx, buf, column->header.domain);
+    break;
   }
   return 1;
 }
@@ -331,10 +463,32 @@ print_tableinfo(grn_ctx *ctx, grn_obj *table, grn_obj *buf, grn_content_type oty
     /* TODO: domain to str */
     GRN_TEXT_PUTC(ctx, buf, ']');
     break;
+  case GRN_CONTENT_MSGPACK:
+    grn_text_msgpack_array(ctx, buf, 5);
+    grn_text_msgpack_uint(ctx, buf, id);
+    grn_text_msgpack_raw(ctx, buf, name, name_len);
+    grn_text_msgpack_raw(ctx, buf, path, GRN_STRLEN(path));
+    grn_text_msgpack_uint(ctx, buf, table->header.flags);
+    grn_text_msgpack_uint(ctx, buf, table->header.domain);
+    break;
   }
   return 1;
 }
 
+/* MessagePack has to know the number of rows before writing them. */
+static void
+msgpack_put_list(grn_ctx *ctx, grn_obj *buf, const char **names, int nnames,
+                 grn_obj *rows, uint32_t nrows)
+{
+  int i;
+  grn_text_msgpack_array(ctx, buf, nrows + 1);
+  grn_text_msgpack_array(ctx, buf, nnames);
+  for (i = 0; i < nnames; i++) {
+    grn_text_msgpack_raw(ctx, buf, names[i], strlen(names[i]));
+  }
+  GRN_TEXT_PUT(ctx, buf, GRN_TEXT_VALUE(rows), GRN_TEXT_LEN(rows));
+}
+
 static grn_obj *
 proc_column_list(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
 {
@@ -353,7 +507,9 @@ proc_column_list(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_da
                                   GRN_OBJ_TABLE_HASH_KEY|GRN_HASH_TINY))) {
         if (grn_table_columns(ctx, table, NULL, 0, (grn_obj *)cols) >= 0) {
           grn_id *key;
-          char line_delimiter, column_delimiter;
+          char line_delimiter = '\n', column_delimiter = '\t';
+          grn_obj rows;
+          uint32_t nrows = 0;
 
           switch (otype) {
           case GRN_CONTENT_TSV:
@@ -366,20 +522,31 @@ proc_column_list(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_da
             column_delimiter = ',';
             GRN_TEXT_PUTS(ctx, buf, "[[\"id\",\"name\",\"path\",\"type\",\"flags\",\"domain\"]");
             break;
+          case GRN_CONTENT_MSGPACK:
+            GRN_TEXT_INIT(&rows, 0);
+            break;
           }
 
           GRN_HASH_EACH(ctx, cols, id, &key, NULL, NULL, {
             grn_obj *col;
             if ((col = grn_ctx_at(ctx, *key))) {
-              GRN_TEXT_PUTC(ctx, buf, line_delimiter);
-              if (!print_columninfo(ctx, col, buf, otype)) {
-                grn_bulk_truncate(ctx, buf, GRN_BULK_VSIZE(buf) - 1);
+              if (otype == GRN_CONTENT_MSGPACK) {
+                if (print_columninfo(ctx, col, &rows, otype)) { nrows++; }
+              } else {
+                GRN_TEXT_PUTC(ctx, buf, line_delimiter);
+                if (!print_columninfo(ctx, col, buf, otype)) {
+                  grn_bulk_truncate(ctx, buf, GRN_BULK_VSIZE(buf) - 1);
+                }
               }
               grn_obj_unlink(ctx, col);
             }
           });
           if (otype == GRN_CONTENT_JSON) {
             GRN_TEXT_PUTC(ctx, buf, ']');
+          } else if (otype == GRN_CONTENT_MSGPACK) {
+            const char *names[] = {"id", "name", "path", "type", "flags", "domain"};
+            msgpack_put_list(ctx, buf, names, 6, &rows, nrows);
+            GRN_OBJ_FIN(ctx, &rows);
           }
         }
         grn_hash_close(ctx, cols);
@@ -402,8 +569,10 @@ proc_table_list(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_dat
     grn_table_cursor *cur;
     if ((cur = grn_table_cursor_open(ctx, db, NULL, 0, NULL, 0, 0, 0, 0))) {
       grn_id id;
-      char line_delimiter, column_delimiter;
+      char line_delimiter = '\n', column_delimiter = '\t';
       grn_content_type otype = GET_OTYPE(&vars[0].value);
+      grn_obj rows;
+      uint32_t nrows = 0;
 
       switch (otype) {
       case GRN_CONTENT_TSV:
@@ -416,20 +585,31 @@ proc_table_list(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_dat
         column_delimiter = ',';
         GRN_TEXT_PUTS(ctx, buf, "[[\"id\",\"name\",\"path\",\"flags\",\"domain\"]");
         break;
+      case GRN_CONTENT_MSGPACK:
+        GRN_TEXT_INIT(&rows, 0);
+        break;
       }
       while ((id = grn_table_cursor_next(ctx, cur)) != GRN_ID_NIL) {
         grn_obj *o;
 
         if ((o = grn_ctx_at(ctx, id))) {
-          GRN_TEXT_PUTC(ctx, buf, line_delimiter);
-          if (!print_tableinfo(ctx, o, buf, otype)) {
-            grn_bulk_truncate(ctx, buf, GRN_BULK_VSIZE(buf) - 1);
+          if (otype == GRN_CONTENT_MSGPACK) {
+            if (print_tableinfo(ctx, o, &rows, otype)) { nrows++; }
+          } else {
+            GRN_TEXT_PUTC(ctx, buf, line_delimiter);
+            if (!print_tableinfo(ctx, o, buf, otype)) {
+              grn_bulk_truncate(ctx, buf, GRN_BULK_VSIZE(buf) - 1);
+            }
           }
           grn_obj_unlink(ctx, o);
         }
       }
       if (otype == GRN_CONTENT_JSON) {
         GRN_TEXT_PUTC(ctx, buf, ']');
+      } else if (otype == GRN_CONTENT_MSGPACK) {
+        const char *names[] = {"id", "name", "path", "flags", "domain"};
+        msgpack_put_list(ctx, buf, names, 5, &rows, nrows);
+        GRN_OBJ_FIN(ctx, &rows);
       }
       grn_table_cursor_close(ctx, cur);
     }
@@ -556,7 +736,8 @@ proc_view_add(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
 void
 grn_db_init_builtin_query(grn_ctx *ctx)
 {
-  grn_expr_var vars[16];
+  grn_obj *obj;
+  grn_expr_var vars[19];
   DEF_VAR(vars[0], "name");
   DEF_VAR(vars[1], "table");
   DEF_VAR(vars[2], "match_column");
@@ -573,11 +754,14 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_VAR(vars[13], "drilldown_offset");
   DEF_VAR(vars[14], "drilldown_limit");
   DEF_VAR(vars[15], "output_type");
+  DEF_VAR(vars[16], "top_k");
+  DEF_VAR(vars[17], "drilldown_calc_types");
+  DEF_VAR(vars[18], "drilldown_calc_target");
   grn_proc_create(ctx, "define_selector", 15, NULL, GRN_PROC_PROCEDURE,
-                  proc_define_selector, NULL, NULL, 16, vars);
+                  proc_define_selector, NULL, NULL, 19, vars);
 
   grn_proc_create(ctx, "select", 6, NULL, GRN_PROC_PROCEDURE,
-                  proc_select, NULL, NULL, 15, vars + 1);
+                  proc_select, NULL, NULL, 18, vars + 1);
 
   DEF_VAR(vars[0], "values");
   DEF_VAR(vars[1], "table");
@@ -624,9 +808,11 @@ grn_db_init_builtin_query(grn_ctx *ctx)
                   NULL, GRN_PROC_PROCEDURE, proc_missing, NULL, NULL, 2, vars);
 
   DEF_VAR(vars[0], "seed");
-  grn_proc_create(ctx, "rand", 4, NULL, GRN_PROC_FUNCTION, proc_rand, NULL, NULL, 0, vars);
+  obj = grn_proc_create(ctx, "rand", 4, NULL, GRN_PROC_FUNCTION, proc_rand, NULL, NULL, 0, vars);
+  if (obj) { obj->header.impl_flags |= GRN_OBJ_VOLATILE; }
 
-  grn_proc_create(ctx, "now", 3, NULL, GRN_PROC_FUNCTION, proc_now, NULL, NULL, 0, vars);
+  obj = grn_proc_create(ctx, "now", 3, NULL, GRN_PROC_FUNCTION, proc_now, NULL, NULL, 0, vars);
+  if (obj) { obj->header.impl_flags |= GRN_OBJ_VOLATILE; }
 
   DEF_VAR(vars[0], "view");
   DEF_VAR(vars[1], "table");
@@ -146,6 +146,9 @@ typedef struct {
   grn_obj values;
   grn_obj level;
   grn_obj columns;
+  grn_obj counts;  /* elements left in each open MessagePack container */
+  grn_obj rest;    /* incomplete MessagePack element */
+  grn_obj indexes; /* index columns switched to bulk load mode */
   grn_obj *table;
   grn_obj *last;
   grn_obj *ifexists;
@@ -153,6 +156,7 @@ typedef struct {
   uint32_t values_size;
   uint32_t nrecords;
   grn_loader_stat stat;
+  grn_content_type input_type; /* kept while values span messages */
 } grn_loader;
 
 typedef struct {
@@ -222,6 +226,8 @@ struct _grn_ctx_impl {
   grn_obj subbuf;
   unsigned int bufcur;
   void (*output)(grn_ctx *, int, void *);
+  uint32_t n_output_flushes;
+  uint32_t n_volatile_procs;
   grn_com *com;
   unsigned int com_status;
   union {
@@ -2371,6 +2371,7 @@ grn_text_otoj(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj, grn_obj_format *format)
           grn_text_otoj(ctx, bulk, &buf, NULL);
         }
         GRN_TEXT_PUTC(ctx, bulk, ']');
+        grn_ctx_output_flush(ctx, bulk);
       }
       GRN_TEXT_PUTC(ctx, bulk, ']');
       grn_table_cursor_close(ctx, tc);
@@ -2397,6 +2398,334 @@ grn_text_otoj(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj, grn_obj_format *format)
   return GRN_SUCCESS;
 }
 
+/* MessagePack */
+
+static grn_rc
+msgpack_put(grn_ctx *ctx, grn_obj *bulk, uint8_t type, const void *value, unsigned int size)
+{
+  uint8_t buf[9];
+  buf[0] = type;
+  grn_hton(buf + 1, value, size);
+  return grn_bulk_write(ctx, bulk, (char *)buf, size + 1);
+}
+
+grn_rc
+grn_text_msgpack_nil(grn_ctx *ctx, grn_obj *bulk)
+{
+  return msgpack_put(ctx, bulk, 0xc0, NULL, 0);
+}
+
+grn_rc
+grn_text_msgpack_bool(grn_ctx *ctx, grn_obj *bulk, int b)
+{
+  return msgpack_put(ctx, bulk, b ? 0xc3 : 0xc2, NULL, 0);
+}
+
+grn_rc
+grn_text_msgpack_uint(grn_ctx *ctx, grn_obj *bulk, uint64_t i)
+{
+  if (i < 0x80) {
+    return msgpack_put(ctx, bulk, (uint8_t)i, NULL, 0);
+  } else if (i <= 0xff) {
+    uint8_t v = (uint8_t)i;
+    return msgpack_put(ctx, bulk, 0xcc, &v, sizeof(v));
+  } else if (i <= 0xffff) {
+    uint16_t v = (uint16_t)i;
+    return msgpack_put(ctx, bulk, 0xcd, &v, sizeof(v));
+  } else if (i <= 0xffffffff) {
+    uint32_t v = (uint32_t)i;
+    return msgpack_put(ctx, bulk, 0xce, &v, sizeof(v));
+  } else {
+    return msgpack_put(ctx, bulk, 0xcf, &i, sizeof(i));
+  }
+}
+
+grn_rc
+grn_text_msgpack_int(grn_ctx *ctx, grn_obj *bulk, int64_t i)
+{
+  if (i >= 0) {
+    return grn_text_msgpack_uint(ctx, bulk, (uint64_t)i);
+  } else if (i >= -32) {
+    return msgpack_put(ctx, bulk, (uint8_t)i, NULL, 0);
+  } else if (i >= INT8_MIN) {
+    int8_t v = (int8_t)i;
+    return msgpack_put(ctx, bulk, 0xd0, &v, sizeof(v));
+  } else if (i >= INT16_MIN) {
+    int16_t v = (int16_t)i;
+    return msgpack_put(ctx, bulk, 0xd1, &v, sizeof(v));
+  } else if (i >= INT32_MIN) {
+    int32_t v = (int32_t)i;
+    return msgpack_put(ctx, bulk, 0xd2, &v, sizeof(v));
+  } else {
+    return msgpack_put(ctx, bulk, 0xd3, &i, sizeof(i));
+  }
+}
+
+grn_rc
+grn_text_msgpack_float(grn_ctx *ctx, grn_obj *bulk, double d)
+{
+  return msgpack_put(ctx, bulk, 0xcb, &d, sizeof(d));
+}
+
+grn_rc
+grn_text_msgpack_raw(grn_ctx *ctx, grn_obj *bulk, const char *s, unsigned int len)
+{
+  grn_rc rc;
+  if (len < 0x20) {
+    rc = msgpack_put(ctx, bulk, 0xa0 | len, NULL, 0);
+  } else if (len < 0x10000) {
+    uint16_t v = (uint16_t)len;
+    rc = msgpack_put(ctx, bulk, 0xda, &v, sizeof(v));
+  } else {
+    uint32_t v = (uint32_t)len;
+    rc = msgpack_put(ctx, bulk, 0xdb, &v, sizeof(v));
+  }
+  return rc ? rc : grn_bulk_write(ctx, bulk, s, len);
+}
+
+grn_rc
+grn_text_msgpack_array(grn_ctx *ctx, grn_obj *bulk, unsigned int n)
+{
+  if (n < 0x10) {
+    return msgpack_put(ctx, bulk, 0x90 | n, NULL, 0);
+  } else if (n < 0x10000) {
+    uint16_t v = (uint16_t)n;
+    return msgpack_put(ctx, bulk, 0xdc, &v, sizeof(v));
+  } else {
+    uint32_t v = (uint32_t)n;
+    return msgpack_put(ctx, bulk, 0xdd, &v, sizeof(v));
+  }
+}
+
+grn_rc
+grn_text_msgpack_map(grn_ctx *ctx, grn_obj *bulk, unsigned int n)
+{
+  if (n < 0x10) {
+    return msgpack_put(ctx, bulk, 0x80 | n, NULL, 0);
+  } else if (n < 0x10000) {
+    uint16_t v = (uint16_t)n;
+    return msgpack_put(ctx, bulk, 0xde, &v, sizeof(v));
+  } else {
+    uint32_t v = (uint32_t)n;
+    return msgpack_put(ctx, bulk, 0xdf, &v, sizeof(v));
+  }
+}
+
+static unsigned int
+table_cursor_count(grn_ctx *ctx, grn_obj *table, int offset, int limit)
+{
+  unsigned int n = 0;
+  grn_obj id;
+  grn_table_cursor *tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                                               offset, limit, GRN_CURSOR_ASCENDING);
+  if (tc) {
+    GRN_TEXT_INIT(&id, 0);
+    while (!grn_table_cursor_next_o(ctx, tc, &id)) { n++; }
+    GRN_OBJ_FIN(ctx, &id);
+    grn_table_cursor_close(ctx, tc);
+  }
+  return n;
+}
+
+static void
+column_value_otomsgpack(grn_ctx *ctx, grn_obj *bulk, grn_obj *column, grn_obj *id,
+                        grn_obj *buf)
+{
+  if (column->header.type == GRN_COLUMN_VAR_SIZE &&
+      (column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) == GRN_OBJ_COLUMN_VECTOR) {
+    /* vector columns are written as arrays instead of their raw bytes. */
+    grn_obj value;
+    grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, column));
+    if (range && range->header.type == GRN_TYPE) {
+      GRN_OBJ_INIT(&value, GRN_VECTOR, 0, GRN_DB_TEXT);
+    } else {
+      GRN_TEXT_INIT(&value, 0);
+    }
+    grn_obj_get_value_o(ctx, column, id, &value);
+    grn_text_otomsgpack(ctx, bulk, &value, NULL);
+    grn_obj_close(ctx, &value);
+  } else {
+    GRN_BULK_REWIND(buf);
+    grn_obj_get_value_o(ctx, column, id, buf);
+    grn_text_otomsgpack(ctx, bulk, buf, NULL);
+  }
+}
+
+grn_rc
+grn_text_otomsgpack(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj, grn_obj_format *format)
+{
+  grn_obj buf;
+  GRN_TEXT_INIT(&buf, 0);
+  switch (obj->header.type) {
+  case GRN_BULK :
+    switch (obj->header.domain) {
+    case GRN_DB_VOID :
+    case GRN_DB_SHORT_TEXT :
+    case GRN_DB_TEXT :
+    case GRN_DB_LONG_TEXT :
+      grn_text_msgpack_raw(ctx, bulk, GRN_BULK_HEAD(obj), GRN_BULK_VSIZE(obj));
+      break;
+    case GRN_DB_BOOL :
+      grn_text_msgpack_bool(ctx, bulk,
+                            GRN_BULK_VSIZE(obj) && *((unsigned char *)GRN_BULK_HEAD(obj)));
+      break;
+    case GRN_DB_INT32 :
+      grn_text_msgpack_int(ctx, bulk, GRN_BULK_VSIZE(obj) ? GRN_INT32_VALUE(obj) : 0);
+      break;
+    case GRN_DB_UINT32 :
+      grn_text_msgpack_uint(ctx, bulk, GRN_BULK_VSIZE(obj) ? GRN_UINT32_VALUE(obj) : 0);
+      break;
+    case GRN_DB_INT64 :
+      grn_text_msgpack_int(ctx, bulk, GRN_BULK_VSIZE(obj) ? GRN_INT64_VALUE(obj) : 0);
+      break;
+    case GRN_DB_UINT64 :
+      grn_text_msgpack_uint(ctx, bulk, GRN_BULK_VSIZE(obj) ? GRN_UINT64_VALUE(obj) : 0);
+      break;
+    case GRN_DB_FLOAT :
+      grn_text_msgpack_float(ctx, bulk, GRN_BULK_VSIZE(obj) ? GRN_FLOAT_VALUE(obj) : 0);
+      break;
+    case GRN_DB_TIME :
+      grn_text_msgpack_float(ctx, bulk, GRN_BULK_VSIZE(obj)
+                             ? *((int64_t *)GRN_BULK_HEAD(obj)) / 1000000.0 : 0);
+      break;
+    default :
+      {
+        grn_obj *table = grn_ctx_at(ctx, obj->header.domain);
+        grn_obj *accessor = table ? grn_obj_column(ctx, table, "_key", 4) : NULL;
+        if (accessor && GRN_BULK_VSIZE(obj)) {
+          grn_obj_get_value(ctx, accessor, *((grn_id *)GRN_BULK_HEAD(obj)), &buf);
+          grn_text_otomsgpack(ctx, bulk, &buf, NULL);
+        } else {
+          grn_text_msgpack_nil(ctx, bulk);
+        }
+        if (accessor) { grn_obj_unlink(ctx, accessor); }
+      }
+    }
+    break;
+  case GRN_VECTOR :
+    {
+      unsigned int i, n = grn_vector_size(ctx, obj);
+      grn_text_msgpack_array(ctx, bulk, n);
+      for (i = 0; i < n; i++) {
+        const char *s;
+        unsigned int len = grn_vector_get_element(ctx, obj, i, &s, NULL, NULL);
+        grn_text_msgpack_raw(ctx, bulk, s, len);
+      }
+    }
+    break;
+  case GRN_UVECTOR :
+    {
+      int j;
+      grn_id *v = (grn_id *)GRN_BULK_HEAD(obj), *ve = (grn_id *)GRN_BULK_CURR(obj);
+      if (format) {
+        int ncolumns = GRN_BULK_VSIZE(&format->columns) / sizeof(grn_obj *);
+        grn_obj **columns = (grn_obj **)GRN_BULK_HEAD(&format->columns);
+        int with_names = (v < ve) && (format->flags & GRN_OBJ_FORMAT_WTIH_COLUMN_NAMES);
+        grn_text_msgpack_array(ctx, bulk, 1 + with_names + (ve - v));
+        grn_text_msgpack_array(ctx, bulk, 1);
+        grn_text_msgpack_uint(ctx, bulk, ve - v);
+        if (with_names) {
+          grn_text_msgpack_array(ctx, bulk, ncolumns);
+          for (j = 0; j < ncolumns; j++) {
+            GRN_BULK_REWIND(&buf);
+            grn_column_name_(ctx, columns[j], &buf);
+            grn_text_msgpack_raw(ctx, bulk, GRN_BULK_HEAD(&buf), GRN_BULK_VSIZE(&buf));
+          }
+        }
+        for (; v < ve; v++) {
+          grn_text_msgpack_array(ctx, bulk, ncolumns);
+          for (j = 0; j < ncolumns; j++) {
+            GRN_BULK_REWIND(&buf);
+            grn_obj_get_value(ctx, columns[j], *v, &buf);
+            grn_text_otomsgpack(ctx, bulk, &buf, NULL);
+          }
+          grn_ctx_output_flush(ctx, bulk);
+        }
+      } else {
+        grn_obj *range = grn_ctx_at(ctx, obj->header.domain);
+        if (range && range->header.type == GRN_TYPE) {
+          // todo
+          grn_text_msgpack_array(ctx, bulk, 0);
+        } else {
+          grn_text_msgpack_array(ctx, bulk, ve - v);
+          for (; v < ve; v++) {
+            GRN_BULK_REWIND(&buf);
+            grn_table_get_key2(ctx, range, *v, &buf);
+            grn_text_msgpack_raw(ctx, bulk, GRN_BULK_HEAD(&buf), GRN_BULK_VSIZE(&buf));
+          }
+        }
+      }
+    }
+    break;
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_NO_KEY :
+  case GRN_TABLE_VIEW :
+    if (format) {
+      int j;
+      int ncolumns = GRN_BULK_VSIZE(&format->columns)/sizeof(grn_obj *);
+      int with_names = (format->flags & GRN_OBJ_FORMAT_WTIH_COLUMN_NAMES) ? 1 : 0;
+      grn_obj id, **columns = (grn_obj **)GRN_BULK_HEAD(&format->columns);
+      /* the number of records has to be known before they are written. */
+      unsigned int n = table_cursor_count(ctx, obj, format->offset, format->limit);
+      grn_table_cursor *tc = grn_table_cursor_open(ctx, obj, NULL, 0, NULL, 0,
+                                                   format->offset, format->limit,
+                                                   GRN_CURSOR_ASCENDING);
+      grn_text_msgpack_array(ctx, bulk, 1 + with_names + n);
+      grn_text_msgpack_array(ctx, bulk, 1);
+      grn_text_msgpack_int(ctx, bulk, format->nhits);
+      if (with_names) {
+        grn_text_msgpack_array(ctx, bulk, ncolumns);
+        for (j = 0; j < ncolumns; j++) {
+          GRN_BULK_REWIND(&buf);
+          grn_column_name_(ctx, columns[j], &buf);
+          grn_text_msgpack_raw(ctx, bulk, GRN_BULK_HEAD(&buf), GRN_BULK_VSIZE(&buf));
+        }
+      }
+      GRN_TEXT_INIT(&id, 0);
+      while (n && !grn_table_cursor_next_o(ctx, tc, &id)) {
+        grn_text_msgpack_array(ctx, bulk, ncolumns);
+        for (j = 0; j < ncolumns; j++) {
+          column_value_otomsgpack(ctx, bulk, columns[j], &id, &buf);
+        }
+        grn_ctx_output_flush(ctx, bulk);
+        n--;
+      }
+      /* records may have been deleted since they were counted. */
+      while (n--) { grn_text_msgpack_nil(ctx, bulk); }
+      GRN_OBJ_FIN(ctx, &id);
+      grn_table_cursor_close(ctx, tc);
+    } else {
+      grn_obj id, *column = grn_obj_column(ctx, obj, "_key", 4);
+      unsigned int n = table_cursor_count(ctx, obj, 0, 0);
+      grn_table_cursor *tc = grn_table_cursor_open(ctx, obj, NULL, 0, NULL, 0,
+                                                   0, 0, GRN_CURSOR_ASCENDING);
+      grn_text_msgpack_array(ctx, bulk, n);
+      GRN_TEXT_INIT(&id, 0);
+      while (n && !grn_table_cursor_next_o(ctx, tc, &id)) {
+        if (column) {
+          GRN_BULK_REWIND(&buf);
+          grn_obj_get_value_o(ctx, column, &id, &buf);
+          grn_text_msgpack_raw(ctx, bulk, GRN_BULK_HEAD(&buf), GRN_BULK_VSIZE(&buf));
+        } else {
+          grn_text_msgpack_nil(ctx, bulk);
+        }
+        n--;
+      }
+      while (n--) { grn_text_msgpack_nil(ctx, bulk); }
+      GRN_OBJ_FIN(ctx, &id);
+      grn_table_cursor_close(ctx, tc);
+      if (column) { grn_obj_unlink(ctx, column); }
+    }
+    break;
+  default :
+    grn_text_msgpack_nil(ctx, bulk);
+    break;
+  }
+  grn_obj_close(ctx, &buf);
+  return GRN_SUCCESS;
+}
+
 const char *
 grn_text_urldec(grn_ctx *ctx, grn_obj *buf, const char *p, const char *e, char d)
 {
@@ -103,6 +103,15 @@ const char *grn_text_cgidec(grn_ctx *ctx, grn_obj *buf,
 const char *grn_text_unesc_tok(grn_ctx *ctx, grn_obj *buf, const char *p, const char *e,
                                char *tok_type);
 
+grn_rc grn_text_msgpack_nil(grn_ctx *ctx, grn_obj *bulk);
+grn_rc grn_text_msgpack_bool(grn_ctx *ctx, grn_obj *bulk, int b);
+grn_rc grn_text_msgpack_int(grn_ctx *ctx, grn_obj *bulk, int64_t i);
+grn_rc grn_text_msgpack_uint(grn_ctx *ctx, grn_obj *bulk, uint64_t i);
+grn_rc grn_text_msgpack_float(grn_ctx *ctx, grn_obj *bulk, double d);
+grn_rc grn_text_msgpack_raw(grn_ctx *ctx, grn_obj *bulk, const char *s, unsigned int len);
+grn_rc grn_text_msgpack_array(grn_ctx *ctx, grn_obj *bulk, unsigned int n);
+grn_rc grn_text_msgpack_map(grn_ctx *ctx, grn_obj *bulk, unsigned int n);
+
 void grn_str_url_path_normalize(const char *path, size_t path_len, char *buf, size_t buf_len);
 
 #ifdef __cplusplus
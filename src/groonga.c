@@ -18,6 +18,8 @@
 #include "lib/com.h"
 #include "lib/ql.h"
 #include "lib/proc.h"
+#include "lib/store.h"
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #ifdef HAVE_SYS_WAIT_H
@@ -61,6 +63,8 @@ usage(void)
           "  -t <max threads>:         max number of free threads (default: %d)\n"
           "  -h, --help:               show usage\n"
           "  --admin-html-path <path>: specify admin html path\n"
+          "  --scan-threads <n>:       number of threads for sequential scan (default: 1)\n"
+          "  --event-loops <n>:        number of event loops accepting connections (default: 1)\n"
           "\n"
           "dest: <db pathname> [<command>] or <dest hostname>\n"
           "  <db pathname> [<command>]: when standalone/server mode\n"
@@ -183,20 +187,76 @@ typedef struct {
   grn_com_addr *addr;
   grn_msg *msg;
   uint8_t stat;
+  uint8_t chunked;
+  uint32_t chunk_offset;
   grn_id id;
 } grn_edge;
 
+/* chunk-size line reserved in front of each chunk and filled in when sent */
+#define CHUNK_HEAD "00000000\r\n"
+#define CHUNK_SIZE_LEN 8
+
+static void output(grn_ctx *ctx, int flags, void *arg);
+
+static int
+lower_equal(const char *p, const char *s, int len)
+{
+  for (; len; p++, s++, len--) {
+    char c = *p;
+    if ('A' <= c && c <= 'Z') { c += 'a' - 'A'; }
+    if (c != *s) { return 0; }
+  }
+  return 1;
+}
+
+static int
+connection_close_p(const char *p, const char *e)
+{
+  while (p < e) {
+    const char *l = p;
+    while (p < e && *p != '\n') { p++; }
+    if (p - l > 11 && lower_equal(l, "connection:", 11)) {
+      for (l += 11; l + 5 <= p; l++) {
+        if (lower_equal(l, "close", 5)) { return 1; }
+      }
+    }
+    p++;
+  }
+  return 0;
+}
+
+/* p points to the query string of a request path. */
+static int
+msgpack_requested_p(const char *p, const char *pe)
+{
+  static const char key[] = "output_type=";
+  while (p < pe) {
+    p++;
+    if (pe - p > sizeof(key) - 1 && !memcmp(p, key, sizeof(key) - 1)) {
+      return p[sizeof(key) - 1] == 'm';
+    }
+    while (p < pe && *p != '&') { p++; }
+  }
+  return 0;
+}
+
 static void
-put_response_header(grn_ctx *ctx, const char *path, uint32_t path_len)
+put_response_header(grn_ctx *ctx, const char *path, uint32_t path_len,
+                    int keep_alive)
 {
   const char *p, *pd, *pe = path + path_len;
   grn_obj *head = ctx->impl->outbuf;
   for (p = pd = path, pe = path + path_len; p < pe && *p != '?'; p++) {
     if (*p == '.') { pd = p; }
   }
-  GRN_TEXT_INIT(head, 0);
+  GRN_BULK_REWIND(head);
   GRN_TEXT_PUTS(ctx, head, "HTTP/1.1 200 OK\r\n");
-  GRN_TEXT_PUTS(ctx, head, "Connection: close\r\n");
+  if (keep_alive) {
+    GRN_TEXT_PUTS(ctx, head, "Connection: keep-alive\r\n");
+    GRN_TEXT_PUTS(ctx, head, "Transfer-Encoding: chunked\r\n");
+  } else {
+    GRN_TEXT_PUTS(ctx, head, "Connection: close\r\n");
+  }
   if (*pd == '.') {
     pd++;
     if (pd < p) {
@@ -243,6 +303,10 @@ put_response_header(grn_ctx *ctx, const char *path, uint32_t path_len)
       }
     }
   }
+  if (msgpack_requested_p(p, pe)) {
+    GRN_TEXT_PUTS(ctx, head, "Content-Type: application/x-msgpack\r\n\r\n");
+    return;
+  }
   GRN_TEXT_PUTS(ctx, head, "Content-Type: text/javascript\r\n\r\n");
 }
 
@@ -251,6 +315,7 @@ do_htreq(grn_ctx *ctx, grn_edge *edge)
 {
   grn_msg *msg = edge->msg;
   grn_com_header *header = &msg->header;
+  int keep_alive = 0;
   switch (header->qtype) {
   case 'G' : /* GET */
     {
@@ -273,15 +338,24 @@ do_htreq(grn_ctx *ctx, grn_edge *edge)
         }
       }
       if (*path == '/') {
-        put_response_header(ctx, path, p - path);
+        /* HTTP/1.1 connections persist unless the client says otherwise */
+        keep_alive = p + 8 < e && p[8] != '0' && !connection_close_p(p, e);
+        put_response_header(ctx, path, p - path, keep_alive);
+        if (keep_alive) {
+          edge->chunked = 1;
+          edge->chunk_offset = GRN_BULK_VSIZE(ctx->impl->outbuf);
+          GRN_TEXT_PUTS(ctx, ctx->impl->outbuf, CHUNK_HEAD);
+        }
         grn_ctx_send(ctx, path, p - path, 0);
+        /* the last chunk has to be sent even if the query failed */
+        if (edge->chunked) { output(ctx, 0, edge); }
+        ERRCLR(ctx);
       }
     }
     break;
   }
 exit :
-  // todo : support "Connection: keep-alive"
-  ctx->stat = GRN_CTX_QUIT;
+  if (!keep_alive) { ctx->stat = GRN_CTX_QUIT; }
 }
 
 enum {
@@ -327,50 +401,192 @@ enum {
 
 static grn_mutex cache_mutex;
 static grn_obj *cache_table = NULL;
-static grn_obj *cache_value = NULL;
-static grn_obj *cache_flags = NULL;
-static grn_obj *cache_expire = NULL;
-static grn_obj *cache_cas = NULL;
+static grn_obj *cache_record = NULL;
+static int cache_sweeper_quit = 0;
+
+/* Memcache.record holds a mb_item followed by the value, so that an item is
+   read by a single lookup. flags is kept in network byte order and directly
+   precedes the value, so that both are sent as is as extras and body. */
+typedef struct {
+  uint64_t cas;
+  uint32_t expire;
+  uint32_t flags;
+} mb_item;
+
+#define MB_ITEM_EXTRAS(record) ((char *)(record) + offsetof(mb_item, flags))
+#define MB_ITEM_VALUE(record) ((char *)(record) + sizeof(mb_item))
 
 #define CTX_GET(name) (grn_ctx_get(ctx, (name), strlen(name)))
 
+static grn_obj *
+cache_migrate(grn_ctx *ctx, grn_obj *longtext_type)
+{
+  grn_obj *record, *value, *flags, *expire, *cas;
+  if (!(record = grn_column_create(ctx, cache_table, "record", 6, NULL,
+                                   GRN_OBJ_PERSISTENT, longtext_type))) {
+    return NULL;
+  }
+  value = CTX_GET("Memcache.value");
+  flags = CTX_GET("Memcache.flags");
+  expire = CTX_GET("Memcache.expire");
+  cas = CTX_GET("Memcache.cas");
+  if (value && flags && expire && cas) {
+    grn_obj buf;
+    GRN_TEXT_INIT(&buf, 0);
+    GRN_TABLE_EACH(ctx, cache_table, 0, 0, rid, NULL, NULL, NULL, {
+      GRN_BULK_REWIND(&buf);
+      grn_obj_get_value(ctx, cas, rid, &buf);
+      grn_obj_get_value(ctx, expire, rid, &buf);
+      grn_obj_get_value(ctx, flags, rid, &buf);
+      if (GRN_BULK_VSIZE(&buf) == sizeof(mb_item)) {
+        grn_obj_get_value(ctx, value, rid, &buf);
+        grn_obj_set_value(ctx, record, rid, &buf, GRN_OBJ_SET);
+      }
+    });
+    grn_obj_close(ctx, &buf);
+    grn_obj_remove(ctx, value);
+    grn_obj_remove(ctx, flags);
+    grn_obj_remove(ctx, expire);
+    grn_obj_remove(ctx, cas);
+    GRN_LOG(ctx, GRN_LOG_NOTICE, "Memcache migrated to Memcache.record");
+  }
+  return record;
+}
+
 static grn_obj *
 cache_init(grn_ctx *ctx)
 {
-  if (cache_cas) { return cache_cas; }
+  if (cache_record) { return cache_record; }
   MUTEX_LOCK(cache_mutex);
-  if (!cache_cas) {
+  if (!cache_record) {
+    grn_obj *longtext_type = grn_ctx_at(ctx, GRN_DB_LONG_TEXT);
     if ((cache_table = CTX_GET("Memcache"))) {
-      cache_value = CTX_GET("Memcache.value");
-      cache_flags = CTX_GET("Memcache.flags");
-      cache_expire = CTX_GET("Memcache.expire");
-      cache_cas = CTX_GET("Memcache.cas");
+      if (!(cache_record = CTX_GET("Memcache.record"))) {
+        cache_record = cache_migrate(ctx, longtext_type);
+      }
     } else {
-      if (!cache_table) {
-        grn_obj *uint32_type = grn_ctx_at(ctx, GRN_DB_UINT32);
-        grn_obj *uint64_type = grn_ctx_at(ctx, GRN_DB_UINT64);
-        grn_obj *shorttext_type = grn_ctx_at(ctx, GRN_DB_SHORT_TEXT);
-        if ((cache_table = grn_table_create(ctx, "Memcache", 8, NULL,
-                                            GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
-                                            shorttext_type, NULL))) {
-          cache_value = grn_column_create(ctx, cache_table, "value", 5, NULL,
-                                          GRN_OBJ_PERSISTENT, shorttext_type);
-          cache_flags = grn_column_create(ctx, cache_table, "flags", 5, NULL,
-                                          GRN_OBJ_PERSISTENT, uint32_type);
-          cache_expire = grn_column_create(ctx, cache_table, "expire", 6, NULL,
-                                           GRN_OBJ_PERSISTENT, uint32_type);
-          cache_cas = grn_column_create(ctx, cache_table, "cas", 3, NULL,
-                                        GRN_OBJ_PERSISTENT, uint64_type);
-        }
+      grn_obj *shorttext_type = grn_ctx_at(ctx, GRN_DB_SHORT_TEXT);
+      if ((cache_table = grn_table_create(ctx, "Memcache", 8, NULL,
+                                          GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                                          shorttext_type, NULL))) {
+        cache_record = grn_column_create(ctx, cache_table, "record", 6, NULL,
+                                         GRN_OBJ_PERSISTENT, longtext_type);
       }
     }
   }
   MUTEX_UNLOCK(cache_mutex);
-  return cache_cas;
+  return cache_record;
 }
 
 #define RELATIVE_TIME_THRESH 1000000000
 
+static uint32_t
+cache_expire_time(grn_ctx *ctx, uint32_t expire)
+{
+  if (expire && expire < RELATIVE_TIME_THRESH) {
+    grn_timeval tv;
+    grn_timeval_now(ctx, &tv);
+    expire += tv.tv_sec;
+  }
+  return expire;
+}
+
+/* Refers to the record of rid in place and copies its header into item.
+   Returns NULL if rid has no record or its item has expired; item->expire
+   is non-zero only in the latter case. Unless NULL is returned, iw must be
+   released by grn_ja_unref(). */
+static char *
+cache_item_ref(grn_ctx *ctx, grn_id rid, mb_item *item,
+               grn_io_win *iw, uint32_t *value_len)
+{
+  char *record;
+  uint32_t size;
+  memset(item, 0, sizeof(mb_item));
+  if ((record = grn_ja_ref(ctx, (grn_ja *)cache_record, rid, iw, &size))) {
+    if (size >= sizeof(mb_item)) {
+      grn_timeval tv;
+      memcpy(item, record, sizeof(mb_item));
+      grn_timeval_now(ctx, &tv);
+      if (!item->expire || item->expire >= tv.tv_sec) {
+        *value_len = size - sizeof(mb_item);
+        return record;
+      }
+    }
+    grn_ja_unref(ctx, iw);
+  }
+  return NULL;
+}
+
+static void
+cache_item_write(grn_ctx *ctx, grn_obj *buf, mb_item *item,
+                 const char *value, uint32_t value_len)
+{
+  GRN_BULK_REWIND(buf);
+  grn_bulk_write(ctx, buf, (char *)item, sizeof(mb_item));
+  grn_bulk_write(ctx, buf, value, value_len);
+}
+
+/* Deletes rid if its item has expired. Must not be called with
+   cache_mutex locked. */
+static int
+cache_item_purge(grn_ctx *ctx, grn_id rid)
+{
+  int purged = 0;
+  mb_item item;
+  grn_io_win iw;
+  uint32_t value_len;
+  MUTEX_LOCK(cache_mutex);
+  if (cache_item_ref(ctx, rid, &item, &iw, &value_len)) {
+    grn_ja_unref(ctx, &iw);
+  } else if (item.expire) {
+    grn_table_delete_by_id(ctx, cache_table, rid);
+    purged = 1;
+  }
+  MUTEX_UNLOCK(cache_mutex);
+  return purged;
+}
+
+#define CACHE_SWEEP_INTERVAL 100000 /* usec */
+#define CACHE_SWEEP_LIMIT 1000
+
+/* Expired items are deleted lazily by GET. This thread walks through the
+   table a few records at a time, so that items never read again are also
+   released. */
+static void * CALLBACK
+cache_sweeper(void *arg)
+{
+  unsigned offset = 0;
+  grn_ctx ctx_, *ctx = &ctx_;
+  grn_ctx_init(ctx, 0);
+  grn_ctx_use(ctx, (grn_obj *)arg);
+  while (!cache_sweeper_quit) {
+    grn_table_cursor *tc;
+    usleep(CACHE_SWEEP_INTERVAL);
+    if (!cache_record) { continue; }
+    if ((tc = grn_table_cursor_open(ctx, cache_table, NULL, 0, NULL, 0,
+                                    offset, CACHE_SWEEP_LIMIT, GRN_CURSOR_BY_ID))) {
+      grn_id rid;
+      unsigned n = 0;
+      while ((rid = grn_table_cursor_next(ctx, tc))) {
+        mb_item item;
+        grn_io_win iw;
+        uint32_t value_len;
+        n++;
+        if (cache_item_ref(ctx, rid, &item, &iw, &value_len)) {
+          grn_ja_unref(ctx, &iw);
+        } else if (item.expire && cache_item_purge(ctx, rid)) {
+          continue;
+        }
+        offset++;
+      }
+      grn_table_cursor_close(ctx, tc);
+      if (n < CACHE_SWEEP_LIMIT) { offset = 0; }
+    }
+  }
+  grn_ctx_fin(ctx);
+  return NULL;
+}
+
 #define MBRES(ctx,re,status,key_len,extra_len,flags) {\
   grn_msg_set_property((ctx), (re), (status), (key_len), (extra_len));\
   grn_msg_send((ctx), (re), (flags));\
@@ -388,12 +604,12 @@ do {\
 static uint64_t
 get_mbreq_cas_id()
 {
-  /* FIXME: I think this logic have bugs.
-            one is a race condition.
-            another is a cyclic increment (cas_id must be non-zero).
-            But memcached-1.2.8 do this... */
-  static uint64_t cas_id = 0;
-  return ++cas_id;
+  /* the upper half comes from the start time, so that cas ids are
+     non-zero and are not reused after a restart. */
+  static uint32_t cas_id = 0;
+  uint32_t n;
+  GRN_ATOMIC_ADD_EX(&cas_id, 1, n);
+  return ((uint64_t)(uint32_t)starttime.tv_sec << 32) | (uint32_t)(n + 1);
 }
 
 static void
@@ -413,40 +629,26 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
       grn_id rid;
       uint16_t keylen = ntohs(header->keylen);
       char *key = GRN_BULK_HEAD((grn_obj *)msg);
+      char *record = NULL;
+      mb_item item;
+      grn_io_win iw;
+      uint32_t value_len;
       cache_init(ctx);
-      rid = grn_table_get(ctx, cache_table, key, keylen);
-      if (!rid) {
+      if ((rid = grn_table_get(ctx, cache_table, key, keylen))) {
+        record = cache_item_ref(ctx, rid, &item, &iw, &value_len);
+        if (!record && item.expire) { cache_item_purge(ctx, rid); }
+      }
+      if (!record) {
         GRN_MSG_MBRES({
           MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
         });
       } else {
-        grn_timeval tv;
-        uint32_t expire;
-        {
-          grn_obj expire_buf;
-          GRN_UINT32_INIT(&expire_buf, 0);
-          grn_obj_get_value(ctx, cache_expire, rid, &expire_buf);
-          expire = GRN_UINT32_VALUE(&expire_buf);
-          grn_obj_close(ctx, &expire_buf);
-        }
-        grn_timeval_now(ctx, &tv);
-        if (expire && expire < tv.tv_sec) {
-          grn_table_delete_by_id(ctx, cache_table, rid);
-          GRN_MSG_MBRES({
-            MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
-          });
-        } else {
-          grn_obj cas_buf;
-          GRN_UINT64_INIT(&cas_buf, 0);
-          grn_obj_get_value(ctx, cache_cas, rid, &cas_buf);
-          GRN_MSG_MBRES({
-            grn_obj_get_value(ctx, cache_flags, rid, re);
-            grn_obj_get_value(ctx, cache_value, rid, re);
-            ((grn_msg *)re)->header.cas = GRN_UINT64_VALUE(&cas_buf);
-            MBRES(ctx, re, MBRES_SUCCESS, 0, 4, flags);
-          });
-          grn_obj_close(ctx, &cas_buf);
-        }
+        GRN_MSG_MBRES({
+          grn_bulk_write(ctx, re, MB_ITEM_EXTRAS(record), 4 + value_len);
+          ((grn_msg *)re)->header.cas = item.cas;
+          MBRES(ctx, re, MBRES_SUCCESS, 0, 4, flags);
+        });
+        grn_ja_unref(ctx, &iw);
       }
     }
     break;
@@ -470,113 +672,54 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
       char *key = body + 8;
       char *value = key + keylen;
       int added = 0;
-      int f = (header->qtype == MBCMD_REPLACE ||
-               header->qtype == MBCMD_REPLACEQ) ? 0 : GRN_TABLE_ADD;
+      int replace = (header->qtype == MBCMD_REPLACE ||
+                     header->qtype == MBCMD_REPLACEQ);
+      uint16_t status = MBRES_SUCCESS;
+      mb_item item;
       GRN_ASSERT(extralen == 8);
       cache_init(ctx);
-      if (header->qtype == MBCMD_REPLACE || header->qtype == MBCMD_REPLACEQ) {
+      MUTEX_LOCK(cache_mutex);
+      if (replace) {
         rid = grn_table_get(ctx, cache_table, key, keylen);
       } else {
         rid = grn_table_add(ctx, cache_table, key, keylen, &added);
       }
       if (!rid) {
-        GRN_MSG_MBRES({
-          MBRES(ctx, re, (f & GRN_TABLE_ADD) ? MBRES_ENOMEM : MBRES_NOT_STORED, 0, 0, 0);
-        });
+        status = replace ? MBRES_NOT_STORED : MBRES_ENOMEM;
       } else {
-        if (added) {
-          grn_obj buf, uint_buf;
-          GRN_TEXT_INIT(&buf, GRN_OBJ_DO_SHALLOW_COPY);
-          GRN_TEXT_SET_REF(&buf, value, valuelen);
-          grn_obj_set_value(ctx, cache_value, rid, &buf, GRN_OBJ_SET);
-          GRN_UINT32_INIT(&uint_buf, 0);
-          GRN_UINT32_SET(ctx, &uint_buf, flags);
-          grn_obj_set_value(ctx, cache_flags, rid, &uint_buf, GRN_OBJ_SET);
-          if (expire && expire < RELATIVE_TIME_THRESH) {
-            grn_timeval tv;
-            grn_timeval_now(ctx, &tv);
-            expire += tv.tv_sec;
-          }
-          GRN_UINT32_SET(ctx, &uint_buf, expire);
-          grn_obj_set_value(ctx, cache_expire, rid, &uint_buf, GRN_OBJ_SET);
-          grn_obj_close(ctx, &uint_buf);
-          {
-            grn_obj cas_buf;
-            uint64_t cas_id = get_mbreq_cas_id();
-            GRN_UINT64_INIT(&cas_buf, 0);
-            GRN_UINT64_SET(ctx, &cas_buf, cas_id);
-            grn_obj_set_value(ctx, cache_cas, rid, &cas_buf, GRN_OBJ_SET);
-            grn_obj_close(ctx, &cas_buf);
-            GRN_MSG_MBRES({
-              ((grn_msg *)re)->header.cas = cas_id;
-              MBRES(ctx, re, MBRES_SUCCESS, 0, 0, 0);
-            });
-          }
-        } else {
-          if (header->qtype != MBCMD_SET && header->qtype != MBCMD_SETQ) {
-            grn_obj buf;
-            grn_timeval tv;
-            uint32_t oexpire;
-
-            GRN_TEXT_INIT(&buf, 0);
-            grn_obj_get_value(ctx, cache_expire, rid, &buf);
-            oexpire = *((uint32_t *)GRN_BULK_HEAD(&buf));
-            grn_timeval_now(ctx, &tv);
-
-            if (oexpire && oexpire < tv.tv_sec) {
-              if (header->qtype == MBCMD_REPLACE ||
-                  header->qtype == MBCMD_REPLACEQ) {
-                grn_table_delete_by_id(ctx, cache_table, rid);
-                GRN_MSG_MBRES({
-                  MBRES(ctx, re, MBRES_NOT_STORED, 0, 0, 0);
-                });
-                break;
-              }
-            } else if (header->qtype == MBCMD_ADD ||
-                       header->qtype == MBCMD_ADDQ) {
-              GRN_MSG_MBRES({
-                MBRES(ctx, re, MBRES_NOT_STORED, 0, 0, 0);
-              });
-              break;
-            }
-            grn_obj_close(ctx, &buf);
-          }
-          {
-            grn_obj cas_buf;
-            GRN_UINT64_INIT(&cas_buf, 0);
-            grn_obj_get_value(ctx, cache_cas, rid, &cas_buf);
-            if (header->cas && header->cas != GRN_UINT64_VALUE(&cas_buf)) {
-              GRN_MSG_MBRES({
-                MBRES(ctx, re, MBRES_NOT_STORED, 0, 0, 0);
-              });
-            } else {
-              grn_obj buf;
-              GRN_TEXT_INIT(&buf, GRN_OBJ_DO_SHALLOW_COPY);
-              GRN_TEXT_SET_REF(&buf, value, valuelen);
-              grn_obj_set_value(ctx, cache_value, rid, &buf, GRN_OBJ_SET);
-              GRN_TEXT_SET_REF(&buf, &flags, 4);
-              grn_obj_set_value(ctx, cache_flags, rid, &buf, GRN_OBJ_SET);
-              if (expire && expire < RELATIVE_TIME_THRESH) {
-                grn_timeval tv;
-                grn_timeval_now(ctx, &tv);
-                expire += tv.tv_sec;
-              }
-              GRN_TEXT_SET_REF(&buf, &expire, 4);
-              grn_obj_set_value(ctx, cache_expire, rid, &buf, GRN_OBJ_SET);
-              {
-                uint64_t cas_id = get_mbreq_cas_id();
-                GRN_UINT64_SET(ctx, &cas_buf, cas_id);
-                grn_obj_set_value(ctx, cache_cas, rid, &cas_buf, GRN_OBJ_SET);
-                GRN_MSG_MBRES({
-                  ((grn_msg *)re)->header.cas = cas_id;
-                  MBRES(ctx, re, MBRES_SUCCESS, 0, 0, 0);
-                });
-              }
+        if (!added && ((header->qtype != MBCMD_SET &&
+                        header->qtype != MBCMD_SETQ) || header->cas)) {
+          grn_io_win iw;
+          uint32_t value_len;
+          if (cache_item_ref(ctx, rid, &item, &iw, &value_len)) {
+            grn_ja_unref(ctx, &iw);
+            if (header->qtype == MBCMD_ADD || header->qtype == MBCMD_ADDQ ||
+                (header->cas && header->cas != item.cas)) {
+              status = MBRES_NOT_STORED;
             }
-            grn_obj_close(ctx, &cas_buf);
+          } else if (replace) {
+            if (item.expire) { grn_table_delete_by_id(ctx, cache_table, rid); }
+            status = MBRES_NOT_STORED;
+          } else if (header->cas) {
+            status = MBRES_NOT_STORED;
           }
         }
+        if (status == MBRES_SUCCESS) {
+          grn_obj buf;
+          item.cas = get_mbreq_cas_id();
+          item.expire = cache_expire_time(ctx, expire);
+          item.flags = flags;
+          GRN_TEXT_INIT(&buf, 0);
+          cache_item_write(ctx, &buf, &item, value, valuelen);
+          grn_obj_set_value(ctx, cache_record, rid, &buf, GRN_OBJ_SET);
+          grn_obj_close(ctx, &buf);
+        }
       }
+      MUTEX_UNLOCK(cache_mutex);
+      GRN_MSG_MBRES({
+        if (status == MBRES_SUCCESS) { ((grn_msg *)re)->header.cas = item.cas; }
+        MBRES(ctx, re, status, 0, 0, 0);
+      });
     }
     break;
   case MBCMD_DELETEQ :
@@ -588,14 +731,17 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
       uint16_t keylen = ntohs(header->keylen);
       char *key = GRN_BULK_HEAD((grn_obj *)msg);
       cache_init(ctx);
-      rid = grn_table_get(ctx, cache_table, key, keylen);
+      MUTEX_LOCK(cache_mutex);
+      if ((rid = grn_table_get(ctx, cache_table, key, keylen))) {
+        grn_table_delete_by_id(ctx, cache_table, rid);
+      }
+      MUTEX_UNLOCK(cache_mutex);
       if (!rid) {
         // GRN_LOG(ctx, GRN_LOG_NOTICE, "GET k=%d not found", keylen);
         GRN_MSG_MBRES({
           MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
         });
       } else {
-        grn_table_delete_by_id(ctx, cache_table, rid);
         GRN_MSG_MBRES({
           MBRES(ctx, re, MBRES_SUCCESS, 0, 4, 0);
         });
@@ -611,79 +757,71 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
     {
       grn_id rid;
       int added = 0;
-      uint64_t delta, init;
+      uint64_t delta, init, value = 0;
       uint16_t keylen = ntohs(header->keylen);
       char *body = GRN_BULK_HEAD((grn_obj *)msg);
       char *key = body + 20;
       uint32_t expire = ntohl(*((uint32_t *)(body + 16)));
+      uint16_t status = MBRES_SUCCESS;
+      mb_item item;
       grn_ntoh(&delta, body, 8);
       grn_ntoh(&init, body + 8, 8);
       GRN_ASSERT(header->level == 20); /* extralen */
       cache_init(ctx);
+      MUTEX_LOCK(cache_mutex);
       if (expire == 0xffffffff) {
         rid = grn_table_get(ctx, cache_table, key, keylen);
       } else {
         rid = grn_table_add(ctx, cache_table, key, keylen, &added);
       }
       if (!rid) {
-        GRN_MSG_MBRES({
-          MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
-        });
+        status = MBRES_KEY_ENOENT;
       } else {
-        grn_obj buf;
-        GRN_TEXT_INIT(&buf, GRN_OBJ_DO_SHALLOW_COPY);
-        if (added) {
-          uint32_t flags = 0;
-          GRN_TEXT_SET_REF(&buf, &init, 8);
-          grn_obj_set_value(ctx, cache_value, rid, &buf, GRN_OBJ_SET);
-          GRN_TEXT_SET_REF(&buf, &flags, 4);
-          grn_obj_set_value(ctx, cache_flags, rid, &buf, GRN_OBJ_SET);
-        } else {
-          grn_timeval tv;
-          uint32_t oexpire;
-
-          grn_obj_get_value(ctx, cache_expire, rid, &buf);
-          oexpire = *((uint32_t *)GRN_BULK_HEAD(&buf));
-          grn_timeval_now(ctx, &tv);
-
-          if (oexpire && oexpire < tv.tv_sec) {
-            if (expire == 0xffffffffU) {
-              GRN_MSG_MBRES({
-                MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
-              });
-              grn_obj_close(ctx, &buf);
-              break;
+        char *record = NULL;
+        grn_io_win iw;
+        uint32_t value_len;
+        if (!added) { record = cache_item_ref(ctx, rid, &item, &iw, &value_len); }
+        if (record) {
+          if (value_len == sizeof(uint64_t)) {
+            memcpy(&value, MB_ITEM_VALUE(record), sizeof(uint64_t));
+            if (header->qtype == MBCMD_INCREMENT ||
+                header->qtype == MBCMD_INCREMENTQ) {
+              value += delta;
             } else {
-              uint32_t flags = 0;
-              GRN_TEXT_SET_REF(&buf, &init, 8);
-              grn_obj_set_value(ctx, cache_value, rid, &buf, GRN_OBJ_SET);
-              GRN_TEXT_SET_REF(&buf, &flags, 4);
-              grn_obj_set_value(ctx, cache_flags, rid, &buf, GRN_OBJ_SET);
+              value -= delta;
             }
           } else {
-            GRN_TEXT_SET_REF(&buf, &delta, 8);
-            grn_obj_set_value(ctx, cache_value, rid, &buf,
-                              header->qtype == MBCMD_INCREMENT ||
-                              header->qtype == MBCMD_INCREMENTQ
-                              ? GRN_OBJ_INCR
-                              : GRN_OBJ_DECR);
+            status = MBRES_EINVAL;
           }
+          grn_ja_unref(ctx, &iw);
+        } else if (expire == 0xffffffffU) {
+          status = MBRES_KEY_ENOENT;
+        } else {
+          value = init;
+          item.expire = cache_expire_time(ctx, expire);
+          item.flags = 0;
         }
-        if (expire && expire < RELATIVE_TIME_THRESH) {
-          grn_timeval tv;
-          grn_timeval_now(ctx, &tv);
-          expire += tv.tv_sec;
+        if (status == MBRES_SUCCESS) {
+          grn_obj buf;
+          item.cas = get_mbreq_cas_id();
+          GRN_TEXT_INIT(&buf, 0);
+          cache_item_write(ctx, &buf, &item, (char *)&value, sizeof(uint64_t));
+          grn_obj_set_value(ctx, cache_record, rid, &buf, GRN_OBJ_SET);
+          grn_obj_close(ctx, &buf);
         }
-        GRN_TEXT_SET_REF(&buf, &expire, 4);
-        grn_obj_set_value(ctx, cache_expire, rid, &buf, GRN_OBJ_SET);
+      }
+      MUTEX_UNLOCK(cache_mutex);
+      if (status == MBRES_SUCCESS) {
         GRN_MSG_MBRES({
-          /* TODO: get_mbreq_cas_id() */
-          grn_obj_get_value(ctx, cache_value, rid, re);
-          grn_hton(&delta, (uint64_t *)GRN_BULK_HEAD(re), 8);
-          GRN_TEXT_SET(ctx, re, &delta, sizeof(uint64_t));
+          grn_hton(&delta, &value, 8);
+          grn_bulk_write(ctx, re, (char *)&delta, sizeof(uint64_t));
+          ((grn_msg *)re)->header.cas = item.cas;
           MBRES(ctx, re, MBRES_SUCCESS, 0, sizeof(uint64_t), 0);
         });
-        grn_obj_close(ctx, &buf);
+      } else {
+        GRN_MSG_MBRES({
+          MBRES(ctx, re, status, 0, 0, 0);
+        });
       }
     }
     break;
@@ -692,38 +830,42 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
     /* fallthru */
   case MBCMD_FLUSH :
     {
-      uint32_t expire;
+      uint32_t expire = 0;
       uint8_t extralen = header->level;
+      grn_table_cursor *tc;
       if (extralen) {
         char *body = GRN_BULK_HEAD((grn_obj *)msg);
         GRN_ASSERT(extralen == 4);
-        expire = ntohl(*((uint32_t *)(body)));
-        if (expire < RELATIVE_TIME_THRESH) {
-          grn_timeval tv;
-          grn_timeval_now(ctx, &tv);
-          if (expire) {
-            expire += tv.tv_sec;
-          } else {
-            expire = tv.tv_sec - 1;
+        expire = cache_expire_time(ctx, ntohl(*((uint32_t *)(body))));
+      }
+      cache_init(ctx);
+      MUTEX_LOCK(cache_mutex);
+      if ((tc = grn_table_cursor_open(ctx, cache_table, NULL, 0, NULL, 0,
+                                      0, 0, GRN_CURSOR_BY_ID))) {
+        grn_id rid;
+        grn_obj buf;
+        GRN_TEXT_INIT(&buf, 0);
+        while ((rid = grn_table_cursor_next(ctx, tc))) {
+          char *record;
+          mb_item item;
+          grn_io_win iw;
+          uint32_t value_len;
+          if (!expire) {
+            grn_table_delete_by_id(ctx, cache_table, rid);
+          } else if ((record = cache_item_ref(ctx, rid, &item, &iw, &value_len))) {
+            item.expire = expire;
+            cache_item_write(ctx, &buf, &item, MB_ITEM_VALUE(record), value_len);
+            grn_ja_unref(ctx, &iw);
+            grn_obj_set_value(ctx, cache_record, rid, &buf, GRN_OBJ_SET);
           }
         }
-      } else {
-        grn_timeval tv;
-        grn_timeval_now(ctx, &tv);
-        expire = tv.tv_sec - 1;
-      }
-      {
-        grn_obj exp_buf;
-        GRN_UINT32_INIT(&exp_buf, 0);
-        GRN_UINT32_SET(ctx, &exp_buf, expire);
-        GRN_TABLE_EACH(ctx, cache_table, 0, 0, rid, NULL, NULL, NULL, {
-          grn_obj_set_value(ctx, cache_expire, rid, &exp_buf, GRN_OBJ_SET);
-        });
-        GRN_MSG_MBRES({
-          MBRES(ctx, re, MBRES_SUCCESS, 0, 4, 0);
-        });
-        grn_obj_close(ctx, &exp_buf);
+        grn_obj_close(ctx, &buf);
+        grn_table_cursor_close(ctx, tc);
       }
+      MUTEX_UNLOCK(cache_mutex);
+      GRN_MSG_MBRES({
+        MBRES(ctx, re, MBRES_SUCCESS, 0, 4, 0);
+      });
     }
     break;
   case MBCMD_NOOP :
@@ -745,37 +887,28 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
       grn_id rid;
       uint16_t keylen = ntohs(header->keylen);
       char *key = GRN_BULK_HEAD((grn_obj *)msg);
+      char *record = NULL;
+      mb_item item;
+      grn_io_win iw;
+      uint32_t value_len;
       cache_init(ctx);
-      rid = grn_table_get(ctx, cache_table, key, keylen);
-      if (!rid) {
+      if ((rid = grn_table_get(ctx, cache_table, key, keylen))) {
+        record = cache_item_ref(ctx, rid, &item, &iw, &value_len);
+        if (!record && item.expire) { cache_item_purge(ctx, rid); }
+      }
+      if (!record) {
         GRN_MSG_MBRES({
           MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
         });
       } else {
-        grn_obj buf;
-        grn_timeval tv;
-        uint32_t expire;
-        GRN_TEXT_INIT(&buf, 0);
-        grn_obj_get_value(ctx, cache_expire, rid, &buf);
-        expire = *((uint32_t *)GRN_BULK_HEAD(&buf));
-        grn_timeval_now(ctx, &tv);
-        if (expire && expire < tv.tv_sec) {
-          grn_table_delete_by_id(ctx, cache_table, rid);
-          GRN_MSG_MBRES({
-            MBRES(ctx, re, MBRES_KEY_ENOENT, 0, 0, 0);
-          });
-        } else {
-          GRN_MSG_MBRES({
-            grn_obj_get_value(ctx, cache_flags, rid, re);
-            grn_bulk_write(ctx, re, key, keylen);
-            grn_obj_get_value(ctx, cache_value, rid, re);
-            GRN_BULK_REWIND(&buf);
-            grn_obj_get_value(ctx, cache_cas, rid, &buf);
-            ((grn_msg *)re)->header.cas = *((uint64_t *)GRN_BULK_HEAD(&buf));
-            MBRES(ctx, re, MBRES_SUCCESS, keylen, 4, flags);
-          });
-        }
-        grn_obj_close(ctx, &buf);
+        GRN_MSG_MBRES({
+          grn_bulk_write(ctx, re, MB_ITEM_EXTRAS(record), 4);
+          grn_bulk_write(ctx, re, key, keylen);
+          grn_bulk_write(ctx, re, MB_ITEM_VALUE(record), value_len);
+          ((grn_msg *)re)->header.cas = item.cas;
+          MBRES(ctx, re, MBRES_SUCCESS, keylen, 4, flags);
+        });
+        grn_ja_unref(ctx, &iw);
       }
     }
     break;
@@ -792,23 +925,35 @@ do_mbreq(grn_ctx *ctx, grn_edge *edge)
       char *key = GRN_BULK_HEAD((grn_obj *)msg);
       char *value = key + keylen;
       uint32_t valuelen = size - keylen;
+      uint16_t status = MBRES_NOT_STORED;
+      char *record = NULL;
+      mb_item item;
+      grn_io_win iw;
+      uint32_t value_len;
       cache_init(ctx);
-      rid = grn_table_add(ctx, cache_table, key, keylen, NULL);
-      if (!rid) {
-        GRN_MSG_MBRES({
-          MBRES(ctx, re, MBRES_ENOMEM, 0, 0, 0);
-        });
-      } else {
-        /* FIXME: check expire */
+      MUTEX_LOCK(cache_mutex);
+      if ((rid = grn_table_get(ctx, cache_table, key, keylen)) &&
+          (record = cache_item_ref(ctx, rid, &item, &iw, &value_len))) {
         grn_obj buf;
-        int flags = header->qtype == MBCMD_APPEND ? GRN_OBJ_APPEND : GRN_OBJ_PREPEND;
-        GRN_TEXT_INIT(&buf, GRN_OBJ_DO_SHALLOW_COPY);
-        GRN_TEXT_SET_REF(&buf, value, valuelen);
-        grn_obj_set_value(ctx, cache_value, rid, &buf, flags);
-        GRN_MSG_MBRES({
-          MBRES(ctx, re, MBRES_SUCCESS, 0, 0, 0);
-        });
+        GRN_TEXT_INIT(&buf, 0);
+        item.cas = get_mbreq_cas_id();
+        if (header->qtype == MBCMD_APPEND || header->qtype == MBCMD_APPENDQ) {
+          cache_item_write(ctx, &buf, &item, MB_ITEM_VALUE(record), value_len);
+          grn_bulk_write(ctx, &buf, value, valuelen);
+        } else {
+          cache_item_write(ctx, &buf, &item, value, valuelen);
+          grn_bulk_write(ctx, &buf, MB_ITEM_VALUE(record), value_len);
+        }
+        grn_ja_unref(ctx, &iw);
+        grn_obj_set_value(ctx, cache_record, rid, &buf, GRN_OBJ_SET);
+        grn_obj_close(ctx, &buf);
+        status = MBRES_SUCCESS;
       }
+      MUTEX_UNLOCK(cache_mutex);
+      GRN_MSG_MBRES({
+        if (status == MBRES_SUCCESS) { ((grn_msg *)re)->header.cas = item.cas; }
+        MBRES(ctx, re, status, 0, 0, 0);
+      });
     }
     break;
   case MBCMD_STAT :
@@ -844,35 +989,46 @@ enum {
   EDGE_ABORT = 0x03,
 };
 
-static grn_hash *edges;
-static grn_com_queue ctx_new;
-static grn_com_queue ctx_old;
-static grn_mutex q_mutex;
-static grn_cond q_cond;
-static uint32_t nthreads = 0, nfthreads = 0,
-                max_nfthreads = DEFAULT_MAX_NFTHREADS;
+typedef struct {
+  grn_com_event ev;
+  grn_ctx ctx;
+  grn_obj *db;
+  grn_hash *edges;
+  grn_com_queue ctx_new;
+  grn_com_queue ctx_old;
+  grn_com_queue ctx_flush;
+  grn_mutex q_mutex;
+  grn_cond q_cond;
+  uint32_t nthreads;
+  uint32_t nfthreads;
+  grn_thread thread;
+} grn_loop;
+
+static uint32_t max_nfthreads = DEFAULT_MAX_NFTHREADS;
+static int n_loops = 1;
 
 static void * CALLBACK
 worker(void *arg)
 {
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)", nfthreads, nthreads + 1);
-  MUTEX_LOCK(q_mutex);
+  grn_loop *loop = arg;
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)", loop->nfthreads, loop->nthreads + 1);
+  MUTEX_LOCK(loop->q_mutex);
   do {
     grn_ctx *ctx;
     grn_edge *edge;
-    nfthreads++;
-    while (!(edge = (grn_edge *)grn_com_queue_deque(&grn_gctx, &ctx_new))) {
-      COND_WAIT(q_cond, q_mutex);
+    loop->nfthreads++;
+    while (!(edge = (grn_edge *)grn_com_queue_deque(&grn_gctx, &loop->ctx_new))) {
+      COND_WAIT(loop->q_cond, loop->q_mutex);
       if (grn_gctx.stat == GRN_CTX_QUIT) { goto exit; }
     }
     ctx = &edge->ctx;
-    nfthreads--;
+    loop->nfthreads--;
     if (edge->stat == EDGE_DOING) { continue; }
     if (edge->stat == EDGE_WAIT) {
       edge->stat = EDGE_DOING;
       while (!GRN_COM_QUEUE_EMPTYP(&edge->recv_new)) {
         grn_obj *msg;
-        MUTEX_UNLOCK(q_mutex);
+        MUTEX_UNLOCK(loop->q_mutex);
         while (ctx->stat != GRN_CTX_QUIT &&
                (edge->msg = (grn_msg *)grn_com_queue_deque(ctx, &edge->recv_new))) {
           grn_com_header *header = &edge->msg->header;
@@ -897,22 +1053,24 @@ worker(void *arg)
         while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
           grn_msg_close(ctx, msg);
         }
-        MUTEX_LOCK(q_mutex);
+        MUTEX_LOCK(loop->q_mutex);
         if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) { break; }
       }
     }
     if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
-      if (edge->com->has_sid) { grn_com_close_(ctx, edge->com); }
-      grn_com_queue_enque(&grn_gctx, &ctx_old, (grn_com_queue_entry *)edge);
+      if (edge->com->has_sid && GRN_COM_QUEUE_EMPTYP(&edge->com->new)) {
+        grn_com_close_(ctx, edge->com);
+      }
+      grn_com_queue_enque(&grn_gctx, &loop->ctx_old, (grn_com_queue_entry *)edge);
       edge->stat = EDGE_ABORT;
     } else {
       edge->stat = EDGE_IDLE;
     }
-  } while (nfthreads < max_nfthreads && grn_gctx.stat != GRN_CTX_QUIT);
+  } while (loop->nfthreads < max_nfthreads && grn_gctx.stat != GRN_CTX_QUIT);
 exit :
-  nthreads--;
-  MUTEX_UNLOCK(q_mutex);
-  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread end (%d/%d)", nfthreads, nthreads);
+  loop->nthreads--;
+  MUTEX_UNLOCK(loop->q_mutex);
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread end (%d/%d)", loop->nfthreads, loop->nthreads);
   return NULL;
 }
 
@@ -921,16 +1079,59 @@ output(grn_ctx *ctx, int flags, void *arg)
 {
   grn_edge *edge = arg;
   grn_com *com = edge->com;
-  grn_msg *req = edge->msg, *msg = (grn_msg *)ctx->impl->outbuf;
-  msg->edge_id = req->edge_id;
-  msg->header.proto = req->header.proto == GRN_COM_PROTO_MBREQ
+  grn_msg *req = edge->msg, *msg = (grn_msg *)ctx->impl->outbuf, *m;
+  grn_obj tmp;
+  if (edge->chunked) {
+    grn_obj *buf = (grn_obj *)msg;
+    uint32_t size = GRN_BULK_VSIZE(buf) - edge->chunk_offset - (sizeof(CHUNK_HEAD) - 1);
+    char *head = GRN_BULK_HEAD(buf) + edge->chunk_offset;
+    /* an empty chunk would terminate the response */
+    if (!size && (flags & GRN_CTX_MORE)) { return; }
+    grn_itoh(size, head, CHUNK_SIZE_LEN);
+    head[CHUNK_SIZE_LEN] = '\r';
+    if (size) { GRN_TEXT_PUTS(ctx, buf, "\r\n"); }
+    if (!(flags & GRN_CTX_MORE)) {
+      GRN_TEXT_PUTS(ctx, buf, size ? "0\r\n\r\n" : "\r\n");
+      edge->chunked = 0;
+    }
+  }
+  if (flags & GRN_CTX_MORE) {
+    /* a streamed response must not pile up in memory behind a slow peer.
+       grn_com_sender signals ev->cond when the queue drains. */
+    grn_com_event *ev = com->ev;
+    MUTEX_LOCK(ev->mutex);
+    while (!GRN_COM_QUEUE_EMPTYP(&com->new) &&
+           edge->stat != EDGE_ABORT && grn_gctx.stat != GRN_CTX_QUIT) {
+      COND_WAIT(ev->cond, ev->mutex);
+    }
+    MUTEX_UNLOCK(ev->mutex);
+  }
+  /* hand the contents over to a fresh msg so that ctx->impl->outbuf stays
+     valid for callers which are still writing into it */
+  if (!(m = (grn_msg *)grn_msg_open(ctx, com, &edge->send_old))) {
+    edge->stat = EDGE_ABORT;
+    GRN_BULK_REWIND(ctx->impl->outbuf);
+    return;
+  }
+  tmp = m->qe.obj;
+  m->qe.obj = msg->qe.obj;
+  msg->qe.obj = tmp;
+  m->header = msg->header;
+  memset(&msg->header, 0, sizeof(grn_com_header));
+  m->edge_id = req->edge_id;
+  m->header.proto = req->header.proto == GRN_COM_PROTO_MBREQ
     ? GRN_COM_PROTO_MBRES : req->header.proto;
-  ERRCLR(ctx);
-  if (grn_msg_send(ctx, (grn_obj *)msg,
+  /* a partial packet is sent in the middle of the query, whose error
+     must be kept until the query ends. */
+  if (!(flags & GRN_CTX_MORE)) { ERRCLR(ctx); }
+  if (grn_msg_send(ctx, (grn_obj *)m,
                    (flags & GRN_CTX_MORE) ? GRN_CTX_MORE : GRN_CTX_TAIL)) {
     edge->stat = EDGE_ABORT;
   }
-  ctx->impl->outbuf = grn_msg_open(ctx, com, &edge->send_old);
+  if (edge->chunked) {
+    edge->chunk_offset = 0;
+    GRN_TEXT_PUTS(ctx, ctx->impl->outbuf, CHUNK_HEAD);
+  }
 }
 
 static void
@@ -938,15 +1139,20 @@ msg_handler(grn_ctx *ctx, grn_obj *msg)
 {
   grn_edge *edge;
   grn_com *com = ((grn_msg *)msg)->peer;
+  grn_loop *loop = com->ev->opaque;
   if (ctx->rc) {
     if (com->has_sid) {
       if ((edge = com->opaque)) {
-        MUTEX_LOCK(q_mutex);
+        MUTEX_LOCK(loop->q_mutex);
         if (edge->stat == EDGE_IDLE) {
-          grn_com_queue_enque(ctx, &ctx_old, (grn_com_queue_entry *)edge);
+          grn_com_queue_enque(ctx, &loop->ctx_old, (grn_com_queue_entry *)edge);
         }
         edge->stat = EDGE_ABORT;
-        MUTEX_UNLOCK(q_mutex);
+        MUTEX_UNLOCK(loop->q_mutex);
+        /* a worker may be waiting in output() for the peer to read */
+        MUTEX_LOCK(com->ev->mutex);
+        COND_BROADCAST(com->ev->cond);
+        MUTEX_UNLOCK(com->ev->mutex);
       } else {
         grn_com_close(ctx, com);
       }
@@ -954,13 +1160,13 @@ msg_handler(grn_ctx *ctx, grn_obj *msg)
     grn_msg_close(ctx, msg);
   } else {
     int added;
-    grn_id id = grn_hash_add(ctx, edges, &((grn_msg *)msg)->edge_id, sizeof(grn_com_addr),
+    grn_id id = grn_hash_add(ctx, loop->edges, &((grn_msg *)msg)->edge_id, sizeof(grn_com_addr),
                              (void **)&edge, &added);
     if (added) {
       grn_ctx_init(&edge->ctx, (useql ? GRN_CTX_USE_QL : 0));
       GRN_COM_QUEUE_INIT(&edge->recv_new);
       GRN_COM_QUEUE_INIT(&edge->send_old);
-      grn_ctx_use(&edge->ctx, (grn_obj *)com->ev->opaque);
+      grn_ctx_use(&edge->ctx, loop->db);
       grn_ctx_recv_handler_set(&edge->ctx, output, edge);
       com->opaque = edge;
       grn_obj_close(&edge->ctx, edge->ctx.impl->outbuf);
@@ -968,42 +1174,149 @@ msg_handler(grn_ctx *ctx, grn_obj *msg)
       edge->com = com;
       edge->id = id;
       edge->stat = EDGE_IDLE;
+      edge->chunked = 0;
     }
     if (edge->ctx.stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
       grn_msg_close(ctx, msg);
     } else {
       grn_com_queue_enque(ctx, &edge->recv_new, (grn_com_queue_entry *)msg);
-      MUTEX_LOCK(q_mutex);
+      MUTEX_LOCK(loop->q_mutex);
       if (edge->stat == EDGE_IDLE) {
-        grn_com_queue_enque(ctx, &ctx_new, (grn_com_queue_entry *)edge);
+        grn_com_queue_enque(ctx, &loop->ctx_new, (grn_com_queue_entry *)edge);
         edge->stat = EDGE_WAIT;
-        if (!nfthreads && nthreads < max_nfthreads) {
+        if (!loop->nfthreads && loop->nthreads < max_nfthreads) {
           grn_thread thread;
-          nthreads++;
-          if (THREAD_CREATE(thread, worker, NULL)) { SERR("pthread_create"); }
+          loop->nthreads++;
+          if (THREAD_CREATE(thread, worker, loop)) { SERR("pthread_create"); }
         }
-        COND_SIGNAL(q_cond);
+        COND_SIGNAL(loop->q_cond);
       }
-      MUTEX_UNLOCK(q_mutex);
+      MUTEX_UNLOCK(loop->q_mutex);
     }
   }
 }
 
 #define MAX_CON 0x10000
 
+static grn_rc
+loop_open(grn_loop *loop, grn_obj *db, struct hostent *he)
+{
+  grn_ctx *ctx = &loop->ctx;
+  grn_ctx_init(ctx, 0);
+  MUTEX_INIT(loop->q_mutex);
+  COND_INIT(loop->q_cond);
+  GRN_COM_QUEUE_INIT(&loop->ctx_new);
+  GRN_COM_QUEUE_INIT(&loop->ctx_old);
+  GRN_COM_QUEUE_INIT(&loop->ctx_flush);
+  loop->nthreads = 0;
+  loop->nfthreads = 0;
+  loop->db = db;
+  if (!grn_com_event_init(ctx, &loop->ev, MAX_CON, sizeof(grn_com))) {
+    loop->ev.opaque = loop;
+    /* the kernel balances connections among the listeners of the loops */
+    loop->ev.reuse_port = n_loops > 1;
+    if ((loop->edges = grn_hash_create(ctx, NULL, sizeof(grn_com_addr),
+                                       sizeof(grn_edge), 0))) {
+      if (!grn_com_sopen(ctx, &loop->ev, port, msg_handler, he)) {
+        return GRN_SUCCESS;
+      }
+      fprintf(stderr, "grn_com_gqtp_sopen failed (%d)\n", port);
+      grn_hash_close(ctx, loop->edges);
+    }
+    grn_com_event_fin(ctx, &loop->ev);
+  } else {
+    fprintf(stderr, "grn_com_event_init failed\n");
+  }
+  grn_ctx_fin(ctx);
+  return GRN_INVALID_ARGUMENT;
+}
+
+static void
+loop_close(grn_loop *loop)
+{
+  grn_ctx *ctx = &loop->ctx;
+  {
+    grn_edge *edge;
+    GRN_HASH_EACH(ctx, loop->edges, id, NULL, NULL, &edge, {
+        grn_obj *obj;
+      while ((obj = (grn_obj *)grn_com_queue_deque(ctx, &edge->com->new))) {
+        grn_msg_close(&edge->ctx, obj);
+      }
+      while ((obj = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
+        grn_msg_close(&edge->ctx, obj);
+      }
+      while ((obj = (grn_obj *)grn_com_queue_deque(ctx, &edge->recv_new))) {
+        grn_msg_close(ctx, obj);
+      }
+      grn_ctx_fin(&edge->ctx);
+      if (edge->com->has_sid) {
+        grn_com_close(ctx, edge->com);
+      }
+      grn_hash_delete_by_id(ctx, loop->edges, edge->id, NULL);
+    });
+  }
+  {
+    grn_com *com;
+    GRN_HASH_EACH(ctx, loop->ev.hash, id, NULL, NULL, &com, { grn_com_close(ctx, com); });
+  }
+  grn_hash_close(ctx, loop->edges);
+  grn_com_event_fin(ctx, &loop->ev);
+  grn_ctx_fin(ctx);
+}
+
+static void * CALLBACK
+event_loop(void *arg)
+{
+  grn_loop *loop = arg;
+  grn_ctx *ctx = &loop->ctx;
+  while (!grn_com_event_poll(ctx, &loop->ev, 1000) && grn_gctx.stat != GRN_CTX_QUIT) {
+    grn_edge *edge;
+    while ((edge = (grn_edge *)grn_com_queue_deque(ctx, &loop->ctx_old))) {
+      grn_obj *msg;
+      if (!GRN_COM_QUEUE_EMPTYP(&edge->com->new)) {
+        /* wait until the rest of the responses are written */
+        grn_com_queue_enque(ctx, &loop->ctx_flush, (grn_com_queue_entry *)edge);
+        continue;
+      }
+      while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
+        grn_msg_close(&edge->ctx, msg);
+      }
+      while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->recv_new))) {
+        grn_msg_close(ctx, msg);
+      }
+      grn_ctx_fin(&edge->ctx);
+      if (edge->com->has_sid && edge->com->opaque == edge) {
+        grn_com_close(ctx, edge->com);
+      }
+      grn_hash_delete_by_id(ctx, loop->edges, edge->id, NULL);
+    }
+    while ((edge = (grn_edge *)grn_com_queue_deque(ctx, &loop->ctx_flush))) {
+      grn_com_queue_enque(ctx, &loop->ctx_old, (grn_com_queue_entry *)edge);
+    }
+    // todo : log stat
+  }
+  for (;;) {
+    MUTEX_LOCK(loop->q_mutex);
+    if (loop->nthreads == loop->nfthreads) { break; }
+    MUTEX_UNLOCK(loop->q_mutex);
+    MUTEX_LOCK(loop->ev.mutex);
+    COND_BROADCAST(loop->ev.cond);
+    MUTEX_UNLOCK(loop->ev.mutex);
+    usleep(1000);
+  }
+  loop_close(loop);
+  return NULL;
+}
+
 static int
 server(char *path)
 {
   int rc = -1;
-  grn_com_event ev;
+  grn_obj *db;
   grn_ctx ctx_, *ctx = &ctx_;
   grn_ctx_init(ctx, 0);
   grn_timeval_now(ctx, &starttime);
-  MUTEX_INIT(q_mutex);
-  COND_INIT(q_cond);
   MUTEX_INIT(cache_mutex);
-  GRN_COM_QUEUE_INIT(&ctx_new);
-  GRN_COM_QUEUE_INIT(&ctx_old);
 #ifndef WIN32
   {
     struct rlimit lim;
@@ -1017,75 +1330,46 @@ server(char *path)
     GRN_LOG(ctx, GRN_LOG_NOTICE, "RLIMIT_NOFILE(%d,%d)", lim.rlim_cur, lim.rlim_max);
   }
 #endif /* WIN32 */
-  if (!grn_com_event_init(ctx, &ev, MAX_CON, sizeof(grn_com))) {
-    grn_obj *db;
-    db = (newdb || !path) ? grn_db_create(ctx, path, NULL) : grn_db_open(ctx, path);
-    if (db) {
-      struct hostent *he;
-      if (!(he = gethostbyname(hostname))) {
-        SERR("gethostbyname");
-        return rc;
+  db = (newdb || !path) ? grn_db_create(ctx, path, NULL) : grn_db_open(ctx, path);
+  if (db) {
+    grn_loop *loops;
+    grn_thread sweeper;
+    int sweeping;
+    struct hostent *he;
+    if (!(he = gethostbyname(hostname))) {
+      SERR("gethostbyname");
+      return rc;
+    }
+    sweeping = !THREAD_CREATE(sweeper, cache_sweeper, db);
+    if (!sweeping) { SERR("pthread_create"); }
+    if ((loops = GRN_MALLOCN(grn_loop, n_loops))) {
+      int i, n;
+      for (n = 0; n < n_loops; n++) {
+        if (loop_open(&loops[n], db, he)) { break; }
       }
-      ev.opaque = db;
-      edges = grn_hash_create(ctx, NULL, sizeof(grn_com_addr), sizeof(grn_edge), 0);
-      if (!grn_com_sopen(ctx, &ev, port, msg_handler, he)) {
-        while (!grn_com_event_poll(ctx, &ev, 1000) && grn_gctx.stat != GRN_CTX_QUIT) {
-          grn_edge *edge;
-          while ((edge = (grn_edge *)grn_com_queue_deque(ctx, &ctx_old))) {
-            grn_obj *msg;
-            while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
-              grn_msg_close(&edge->ctx, msg);
-            }
-            while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->recv_new))) {
-              grn_msg_close(ctx, msg);
-            }
-            grn_ctx_fin(&edge->ctx);
-            if (edge->com->has_sid && edge->com->opaque == edge) {
-              grn_com_close(ctx, edge->com);
-            }
-            grn_hash_delete_by_id(ctx, edges, edge->id, NULL);
+      if (n == n_loops) {
+        for (i = 1; i < n; i++) {
+          if (THREAD_CREATE(loops[i].thread, event_loop, &loops[i])) {
+            SERR("pthread_create");
+            for (n = i; i < n_loops; i++) { loop_close(&loops[i]); }
+            break;
           }
-          // todo : log stat
-        }
-        for (;;) {
-          MUTEX_LOCK(q_mutex);
-          if (nthreads == nfthreads) { break; }
-          MUTEX_UNLOCK(q_mutex);
-          usleep(1000);
-        }
-        {
-          grn_edge *edge;
-          GRN_HASH_EACH(ctx, edges, id, NULL, NULL, &edge, {
-              grn_obj *obj;
-            while ((obj = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
-              grn_msg_close(&edge->ctx, obj);
-            }
-            while ((obj = (grn_obj *)grn_com_queue_deque(ctx, &edge->recv_new))) {
-              grn_msg_close(ctx, obj);
-            }
-            grn_ctx_fin(&edge->ctx);
-            if (edge->com->has_sid) {
-              grn_com_close(ctx, edge->com);
-            }
-            grn_hash_delete_by_id(ctx, edges, edge->id, NULL);
-          });
-        }
-        {
-          grn_com *com;
-          GRN_HASH_EACH(ctx, ev.hash, id, NULL, NULL, &com, { grn_com_close(ctx, com); });
         }
+        event_loop(&loops[0]);
+        for (i = 1; i < n; i++) { THREAD_JOIN(loops[i].thread); }
         rc = 0;
       } else {
-        fprintf(stderr, "grn_com_gqtp_sopen failed (%d)\n", port);
+        for (i = 0; i < n; i++) { loop_close(&loops[i]); }
       }
-      grn_hash_close(ctx, edges);
-      grn_db_close(ctx, db);
-    } else {
-      fprintf(stderr, "db open failed (%s)\n", path);
+      GRN_FREE(loops);
     }
-    grn_com_event_fin(ctx, &ev);
+    if (sweeping) {
+      cache_sweeper_quit = 1;
+      THREAD_JOIN(sweeper);
+    }
+    grn_db_close(ctx, db);
   } else {
-    fprintf(stderr, "grn_com_event_init failed\n");
+    fprintf(stderr, "db open failed (%s)\n", path);
   }
   grn_ctx_fin(ctx);
   return rc;
@@ -1147,7 +1431,8 @@ main(int argc, char **argv)
   grn_encoding enc = GRN_ENC_DEFAULT;
   const char *portstr = NULL, *encstr = NULL,
              *max_nfthreadsstr = NULL, *loglevel = NULL,
-             *hostnamestr = NULL;
+             *hostnamestr = NULL, *scan_threadsstr = NULL,
+             *event_loopsstr = NULL;
   int r, i, mode = mode_alone;
   static grn_str_getopt_opt opts[] = {
     {'p', NULL, NULL, 0, getopt_op_none},
@@ -1163,6 +1448,8 @@ main(int argc, char **argv)
     {'q', NULL, NULL, MODE_USE_QL, getopt_op_on},
     {'n', NULL, NULL, MODE_NEW_DB, getopt_op_on},
     {'\0', "admin-html-path", NULL, 0, getopt_op_none},
+    {'\0', "scan-threads", NULL, 0, getopt_op_none},
+    {'\0', "event-loops", NULL, 0, getopt_op_none},
     {'\0', NULL, NULL, 0, 0}
   };
   opts[0].arg = &portstr;
@@ -1171,6 +1458,8 @@ main(int argc, char **argv)
   opts[8].arg = &loglevel;
   opts[9].arg = &hostnamestr;
   opts[12].arg = &admin_html_path;
+  opts[13].arg = &scan_threadsstr;
+  opts[14].arg = &event_loopsstr;
   i = grn_str_getopt(argc, argv, opts, &mode);
   if (i < 0) { mode = mode_usage; }
   if (portstr) { port = atoi(portstr); }
@@ -1205,10 +1494,21 @@ main(int argc, char **argv)
   if (max_nfthreadsstr) {
     max_nfthreads = atoi(max_nfthreadsstr);
   }
+  if (event_loopsstr) {
+    n_loops = atoi(event_loopsstr);
+#ifndef SO_REUSEPORT
+    if (n_loops > 1) {
+      fprintf(stderr, "SO_REUSEPORT is not supported. only one event loop runs.\n");
+    }
+    n_loops = 1;
+#endif /* SO_REUSEPORT */
+    if (n_loops < 1) { n_loops = 1; }
+  }
   batchmode = !isatty(0);
   if (grn_init()) { return -1; }
   grn_set_default_encoding(enc);
   if (loglevel) { SET_LOGLEVEL(atoi(loglevel)); }
+  if (scan_threadsstr) { grn_set_scan_threads(atoi(scan_threadsstr)); }
   if (hostnamestr) {
     size_t hostnamelen = strlen(hostnamestr);
     if (hostnamelen > HOST_NAME_MAX) {
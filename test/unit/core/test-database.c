@@ -16,6 +16,8 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <db.h>
+
 #include <gcutter.h>
 #include <glib/gstdio.h>
 
@@ -26,6 +28,8 @@ void test_range(void);
 void test_cursor(void);
 void test_get_persistent_object_from_opened_database(void);
 void test_recreate_temporary_object_on_opened_database(void);
+void test_modified_by_schema_change(void);
+void test_modified_by_other_handle(void);
 
 static gchar *tmp_directory;
 
@@ -168,3 +172,78 @@ test_recreate_temporary_object_on_opened_database(void)
                                             grn_ctx_at(context, GRN_DB_UINT32),
                                             NULL));
 }
+
+void
+test_modified_by_schema_change(void)
+{
+  const gchar *path;
+  grn_obj *table, *column, *lexicon, *index, source;
+  grn_id column_id;
+  uint32_t modified;
+
+  path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, path, NULL);
+  grn_test_assert_not_null(context, database);
+
+  modified = grn_db_modified(database);
+  table = grn_table_create(context, "Users", 5, NULL,
+                           GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(context, GRN_DB_SHORT_TEXT), NULL);
+  grn_test_assert_not_null(context, table);
+  cut_assert_operator_uint(modified, <, grn_db_modified(database));
+
+  modified = grn_db_modified(database);
+  column = grn_column_create(context, table, "name", 4, NULL,
+                             GRN_OBJ_COLUMN_SCALAR|GRN_OBJ_PERSISTENT,
+                             grn_ctx_at(context, GRN_DB_TEXT));
+  grn_test_assert_not_null(context, column);
+  cut_assert_operator_uint(modified, <, grn_db_modified(database));
+
+  lexicon = grn_table_create(context, "Terms", 5, NULL,
+                             GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                             grn_ctx_at(context, GRN_DB_SHORT_TEXT), NULL);
+  modified = grn_db_modified(database);
+  grn_test_assert(grn_obj_set_info(context, lexicon,
+                                   GRN_INFO_DEFAULT_TOKENIZER,
+                                   grn_ctx_at(context, GRN_DB_BIGRAM)));
+  cut_assert_operator_uint(modified, <, grn_db_modified(database));
+
+  index = grn_column_create(context, lexicon, "index", 5, NULL,
+                            GRN_OBJ_COLUMN_INDEX|GRN_OBJ_PERSISTENT, table);
+  modified = grn_db_modified(database);
+  column_id = grn_obj_id(context, column);
+  GRN_TEXT_INIT(&source, 0);
+  GRN_TEXT_PUT(context, &source, &column_id, sizeof(grn_id));
+  grn_test_assert(grn_obj_set_info(context, index, GRN_INFO_SOURCE, &source));
+  grn_obj_unlink(context, &source);
+  cut_assert_operator_uint(modified, <, grn_db_modified(database));
+
+  modified = grn_db_modified(database);
+  grn_test_assert(grn_obj_remove(context, index));
+  cut_assert_operator_uint(modified, <, grn_db_modified(database));
+}
+
+void
+test_modified_by_other_handle(void)
+{
+  const gchar *path;
+  grn_obj *table;
+  uint32_t modified;
+
+  path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, path, NULL);
+  grn_test_assert_not_null(context, database);
+  database2 = grn_db_open(context2, path);
+  grn_test_assert_not_null(context2, database2);
+
+  modified = grn_db_modified(database2);
+  table = grn_table_create(context, "Users", 5, NULL,
+                           GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(context, GRN_DB_SHORT_TEXT), NULL);
+  grn_test_assert_not_null(context, table);
+  cut_assert_operator_uint(modified, <, grn_db_modified(database2));
+
+  modified = grn_db_modified(database2);
+  grn_table_add(context, table, "alice", 5, NULL);
+  cut_assert_operator_uint(modified, <, grn_db_modified(database2));
+}
@@ -40,6 +40,8 @@ void test_table_select_search(void);
 void test_table_select_select_search(void);
 void test_table_select_match(void);
 void test_table_select_match_equal(void);
+void test_table_select_range_indexed(void);
+void test_table_select_match_range_indexed(void);
 
 void test_expr_parse(void);
 void test_expr_set_value(void);
@@ -423,6 +425,7 @@ test_expr_query(void)
 }
 
 static grn_obj *docs, *terms, *size, *body, *index_body;
+static grn_obj *sizes, *index_size;
 
 #define INSERT_DATA(str) {\
   uint32_t s = (uint32_t)strlen(str);\
@@ -434,7 +437,7 @@ static grn_obj *docs, *terms, *size, *body, *index_body;
 }
 
 static void
-prepare_data(grn_obj *textbuf, grn_obj *intbuf)
+create_tables(grn_obj *textbuf, grn_obj *intbuf)
 {
   docs = grn_table_create(&context, "docs", 4, NULL,
                           GRN_OBJ_TABLE_NO_KEY|GRN_OBJ_PERSISTENT, NULL, NULL);
@@ -464,7 +467,28 @@ prepare_data(grn_obj *textbuf, grn_obj *intbuf)
 
   GRN_UINT32_SET(&context, intbuf, grn_obj_id(&context, body));
   grn_obj_set_info(&context, index_body, GRN_INFO_SOURCE, intbuf);
+}
+
+static void
+create_size_index(grn_obj *intbuf)
+{
+  sizes = grn_table_create(&context, "sizes", 5, NULL,
+                           GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_UINT32), NULL);
+  cut_assert_not_null(sizes);
 
+  index_size = grn_column_create(&context, sizes, "docs_size", 9, NULL,
+                                 GRN_OBJ_COLUMN_INDEX|GRN_OBJ_PERSISTENT,
+                                 docs);
+  cut_assert_not_null(index_size);
+
+  GRN_UINT32_SET(&context, intbuf, grn_obj_id(&context, size));
+  grn_obj_set_info(&context, index_size, GRN_INFO_SOURCE, intbuf);
+}
+
+static void
+insert_data(grn_obj *textbuf, grn_obj *intbuf)
+{
   INSERT_DATA("hoge");
   INSERT_DATA("fuga fuga");
   INSERT_DATA("moge moge moge");
@@ -477,6 +501,13 @@ prepare_data(grn_obj *textbuf, grn_obj *intbuf)
   INSERT_DATA("poyo moge hoge moge moge moge");
 }
 
+static void
+prepare_data(grn_obj *textbuf, grn_obj *intbuf)
+{
+  create_tables(textbuf, intbuf);
+  insert_data(textbuf, intbuf);
+}
+
 void
 test_table_select_equal(void)
 {
@@ -812,6 +843,92 @@ test_table_select_match_equal(void)
   grn_test_assert(grn_obj_close(&context, &textbuf));
 }
 
+void
+test_table_select_range_indexed(void)
+{
+  grn_obj *cond, *v, *res, textbuf, intbuf;
+  GRN_TEXT_INIT(&textbuf, 0);
+  GRN_UINT32_INIT(&intbuf, 0);
+
+  create_tables(&textbuf, &intbuf);
+  create_size_index(&intbuf);
+  insert_data(&textbuf, &intbuf);
+
+  cut_assert_not_null((cond = grn_expr_create(&context, NULL, 0)));
+  v = grn_expr_add_var(&context, cond, NULL, 0);
+  GRN_RECORD_INIT(v, 0, grn_obj_id(&context, docs));
+  grn_expr_append_obj(&context, cond, v, GRN_OP_PUSH, 1);
+  GRN_TEXT_SETS(&context, &textbuf, "size");
+  grn_expr_append_const(&context, cond, &textbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_GET_VALUE, 2);
+  GRN_UINT32_SET(&context, &intbuf, 14);
+  grn_expr_append_const(&context, cond, &intbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_LESS, 2);
+  grn_expr_compile(&context, cond);
+
+  res = grn_table_create(&context, NULL, 0, NULL,
+                         GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, docs, NULL);
+  cut_assert_not_null(res);
+
+  cut_assert_not_null(grn_table_select(&context, docs, cond, res, GRN_OP_OR));
+
+  cut_assert_equal_uint(3, grn_table_size(&context, res));
+
+  grn_test_assert(grn_obj_close(&context, res));
+  grn_test_assert(grn_obj_close(&context, cond));
+  grn_test_assert(grn_obj_close(&context, &textbuf));
+  grn_test_assert(grn_obj_close(&context, &intbuf));
+}
+
+void
+test_table_select_match_range_indexed(void)
+{
+  grn_obj *cond, *v, *res, textbuf, intbuf;
+  GRN_TEXT_INIT(&textbuf, 0);
+  GRN_UINT32_INIT(&intbuf, 0);
+
+  create_tables(&textbuf, &intbuf);
+  create_size_index(&intbuf);
+  insert_data(&textbuf, &intbuf);
+
+  cut_assert_not_null((cond = grn_expr_create(&context, NULL, 0)));
+  v = grn_expr_add_var(&context, cond, NULL, 0);
+  GRN_RECORD_INIT(v, 0, grn_obj_id(&context, docs));
+
+  grn_expr_append_obj(&context, cond, v, GRN_OP_PUSH, 1);
+  GRN_TEXT_SETS(&context, &textbuf, "body");
+  grn_expr_append_const(&context, cond, &textbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_GET_VALUE, 2);
+  GRN_TEXT_SETS(&context, &textbuf, "moge");
+  grn_expr_append_const(&context, cond, &textbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_MATCH, 2);
+
+  grn_expr_append_obj(&context, cond, v, GRN_OP_PUSH, 1);
+  GRN_TEXT_SETS(&context, &textbuf, "size");
+  grn_expr_append_const(&context, cond, &textbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_GET_VALUE, 2);
+  GRN_UINT32_SET(&context, &intbuf, 14);
+  grn_expr_append_const(&context, cond, &intbuf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_GREATER, 2);
+
+  grn_expr_append_op(&context, cond, GRN_OP_AND, 2);
+
+  grn_expr_compile(&context, cond);
+
+  res = grn_table_create(&context, NULL, 0, NULL,
+                         GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, docs, NULL);
+  cut_assert_not_null(res);
+
+  cut_assert_not_null(grn_table_select(&context, docs, cond, res, GRN_OP_OR));
+
+  cut_assert_equal_uint(4, grn_table_size(&context, res));
+
+  grn_test_assert(grn_obj_close(&context, res));
+  grn_test_assert(grn_obj_close(&context, cond));
+  grn_test_assert(grn_obj_close(&context, &textbuf));
+  grn_test_assert(grn_obj_close(&context, &intbuf));
+}
+
 #define PARSE(expr,str,level) \
   grn_expr_parse(&context, (expr), (str), strlen(str), body, GRN_OP_MATCH, GRN_OP_AND, level)
 
@@ -26,6 +26,10 @@ void data_open(void);
 void test_open(gconstpointer data);
 void test_open_without_path(void);
 void test_open_tiny_hash(void);
+void test_io_version(void);
+void test_bin_hash_file(void);
+void test_reopen_while_resizing(void);
+void test_resize_after_deletes(void);
 void data_lookup_add(void);
 void test_lookup_add(gconstpointer data);
 void data_delete_by_id(void);
@@ -176,6 +180,152 @@ test_open_tiny_hash(void)
   cut_assert_fail_open_hash();
 }
 
+void
+test_io_version(void)
+{
+  /* hash_func is unknown to the builds which only know version 1 */
+  cut_assert_create_hash();
+  cut_assert_equal_uint(2, grn_io_get_version(hash->io));
+  cut_assert_open_hash();
+  cut_assert_equal_uint(2, grn_io_get_version(hash->io));
+}
+
+/* hash_func of lib/hash.c in the files created before it was introduced */
+#define HASH_FUNC_BIN 0
+#define N_BIN_HASH_KEYS 1000
+
+void
+test_bin_hash_file(void)
+{
+  grn_id bin_hash_ids[N_BIN_HASH_KEYS];
+  gchar key[16];
+  gint i;
+
+  set_variable_size();
+  cut_assert_create_hash();
+  /* as written by the builds which only know version 1 */
+  grn_io_set_version(hash->io, 1);
+  hash->header->hash_func = HASH_FUNC_BIN;
+  hash->hash_func = HASH_FUNC_BIN;
+  for (i = 0; i < N_BIN_HASH_KEYS; i++) {
+    sprintf(key, "key%d", i);
+    bin_hash_ids[i] = grn_hash_add(context, hash, key, strlen(key), NULL, NULL);
+    grn_test_assert_not_nil(bin_hash_ids[i]);
+  }
+  grn_test_assert(grn_hash_close(context, hash));
+
+  cut_assert_open_hash();
+  cut_assert_equal_uint(1, grn_io_get_version(hash->io));
+  cut_assert_equal_uint(HASH_FUNC_BIN, hash->hash_func);
+  cut_assert_equal_uint(N_BIN_HASH_KEYS, GRN_HASH_SIZE(hash));
+  for (i = 0; i < N_BIN_HASH_KEYS; i++) {
+    sprintf(key, "key%d", i);
+    cut_assert_equal_uint(bin_hash_ids[i],
+                          grn_hash_get(context, hash, key, strlen(key), NULL),
+                          cut_message("<%s>", key));
+  }
+  sprintf(key, "key%d", N_BIN_HASH_KEYS);
+  grn_test_assert_nil(grn_hash_get(context, hash, key, strlen(key), NULL));
+}
+
+/* resize_stat of lib/hash.c while entries are moved to the new index */
+#define RESIZE_MOVE 2
+
+static void
+add_key(uint32_t key)
+{
+  grn_id added_id;
+
+  added_id = grn_hash_add(context, hash, &key, sizeof(uint32_t), NULL, NULL);
+  cut_assert_not_equal_uint(GRN_ID_NIL, added_id, cut_message("<%u>", key));
+  g_array_append_val(ids, added_id);
+}
+
+/* the keys from deleted_begin up to deleted_end must not be found */
+static void
+assert_keys(uint32_t deleted_begin, uint32_t deleted_end)
+{
+  uint32_t key;
+
+  for (key = 0; key < ids->len; key++) {
+    grn_id expected_id = GRN_ID_NIL;
+    if (key < deleted_begin || deleted_end <= key) {
+      expected_id = g_array_index(ids, grn_id, key);
+    }
+    cut_assert_equal_uint(expected_id,
+                          grn_hash_get(context, hash, &key, sizeof(uint32_t),
+                                       NULL),
+                          cut_message("<%u>", key));
+  }
+}
+
+void
+test_reopen_while_resizing(void)
+{
+  uint32_t key = 0, deleted_key = 1;
+
+  ids = g_array_new(FALSE, FALSE, sizeof(grn_id));
+  cut_assert_create_hash();
+  /* stop after a part of the entries has been moved */
+  while (hash->header->resize_stat != RESIZE_MOVE ||
+         !hash->header->resize_pos) {
+    add_key(key++);
+  }
+  grn_test_assert(grn_hash_close(context, hash));
+
+  cut_assert_open_hash();
+  cut_assert_equal_uint(RESIZE_MOVE, hash->header->resize_stat);
+  cut_assert_operator_uint(0, <, hash->header->resize_pos);
+  cut_assert_equal_uint(key, GRN_HASH_SIZE(hash));
+  assert_keys(0, 0);
+
+  grn_test_assert(grn_hash_delete(context, hash, &deleted_key,
+                                  sizeof(uint32_t), NULL));
+  while (hash->header->resize_stat) {
+    add_key(key++);
+  }
+  cut_assert_equal_uint(key - 1, GRN_HASH_SIZE(hash));
+  assert_keys(deleted_key, deleted_key + 1);
+
+  grn_test_assert(grn_hash_close(context, hash));
+  cut_assert_open_hash();
+  cut_assert_equal_uint(key - 1, GRN_HASH_SIZE(hash));
+  assert_keys(deleted_key, deleted_key + 1);
+}
+
+void
+test_resize_after_deletes(void)
+{
+  uint32_t key = 0, n_deleted_keys, max_offset;
+
+  ids = g_array_new(FALSE, FALSE, sizeof(grn_id));
+  cut_assert_create_hash();
+  /* up to just below the load which begins a resize */
+  while ((GRN_HASH_SIZE(hash) + *hash->n_garbages + 1) * 2 <=
+         *hash->max_offset) {
+    add_key(key++);
+  }
+  cut_assert_equal_uint(0, hash->header->resize_stat);
+  max_offset = *hash->max_offset;
+  for (n_deleted_keys = 0; n_deleted_keys < key; n_deleted_keys++) {
+    grn_test_assert(grn_hash_delete(context, hash, &n_deleted_keys,
+                                    sizeof(uint32_t), NULL));
+  }
+  cut_assert_equal_uint(0, GRN_HASH_SIZE(hash));
+
+  /* the resize begins with a few entries and many garbages. the new index
+     also receives the keys added while the large old one is moved. */
+  while (!hash->header->resize_stat) {
+    add_key(key++);
+  }
+  while (hash->header->resize_stat) {
+    add_key(key++);
+  }
+  cut_assert_operator_uint(*hash->max_offset, <, max_offset);
+  cut_assert_equal_uint(key - n_deleted_keys, GRN_HASH_SIZE(hash));
+  assert_keys(0, n_deleted_keys);
+}
+
 typedef struct _grn_test_data grn_test_data;
 
 typedef void (*increment_key_func) (grn_test_data *test_data);
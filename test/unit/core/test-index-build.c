@@ -0,0 +1,258 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <ii.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_single_source(void);
+void test_sections(void);
+void test_shared_posting(void);
+void test_key_source(void);
+
+#define N_RECORDS 300
+#define N_WORDS   40
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *docs, *title, *body, *terms;
+static gchar *base_dir;
+static grn_obj dump1, dump2;
+
+void
+cut_setup(void)
+{
+  gchar *path;
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "index-build", NULL);
+  database = grn_db_create(&context, path, NULL);
+  g_free(path);
+
+  docs = grn_table_create(&context, "Docs", 4, NULL,
+                          GRN_OBJ_TABLE_NO_KEY|GRN_OBJ_PERSISTENT, NULL, NULL);
+  title = grn_column_create(&context, docs, "title", 5, NULL,
+                            GRN_OBJ_COLUMN_SCALAR|GRN_OBJ_PERSISTENT,
+                            grn_ctx_at(&context, GRN_DB_TEXT));
+  body = grn_column_create(&context, docs, "body", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_TEXT));
+  terms = grn_table_create(&context, "Terms", 5, NULL,
+                           GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  grn_obj_set_info(&context, terms, GRN_INFO_DEFAULT_TOKENIZER,
+                   grn_ctx_at(&context, GRN_DB_DELIMIT));
+  GRN_TEXT_INIT(&dump1, 0);
+  GRN_TEXT_INIT(&dump2, 0);
+}
+
+void
+cut_teardown(void)
+{
+  grn_obj_unlink(&context, &dump1);
+  grn_obj_unlink(&context, &dump2);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+static grn_obj *
+create_index(const gchar *name, grn_obj_flags flags)
+{
+  return grn_column_create(&context, terms, name, strlen(name), NULL,
+                           GRN_OBJ_COLUMN_INDEX|GRN_OBJ_PERSISTENT|flags, docs);
+}
+
+static void
+set_sources(grn_obj *index, int n_sources)
+{
+  grn_obj source;
+  grn_id ids[2];
+
+  ids[0] = grn_obj_id(&context, title);
+  ids[1] = grn_obj_id(&context, body);
+  GRN_TEXT_INIT(&source, 0);
+  GRN_TEXT_PUT(&context, &source, ids, sizeof(grn_id) * n_sources);
+  grn_test_assert(grn_obj_set_info(&context, index, GRN_INFO_SOURCE, &source));
+  grn_obj_unlink(&context, &source);
+}
+
+static void
+put_words(grn_obj *column, grn_id id, int n_words, int a, int b)
+{
+  grn_obj value;
+  int i;
+
+  GRN_TEXT_INIT(&value, 0);
+  for (i = 0; i < n_words; i++) {
+    char word[16];
+    sprintf(word, "%sw%d", i ? " " : "", (id * a + i * b) % 97);
+    GRN_TEXT_PUTS(&context, &value, word);
+  }
+  grn_test_assert(grn_obj_set_value(&context, column, id, &value, GRN_OBJ_SET));
+  grn_obj_unlink(&context, &value);
+}
+
+static void
+add_records(int n_records, int n_words)
+{
+  int i;
+
+  for (i = 0; i < n_records; i++) {
+    grn_id id = grn_table_add(&context, docs, NULL, 0, NULL);
+    put_words(title, id, n_words / 4 + 1, 7, 3);
+    put_words(body, id, n_words, 5, 11);
+  }
+}
+
+/* writes all the postings of index as "term: rid/sid/tf(pos,...)" lines */
+static const gchar *
+dump_postings(grn_obj *index, grn_obj *dump)
+{
+  grn_id tid;
+  grn_table_cursor *tc;
+
+  GRN_BULK_REWIND(dump);
+  tc = grn_table_cursor_open(&context, terms, NULL, 0, NULL, 0, 0, -1, 0);
+  cut_assert_not_null(tc);
+  while ((tid = grn_table_cursor_next(&context, tc))) {
+    void *key;
+    int key_size = grn_table_cursor_get_key(&context, tc, &key);
+    grn_ii_cursor *c;
+    GRN_TEXT_PUT(&context, dump, key, key_size);
+    GRN_TEXT_PUTC(&context, dump, ':');
+    if ((c = grn_ii_cursor_open(&context, (grn_ii *)index, tid,
+                                GRN_ID_NIL, GRN_ID_MAX,
+                                ((grn_ii *)index)->n_elements, 0))) {
+      grn_ii_posting *posting;
+      while ((posting = grn_ii_cursor_next(&context, c))) {
+        gchar buf[64];
+        sprintf(buf, " %u/%u/%u(", posting->rid, posting->sid, posting->tf);
+        GRN_TEXT_PUTS(&context, dump, buf);
+        while ((posting = grn_ii_cursor_next_pos(&context, c))) {
+          sprintf(buf, "%u,", posting->pos);
+          GRN_TEXT_PUTS(&context, dump, buf);
+        }
+        GRN_TEXT_PUTC(&context, dump, ')');
+      }
+      grn_ii_cursor_close(&context, c);
+    }
+    GRN_TEXT_PUTC(&context, dump, '\n');
+  }
+  grn_table_cursor_close(&context, tc);
+  GRN_TEXT_PUTC(&context, dump, '\0');
+  return GRN_TEXT_VALUE(dump);
+}
+
+static void
+assert_build(grn_obj_flags flags, int n_sources)
+{
+  grn_obj *incremental, *bulk;
+
+  incremental = create_index("incremental", flags);
+  set_sources(incremental, n_sources);
+  add_records(N_RECORDS, N_WORDS);
+  bulk = create_index("bulk", flags);
+  set_sources(bulk, n_sources);
+  cut_assert_equal_string(dump_postings(incremental, &dump1),
+                          dump_postings(bulk, &dump2));
+}
+
+void
+test_single_source(void)
+{
+  assert_build(GRN_OBJ_WITH_POSITION, 1);
+}
+
+void
+test_sections(void)
+{
+  assert_build(GRN_OBJ_WITH_SECTION|GRN_OBJ_WITH_POSITION, 2);
+}
+
+void
+test_shared_posting(void)
+{
+  grn_obj *index, value;
+  grn_id id;
+
+  id = grn_table_add(&context, docs, NULL, 0, NULL);
+  GRN_TEXT_INIT(&value, 0);
+  GRN_TEXT_PUTS(&context, &value, "x y");
+  grn_test_assert(grn_obj_set_value(&context, title, id, &value, GRN_OBJ_SET));
+  GRN_BULK_REWIND(&value);
+  GRN_TEXT_PUTS(&context, &value, "y z x");
+  grn_test_assert(grn_obj_set_value(&context, body, id, &value, GRN_OBJ_SET));
+  grn_obj_unlink(&context, &value);
+
+  /* without sections, the positions of body follow the ones of title */
+  index = create_index("bulk", GRN_OBJ_WITH_POSITION);
+  set_sources(index, 2);
+  cut_assert_equal_string("x: 1/1/2(0,4,)\n"
+                          "y: 1/1/2(1,2,)\n"
+                          "z: 1/1/1(3,)\n",
+                          dump_postings(index, &dump1));
+}
+
+void
+test_key_source(void)
+{
+  grn_obj *keys, *index, source, value;
+  grn_id source_id;
+  const gchar *key;
+  int32_t i = 0x41424344;
+
+  /* the values are text like "DCBA" in little endian, which must not be
+     indexed instead of the keys */
+  keys = grn_table_create(&context, "Keys", 4, NULL,
+                          GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_PERSISTENT,
+                          grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                          grn_ctx_at(&context, GRN_DB_INT32));
+  cut_assert_not_null(keys);
+  GRN_INT32_INIT(&value, 0);
+  for (key = "x y\0y z\0"; *key; key += strlen(key) + 1) {
+    grn_id id = grn_table_add(&context, keys, key, strlen(key), NULL);
+    GRN_INT32_SET(&context, &value, i++);
+    grn_test_assert(grn_obj_set_value(&context, keys, id, &value, GRN_OBJ_SET));
+  }
+  grn_obj_unlink(&context, &value);
+
+  index = grn_column_create(&context, terms, "key_index", 9, NULL,
+                            GRN_OBJ_COLUMN_INDEX|GRN_OBJ_PERSISTENT|
+                            GRN_OBJ_WITH_POSITION, keys);
+  cut_assert_not_null(index);
+  source_id = grn_obj_id(&context, keys);
+  GRN_TEXT_INIT(&source, 0);
+  GRN_TEXT_PUT(&context, &source, &source_id, sizeof(grn_id));
+  grn_test_assert(grn_obj_set_info(&context, index, GRN_INFO_SOURCE, &source));
+  grn_obj_unlink(&context, &source);
+  cut_assert_equal_string("x: 1/1/1(0,)\n"
+                          "y: 1/1/1(1,) 2/1/1(0,)\n"
+                          "z: 2/1/1(1,)\n",
+                          dump_postings(index, &dump1));
+}
@@ -33,7 +33,12 @@ void test_open_invalid_segment_file(void);
 void test_open_invalid_chunk_file(void);
 void test_open_with_null_lexicon(void);
 void test_crud(void);
+void test_cursor_skip(void);
+void test_cursor_skip_chunks(void);
+void test_select_top_k(void);
+void test_select_top_k_after_update_by_other_handle(void);
 void test_array_index(void);
+void test_p_dec_avx2(void);
 
 #define TYPE_SIZE 1024
 
@@ -157,6 +162,7 @@ record_ids_free(void)
 void
 cut_teardown(void)
 {
+  grn_p_dec_avx2(TRUE);
   if (context) {
     inverted_index_free();
     if (path)
@@ -425,6 +431,187 @@ test_crud(void)
   gcut_assert_equal_list_string(NULL, retrieve_record_ids("検索"));
 }
 
+void
+test_cursor_skip(void)
+{
+  grn_id term_id;
+  grn_ii_cursor *cursor;
+  grn_ii_posting *posting;
+
+  cut_assert_create();
+
+  add_data(1, 1, "API.JA");
+  add_data(2, 1, "CHECKINSTALL.JA");
+  add_data(3, 1, "FUTUREWORKS.JA");
+  add_data(5, 1, "API.JA");
+  add_data(7, 1, "FUTUREWORKS.JA");
+
+  term_id = grn_table_get(context, lexicon, "検索", strlen("検索"));
+  cursor = grn_ii_cursor_open(context, inverted_index, term_id,
+                              GRN_ID_NIL, GRN_ID_MAX, 5, 0);
+  cut_assert_not_null(cursor);
+
+  posting = grn_ii_cursor_next(context, cursor);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(1, posting->rid);
+
+  posting = grn_ii_cursor_skip(context, cursor, 1, 1);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(1, posting->rid);
+
+  posting = grn_ii_cursor_skip(context, cursor, 4, 1);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(5, posting->rid);
+
+  posting = grn_ii_cursor_skip(context, cursor, 6, 1);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(7, posting->rid);
+
+  cut_assert_null(grn_ii_cursor_skip(context, cursor, 8, 1));
+  grn_ii_cursor_close(context, cursor);
+}
+
+static void
+add_text_to(grn_ii *ii, grn_id record_id, const gchar *text)
+{
+  grn_obj old_value, new_value;
+
+  GRN_TEXT_INIT(&old_value, GRN_OBJ_DO_SHALLOW_COPY);
+  GRN_TEXT_INIT(&new_value, GRN_OBJ_DO_SHALLOW_COPY);
+  GRN_TEXT_SET_REF(&new_value, text, strlen(text));
+  grn_ii_column_update(context, ii, record_id, 1,
+                       &old_value, &new_value, NULL);
+  grn_obj_close(context, &old_value);
+  grn_obj_close(context, &new_value);
+}
+
+static void
+add_text(grn_id record_id, const gchar *text)
+{
+  add_text_to(inverted_index, record_id, text);
+}
+
+/* enough postings of a term to split its chunk */
+#define N_CHUNK_RECORDS 600000
+
+void
+test_cursor_skip_chunks(void)
+{
+  static const gchar *texts[] = {"検索", "検索と検索", "検索検索検索", "索引の検索"};
+  grn_id rid, term_id, *rids;
+  grn_ii_cursor *cursor;
+  grn_ii_posting *posting;
+  int i, j;
+
+  cut_assert_create();
+  rids = cut_take_memory(g_new(grn_id, N_CHUNK_RECORDS));
+  for (i = 0, rid = 0; i < N_CHUNK_RECORDS; i++) {
+    /* irregular gaps keep the chunk from being packed too small to split */
+    rid += 1 + (i * 37) % 61;
+    rids[i] = rid;
+    add_text(rid, texts[i % 4]);
+  }
+
+  term_id = grn_table_get(context, lexicon, "検索", strlen("検索"));
+  cursor = grn_ii_cursor_open(context, inverted_index, term_id,
+                              GRN_ID_NIL, GRN_ID_MAX, 5, 0);
+  cut_assert_not_null(cursor);
+  posting = grn_ii_cursor_next(context, cursor);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(rids[0], posting->rid);
+
+  /* both within the decoded chunk and over the rest of split chunks */
+  for (j = 1; j < 16; j++) {
+    i = N_CHUNK_RECORDS / 16 * j + j;
+    posting = grn_ii_cursor_skip(context, cursor, rids[i - 1] + 1, 1);
+    cut_assert_not_null(posting);
+    cut_assert_equal_uint(rids[i], posting->rid);
+    posting = grn_ii_cursor_next(context, cursor);
+    cut_assert_not_null(posting);
+    cut_assert_equal_uint(rids[i + 1], posting->rid);
+  }
+  posting = grn_ii_cursor_skip(context, cursor, rids[N_CHUNK_RECORDS - 1], 1);
+  cut_assert_not_null(posting);
+  cut_assert_equal_uint(rids[N_CHUNK_RECORDS - 1], posting->rid);
+  cut_assert_null(grn_ii_cursor_skip(context, cursor, rid + 1, 1));
+  grn_ii_cursor_close(context, cursor);
+}
+
+/* collects the ids of the top k records for "検索" into record_ids */
+static uint32_t
+select_top_k(int k)
+{
+  grn_obj *result, query, *queries[1];
+  grn_id *key;
+  uint32_t nhits = 0;
+  grn_table_cursor *cursor;
+
+  record_ids_free();
+  result = grn_table_create(context, NULL, 0, NULL,
+                            GRN_OBJ_TABLE_HASH_KEY | GRN_OBJ_WITH_SUBREC,
+                            grn_ctx_at(context, GRN_DB_UINT32), NULL);
+  GRN_TEXT_INIT(&query, 0);
+  GRN_TEXT_PUTS(context, &query, "検索");
+  queries[0] = &query;
+  grn_test_assert(grn_ii_select_top_k(context, inverted_index, queries, 1,
+                                      GRN_OP_OR, k, (grn_hash *)result,
+                                      &nhits));
+  grn_obj_close(context, &query);
+  cut_assert_equal_uint(k, grn_table_size(context, result));
+
+  cursor = grn_table_cursor_open(context, result, NULL, 0, NULL, 0, 0, -1, 0);
+  while (grn_table_cursor_next(context, cursor) != GRN_ID_NIL) {
+    grn_table_cursor_get_key(context, cursor, (void **)&key);
+    record_ids = g_list_append(record_ids, g_strdup_printf("%u", *key));
+  }
+  grn_table_cursor_close(context, cursor);
+  grn_obj_close(context, result);
+
+  record_ids = g_list_sort(record_ids, (GCompareFunc)strcmp);
+  return nhits;
+}
+
+void
+test_select_top_k(void)
+{
+  cut_assert_create();
+
+  add_text(1, "検索");
+  add_text(2, "検索と検索");
+  add_text(3, "検索");
+  add_text(4, "索引");
+  add_text(5, "検索検索検索");
+
+  cut_assert_equal_uint(4, select_top_k(2));
+  gcut_assert_equal_list_string(gcut_list_string_new("2", "5", NULL),
+                                record_ids);
+}
+
+void
+test_select_top_k_after_update_by_other_handle(void)
+{
+  grn_ii *other;
+
+  cut_assert_create();
+
+  add_text(1, "検索");
+  add_text(2, "検索と検索");
+  select_top_k(1);
+  gcut_assert_equal_list_string(gcut_list_string_new("2", NULL),
+                                record_ids);
+
+  /* the upper bound of "検索" cached by inverted_index is 2 now, and
+     another handle, like the one of another process, adds a better one */
+  other = grn_ii_open(context, path, lexicon);
+  cut_assert_not_null(other);
+  add_text_to(other, 3, "検索検索検索");
+  grn_ii_close(context, other);
+
+  select_top_k(1);
+  gcut_assert_equal_list_string(gcut_list_string_new("3", NULL),
+                                record_ids);
+}
+
 static grn_rc
 set_index_source(grn_obj *index, grn_obj *source)
 {
@@ -881,3 +1068,67 @@ test_mroonga_index_score(void)
   grn_obj_close(context, lc);
   grn_obj_close(context, t1);
 }
+
+/* values of a few units of 128 and a remainder, which is not a multiple
+   of 8 */
+#define N_PACKED_VALUES (128 * 3 + 13)
+
+static uint32_t packed_values_seed;
+
+static uint32_t
+packed_value(int w)
+{
+  packed_values_seed = packed_values_seed * 1103515245 + 12345;
+  return w < 32 ? (packed_values_seed >> 7) & ((1U << w) - 1) :
+    packed_values_seed ^ (packed_values_seed << 16);
+}
+
+static void
+assert_p_dec(uint32_t *values, const gchar *label)
+{
+  grn_ctx *ctx = context;
+  uint8_t *packed;
+  uint32_t *decoded;
+  int packed_size;
+
+  packed_size = grn_p_enc(context, values, N_PACKED_VALUES, &packed);
+  cut_assert_operator_int(0, <, packed_size);
+  cut_assert_equal_int(N_PACKED_VALUES,
+                       grn_p_dec(context, packed, packed_size, 0, &decoded),
+                       cut_message("%s", label));
+  cut_assert_equal_memory(values, N_PACKED_VALUES * sizeof(uint32_t),
+                          decoded, N_PACKED_VALUES * sizeof(uint32_t),
+                          cut_message("%s", label));
+  GRN_FREE(decoded);
+  GRN_FREE(packed);
+}
+
+/* decodes runs of every bit width, and ones with wider exceptions, with
+   the scalar decoder and with the AVX2 one when the CPU supports it */
+void
+test_p_dec_avx2(void)
+{
+  uint32_t values[N_PACKED_VALUES];
+  int w, i, avx2;
+
+  for (avx2 = FALSE; avx2 <= TRUE; avx2++) {
+    const gchar *decoder = avx2 ? "avx2" : "scalar";
+    if (grn_p_dec_avx2(avx2) != avx2) {
+      cut_notify("AVX2 is not available");
+    }
+    for (w = 0; w <= 32; w++) {
+      packed_values_seed = w;
+      for (i = 0; i < N_PACKED_VALUES; i++) {
+        values[i] = packed_value(w);
+      }
+      if (w) { values[N_PACKED_VALUES / 2] |= 1U << (w - 1); }
+      assert_p_dec(values, cut_take_printf("%s: w=%d", decoder, w));
+
+      for (i = 0; i < N_PACKED_VALUES; i += 16) {
+        values[i] = packed_value(w + 6 < 32 ? w + 6 : 32);
+      }
+      assert_p_dec(values,
+                   cut_take_printf("%s: w=%d with exceptions", decoder, w));
+    }
+  }
+}
@@ -0,0 +1,182 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <hash.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_statistics(void);
+void test_timeout(void);
+void test_timeout_while_lock_changes(void);
+
+#define TIMEOUT 100 /* msecs */
+/* some slack for the scheduling of the busy contenders */
+#define MAX_ELAPSED (TIMEOUT * 5)
+#define N_CONTENDERS 4
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_hash *hash;
+static gchar *base_dir;
+static grn_io_lock_statistics before;
+static GThread *threads[N_CONTENDERS];
+static volatile gboolean contending;
+
+void
+cut_setup(void)
+{
+  gchar *path;
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "io-lock", NULL);
+  hash = grn_hash_create(&context, path, sizeof(uint32_t), 0, 0);
+  g_free(path);
+  contending = FALSE;
+  memset(threads, 0, sizeof(threads));
+  grn_io_get_lock_statistics(&before);
+}
+
+void
+cut_teardown(void)
+{
+  gint i;
+
+  contending = FALSE;
+  for (i = 0; i < N_CONTENDERS; i++) {
+    if (threads[i]) {
+      g_thread_join(threads[i]);
+    }
+  }
+  if (hash) {
+    grn_io_clear_lock(hash->io);
+    grn_hash_close(&context, hash);
+  }
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+/* the lock statistics are shared by the whole process, so they are
+   checked by the differences from the ones at cut_setup() */
+#define lock_stat_diff(member) (after.member - before.member)
+
+void
+test_statistics(void)
+{
+  grn_io_lock_statistics after;
+
+  cut_assert_not_null(hash);
+  grn_test_assert(grn_io_lock(&context, hash->io, 0));
+  cut_assert_equal_uint(1, grn_io_is_locked(hash->io));
+  grn_test_assert_equal_rc(GRN_RESOURCE_DEADLOCK_AVOIDED,
+                           grn_io_lock(&context, hash->io, 0));
+  grn_io_unlock(hash->io);
+  cut_assert_equal_uint(0, grn_io_is_locked(hash->io));
+
+  grn_io_get_lock_statistics(&after);
+  cut_assert_equal_uint(2, lock_stat_diff(nlocks));
+  cut_assert_equal_uint(1, lock_stat_diff(ncollisions));
+  cut_assert_equal_uint(0, lock_stat_diff(nwaits));
+  cut_assert_equal_uint(0, lock_stat_diff(ntimeouts));
+}
+
+/* returns the usecs until grn_io_lock() gave up */
+static gint64
+assert_lock_timeout(void)
+{
+  GTimer *timer;
+  gint64 elapsed;
+
+  timer = g_timer_new();
+  grn_test_assert_equal_rc(GRN_RESOURCE_DEADLOCK_AVOIDED,
+                           grn_io_lock(&context, hash->io, TIMEOUT));
+  elapsed = g_timer_elapsed(timer, NULL) * G_USEC_PER_SEC;
+  g_timer_destroy(timer);
+  cut_assert_operator_int(TIMEOUT * 1000, <=, elapsed);
+  return elapsed;
+}
+
+void
+test_timeout(void)
+{
+  grn_io_lock_statistics after;
+  gint64 elapsed;
+
+  cut_assert_not_null(hash);
+  grn_test_assert(grn_io_lock(&context, hash->io, 0));
+  elapsed = assert_lock_timeout();
+  cut_assert_operator_int(elapsed, <, MAX_ELAPSED * 1000);
+  grn_io_unlock(hash->io);
+
+  grn_io_get_lock_statistics(&after);
+  cut_assert_equal_uint(2, lock_stat_diff(nlocks));
+  cut_assert_equal_uint(1, lock_stat_diff(ncollisions));
+  cut_assert_equal_uint(1, lock_stat_diff(ntimeouts));
+  cut_assert_operator_uint(0, <, lock_stat_diff(nwaits));
+  cut_assert_operator_uint(0, <, lock_stat_diff(wait_time));
+  cut_assert_operator_uint(lock_stat_diff(wait_time), <=, elapsed);
+}
+
+/* tries the lock the way the waiters of grn_io_lock() do, which changes
+   the lock word while it is held */
+static gpointer
+contend(gpointer data)
+{
+  uint32_t lock;
+
+  while (contending) {
+    GRN_ATOMIC_ADD_EX(hash->io->lock, 1, lock);
+    GRN_ATOMIC_ADD_EX(hash->io->lock, -1, lock);
+  }
+  return NULL;
+}
+
+void
+test_timeout_while_lock_changes(void)
+{
+  GError *error = NULL;
+  gint64 elapsed;
+  gint i;
+
+  cut_assert_not_null(hash);
+  grn_test_assert(grn_io_lock(&context, hash->io, 0));
+  if (!g_thread_supported()) { g_thread_init(NULL); }
+  contending = TRUE;
+  for (i = 0; i < N_CONTENDERS; i++) {
+    threads[i] = g_thread_create(contend, NULL, TRUE, &error);
+    gcut_assert_error(error);
+  }
+  elapsed = assert_lock_timeout();
+  contending = FALSE;
+  for (i = 0; i < N_CONTENDERS; i++) {
+    g_thread_join(threads[i]);
+    threads[i] = NULL;
+  }
+  cut_assert_operator_int(elapsed, <, MAX_ELAPSED * 1000);
+  grn_io_unlock(hash->io);
+  cut_assert_equal_uint(0, grn_io_is_locked(hash->io));
+}
@@ -0,0 +1,186 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <ii.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_tsv_header_only(void);
+void test_tsv_nonexistent_column(void);
+void test_tsv_quoted_multi_line(void);
+void test_tsv_continued(void);
+void test_json_bulk_indexes(void);
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table, *body, *price;
+static grn_obj value;
+
+#define LOAD_TSV(values)                                                \
+  grn_load(&context, GRN_CONTENT_TSV, "Items", 5, NULL, 0,             \
+           (values), strlen(values), NULL, 0)
+
+#define LOAD_JSON(values)                                               \
+  grn_load(&context, GRN_CONTENT_JSON, "Items", 5, NULL, 0,            \
+           (values), strlen(values), NULL, 0)
+
+#define LOAD_JSON_MORE(values)                                          \
+  grn_load(&context, GRN_CONTENT_JSON, NULL, 0, NULL, 0,                \
+           (values), strlen(values), NULL, 0)
+
+#define LOAD_TSV_MORE(values)                                           \
+  grn_load(&context, GRN_CONTENT_TSV, NULL, 0, NULL, 0,                 \
+           (values), strlen(values), NULL, 0)
+
+void
+cut_setup(void)
+{
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  database = grn_db_create(&context, NULL, NULL);
+  table = grn_table_create(&context, "Items", 5, NULL,
+                           GRN_OBJ_TABLE_HASH_KEY,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  body = grn_column_create(&context, table, "body", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR,
+                           grn_ctx_at(&context, GRN_DB_TEXT));
+  price = grn_column_create(&context, table, "price", 5, NULL,
+                            GRN_OBJ_COLUMN_SCALAR,
+                            grn_ctx_at(&context, GRN_DB_UINT32));
+  GRN_TEXT_INIT(&value, 0);
+}
+
+void
+cut_teardown(void)
+{
+  grn_obj_unlink(&context, &value);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+}
+
+static const gchar *
+get_body(const gchar *key)
+{
+  grn_id id = grn_table_get(&context, table, key, strlen(key));
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  GRN_BULK_REWIND(&value);
+  grn_obj_get_value(&context, body, id, &value);
+  GRN_TEXT_PUTC(&context, &value, '\0');
+  return GRN_TEXT_VALUE(&value);
+}
+
+void
+test_tsv_header_only(void)
+{
+  grn_test_assert(LOAD_TSV("_key\tbody\tprice\n"));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+
+  grn_test_assert(LOAD_TSV("_key\tbody\tprice\nfoo\tFOO\t100\n"));
+  cut_assert_equal_uint(1, grn_table_size(&context, table));
+}
+
+void
+test_tsv_nonexistent_column(void)
+{
+  grn_test_assert_equal_rc(GRN_INVALID_ARGUMENT,
+                           LOAD_TSV("_key\tnonexistent\nfoo\t9\n"));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+
+  grn_test_assert(LOAD_TSV("_key\tprice\nfoo\t9\n"));
+  cut_assert_equal_uint(1, grn_table_size(&context, table));
+}
+
+void
+test_tsv_quoted_multi_line(void)
+{
+  grn_test_assert(LOAD_TSV("_key\tbody\n"
+                           "foo\t\"first\nsecond\"\n"
+                           "bar\t\"with \\\"quote\\\"\"\n"));
+  cut_assert_equal_uint(2, grn_table_size(&context, table));
+  cut_assert_equal_string("first\nsecond", get_body("foo"));
+  cut_assert_equal_string("with \"quote\"", get_body("bar"));
+}
+
+void
+test_tsv_continued(void)
+{
+  grn_test_assert(LOAD_TSV(""));
+  grn_test_assert(LOAD_TSV_MORE("_key\tbody\tprice"));
+  grn_test_assert(LOAD_TSV_MORE("foo\tFOO\t100"));
+  grn_test_assert(LOAD_TSV_MORE("bar\t\"first"));
+  grn_test_assert(LOAD_TSV_MORE("second\"\t200"));
+  grn_test_assert(LOAD_TSV_MORE(""));
+  cut_assert_equal_uint(2, grn_table_size(&context, table));
+  cut_assert_equal_string("FOO", get_body("foo"));
+  cut_assert_equal_string("first\nsecond", get_body("bar"));
+
+  grn_test_assert(LOAD_TSV("_key\tbody\nbaz\tBAZ\n"));
+  cut_assert_equal_uint(3, grn_table_size(&context, table));
+}
+
+static grn_obj *
+index_create(grn_obj *lexicon, const gchar *name, grn_obj *source)
+{
+  grn_obj *index, source_ids;
+  grn_id source_id = grn_obj_id(&context, source);
+
+  index = grn_column_create(&context, lexicon, name, strlen(name), NULL,
+                            GRN_OBJ_COLUMN_INDEX|GRN_OBJ_WITH_POSITION, table);
+  cut_assert_not_null(index);
+  GRN_TEXT_INIT(&source_ids, 0);
+  GRN_TEXT_PUT(&context, &source_ids, &source_id, sizeof(grn_id));
+  grn_test_assert(grn_obj_set_info(&context, index, GRN_INFO_SOURCE,
+                                   &source_ids));
+  grn_obj_unlink(&context, &source_ids);
+  return index;
+}
+
+void
+test_json_bulk_indexes(void)
+{
+  grn_obj *terms, *key_index, *body_index;
+
+  terms = grn_table_create(&context, "Terms", 5, NULL,
+                           GRN_OBJ_TABLE_PAT_KEY,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  grn_obj_set_info(&context, terms, GRN_INFO_DEFAULT_TOKENIZER,
+                   grn_ctx_at(&context, GRN_DB_DELIMIT));
+  key_index = index_create(terms, "key_index", table);
+  body_index = index_create(terms, "body_index", body);
+
+  /* the indexes of both _key and columns stay in bulk mode until the top
+     level value is closed */
+  grn_test_assert(LOAD_JSON("[{\"_key\":\"foo\",\"body\":\"x y\"}"));
+  cut_assert_equal_uint(1, ((grn_ii *)key_index)->n_bulk_loaders);
+  cut_assert_equal_uint(1, ((grn_ii *)body_index)->n_bulk_loaders);
+  grn_test_assert(LOAD_JSON_MORE(",{\"_key\":\"bar\",\"body\":\"y z\"}]"));
+  cut_assert_equal_uint(0, ((grn_ii *)key_index)->n_bulk_loaders);
+  cut_assert_equal_uint(0, ((grn_ii *)body_index)->n_bulk_loaders);
+
+  cut_assert_equal_uint(2, grn_table_size(&context, table));
+  cut_assert_equal_string("y z", get_body("bar"));
+  cut_assert_not_equal_uint(GRN_ID_NIL, grn_table_get(&context, terms, "z", 1));
+  cut_assert_operator_uint(0, <, grn_ii_estimate_size(&context,
+                                                     (grn_ii *)body_index,
+                                                     grn_table_get(&context, terms,
+                                                                   "y", 1)));
+}
@@ -0,0 +1,279 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <groonga.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_load_split(void);
+void test_load_truncated(void);
+void test_load_oversized_length(void);
+void test_select_output(void);
+void test_status_output(void);
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table, *body, *price;
+static grn_obj value, result;
+
+#define LOAD_MSGPACK(values)                                            \
+  grn_load(&context, GRN_CONTENT_MSGPACK, "Items", 5, NULL, 0,         \
+           (values), sizeof(values) - 1, NULL, 0)
+
+#define LOAD_MSGPACK_MORE(values, values_len)                           \
+  grn_load(&context, GRN_CONTENT_MSGPACK, NULL, 0, NULL, 0,             \
+           (values), (values_len), NULL, 0)
+
+/* [{"_key":"foo","body":"x" * 300,"price":100},
+    {"_key":"bar","body":"BAR","price":70000}]
+   "x" * 300 is a raw 16 and "BAR" a raw 32. */
+#define BODY_SIZE 300
+#define RECORD1_HEAD                                                    \
+  "\x92"                                                                \
+  "\x83" "\xa4_key" "\xa3" "foo" "\xa4" "body" "\xda\x01\x2c"
+#define RECORD1_TAIL                                                    \
+  "\xa5" "price" "\x64"
+#define RECORD2                                                         \
+  "\x83" "\xa4_key" "\xa3" "bar"                                        \
+  "\xa4" "body" "\xdb\x00\x00\x00\x03" "BAR"                            \
+  "\xa5" "price" "\xce\x00\x01\x11\x70"
+
+void
+cut_setup(void)
+{
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  database = grn_db_create(&context, NULL, NULL);
+  table = grn_table_create(&context, "Items", 5, NULL,
+                           GRN_OBJ_TABLE_HASH_KEY,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  body = grn_column_create(&context, table, "body", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR,
+                           grn_ctx_at(&context, GRN_DB_TEXT));
+  price = grn_column_create(&context, table, "price", 5, NULL,
+                            GRN_OBJ_COLUMN_SCALAR,
+                            grn_ctx_at(&context, GRN_DB_UINT32));
+  GRN_TEXT_INIT(&value, 0);
+  GRN_TEXT_INIT(&result, 0);
+}
+
+void
+cut_teardown(void)
+{
+  grn_obj_unlink(&context, &value);
+  grn_obj_unlink(&context, &result);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+}
+
+static const gchar *
+get_body(const gchar *key)
+{
+  grn_id id = grn_table_get(&context, table, key, strlen(key));
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  GRN_BULK_REWIND(&value);
+  grn_obj_get_value(&context, body, id, &value);
+  GRN_TEXT_PUTC(&context, &value, '\0');
+  return GRN_TEXT_VALUE(&value);
+}
+
+static uint32_t
+get_price(const gchar *key)
+{
+  grn_id id = grn_table_get(&context, table, key, strlen(key));
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  GRN_BULK_REWIND(&value);
+  grn_obj_get_value(&context, price, id, &value);
+  return GRN_UINT32_VALUE(&value);
+}
+
+static void
+put_records(grn_obj *buf)
+{
+  gint i;
+
+  GRN_TEXT_PUT(&context, buf, RECORD1_HEAD, sizeof(RECORD1_HEAD) - 1);
+  for (i = 0; i < BODY_SIZE; i++) {
+    GRN_TEXT_PUTC(&context, buf, 'x');
+  }
+  GRN_TEXT_PUT(&context, buf, RECORD1_TAIL, sizeof(RECORD1_TAIL) - 1);
+  GRN_TEXT_PUT(&context, buf, RECORD2, sizeof(RECORD2) - 1);
+}
+
+static void
+assert_records(void)
+{
+  cut_assert_equal_uint(2, grn_table_size(&context, table));
+  cut_assert_equal_uint(BODY_SIZE, strlen(get_body("foo")));
+  cut_assert_equal_uint(100, get_price("foo"));
+  cut_assert_equal_string("BAR", get_body("bar"));
+  cut_assert_equal_uint(70000, get_price("bar"));
+}
+
+void
+test_load_split(void)
+{
+  grn_obj values;
+  const char *p, *pe;
+
+  GRN_TEXT_INIT(&values, 0);
+  put_records(&values);
+  p = GRN_TEXT_VALUE(&values);
+  pe = p + GRN_TEXT_LEN(&values);
+  /* every element, header and length prefix is split */
+  grn_test_assert(LOAD_MSGPACK(""));
+  for (; p < pe - 1; p++) {
+    grn_test_assert(LOAD_MSGPACK_MORE(p, 1));
+  }
+  cut_assert_equal_uint(1, grn_table_size(&context, table));
+  grn_test_assert(LOAD_MSGPACK_MORE(p, 1));
+  GRN_OBJ_FIN(&context, &values);
+  assert_records();
+}
+
+void
+test_load_truncated(void)
+{
+  grn_obj values;
+
+  GRN_TEXT_INIT(&values, 0);
+  put_records(&values);
+  /* the values end in the middle of the body of the first record */
+  grn_test_assert(LOAD_MSGPACK(""));
+  grn_test_assert(LOAD_MSGPACK_MORE(GRN_TEXT_VALUE(&values),
+                                    sizeof(RECORD1_HEAD) - 1 + BODY_SIZE / 2));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+  grn_test_assert(LOAD_MSGPACK_MORE(GRN_TEXT_VALUE(&values) +
+                                    sizeof(RECORD1_HEAD) - 1 + BODY_SIZE / 2,
+                                    GRN_TEXT_LEN(&values) -
+                                    (sizeof(RECORD1_HEAD) - 1 + BODY_SIZE / 2)));
+  GRN_OBJ_FIN(&context, &values);
+  assert_records();
+}
+
+void
+test_load_oversized_length(void)
+{
+  /* the lengths exceed the values, and 3 + length or 5 + length wraps
+     around in 32 bits */
+  grn_test_assert(LOAD_MSGPACK("\x91\x81\xa4_key\xdb\xff\xff\xff\xfc" "abc"));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+  grn_test_assert(LOAD_MSGPACK("\x91\x81\xa4_key\xc6\xff\xff\xff\xff" "abc"));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+  grn_test_assert(LOAD_MSGPACK("\x91\x81\xa4_key\xda\xff\xfe" "abc"));
+  cut_assert_equal_uint(0, grn_table_size(&context, table));
+
+  /* loading the table again drops the incomplete element */
+  grn_test_assert(LOAD_MSGPACK("\x91\x81\xa4_key\xa3" "foo"));
+  cut_assert_equal_uint(1, grn_table_size(&context, table));
+}
+
+static const gchar *
+send_command(const gchar *command)
+{
+  grn_ctx_info info;
+
+  grn_ctx_send(&context, (char *)command, strlen(command), 0);
+  grn_test_assert(context.rc);
+  grn_test_assert(grn_ctx_info_get(&context, &info));
+  GRN_BULK_REWIND(&result);
+  GRN_TEXT_PUT(&context, &result,
+               GRN_TEXT_VALUE(info.outbuf), GRN_TEXT_LEN(info.outbuf));
+  GRN_BULK_REWIND(info.outbuf);
+  return GRN_TEXT_VALUE(&result);
+}
+
+#define cut_assert_equal_output(expected, command) do {                 \
+  const gchar *output = send_command(command);                          \
+  cut_assert_equal_memory(expected, sizeof(expected) - 1,               \
+                          output, GRN_TEXT_LEN(&result));               \
+} while (0)
+
+void
+test_select_output(void)
+{
+  grn_test_assert(LOAD_MSGPACK("\x92"
+                               "\x82\xa4_key\xa3" "foo\xa5price\x64"
+                               "\x82\xa4_key\xa3" "bar\xa5price\xcd\x01\x2c"));
+  /* [[0],[[2],["_key","price"],["foo",100],["bar",300]]] */
+  cut_assert_equal_output("\x92"
+                          "\x91\x00"
+                          "\x94"
+                          "\x91\x02"
+                          "\x92\xa4_key\xa5price"
+                          "\x92\xa3" "foo\x64"
+                          "\x92\xa3" "bar\xcd\x01\x2c",
+                          "select --table Items "
+                          "--output_columns '_key price' "
+                          "--output_type msgpack");
+  /* [[0],[[0],["_key"]]] */
+  cut_assert_equal_output("\x92"
+                          "\x91\x00"
+                          "\x92"
+                          "\x91\x00"
+                          "\x91\xa4_key",
+                          "select --table Items --filter 'price > 1000' "
+                          "--output_columns _key "
+                          "--output_type msgpack");
+}
+
+/* returns the bytes of the unsigned integer or float at p */
+static gint
+value_size(const guchar *p)
+{
+  if (*p < 0x80) { return 1; }
+  switch (*p) {
+  case 0xcc : return 2;
+  case 0xcd : return 3;
+  case 0xce : return 5;
+  case 0xcf : case 0xcb : return 9;
+  }
+  cut_fail("unexpected type: <%02x>", *p);
+  return 0;
+}
+
+void
+test_status_output(void)
+{
+  const gchar *names[] = {
+    "alloc_count", "starttime", "uptime",
+    "cache_entries", "cache_size", "cache_fetches", "cache_hits",
+    "cache_hit_rate",
+    "lock_count", "lock_collisions", "lock_waits", "lock_wait_time",
+    "lock_timeouts"
+  };
+  const guchar *p, *pe;
+  guint i;
+
+  p = (const guchar *)send_command("status --output_type msgpack");
+  pe = p + GRN_TEXT_LEN(&result);
+  cut_assert_equal_uint(0x80 | G_N_ELEMENTS(names), *p++);
+  for (i = 0; i < G_N_ELEMENTS(names); i++) {
+    guint name_len = strlen(names[i]);
+    cut_assert_operator_int(pe - p, >, 1 + name_len);
+    cut_assert_equal_uint(0xa0 | name_len, *p++);
+    cut_assert_equal_memory(names[i], name_len, p, name_len);
+    p += name_len;
+    p += value_size(p);
+  }
+  cut_assert_equal_int(0, pe - p);
+}
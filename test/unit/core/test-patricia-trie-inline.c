@@ -0,0 +1,264 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <groonga.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_same_ids(void);
+void test_same_results(void);
+void test_same_results_after_delete(void);
+void test_reopen(void);
+
+#define N_KEYS   3000
+/* longer than the keys kept in a node of both layouts */
+#define MAX_KEY_SIZE 40
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *inline_table, *plain_table;
+static gchar *base_dir, *path;
+static grn_obj dump1, dump2;
+
+void
+cut_setup(void)
+{
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "patricia-trie-inline", NULL);
+  database = grn_db_create(&context, path, NULL);
+
+  inline_table = grn_table_create(&context, "Inline", 6, NULL,
+                                  GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_KEY_INLINE|
+                                  GRN_OBJ_PERSISTENT,
+                                  grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                                  NULL);
+  plain_table = grn_table_create(&context, "Plain", 5, NULL,
+                                 GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                                 grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                                 NULL);
+  GRN_TEXT_INIT(&dump1, 0);
+  GRN_TEXT_INIT(&dump2, 0);
+}
+
+void
+cut_teardown(void)
+{
+  grn_obj_unlink(&context, &dump1);
+  grn_obj_unlink(&context, &dump2);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(path);
+  g_free(base_dir);
+}
+
+/* the i-th key is 1 to MAX_KEY_SIZE bytes long, and the keys of
+   i % MAX_KEY_SIZE == 0 .. MAX_KEY_SIZE - 1 for the same i / MAX_KEY_SIZE
+   are prefixes of each other */
+static int
+make_key(gint i, gchar *key)
+{
+  gint j, size = 1 + i % MAX_KEY_SIZE;
+  guint32 seed = (i / MAX_KEY_SIZE) * 2654435761U;
+
+  for (j = 0; j < size; j++) {
+    key[j] = 'a' + (seed >> ((j % 4) * 8)) % 26;
+    if (j % 4 == 3) { seed = seed * 1103515245 + 12345; }
+  }
+  return size;
+}
+
+static void
+add_keys(gboolean with_ids)
+{
+  gint i;
+
+  for (i = 0; i < N_KEYS; i++) {
+    gchar key[MAX_KEY_SIZE];
+    int size = make_key(i, key);
+    grn_id plain_id = grn_table_add(&context, plain_table, key, size, NULL);
+    grn_id inline_id = grn_table_add(&context, inline_table, key, size, NULL);
+    cut_assert_not_equal_uint(GRN_ID_NIL, inline_id);
+    if (with_ids) {
+      cut_assert_equal_uint(plain_id, inline_id,
+                            cut_message("<%.*s>", size, key));
+    }
+  }
+}
+
+static void
+delete_keys(gint step)
+{
+  gint i;
+
+  for (i = 0; i < N_KEYS; i += step) {
+    gchar key[MAX_KEY_SIZE];
+    int size = make_key(i, key);
+    /* the key may already be deleted as the one of another chain */
+    grn_test_assert_equal_rc(grn_table_delete(&context, plain_table, key, size),
+                             grn_table_delete(&context, inline_table, key, size));
+  }
+}
+
+/* writes the id, or the key instead after deleted ids are reused, because
+   the short keys of the inline layout share a single garbage list */
+static void
+put_id(grn_obj *table, grn_obj *dump, grn_id id, gboolean with_ids)
+{
+  gchar buf[MAX_KEY_SIZE + 1];
+  int key_size;
+
+  if (with_ids || !id) {
+    sprintf(buf, "%u", id);
+    GRN_TEXT_PUTS(&context, dump, buf);
+  } else {
+    key_size = grn_table_get_key(&context, table, id, buf, MAX_KEY_SIZE);
+    GRN_TEXT_PUTC(&context, dump, '<');
+    GRN_TEXT_PUT(&context, dump, buf, key_size);
+    GRN_TEXT_PUTC(&context, dump, '>');
+  }
+}
+
+static void
+dump_cursor(grn_obj *table, grn_obj *dump, gboolean with_ids,
+            const gchar *min, const gchar *max, int flags)
+{
+  grn_table_cursor *tc;
+  grn_id id;
+
+  tc = grn_table_cursor_open(&context, table,
+                             min, min ? strlen(min) : 0,
+                             max, max ? strlen(max) : 0,
+                             0, 0, flags);
+  cut_assert_not_null(tc);
+  while ((id = grn_table_cursor_next(&context, tc))) {
+    void *key;
+    int key_size = grn_table_cursor_get_key(&context, tc, &key);
+    put_id(table, dump, id, with_ids);
+    GRN_TEXT_PUTC(&context, dump, ':');
+    GRN_TEXT_PUT(&context, dump, key, key_size);
+    GRN_TEXT_PUTC(&context, dump, '\n');
+  }
+  grn_test_assert(grn_table_cursor_close(&context, tc));
+  GRN_TEXT_PUTS(&context, dump, "--\n");
+}
+
+/* writes the results of get, get_key, lcp search and cursors */
+static const gchar *
+dump_table(grn_obj *table, grn_obj *dump, gboolean with_ids)
+{
+  gint i;
+
+  GRN_BULK_REWIND(dump);
+  for (i = 0; i < N_KEYS; i++) {
+    gchar key[MAX_KEY_SIZE + 1], buf[MAX_KEY_SIZE];
+    int size = make_key(i, key), key_size;
+    grn_id id;
+
+    id = grn_table_get(&context, table, key, size);
+    if (id) {
+      key_size = grn_table_get_key(&context, table, id, buf, MAX_KEY_SIZE);
+      cut_assert_equal_memory(key, size, buf, key_size);
+    }
+    put_id(table, dump, id, with_ids);
+    GRN_TEXT_PUTC(&context, dump, ' ');
+    /* a query longer than the key, which matches it as a prefix */
+    key[size] = '!';
+    put_id(table, dump, grn_table_get(&context, table, key, size + 1), with_ids);
+    GRN_TEXT_PUTC(&context, dump, ' ');
+    put_id(table, dump, grn_table_lcp_search(&context, table, key, size + 1),
+           with_ids);
+    GRN_TEXT_PUTC(&context, dump, '\n');
+  }
+  dump_cursor(table, dump, with_ids, NULL, NULL, GRN_CURSOR_ASCENDING);
+  dump_cursor(table, dump, with_ids, NULL, NULL, GRN_CURSOR_DESCENDING);
+  dump_cursor(table, dump, with_ids, "b", "m", GRN_CURSOR_ASCENDING);
+  dump_cursor(table, dump, with_ids, "c", "cz",
+              GRN_CURSOR_DESCENDING|GRN_CURSOR_GT);
+  if (with_ids) {
+    dump_cursor(table, dump, with_ids, NULL, NULL, GRN_CURSOR_BY_ID);
+  }
+  GRN_TEXT_PUTC(&context, dump, '\0');
+  return GRN_TEXT_VALUE(dump);
+}
+
+static void
+cut_assert_same_tables(gboolean with_ids)
+{
+  cut_assert_equal_uint(grn_table_size(&context, plain_table),
+                        grn_table_size(&context, inline_table));
+  cut_assert_equal_string(dump_table(plain_table, &dump1, with_ids),
+                          dump_table(inline_table, &dump2, with_ids));
+}
+
+void
+test_same_ids(void)
+{
+  cut_assert_not_null(inline_table);
+  cut_assert_not_null(plain_table);
+  add_keys(TRUE);
+  /* the short keys of different chains may be the same */
+  cut_assert_equal_uint(grn_table_size(&context, plain_table),
+                        grn_table_size(&context, inline_table));
+}
+
+void
+test_same_results(void)
+{
+  add_keys(TRUE);
+  cut_assert_same_tables(TRUE);
+}
+
+void
+test_same_results_after_delete(void)
+{
+  add_keys(TRUE);
+  delete_keys(3);
+  cut_assert_same_tables(TRUE);
+  add_keys(FALSE);
+  cut_assert_same_tables(FALSE);
+}
+
+void
+test_reopen(void)
+{
+  add_keys(TRUE);
+  delete_keys(7);
+  grn_test_assert(grn_obj_close(&context, database));
+
+  database = grn_db_open(&context, path);
+  cut_assert_not_null(database);
+  inline_table = grn_ctx_get(&context, "Inline", 6);
+  plain_table = grn_ctx_get(&context, "Plain", 5);
+  cut_assert_not_null(inline_table);
+  cut_assert_not_null(plain_table);
+  cut_assert_true(inline_table->header.flags & GRN_OBJ_KEY_INLINE);
+  cut_assert_false(plain_table->header.flags & GRN_OBJ_KEY_INLINE);
+  cut_assert_same_tables(TRUE);
+  add_keys(FALSE);
+  cut_assert_same_tables(FALSE);
+}
@@ -0,0 +1,238 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <ctx.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_hit(void);
+void test_expire_by_update(void);
+void test_volatile_proc(void);
+void test_streamed_result(void);
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table, *price;
+static gchar *base_dir;
+static grn_obj value, result;
+static grn_cache_statistics before;
+static grn_obj streamed;
+static gint n_partial_outputs;
+
+void
+cut_setup(void)
+{
+  gchar *path;
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "select-cache", NULL);
+  database = grn_db_create(&context, path, NULL);
+  g_free(path);
+  table = grn_table_create(&context, "Items", 5, NULL,
+                           GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  price = grn_column_create(&context, table, "price", 5, NULL,
+                            GRN_OBJ_COLUMN_SCALAR|GRN_OBJ_PERSISTENT,
+                            grn_ctx_at(&context, GRN_DB_UINT32));
+  GRN_UINT32_INIT(&value, 0);
+  GRN_TEXT_INIT(&result, 0);
+  GRN_TEXT_INIT(&streamed, 0);
+  n_partial_outputs = 0;
+}
+
+void
+cut_teardown(void)
+{
+  grn_obj_unlink(&context, &value);
+  grn_obj_unlink(&context, &result);
+  grn_obj_unlink(&context, &streamed);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+static void
+set_price(const gchar *key, uint32_t item_price)
+{
+  grn_id id;
+
+  id = grn_table_add(&context, table, key, strlen(key), NULL);
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  GRN_UINT32_SET(&context, &value, item_price);
+  grn_test_assert(grn_obj_set_value(&context, price, id, &value, GRN_OBJ_SET));
+}
+
+static const gchar *
+send_command(const gchar *command)
+{
+  grn_ctx_info info;
+
+  grn_ctx_send(&context, (char *)command, strlen(command), 0);
+  grn_test_assert(context.rc);
+  grn_test_assert(grn_ctx_info_get(&context, &info));
+  GRN_BULK_REWIND(&result);
+  GRN_TEXT_PUT(&context, &result,
+               GRN_TEXT_VALUE(info.outbuf), GRN_TEXT_LEN(info.outbuf));
+  GRN_TEXT_PUTC(&context, &result, '\0');
+  GRN_BULK_REWIND(info.outbuf);
+  return GRN_TEXT_VALUE(&result);
+}
+
+/* the cache is shared by the whole process, so that its statistics are
+   checked by the differences from the ones before the first select */
+#define cache_stat_diff(member) (after.member - before.member)
+
+void
+test_hit(void)
+{
+  grn_cache_statistics after;
+  const gchar *command =
+    "select --table Items --output_columns '_key price' --sortby _key";
+
+  set_price("foo", 100);
+  set_price("bar", 300);
+  grn_cache_get_statistics(&before);
+  cut_assert_equal_string("[[0],[[2],[\"_key\",\"price\"],"
+                          "[\"bar\",300],[\"foo\",100]]]",
+                          send_command(command));
+  cut_assert_equal_string("[[0],[[2],[\"_key\",\"price\"],"
+                          "[\"bar\",300],[\"foo\",100]]]",
+                          send_command(command));
+  grn_cache_get_statistics(&after);
+  cut_assert_equal_uint(2, cache_stat_diff(nfetches));
+  cut_assert_equal_uint(1, cache_stat_diff(nhits));
+  cut_assert_equal_uint(1, cache_stat_diff(nentries));
+}
+
+void
+test_expire_by_update(void)
+{
+  grn_cache_statistics after;
+  const gchar *command =
+    "select --table Items --filter 'price < 200' --output_columns _key";
+
+  set_price("foo", 100);
+  grn_cache_get_statistics(&before);
+  cut_assert_equal_string("[[0],[[1],[\"_key\"],[\"foo\"]]]",
+                          send_command(command));
+  set_price("foo", 200);
+  cut_assert_equal_string("[[0],[[0],[\"_key\"]]]",
+                          send_command(command));
+  set_price("bar", 150);
+  cut_assert_equal_string("[[0],[[1],[\"_key\"],[\"bar\"]]]",
+                          send_command(command));
+  grn_cache_get_statistics(&after);
+  cut_assert_equal_uint(3, cache_stat_diff(nfetches));
+  cut_assert_equal_uint(0, cache_stat_diff(nhits));
+}
+
+void
+test_volatile_proc(void)
+{
+  grn_cache_statistics after;
+
+  set_price("foo", 100);
+  grn_cache_get_statistics(&before);
+  send_command("select --table Items --filter 'rand() >= 0'");
+  send_command("select --table Items --filter 'rand() >= 0'");
+  send_command("select --table Items --filter 'now() > 0'");
+  send_command("select --table Items --filter 'now() > 0'");
+  send_command("select --table Items --filter 'price > 0'");
+  send_command("select --table Items --filter 'price > 0'");
+  grn_cache_get_statistics(&after);
+  cut_assert_equal_uint(6, cache_stat_diff(nfetches));
+  cut_assert_equal_uint(1, cache_stat_diff(nhits));
+  cut_assert_equal_uint(1, cache_stat_diff(nentries));
+}
+
+/* the keys are long enough for the result to be flushed several times */
+#define N_STREAMED_ITEMS 3000
+#define STREAMED_KEY_FORMAT "item-%05d-%050d"
+
+/* receives the output of the context the way the server does */
+static void
+collect_output(grn_ctx *ctx, int flags, void *arg)
+{
+  grn_ctx_info info;
+
+  grn_ctx_info_get(ctx, &info);
+  GRN_TEXT_PUT(ctx, &streamed,
+               GRN_TEXT_VALUE(info.outbuf), GRN_TEXT_LEN(info.outbuf));
+  GRN_BULK_REWIND(info.outbuf);
+  if (flags & GRN_CTX_MORE) { n_partial_outputs++; }
+}
+
+void
+test_streamed_result(void)
+{
+  grn_cache_statistics after;
+  grn_obj expected;
+  const gchar *command;
+  gint i;
+
+  command = cut_take_printf("select --table Items --output_columns _key "
+                            "--limit %d", N_STREAMED_ITEMS);
+  GRN_TEXT_INIT(&expected, 0);
+  GRN_TEXT_PUTS(&context, &expected,
+                cut_take_printf("[[0],[[%d],[\"_key\"]", N_STREAMED_ITEMS));
+  for (i = 0; i < N_STREAMED_ITEMS; i++) {
+    const gchar *key = cut_take_printf(STREAMED_KEY_FORMAT, i, 0);
+    set_price(key, i);
+    GRN_TEXT_PUTS(&context, &expected, ",[\"");
+    GRN_TEXT_PUTS(&context, &expected, key);
+    GRN_TEXT_PUTS(&context, &expected, "\"]");
+  }
+  GRN_TEXT_PUTS(&context, &expected, "]]");
+  GRN_TEXT_PUTC(&context, &expected, '\0');
+
+  grn_cache_get_statistics(&before);
+  grn_ctx_recv_handler_set(&context, collect_output, NULL);
+  for (i = 0; i < 2; i++) {
+    GRN_BULK_REWIND(&streamed);
+    n_partial_outputs = 0;
+    grn_ctx_send(&context, (char *)command, strlen(command), 0);
+    grn_test_assert(context.rc);
+    GRN_TEXT_PUTC(&context, &streamed, '\0');
+    cut_assert_operator_int(1, <, n_partial_outputs);
+    cut_assert_equal_string(GRN_TEXT_VALUE(&expected),
+                            GRN_TEXT_VALUE(&streamed));
+  }
+  grn_ctx_recv_handler_set(&context, NULL, NULL);
+  grn_cache_get_statistics(&after);
+  cut_assert_equal_uint(2, cache_stat_diff(nfetches));
+  cut_assert_equal_uint(0, cache_stat_diff(nhits));
+  cut_assert_equal_uint(0, cache_stat_diff(nentries));
+
+  /* the whole result is kept in outbuf and cached without the handler */
+  cut_assert_equal_string(GRN_TEXT_VALUE(&expected), send_command(command));
+  cut_assert_equal_string(GRN_TEXT_VALUE(&expected), send_command(command));
+  GRN_OBJ_FIN(&context, &expected);
+  grn_cache_get_statistics(&after);
+  cut_assert_equal_uint(1, cache_stat_diff(nhits));
+  cut_assert_equal_uint(1, cache_stat_diff(nentries));
+}
@@ -0,0 +1,217 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <groonga.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_hash(void);
+void test_hash_after_delete(void);
+void test_hash_disabled(void);
+void test_pat(void);
+
+#define N_THREADS         4
+#define N_KEYS_PER_THREAD 20000
+/* the keys of a thread overlap the half of the ones of the next thread */
+#define N_KEYS            (N_KEYS_PER_THREAD / 2 * (N_THREADS + 1))
+
+typedef struct {
+  grn_ctx context;
+  gint first_key;
+  gint n_added;
+  grn_id *ids;
+} worker;
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table;
+static gchar *base_dir;
+static worker workers[N_THREADS];
+
+void
+cut_setup(void)
+{
+  gchar *path;
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "concurrent-insert", NULL);
+  database = grn_db_create(&context, path, NULL);
+  g_free(path);
+  table = NULL;
+  memset(workers, 0, sizeof(workers));
+}
+
+void
+cut_teardown(void)
+{
+  int i;
+
+  for (i = 0; i < N_THREADS; i++) {
+    if (workers[i].ids) {
+      g_free(workers[i].ids);
+    }
+  }
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+static grn_rc
+set_concurrent_insert(grn_obj *table, gboolean enable)
+{
+  grn_obj value;
+  grn_rc rc;
+
+  GRN_BOOL_INIT(&value, 0);
+  GRN_BOOL_SET(&context, &value, enable);
+  rc = grn_obj_set_info(&context, table, GRN_INFO_CONCURRENT_INSERT, &value);
+  grn_obj_unlink(&context, &value);
+  return rc;
+}
+
+static void
+table_create(grn_obj_flags flags)
+{
+  table = grn_table_create(&context, "Keys", 4, NULL,
+                           flags|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  cut_assert_not_null(table);
+}
+
+static gpointer
+worker_add(gpointer data)
+{
+  worker *w = data;
+  gint i;
+
+  for (i = 0; i < N_KEYS_PER_THREAD; i++) {
+    gchar key[16];
+    int added = 0;
+    sprintf(key, "key%08d", w->first_key + i);
+    w->ids[i] = grn_table_add(&w->context, table, key, strlen(key), &added);
+    if (added) { w->n_added++; }
+  }
+  return NULL;
+}
+
+/* adds the keys of all the workers at once, and checks that each key is
+   added exactly once and gets the same id in every thread */
+static void
+assert_concurrent_add(gint n_expected_added)
+{
+  GThread *threads[N_THREADS];
+  GError *error = NULL;
+  gint i, j, n_added = 0;
+
+  if (!g_thread_supported()) { g_thread_init(NULL); }
+  for (i = 0; i < N_THREADS; i++) {
+    worker *w = &workers[i];
+    grn_ctx_init(&w->context, 0);
+    grn_ctx_use(&w->context, database);
+    w->first_key = N_KEYS_PER_THREAD / 2 * i;
+    w->n_added = 0;
+    if (!w->ids) { w->ids = g_new(grn_id, N_KEYS_PER_THREAD); }
+  }
+  for (i = 0; i < N_THREADS; i++) {
+    threads[i] = g_thread_create(worker_add, &workers[i], TRUE, &error);
+    gcut_assert_error(error);
+  }
+  for (i = 0; i < N_THREADS; i++) {
+    g_thread_join(threads[i]);
+    grn_ctx_fin(&workers[i].context);
+    n_added += workers[i].n_added;
+  }
+
+  cut_assert_equal_int(n_expected_added, n_added);
+  cut_assert_equal_uint(N_KEYS, grn_table_size(&context, table));
+  for (i = 0; i < N_THREADS; i++) {
+    worker *w = &workers[i];
+    for (j = 0; j < N_KEYS_PER_THREAD; j++) {
+      gchar key[16];
+      sprintf(key, "key%08d", w->first_key + j);
+      cut_assert_not_equal_uint(GRN_ID_NIL, w->ids[j], cut_message("<%s>", key));
+      cut_assert_equal_uint(grn_table_get(&context, table, key, strlen(key)),
+                            w->ids[j],
+                            cut_message("<%s>", key));
+    }
+  }
+}
+
+void
+test_hash(void)
+{
+  table_create(GRN_OBJ_TABLE_HASH_KEY);
+  grn_test_assert(set_concurrent_insert(table, TRUE));
+  assert_concurrent_add(N_KEYS);
+  /* the keys are found again without being added */
+  assert_concurrent_add(0);
+  grn_test_assert(set_concurrent_insert(table, FALSE));
+}
+
+void
+test_hash_after_delete(void)
+{
+  gint i;
+
+  table_create(GRN_OBJ_TABLE_HASH_KEY);
+  grn_test_assert(set_concurrent_insert(table, TRUE));
+  assert_concurrent_add(N_KEYS);
+  for (i = 0; i < N_KEYS; i += 3) {
+    gchar key[16];
+    sprintf(key, "key%08d", i);
+    grn_test_assert(grn_table_delete(&context, table, key, strlen(key)));
+  }
+  cut_assert_equal_uint(N_KEYS - (N_KEYS + 2) / 3,
+                        grn_table_size(&context, table));
+  assert_concurrent_add((N_KEYS + 2) / 3);
+}
+
+void
+test_hash_disabled(void)
+{
+  gchar key[16];
+  gint i;
+
+  table_create(GRN_OBJ_TABLE_HASH_KEY);
+  grn_test_assert(set_concurrent_insert(table, TRUE));
+  grn_test_assert(set_concurrent_insert(table, FALSE));
+  for (i = 0; i < N_KEYS; i++) {
+    sprintf(key, "key%08d", i);
+    cut_assert_equal_uint(i + 1,
+                          grn_table_add(&context, table, key, strlen(key), NULL));
+  }
+  cut_assert_equal_uint(N_KEYS, grn_table_size(&context, table));
+}
+
+void
+test_pat(void)
+{
+  table_create(GRN_OBJ_TABLE_PAT_KEY);
+  grn_test_assert_equal_rc(GRN_INVALID_ARGUMENT,
+                           set_concurrent_insert(table, TRUE));
+}
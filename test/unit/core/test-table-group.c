@@ -0,0 +1,318 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <groonga.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_empty_key_range(void);
+void test_key_range(void);
+void test_calc_values(void);
+void test_calc_values_without_room(void);
+void test_calc_value_names(void);
+void test_vector_column(void);
+void test_vector_accessor(void);
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *items, *tag, *size;
+static gchar *base_dir;
+
+void
+cut_setup(void)
+{
+  const char *values =
+    "[[\"tag\",\"size\"],"
+    "[\"a\",1],[\"b\",1],[\"c\",2],[\"a\",2],[\"a\",1]]";
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  database = grn_db_create(&context, NULL, NULL);
+  items = grn_table_create(&context, "Items", 5, NULL,
+                           GRN_OBJ_TABLE_NO_KEY, NULL, NULL);
+  tag = grn_column_create(&context, items, "tag", 3, NULL,
+                          GRN_OBJ_COLUMN_SCALAR,
+                          grn_ctx_at(&context, GRN_DB_SHORT_TEXT));
+  size = grn_column_create(&context, items, "size", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR,
+                           grn_ctx_at(&context, GRN_DB_UINT32));
+  grn_test_assert(grn_load(&context, GRN_CONTENT_JSON, "Items", 5, NULL, 0,
+                           values, strlen(values), NULL, 0));
+  cut_assert_equal_uint(5, grn_table_size(&context, items));
+}
+
+void
+cut_teardown(void)
+{
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+static grn_obj *
+group_result_create(void)
+{
+  return grn_table_create(&context, NULL, 0, NULL,
+                          GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                          grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+}
+
+void
+test_empty_key_range(void)
+{
+  grn_table_sort_key keys[1];
+  grn_table_group_result result;
+
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = tag;
+  memset(&result, 0, sizeof(result));
+  result.table = group_result_create();
+  result.key_begin = 0;
+  result.key_end = 0;
+  result.op = GRN_OP_OR;
+  grn_test_assert(grn_table_group(&context, items, keys, 1, &result, 1));
+  cut_assert_equal_uint(3, grn_table_size(&context, result.table));
+}
+
+void
+test_key_range(void)
+{
+  grn_table_sort_key keys[2];
+  grn_table_group_result results[3];
+  int i;
+
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = tag;
+  keys[1].key = size;
+  memset(results, 0, sizeof(results));
+  for (i = 0; i < 3; i++) {
+    results[i].table = group_result_create();
+    results[i].op = GRN_OP_OR;
+  }
+  /* tag */
+  results[0].key_begin = 0;
+  results[0].key_end = 1;
+  /* size */
+  results[1].key_begin = 1;
+  results[1].key_end = 2;
+  /* tag and size, given as an empty range */
+  results[2].key_begin = 0;
+  results[2].key_end = 0;
+  grn_test_assert(grn_table_group(&context, items, keys, 2, results, 3));
+  cut_assert_equal_uint(3, grn_table_size(&context, results[0].table));
+  cut_assert_equal_uint(2, grn_table_size(&context, results[1].table));
+  cut_assert_equal_uint(4, grn_table_size(&context, results[2].table));
+}
+
+static double
+get_calc_value(grn_obj *table, const gchar *key, const gchar *name)
+{
+  grn_obj value;
+  grn_id id = grn_table_get(&context, table, key, strlen(key));
+  grn_obj *accessor = grn_obj_column(&context, table, name, strlen(name));
+  double result;
+
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  cut_assert_not_null(accessor);
+  GRN_FLOAT_INIT(&value, 0);
+  grn_obj_get_value(&context, accessor, id, &value);
+  result = GRN_FLOAT_VALUE(&value);
+  grn_obj_unlink(&context, &value);
+  grn_obj_unlink(&context, accessor);
+  return result;
+}
+
+void
+test_calc_values(void)
+{
+  grn_table_sort_key keys[1];
+  grn_table_group_result result;
+
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = tag;
+  memset(&result, 0, sizeof(result));
+  result.table =
+    grn_table_create_with_calc_values(&context, NULL, 0, NULL,
+                                      GRN_OBJ_TABLE_HASH_KEY,
+                                      grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                                      NULL);
+  result.key_end = 1;
+  result.op = GRN_OP_OR;
+  result.flags = GRN_TABLE_GROUP_CALC_COUNT|
+    GRN_TABLE_GROUP_CALC_MAX|GRN_TABLE_GROUP_CALC_MIN|
+    GRN_TABLE_GROUP_CALC_SUM|GRN_TABLE_GROUP_CALC_AVG;
+  grn_test_assert(grn_table_group_with_calc_target(&context, items, keys, 1,
+                                                   &result, 1, size));
+  cut_assert_equal_uint(3, grn_table_size(&context, result.table));
+  cut_assert_equal_double(2.0, 0.001, get_calc_value(result.table, "a", "_max"));
+  cut_assert_equal_double(1.0, 0.001, get_calc_value(result.table, "a", "_min"));
+  cut_assert_equal_double(4.0, 0.001, get_calc_value(result.table, "a", "_sum"));
+  cut_assert_equal_double(4.0 / 3, 0.001, get_calc_value(result.table, "a", "_avg"));
+  cut_assert_equal_double(2.0, 0.001, get_calc_value(result.table, "c", "_avg"));
+}
+
+void
+test_calc_values_without_room(void)
+{
+  grn_table_sort_key keys[1];
+  grn_table_group_result result;
+  gchar *path;
+
+  /* a table with an explicit path has a private flag which must not be
+     taken for the room of calc values */
+  path = g_build_filename(base_dir, "group", NULL);
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = tag;
+  memset(&result, 0, sizeof(result));
+  result.table = grn_table_create(&context, NULL, 0, path,
+                                  GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC|
+                                  GRN_OBJ_PERSISTENT,
+                                  grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                                  NULL);
+  g_free(path);
+  cut_assert_not_null(result.table);
+  cut_assert_null(grn_obj_column(&context, result.table, "_max", 4));
+  result.key_end = 1;
+  result.op = GRN_OP_OR;
+  result.flags = GRN_TABLE_GROUP_CALC_MAX;
+  grn_test_assert_equal_rc(GRN_INVALID_ARGUMENT,
+                           grn_table_group_with_calc_target(&context, items,
+                                                            keys, 1,
+                                                            &result, 1, size));
+}
+
+void
+test_calc_value_names(void)
+{
+  const gchar *names[] = {"_ma", "_mix", "_mux", "_a", "_abc", "_average"};
+  grn_obj *table;
+  int i;
+
+  table = grn_table_create_with_calc_values(&context, NULL, 0, NULL,
+                                            GRN_OBJ_TABLE_HASH_KEY,
+                                            grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                                            NULL);
+  cut_assert_not_null(table);
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    cut_assert_null(grn_obj_column(&context, table, names[i], strlen(names[i])),
+                    cut_message("<%s>", names[i]));
+  }
+}
+
+static grn_obj *
+tags_create(void)
+{
+  const gchar *tags[] = {"x y", "y", "", "x z y", "z"};
+  grn_obj *column, value;
+  grn_id id;
+
+  column = grn_column_create(&context, items, "tags", 4, NULL,
+                             GRN_OBJ_COLUMN_VECTOR,
+                             grn_ctx_at(&context, GRN_DB_SHORT_TEXT));
+  cut_assert_not_null(column);
+  GRN_OBJ_INIT(&value, GRN_VECTOR, 0, GRN_DB_SHORT_TEXT);
+  for (id = 1; id <= 5; id++) {
+    const gchar *p = tags[id - 1];
+    value.u.v.n_sections = 0;
+    if (value.u.v.body) { GRN_BULK_REWIND(value.u.v.body); }
+    while (*p) {
+      grn_vector_add_element(&context, &value, p, 1, 0, GRN_DB_SHORT_TEXT);
+      p += p[1] ? 2 : 1;
+    }
+    grn_test_assert(grn_obj_set_value(&context, column, id, &value, GRN_OBJ_SET));
+  }
+  grn_obj_unlink(&context, &value);
+  return column;
+}
+
+static void
+assert_tag_counts(grn_obj *table)
+{
+  const gchar *keys[] = {"x", "y", "z"};
+  int n_subrecs[] = {2, 3, 2};
+  grn_obj *accessor, value;
+  int i;
+
+  cut_assert_equal_uint(3, grn_table_size(&context, table));
+  accessor = grn_obj_column(&context, table, "_nsubrecs", 9);
+  cut_assert_not_null(accessor);
+  GRN_INT32_INIT(&value, 0);
+  for (i = 0; i < 3; i++) {
+    grn_id id = grn_table_get(&context, table, keys[i], 1);
+    cut_assert_not_equal_uint(GRN_ID_NIL, id);
+    GRN_BULK_REWIND(&value);
+    grn_obj_get_value(&context, accessor, id, &value);
+    cut_assert_equal_int(n_subrecs[i], GRN_INT32_VALUE(&value),
+                         cut_message("<%s>", keys[i]));
+  }
+  grn_obj_unlink(&context, &value);
+  grn_obj_unlink(&context, accessor);
+}
+
+void
+test_vector_column(void)
+{
+  grn_table_sort_key keys[1];
+  grn_table_group_result result;
+
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = tags_create();
+  memset(&result, 0, sizeof(result));
+  result.table = group_result_create();
+  result.key_end = 1;
+  result.op = GRN_OP_OR;
+  grn_test_assert(grn_table_group(&context, items, keys, 1, &result, 1));
+  assert_tag_counts(result.table);
+}
+
+void
+test_vector_accessor(void)
+{
+  grn_table_sort_key keys[1];
+  grn_table_group_result result;
+  grn_obj *res;
+  grn_id id;
+
+  tags_create();
+  /* a result set, as drilldown groups one */
+  res = grn_table_create(&context, NULL, 0, NULL,
+                         GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                         items, NULL);
+  for (id = 1; id <= 5; id++) {
+    grn_table_add(&context, res, &id, sizeof(grn_id), NULL);
+  }
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = grn_obj_column(&context, res, "tags", 4);
+  cut_assert_not_null(keys[0].key);
+  memset(&result, 0, sizeof(result));
+  result.table = group_result_create();
+  result.key_end = 1;
+  result.op = GRN_OP_OR;
+  grn_test_assert(grn_table_group(&context, res, keys, 1, &result, 1));
+  grn_obj_unlink(&context, keys[0].key);
+  assert_tag_counts(result.table);
+}
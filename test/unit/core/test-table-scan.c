@@ -0,0 +1,269 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <db.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_id_range_no_key(void);
+void test_id_range_hash(void);
+void test_id_range_pat(void);
+void test_id_range_descending(void);
+void test_parallel_no_key(void);
+void test_parallel_hash(void);
+void test_parallel_pat(void);
+
+#define N_RECORDS 50000
+#define LIMIT     30000
+/* ids 1 and N_RECORDS / 3 + 2 are deleted */
+#define N_HITS    (LIMIT - 2)
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table, *number;
+static gchar *base_dir;
+static int saved_scan_threads;
+static grn_obj ids, serial_ids;
+
+void
+cut_setup(void)
+{
+  gchar *path;
+
+  base_dir = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(base_dir, NULL);
+  g_mkdir_with_parents(base_dir, 0755);
+
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  path = g_build_filename(base_dir, "table-scan", NULL);
+  database = grn_db_create(&context, path, NULL);
+  g_free(path);
+  table = NULL;
+  saved_scan_threads = grn_get_scan_threads();
+  GRN_TEXT_INIT(&ids, 0);
+  GRN_TEXT_INIT(&serial_ids, 0);
+}
+
+void
+cut_teardown(void)
+{
+  grn_set_scan_threads(saved_scan_threads);
+  grn_obj_unlink(&context, &ids);
+  grn_obj_unlink(&context, &serial_ids);
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+  cut_remove_path(base_dir, NULL);
+  g_free(base_dir);
+}
+
+static void
+table_create(grn_obj_flags flags, int n_records)
+{
+  grn_obj value;
+  int i;
+
+  table = grn_table_create(&context, "Numbers", 7, NULL,
+                           flags|GRN_OBJ_PERSISTENT,
+                           (flags == GRN_OBJ_TABLE_NO_KEY) ?
+                           NULL : grn_ctx_at(&context, GRN_DB_UINT32), NULL);
+  cut_assert_not_null(table);
+  number = grn_column_create(&context, table, "number", 6, NULL,
+                             GRN_OBJ_COLUMN_SCALAR|GRN_OBJ_PERSISTENT,
+                             grn_ctx_at(&context, GRN_DB_UINT32));
+  cut_assert_not_null(number);
+  GRN_UINT32_INIT(&value, 0);
+  for (i = 0; i < n_records; i++) {
+    /* descending keys, so that the key order of patricia tries is the
+       reverse of the id order */
+    uint32_t key = (n_records - i) * 7;
+    grn_id id = grn_table_add(&context, table, &key, sizeof(uint32_t), NULL);
+    cut_assert_equal_uint(i + 1, id);
+    GRN_UINT32_SET(&context, &value, i);
+    grn_test_assert(grn_obj_set_value(&context, number, id, &value, GRN_OBJ_SET));
+  }
+  grn_obj_unlink(&context, &value);
+}
+
+static const gchar *
+cursor_ids(grn_id min, grn_id max, int flags)
+{
+  grn_table_cursor *tc;
+  grn_id id;
+
+  GRN_BULK_REWIND(&ids);
+  tc = grn_table_cursor_open_by_id(&context, table, min, max, flags);
+  cut_assert_not_null(tc);
+  while ((id = grn_table_cursor_next(&context, tc))) {
+    gchar buf[16];
+    sprintf(buf, "%u,", id);
+    GRN_TEXT_PUTS(&context, &ids, buf);
+  }
+  grn_test_assert(grn_table_cursor_close(&context, tc));
+  GRN_TEXT_PUTC(&context, &ids, '\0');
+  return GRN_TEXT_VALUE(&ids);
+}
+
+static void
+assert_id_range(grn_obj_flags flags)
+{
+  table_create(flags, 10);
+  grn_test_assert(grn_table_delete_by_id(&context, table, 4));
+  cut_assert_equal_string("3,5,6,", cursor_ids(3, 6, GRN_CURSOR_ASCENDING));
+  cut_assert_equal_string("8,9,10,", cursor_ids(8, 0, GRN_CURSOR_ASCENDING));
+  cut_assert_equal_string("1,2,", cursor_ids(0, 2, GRN_CURSOR_ASCENDING));
+  cut_assert_equal_string("10,", cursor_ids(10, 100, GRN_CURSOR_ASCENDING));
+  cut_assert_equal_string("", cursor_ids(6, 5, GRN_CURSOR_ASCENDING));
+  cut_assert_equal_string("", cursor_ids(11, 20, GRN_CURSOR_ASCENDING));
+}
+
+void
+test_id_range_no_key(void)
+{
+  assert_id_range(GRN_OBJ_TABLE_NO_KEY);
+}
+
+void
+test_id_range_hash(void)
+{
+  assert_id_range(GRN_OBJ_TABLE_HASH_KEY);
+}
+
+void
+test_id_range_pat(void)
+{
+  assert_id_range(GRN_OBJ_TABLE_PAT_KEY);
+}
+
+void
+test_id_range_descending(void)
+{
+  table_create(GRN_OBJ_TABLE_PAT_KEY, 10);
+  cut_assert_equal_string("6,5,4,3,", cursor_ids(3, 6, GRN_CURSOR_DESCENDING));
+  cut_assert_equal_string("10,9,", cursor_ids(9, 0, GRN_CURSOR_DESCENDING));
+  cut_assert_equal_string("", cursor_ids(6, 5, GRN_CURSOR_DESCENDING));
+}
+
+/* number < LIMIT */
+static grn_obj *
+select_less_than_limit(void)
+{
+  grn_obj *cond, *v, *res, buf;
+
+  cond = grn_expr_create(&context, NULL, 0);
+  cut_assert_not_null(cond);
+  v = grn_expr_add_var(&context, cond, NULL, 0);
+  GRN_RECORD_INIT(v, 0, grn_obj_id(&context, table));
+  grn_expr_append_obj(&context, cond, v, GRN_OP_PUSH, 1);
+  GRN_TEXT_INIT(&buf, 0);
+  GRN_TEXT_SETS(&context, &buf, "number");
+  grn_expr_append_const(&context, cond, &buf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_GET_VALUE, 2);
+  grn_obj_unlink(&context, &buf);
+  GRN_UINT32_INIT(&buf, 0);
+  GRN_UINT32_SET(&context, &buf, LIMIT);
+  grn_expr_append_const(&context, cond, &buf, GRN_OP_PUSH, 1);
+  grn_expr_append_op(&context, cond, GRN_OP_LESS, 2);
+  grn_obj_unlink(&context, &buf);
+  grn_expr_compile(&context, cond);
+
+  res = grn_table_create(&context, NULL, 0, NULL,
+                         GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC, table, NULL);
+  cut_assert_not_null(res);
+  cut_assert_not_null(grn_table_select(&context, table, cond, res, GRN_OP_OR));
+  grn_test_assert(grn_obj_close(&context, cond));
+  return res;
+}
+
+/* writes the ids of the hits in the order they were added to res, or in
+   the reverse order with GRN_CURSOR_DESCENDING */
+static const gchar *
+result_ids(grn_obj *res, grn_obj *buf, int flags)
+{
+  grn_table_cursor *tc;
+
+  GRN_BULK_REWIND(buf);
+  tc = grn_table_cursor_open(&context, res, NULL, 0, NULL, 0, 0, 0, flags);
+  cut_assert_not_null(tc);
+  while (grn_table_cursor_next(&context, tc)) {
+    grn_id *key;
+    gchar id[16];
+    grn_table_cursor_get_key(&context, tc, (void **)&key);
+    cut_assert_operator_uint(*key, <=, LIMIT);
+    cut_assert_not_equal_uint(N_RECORDS / 3 + 2, *key);
+    sprintf(id, "%u,", *key);
+    GRN_TEXT_PUTS(&context, buf, id);
+  }
+  grn_test_assert(grn_table_cursor_close(&context, tc));
+  GRN_TEXT_PUTC(&context, buf, '\0');
+  return GRN_TEXT_VALUE(buf);
+}
+
+static void
+assert_parallel(grn_obj_flags flags)
+{
+  grn_obj *parallel_res, *serial_res;
+  int order;
+
+  table_create(flags, N_RECORDS);
+  /* records deleted on the boundaries of the chunks of 3 threads must be
+     skipped */
+  grn_test_assert(grn_table_delete_by_id(&context, table, 1));
+  grn_test_assert(grn_table_delete_by_id(&context, table, N_RECORDS / 3 + 2));
+  grn_test_assert(grn_table_delete_by_id(&context, table, N_RECORDS));
+
+  grn_test_assert(grn_set_scan_threads(4));
+  parallel_res = select_less_than_limit();
+  cut_assert_equal_uint(N_HITS, grn_table_size(&context, parallel_res));
+
+  grn_test_assert(grn_set_scan_threads(1));
+  serial_res = select_less_than_limit();
+  cut_assert_equal_uint(N_HITS, grn_table_size(&context, serial_res));
+
+  /* the parallel scan adds the hits in the order of ids, and the serial
+     one in the order of keys for patricia tries */
+  order = (flags == GRN_OBJ_TABLE_PAT_KEY) ?
+    GRN_CURSOR_DESCENDING : GRN_CURSOR_ASCENDING;
+  cut_assert_equal_string(result_ids(serial_res, &serial_ids,
+                                     GRN_CURSOR_ASCENDING),
+                          result_ids(parallel_res, &ids, order));
+  grn_test_assert(grn_obj_close(&context, parallel_res));
+  grn_test_assert(grn_obj_close(&context, serial_res));
+}
+
+void
+test_parallel_no_key(void)
+{
+  assert_parallel(GRN_OBJ_TABLE_NO_KEY);
+}
+
+void
+test_parallel_hash(void)
+{
+  assert_parallel(GRN_OBJ_TABLE_HASH_KEY);
+}
+
+void
+test_parallel_pat(void)
+{
+  assert_parallel(GRN_OBJ_TABLE_PAT_KEY);
+}
@@ -0,0 +1,282 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright (C) 2009  Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <groonga.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_heap_ascending(void);
+void test_heap_descending_with_offset(void);
+void test_heap_text(void);
+void test_heap_threshold(void);
+void test_radix_uint32(void);
+void test_radix_int32(void);
+void test_radix_float(void);
+void test_radix_id(void);
+void test_radix_deleted(void);
+void test_parallel(void);
+
+#define N_RECORDS 10000
+/* coprime to the numbers of records, the values are a permutation of them */
+#define STEP      7919
+/* enough records for 3 threads of the parallel merge sort */
+#define N_PARALLEL_RECORDS (0x10000 * 3)
+
+static grn_logger_info *logger;
+static grn_ctx context;
+static grn_obj *database;
+static grn_obj *table, *number, *text, *integer, *real;
+static grn_id *ids_by_value;
+static int n_records;
+static int saved_scan_threads;
+
+void
+cut_setup(void)
+{
+  logger = setup_grn_logger();
+  grn_ctx_init(&context, 0);
+  database = grn_db_create(&context, NULL, NULL);
+  table = NULL;
+  ids_by_value = NULL;
+  saved_scan_threads = grn_get_scan_threads();
+}
+
+void
+cut_teardown(void)
+{
+  grn_set_scan_threads(saved_scan_threads);
+  if (ids_by_value) {
+    g_free(ids_by_value);
+  }
+  grn_ctx_fin(&context);
+  teardown_grn_logger(logger);
+}
+
+/* the record of id i + 1 has the value v = (i * STEP) % n in every column,
+   integer and real are shifted by -n / 2 to have negative values */
+static void
+table_create(int n)
+{
+  grn_obj value, signed_value, float_value, buf;
+  int i;
+
+  n_records = n;
+  table = grn_table_create(&context, "Items", 5, NULL,
+                           GRN_OBJ_TABLE_NO_KEY, NULL, NULL);
+  cut_assert_not_null(table);
+  number = grn_column_create(&context, table, "number", 6, NULL,
+                             GRN_OBJ_COLUMN_SCALAR,
+                             grn_ctx_at(&context, GRN_DB_UINT32));
+  cut_assert_not_null(number);
+  text = grn_column_create(&context, table, "text", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT));
+  cut_assert_not_null(text);
+  integer = grn_column_create(&context, table, "integer", 7, NULL,
+                              GRN_OBJ_COLUMN_SCALAR,
+                              grn_ctx_at(&context, GRN_DB_INT32));
+  cut_assert_not_null(integer);
+  real = grn_column_create(&context, table, "real", 4, NULL,
+                           GRN_OBJ_COLUMN_SCALAR,
+                           grn_ctx_at(&context, GRN_DB_FLOAT));
+  cut_assert_not_null(real);
+  ids_by_value = g_new(grn_id, n);
+  GRN_UINT32_INIT(&value, 0);
+  GRN_INT32_INIT(&signed_value, 0);
+  GRN_FLOAT_INIT(&float_value, 0);
+  GRN_TEXT_INIT(&buf, 0);
+  for (i = 0; i < n; i++) {
+    uint32_t v = (uint32_t)(((uint64_t)i * STEP) % n);
+    gchar s[16];
+    grn_id id = grn_table_add(&context, table, NULL, 0, NULL);
+    cut_assert_equal_uint(i + 1, id);
+    ids_by_value[v] = id;
+    GRN_UINT32_SET(&context, &value, v);
+    grn_test_assert(grn_obj_set_value(&context, number, id, &value, GRN_OBJ_SET));
+    sprintf(s, "%08u", v);
+    GRN_TEXT_SETS(&context, &buf, s);
+    grn_test_assert(grn_obj_set_value(&context, text, id, &buf, GRN_OBJ_SET));
+    GRN_INT32_SET(&context, &signed_value, (int32_t)v - n / 2);
+    grn_test_assert(grn_obj_set_value(&context, integer, id, &signed_value,
+                                      GRN_OBJ_SET));
+    GRN_FLOAT_SET(&context, &float_value, ((int32_t)v - n / 2) / 4.0);
+    grn_test_assert(grn_obj_set_value(&context, real, id, &float_value,
+                                      GRN_OBJ_SET));
+  }
+  grn_obj_unlink(&context, &value);
+  grn_obj_unlink(&context, &signed_value);
+  grn_obj_unlink(&context, &float_value);
+  grn_obj_unlink(&context, &buf);
+}
+
+/* sorts by key and checks the records of [offset, offset + limit) against
+   expected, the ids in ascending order of the key */
+static void
+assert_sort_ids(grn_obj *key, int flags, int offset, int limit,
+                const grn_id *expected, int n_expected_records)
+{
+  grn_obj *result;
+  grn_table_sort_key keys[1];
+  grn_table_cursor *tc;
+  int i = 0, n_expected;
+
+  if (limit < 0) { limit += n_expected_records - offset + 1; }
+  n_expected = (offset + limit > n_expected_records) ?
+    n_expected_records - offset : limit;
+  memset(keys, 0, sizeof(keys));
+  keys[0].key = key;
+  keys[0].flags = flags;
+  result = grn_table_create(&context, NULL, 0, NULL,
+                            GRN_OBJ_TABLE_NO_KEY, NULL, table);
+  cut_assert_not_null(result);
+  cut_assert_equal_int(n_expected,
+                       grn_table_sort(&context, table, offset, limit,
+                                      result, keys, 1));
+  cut_assert_equal_uint(n_expected, grn_table_size(&context, result));
+  tc = grn_table_cursor_open(&context, result, NULL, 0, NULL, 0, 0, 0, 0);
+  cut_assert_not_null(tc);
+  while (grn_table_cursor_next(&context, tc)) {
+    grn_id *id;
+    int v = offset + i++;
+    grn_table_cursor_get_value(&context, tc, (void **)&id);
+    if (flags & GRN_TABLE_SORT_DESC) { v = n_expected_records - 1 - v; }
+    cut_assert_equal_uint(expected[v], *id, cut_message("<%d>", i));
+  }
+  grn_test_assert(grn_table_cursor_close(&context, tc));
+  cut_assert_equal_int(n_expected, i);
+  grn_test_assert(grn_obj_close(&context, result));
+}
+
+static void
+assert_sort(grn_obj *key, int flags, int offset, int limit)
+{
+  assert_sort_ids(key, flags, offset, limit, ids_by_value, n_records);
+}
+
+void
+test_heap_ascending(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(number, GRN_TABLE_SORT_ASC, 0, 10);
+  assert_sort(number, GRN_TABLE_SORT_ASC, 0, 1);
+}
+
+void
+test_heap_descending_with_offset(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(number, GRN_TABLE_SORT_DESC, 30, 20);
+  assert_sort(number, GRN_TABLE_SORT_DESC, 999, 1);
+}
+
+void
+test_heap_text(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(text, GRN_TABLE_SORT_ASC, 5, 10);
+  assert_sort(text, GRN_TABLE_SORT_DESC, 100, 50);
+}
+
+void
+test_heap_threshold(void)
+{
+  /* the pages just below and at the threshold of the bounded heap must be
+     sorted in the same order */
+  table_create(N_RECORDS);
+  assert_sort(text, GRN_TABLE_SORT_ASC, 1000, N_RECORDS / 8 - 1001);
+  assert_sort(text, GRN_TABLE_SORT_ASC, 1000, N_RECORDS / 8 - 1000);
+}
+
+void
+test_radix_uint32(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(number, GRN_TABLE_SORT_ASC, 0, -1);
+  assert_sort(number, GRN_TABLE_SORT_DESC, 2000, 3000);
+}
+
+void
+test_radix_int32(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(integer, GRN_TABLE_SORT_ASC, 0, -1);
+  assert_sort(integer, GRN_TABLE_SORT_DESC, 0, -1);
+}
+
+void
+test_radix_float(void)
+{
+  table_create(N_RECORDS);
+  assert_sort(real, GRN_TABLE_SORT_ASC, 0, -1);
+  assert_sort(real, GRN_TABLE_SORT_DESC, 4000, 2000);
+}
+
+void
+test_radix_id(void)
+{
+  grn_obj *id_accessor;
+  grn_id *ids;
+  int i;
+
+  table_create(N_RECORDS);
+  ids = g_new(grn_id, N_RECORDS);
+  for (i = 0; i < N_RECORDS; i++) {
+    ids[i] = i + 1;
+  }
+  id_accessor = grn_obj_column(&context, table, "_id", 3);
+  cut_assert_not_null(id_accessor);
+  assert_sort_ids(id_accessor, GRN_TABLE_SORT_DESC, 0, -1, ids, N_RECORDS);
+  assert_sort_ids(id_accessor, GRN_TABLE_SORT_ASC, 10, 5000, ids, N_RECORDS);
+  grn_obj_unlink(&context, id_accessor);
+  g_free(ids);
+}
+
+void
+test_radix_deleted(void)
+{
+  grn_id *ids;
+  int i, j;
+
+  /* deleted records must not be taken into the keys */
+  table_create(N_RECORDS);
+  ids = g_new(grn_id, N_RECORDS);
+  for (i = 0, j = 0; i < N_RECORDS; i++) {
+    if (ids_by_value[i] % 3) {
+      ids[j++] = ids_by_value[i];
+    } else {
+      grn_test_assert(grn_table_delete_by_id(&context, table, ids_by_value[i]));
+    }
+  }
+  assert_sort_ids(number, GRN_TABLE_SORT_ASC, 0, -1, ids, j);
+  assert_sort_ids(integer, GRN_TABLE_SORT_DESC, 0, -1, ids, j);
+  g_free(ids);
+}
+
+void
+test_parallel(void)
+{
+  table_create(N_PARALLEL_RECORDS);
+  grn_test_assert(grn_set_scan_threads(4));
+  assert_sort(text, GRN_TABLE_SORT_ASC, 0, -1);
+  assert_sort(text, GRN_TABLE_SORT_DESC, N_PARALLEL_RECORDS / 2, 100);
+  grn_test_assert(grn_set_scan_threads(1));
+  assert_sort(text, GRN_TABLE_SORT_ASC, N_PARALLEL_RECORDS / 2, 100);
+}
@@ -18,19 +18,52 @@
 
 #include <soupcutter.h>
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
 #include "../lib/grn-assertions.h"
 
 #define GROONGA_TEST_PORT 5454
+#define GROONGA_EVENT_LOOPS_TEST_PORT 5455
+#define N_EVENT_LOOPS 4
+#define N_CONNECTIONS 32
+/* large enough for a streamed select result */
+#define MAX_RESPONSES_SIZE (1024 * 1024)
+#define N_STREAMED_USERS 3000
+
+#define TABLE_LIST_HEADER "[[\"id\",\"name\",\"path\",\"flags\",\"domain\"]]"
+#define KEEP_ALIVE_HEADER                       \
+  "HTTP/1.1 200 OK\r\n"                         \
+  "Connection: keep-alive\r\n"                  \
+  "Transfer-Encoding: chunked\r\n"              \
+  "Content-Type: text/javascript\r\n"           \
+  "\r\n"
+#define CLOSE_HEADER                            \
+  "HTTP/1.1 200 OK\r\n"                         \
+  "Connection: close\r\n"                       \
+  "Content-Type: text/javascript\r\n"           \
+  "\r\n"
+#define CHUNKED_TABLE_LIST                      \
+  KEEP_ALIVE_HEADER                             \
+  "00000027\r\n" TABLE_LIST_HEADER "\r\n"       \
+  "0\r\n\r\n"
 
 static gchar *tmp_directory;
 
-static GCutEgg *egg;
+static GCutEgg *egg, *event_loops_egg;
 
 static SoupCutClient *client;
 
 static grn_ctx context;
 static grn_obj *database;
 
+static int sock;
+static int socks[N_CONNECTIONS];
+
 void
 cut_setup(void)
 {
@@ -49,6 +82,9 @@ cut_setup(void)
 
   grn_ctx_init(&context, 0);
   database = NULL;
+  sock = -1;
+  memset(socks, -1, sizeof(socks));
+  event_loops_egg = NULL;
   db_path = cut_take_printf("%s%s%s",
                             tmp_directory,
                             G_DIR_SEPARATOR_S,
@@ -70,10 +106,26 @@ cut_setup(void)
 void
 cut_teardown(void)
 {
+  int i;
+
+  if (sock != -1) {
+    close(sock);
+  }
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    /* sock may still be one of them when an assertion failed */
+    if (socks[i] != -1 && socks[i] != sock) {
+      close(socks[i]);
+    }
+  }
+
   if (egg) {
     g_object_unref(egg);
   }
 
+  if (event_loops_egg) {
+    g_object_unref(event_loops_egg);
+  }
+
   if (client) {
     g_object_unref(client);
   }
@@ -107,7 +159,17 @@ test_get_status(void)
   soupcut_client_assert_match_body("{"
                                    "\"alloc_count\":\\d+,"
                                    "\"starttime\":\\d+,"
-                                   "\"uptime\":\\d+"
+                                   "\"uptime\":\\d+,"
+                                   "\"cache_entries\":\\d+,"
+                                   "\"cache_size\":\\d+,"
+                                   "\"cache_fetches\":\\d+,"
+                                   "\"cache_hits\":\\d+,"
+                                   "\"cache_hit_rate\":[\\d.e+-]+,"
+                                   "\"lock_count\":\\d+,"
+                                   "\"lock_collisions\":\\d+,"
+                                   "\"lock_waits\":\\d+,"
+                                   "\"lock_wait_time\":\\d+,"
+                                   "\"lock_timeouts\":\\d+"
                                    "}",
                                    client);
 }
@@ -260,3 +322,331 @@ test_select(void)
                     column_name, hayamizu_id, hayamizu_name, hayamizu_age),
     client);
 }
+
+static void
+connect_groonga(guint port)
+{
+  struct sockaddr_in addr;
+  struct timeval timeout;
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock == -1) {
+    cut_assert_errno();
+  }
+  /* a missing end of a response must not hang the test */
+  timeout.tv_sec = 5;
+  timeout.tv_usec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    cut_assert_errno();
+  }
+}
+
+static void
+send_request(const gchar *request)
+{
+  size_t size = strlen(request);
+  while (size) {
+    ssize_t n = send(sock, request, size, 0);
+    if (n == -1) {
+      cut_assert_errno();
+    }
+    request += n;
+    size -= n;
+  }
+}
+
+/* returns the size of the first complete response in buffer, or 0 */
+static size_t
+response_size(const gchar *buffer, size_t size)
+{
+  const gchar *p = buffer, *e = buffer + size, *body;
+
+  body = g_strstr_len(p, size, "\r\n\r\n");
+  if (!body) {
+    return 0;
+  }
+  body += 4;
+  if (!g_strstr_len(p, body - p, "Transfer-Encoding: chunked")) {
+    /* a response without chunks is closed by the server */
+    return 0;
+  }
+  for (p = body; p < e;) {
+    gchar *line_end;
+    gulong chunk_size = strtoul(p, &line_end, 16);
+    if (line_end + 2 > e || memcmp(line_end, "\r\n", 2)) {
+      return 0;
+    }
+    p = line_end + 2 + chunk_size + 2;
+    if (p > e) {
+      return 0;
+    }
+    cut_assert_equal_memory("\r\n", 2, p - 2, 2);
+    if (!chunk_size) {
+      return p - buffer;
+    }
+  }
+  return 0;
+}
+
+/* receives n_responses chunked responses, or everything until the server
+   closes the connection if n_responses is 0 */
+static const gchar *
+receive_responses(gint n_responses)
+{
+  static gchar buffer[MAX_RESPONSES_SIZE];
+  size_t size = 0, offset = 0;
+  gint i = 0;
+
+  while (!n_responses || i < n_responses) {
+    size_t n;
+    ssize_t received;
+    while ((n = response_size(buffer + offset, size - offset))) {
+      offset += n;
+      i++;
+    }
+    if (n_responses && i == n_responses) {
+      break;
+    }
+    cut_assert_operator_uint(size, <, sizeof(buffer) - 1);
+    received = recv(sock, buffer + size, sizeof(buffer) - 1 - size, 0);
+    if (received == -1) {
+      cut_assert_errno();
+    }
+    if (!received) {
+      break;
+    }
+    size += received;
+  }
+  cut_assert_equal_int(n_responses, i);
+  if (n_responses) {
+    cut_assert_equal_uint(offset, size);
+  }
+  buffer[size] = '\0';
+  return cut_take_strdup(buffer);
+}
+
+void
+test_keep_alive(void)
+{
+  connect_groonga(GROONGA_TEST_PORT);
+
+  send_request("GET /table_list HTTP/1.1\r\n\r\n");
+  cut_assert_equal_string(CHUNKED_TABLE_LIST, receive_responses(1));
+
+  send_request("GET /table_list HTTP/1.1\r\n"
+               "Connection: Keep-Alive\r\n"
+               "\r\n");
+  cut_assert_equal_string(CHUNKED_TABLE_LIST, receive_responses(1));
+}
+
+void
+test_connection_close(void)
+{
+  connect_groonga(GROONGA_TEST_PORT);
+
+  send_request("GET /table_list HTTP/1.1\r\n\r\n");
+  cut_assert_equal_string(CHUNKED_TABLE_LIST, receive_responses(1));
+
+  send_request("GET /table_list HTTP/1.1\r\n"
+               "Connection: close\r\n"
+               "\r\n");
+  cut_assert_equal_string(CLOSE_HEADER TABLE_LIST_HEADER,
+                          receive_responses(0));
+}
+
+void
+test_http_1_0(void)
+{
+  connect_groonga(GROONGA_TEST_PORT);
+
+  send_request("GET /table_list HTTP/1.0\r\n\r\n");
+  cut_assert_equal_string(CLOSE_HEADER TABLE_LIST_HEADER,
+                          receive_responses(0));
+}
+
+void
+test_pipelining(void)
+{
+  const gchar *responses, *expected;
+
+  connect_groonga(GROONGA_TEST_PORT);
+
+  /* the second request is received with the first one and the third one
+     is split into two packets */
+  send_request("GET /table_list HTTP/1.1\r\n\r\n"
+               "GET /table_create?name=users HTTP/1.1\r\n\r\n"
+               "GET /table_li");
+  g_usleep(G_USEC_PER_SEC / 10);
+  send_request("st HTTP/1.1\r\n\r\n");
+  responses = receive_responses(3);
+  expected = CHUNKED_TABLE_LIST KEEP_ALIVE_HEADER "00000004\r\ntrue\r\n0\r\n\r\n";
+  cut_assert_equal_substring(expected, responses, strlen(expected));
+  responses += strlen(expected);
+  cut_assert_equal_substring(KEEP_ALIVE_HEADER, responses,
+                             strlen(KEEP_ALIVE_HEADER));
+  cut_assert_not_null(strstr(responses, "\"users\""));
+}
+
+void
+test_last_chunk(void)
+{
+  connect_groonga(GROONGA_TEST_PORT);
+
+  /* an empty body must be terminated by the last chunk alone */
+  send_request("GET / HTTP/1.1\r\n\r\n"
+               "GET /table_list HTTP/1.1\r\n\r\n");
+  cut_assert_equal_string(KEEP_ALIVE_HEADER
+                          "00000000\r\n\r\n"
+                          CHUNKED_TABLE_LIST,
+                          receive_responses(2));
+}
+
+/* returns the body of a chunked response and counts its chunks */
+static const gchar *
+dechunk(const gchar *response, gint *n_chunks)
+{
+  GString *body;
+  const gchar *p;
+
+  p = strstr(response, "\r\n\r\n");
+  cut_assert_not_null(p);
+  p += 4;
+  body = g_string_new(NULL);
+  *n_chunks = 0;
+  for (;;) {
+    gchar *line_end;
+    gulong chunk_size = strtoul(p, &line_end, 16);
+    if (!chunk_size) {
+      break;
+    }
+    g_string_append_len(body, line_end + 2, chunk_size);
+    p = line_end + 2 + chunk_size + 2;
+    (*n_chunks)++;
+  }
+  return cut_take_string(g_string_free(body, FALSE));
+}
+
+static guint64
+get_status_value(const gchar *name)
+{
+  const gchar *response, *value;
+
+  send_request("GET /status HTTP/1.1\r\n\r\n");
+  response = receive_responses(1);
+  value = strstr(response, cut_take_printf("\"%s\":", name));
+  cut_assert_not_null(value, cut_message("<%s>", name));
+  return g_ascii_strtoull(value + strlen(name) + 3, NULL, 10);
+}
+
+void
+test_streamed_select(void)
+{
+  const gchar *table_name = "users";
+  grn_obj *users;
+  GString *expected;
+  const gchar *expected_body;
+  guint64 cache_hits, cache_entries;
+  gint i, n_chunks;
+
+  users = grn_table_create(&context, table_name, strlen(table_name),
+                           NULL, GRN_OBJ_PERSISTENT | GRN_OBJ_TABLE_HASH_KEY,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT),
+                           NULL);
+  grn_test_assert_not_null(&context, users);
+  /* the result is more than GRN_CTX_OUTPUT_FLUSH_SIZE, 64KB */
+  expected = g_string_new(NULL);
+  g_string_append_printf(expected, "[[0],[[%d],[\"_key\"]", N_STREAMED_USERS);
+  for (i = 0; i < N_STREAMED_USERS; i++) {
+    const gchar *key = cut_take_printf("user-%05d-%050d", i, 0);
+    grn_test_assert_not_nil(grn_table_add(&context, users,
+                                          key, strlen(key), NULL));
+    g_string_append_printf(expected, ",[\"%s\"]", key);
+  }
+  g_string_append(expected, "]]");
+  expected_body = cut_take_string(g_string_free(expected, FALSE));
+  cut_assert_operator_uint(64 * 1024, <, strlen(expected_body));
+
+  connect_groonga(GROONGA_TEST_PORT);
+  cache_hits = get_status_value("cache_hits");
+  cache_entries = get_status_value("cache_entries");
+  for (i = 0; i < 2; i++) {
+    send_request(cut_take_printf("GET /select?table=%s&output_columns=_key"
+                                 "&limit=%d HTTP/1.1\r\n\r\n",
+                                 table_name, N_STREAMED_USERS));
+    cut_assert_equal_string(expected_body,
+                            dechunk(receive_responses(1), &n_chunks));
+    cut_assert_operator_int(1, <, n_chunks);
+  }
+
+  /* a streamed result is never cached */
+  cut_assert_equal_uint(cache_hits, get_status_value("cache_hits"));
+  cut_assert_equal_uint(cache_entries, get_status_value("cache_entries"));
+}
+
+void
+test_event_loops(void)
+{
+  GError *error = NULL;
+  const gchar *responses;
+  gint i;
+
+#ifndef SO_REUSEPORT
+  cut_omit("SO_REUSEPORT is not supported");
+#endif
+
+  event_loops_egg =
+    gcut_egg_new(GROONGA, "-s",
+                 "-i", "127.0.0.1",
+                 "-p", cut_take_printf("%d", GROONGA_EVENT_LOOPS_TEST_PORT),
+                 "--event-loops", cut_take_printf("%d", N_EVENT_LOOPS),
+                 "-n", cut_take_printf("%s%s%s",
+                                       tmp_directory,
+                                       G_DIR_SEPARATOR_S,
+                                       "event-loops.db"),
+                 NULL);
+  gcut_egg_hatch(event_loops_egg, &error);
+  gcut_assert_error(error);
+
+  g_usleep(G_USEC_PER_SEC);
+
+  /* the connections stay open together, so that the listeners of all the
+     loops accept some of them */
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    connect_groonga(GROONGA_EVENT_LOOPS_TEST_PORT);
+    socks[i] = sock;
+  }
+  sock = -1;
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    sock = socks[i];
+    send_request(cut_take_printf("GET /table_create?name=t%d HTTP/1.1\r\n\r\n",
+                                 i));
+  }
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    sock = socks[i];
+    cut_assert_equal_string(KEEP_ALIVE_HEADER
+                            "00000004\r\ntrue\r\n0\r\n\r\n",
+                            receive_responses(1),
+                            cut_message("<%d>", i));
+  }
+
+  /* the loops share the database */
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    sock = socks[i];
+    send_request("GET /table_list HTTP/1.1\r\n\r\n");
+  }
+  for (i = 0; i < N_CONNECTIONS; i++) {
+    gint j;
+    sock = socks[i];
+    responses = receive_responses(1);
+    for (j = 0; j < N_CONNECTIONS; j++) {
+      cut_assert_not_null(strstr(responses, cut_take_printf("\"t%d\"", j)),
+                          cut_message("<%d>: <t%d>", i, j));
+    }
+  }
+  sock = -1;
+}
@@ -23,6 +23,7 @@
 #include <unistd.h> /* for exec */
 #include <sys/types.h>
 #include <signal.h>
+#include <arpa/inet.h>
 
 #include "../lib/grn-assertions.h"
 
@@ -37,31 +38,15 @@ static struct memcached_server_st *servers = NULL;
 
 static GCutEgg *egg;
 
-void
-cut_setup(void)
+static const gchar *db_path;
+static grn_ctx context;
+static grn_obj *database;
+
+static void
+memcached_connect(void)
 {
-  GError *error = NULL;
   memcached_return rc;
 
-  tmp_directory = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
-  cut_remove_path(tmp_directory, NULL);
-  if (g_mkdir_with_parents(tmp_directory, 0700) == -1) {
-    cut_assert_errno();
-  }
-
-  egg = gcut_egg_new(GROONGA, "-s",
-                     "-p", GROONGA_TEST_PORT,
-                     "-e", "utf8",
-                     "-n",
-                     cut_take_printf("%s%s%s",
-                                     tmp_directory,
-                                     G_DIR_SEPARATOR_S,
-                                     "memcached.db"),
-                     NULL);
-  gcut_egg_hatch(egg, &error);
-  gcut_assert_error(error);
-
-  sleep(1); /* wait for groonga daemon */
   memc = memcached_create(NULL);
   memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, 1);
 
@@ -70,6 +55,73 @@ cut_setup(void)
 
   cut_set_message("memcached server connect failed.");
   cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+}
+
+static void
+memcached_disconnect(void)
+{
+  if (servers) {
+    memcached_server_list_free(servers);
+    servers = NULL;
+  }
+  if (memc) {
+    memcached_free(memc);
+    memc = NULL;
+  }
+}
+
+static void
+groonga_start(gboolean new_db)
+{
+  GError *error = NULL;
+
+  if (new_db) {
+    egg = gcut_egg_new(GROONGA, "-s",
+                       "-p", GROONGA_TEST_PORT,
+                       "-e", "utf8",
+                       "-n", db_path,
+                       NULL);
+  } else {
+    egg = gcut_egg_new(GROONGA, "-s",
+                       "-p", GROONGA_TEST_PORT,
+                       "-e", "utf8",
+                       db_path,
+                       NULL);
+  }
+  gcut_egg_hatch(egg, &error);
+  gcut_assert_error(error);
+
+  sleep(1); /* wait for groonga daemon */
+}
+
+static void
+groonga_stop(void)
+{
+  if (egg) {
+    g_object_unref(egg);
+    egg = NULL;
+  }
+}
+
+void
+cut_setup(void)
+{
+  tmp_directory = g_build_filename(grn_test_get_base_dir(), "tmp", NULL);
+  cut_remove_path(tmp_directory, NULL);
+  if (g_mkdir_with_parents(tmp_directory, 0700) == -1) {
+    cut_assert_errno();
+  }
+
+  grn_ctx_init(&context, 0);
+  database = NULL;
+  db_path = cut_take_printf("%s%s%s",
+                            tmp_directory,
+                            G_DIR_SEPARATOR_S,
+                            "memcached.db");
+
+  egg = NULL;
+  groonga_start(TRUE);
+  memcached_connect();
 
   memcached_flush(memc, 0); /* flush immediately for debug daemon */
 }
@@ -80,18 +132,16 @@ cut_teardown(void)
   if (val1) { free(val1); val1 = NULL; }
   if (val2) { free(val2); val2 = NULL; }
 
-  if (egg) {
-    g_object_unref(egg);
+  groonga_stop();
+
+  if (database) {
+    grn_obj_close(&context, database);
   }
+  grn_ctx_fin(&context);
 
   cut_remove_path(tmp_directory, NULL);
 
-  if (servers) {
-    memcached_server_list_free(servers);
-  }
-  if (memc) {
-    memcached_free(memc);
-  }
+  memcached_disconnect();
 }
 
 void
@@ -313,3 +363,180 @@ test_memcached_decrement(void)
   cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
   cut_assert_true(intval == 82);
 }
+
+void
+test_memcached_append_and_prepend(void)
+{
+  uint32_t flags;
+  memcached_return rc;
+
+  rc = memcached_set(memc, "key", 3, "value", 5, 0, 0xdeadbeefU);
+  cut_set_message("memcached set failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+
+  rc = memcached_append(memc, "key", 3, "-tail", 5, 0, 0);
+  cut_set_message("memcached append failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+
+  rc = memcached_prepend(memc, "key", 3, "head-", 5, 0, 0);
+  cut_set_message("memcached prepend failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+
+  val1 = memcached_get(memc, "key", 3, &val1_len, &flags, &rc);
+  cut_set_message("memcached get failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+  cut_assert_equal_memory("head-value-tail", 15, val1, val1_len);
+  cut_assert_equal_uint(0xdeadbeefU, flags);
+}
+
+void
+test_memcached_append_without_item(void)
+{
+  uint32_t flags;
+  memcached_return rc;
+
+  rc = memcached_append(memc, "key", 3, "-tail", 5, 0, 0);
+  cut_set_message("memcached append succeeded.");
+  /* TODO: fix rc after libmemcached fix */
+  cut_assert_equal_int(MEMCACHED_PROTOCOL_ERROR, rc);
+
+  rc = memcached_prepend(memc, "key", 3, "head-", 5, 0, 0);
+  cut_set_message("memcached prepend succeeded.");
+  /* TODO: fix rc after libmemcached fix */
+  cut_assert_equal_int(MEMCACHED_PROTOCOL_ERROR, rc);
+
+  val1 = memcached_get(memc, "key", 3, &val1_len, &flags, &rc);
+  cut_set_message("memcached append created an item.");
+  cut_assert_equal_int(MEMCACHED_NOTFOUND, rc);
+}
+
+void
+test_memcached_large_value(void)
+{
+  uint32_t flags;
+  memcached_return rc;
+  const size_t value_len = 100000;
+  gchar *value;
+
+  value = cut_take_memory(g_malloc(value_len));
+  memset(value, 'x', value_len);
+  value[value_len - 1] = 'y';
+
+  rc = memcached_set(memc, "key", 3, value, value_len, 0, 0xdeadbeefU);
+  cut_set_message("memcached set failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+
+  val1 = memcached_get(memc, "key", 3, &val1_len, &flags, &rc);
+  cut_set_message("memcached get failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+  cut_assert_equal_memory(value, value_len, val1, val1_len);
+  cut_assert_equal_uint(0xdeadbeefU, flags);
+}
+
+void
+test_memcached_expired_items_are_swept(void)
+{
+  grn_obj *table;
+  memcached_return rc;
+  const int timeout = 1;
+
+  rc = memcached_set(memc, "key", 3, "value", 5, timeout, 0xdeadbeefU);
+  cut_set_message("memcached set with expiration failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+  rc = memcached_set(memc, "persistent", 10, "value", 5, 0, 0xdeadbeefU);
+  cut_set_message("memcached set failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+
+  database = grn_db_open(&context, db_path);
+  table = grn_ctx_get(&context, "Memcache", 8);
+  cut_assert_not_null(table);
+  cut_assert_equal_uint(2, grn_table_size(&context, table));
+
+  /* the expired item is deleted by the server without being read again */
+  sleep(timeout + 2);
+  cut_assert_equal_uint(1, grn_table_size(&context, table));
+}
+
+static void
+old_item_add(grn_obj *table, const gchar *key, const gchar *value,
+             uint32_t flags)
+{
+  grn_obj buf;
+  grn_id id;
+
+  id = grn_table_add(&context, table, key, strlen(key), NULL);
+  cut_assert_not_equal_uint(GRN_ID_NIL, id);
+  GRN_TEXT_INIT(&buf, 0);
+  GRN_TEXT_SETS(&context, &buf, value);
+  grn_test_assert(grn_obj_set_value(&context,
+                                    grn_ctx_get(&context, "Memcache.value", 14),
+                                    id, &buf, GRN_OBJ_SET));
+  grn_obj_unlink(&context, &buf);
+  /* the flags were stored as sent, in network byte order */
+  GRN_UINT32_INIT(&buf, 0);
+  GRN_UINT32_SET(&context, &buf, htonl(flags));
+  grn_test_assert(grn_obj_set_value(&context,
+                                    grn_ctx_get(&context, "Memcache.flags", 14),
+                                    id, &buf, GRN_OBJ_SET));
+  GRN_UINT32_SET(&context, &buf, 0);
+  grn_test_assert(grn_obj_set_value(&context,
+                                    grn_ctx_get(&context, "Memcache.expire", 15),
+                                    id, &buf, GRN_OBJ_SET));
+  grn_obj_unlink(&context, &buf);
+  GRN_UINT64_INIT(&buf, 0);
+  GRN_UINT64_SET(&context, &buf, id);
+  grn_test_assert(grn_obj_set_value(&context,
+                                    grn_ctx_get(&context, "Memcache.cas", 12),
+                                    id, &buf, GRN_OBJ_SET));
+  grn_obj_unlink(&context, &buf);
+}
+
+void
+test_memcached_migrate_old_columns(void)
+{
+  grn_obj *table;
+  uint32_t flags;
+  memcached_return rc;
+  const gchar *columns[] = {"value", "flags", "expire", "cas"};
+  grn_id types[] = {GRN_DB_SHORT_TEXT, GRN_DB_UINT32, GRN_DB_UINT32, GRN_DB_UINT64};
+  int i;
+
+  /* a database written by an older server */
+  memcached_disconnect();
+  groonga_stop();
+  cut_remove_path(tmp_directory, NULL);
+  if (g_mkdir_with_parents(tmp_directory, 0700) == -1) {
+    cut_assert_errno();
+  }
+  database = grn_db_create(&context, db_path, NULL);
+  cut_assert_not_null(database);
+  table = grn_table_create(&context, "Memcache", 8, NULL,
+                           GRN_OBJ_TABLE_PAT_KEY|GRN_OBJ_PERSISTENT,
+                           grn_ctx_at(&context, GRN_DB_SHORT_TEXT), NULL);
+  cut_assert_not_null(table);
+  for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+    cut_assert_not_null(grn_column_create(&context, table,
+                                          columns[i], strlen(columns[i]),
+                                          NULL, GRN_OBJ_PERSISTENT,
+                                          grn_ctx_at(&context, types[i])));
+  }
+  old_item_add(table, "key1", "value1", 0xdeadbeefU);
+  old_item_add(table, "key2", "value2", 1);
+  grn_test_assert(grn_obj_close(&context, database));
+  database = NULL;
+
+  groonga_start(FALSE);
+  memcached_connect();
+
+  val1 = memcached_get(memc, "key1", 4, &val1_len, &flags, &rc);
+  cut_set_message("memcached get of a migrated item failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+  cut_assert_equal_memory("value1", 6, val1, val1_len);
+  cut_assert_equal_uint(0xdeadbeefU, flags);
+
+  val2 = memcached_get(memc, "key2", 4, &val2_len, &flags, &rc);
+  cut_set_message("memcached get of a migrated item failed.");
+  cut_assert_equal_int(MEMCACHED_SUCCESS, rc);
+  cut_assert_equal_memory("value2", 6, val2, val2_len);
+  cut_assert_equal_uint(1, flags);
+}